@@ -0,0 +1,148 @@
+/**
+ * @file AnalogModelEval.h
+ * @brief Evaluation of the analog oscillator model, with NEON, SSE and scalar implementations of exp2.
+ *
+ * The model is a polynomial in the log2 frequency plus terms in the frequency in Hz. The polynomial is evaluated in
+ * Horner form, and the frequency in Hz comes from a minimax polynomial for exp2 on [-0.5, 0.5] with the exponent set
+ * directly, which is within 2 ulp of exp2f. The scalar and vector versions round the same way, so the osc models and
+ * the batch give the same voltages.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+#pragma once
+#include "common.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+struct AnalogModel {
+    float a = -1.9e-2f;
+    float b = 5.2e-2f;
+    float c = -9.6e-8f;
+    float d = 1e-7f;
+    float e = -4.4e-9f;
+    float f = -2.5e-5f;
+    float g = -9.2e-16f;
+    float h = 3.3e-11f;
+    float i = 1.1e-20f;
+    float j = 0.0f;
+};
+
+// range of the exp2 input, so the result is always a normal float
+constexpr float ANALOG_EXP2_MIN = -126.f;
+constexpr float ANALOG_EXP2_MAX = 126.f;
+
+// minimax coefficients of exp2 on [-0.5, 0.5], highest order first
+constexpr float ANALOG_EXP2_C6 = 1.535336188319500e-4f;
+constexpr float ANALOG_EXP2_C5 = 1.339887440266574e-3f;
+constexpr float ANALOG_EXP2_C4 = 9.618437357674640e-3f;
+constexpr float ANALOG_EXP2_C3 = 5.550332471162809e-2f;
+constexpr float ANALOG_EXP2_C2 = 2.402264791363012e-1f;
+constexpr float ANALOG_EXP2_C1 = 6.931472028550421e-1f;
+
+// scale of the 1 / Hz term of the model
+constexpr float ANALOG_MODEL_HZ_SCALE = 0.001f;
+
+// a + b * c, fused on targets with fma so that the scalar and vector models round the same way
+inline float oscMulAdd(float a, float b, float c) {
+#if defined(__aarch64__) || defined(__FMA__)
+    return std::fmaf(b, c, a);
+#else
+    return a + b * c;
+#endif
+}
+
+inline float analogExp2(float x) {
+    x = std::min(std::max(x, ANALOG_EXP2_MIN), ANALOG_EXP2_MAX);
+    const float n = std::nearbyint(x);
+    const float r = x - n;
+    float p = oscMulAdd(ANALOG_EXP2_C5, ANALOG_EXP2_C6, r);
+    p = oscMulAdd(ANALOG_EXP2_C4, p, r);
+    p = oscMulAdd(ANALOG_EXP2_C3, p, r);
+    p = oscMulAdd(ANALOG_EXP2_C2, p, r);
+    p = oscMulAdd(ANALOG_EXP2_C1, p, r);
+    p = oscMulAdd(1.f, p, r);
+
+    // multiply by 2^n by adding n to the exponent
+    int32_t bits;
+    std::memcpy(&bits, &p, sizeof(bits));
+    bits += (int32_t)n << 23;
+    std::memcpy(&p, &bits, sizeof(p));
+    return p;
+}
+
+/**
+ * @brief Voltage of a model, the sums are in the same order as the vector models
+ *
+ * @param f1 log2 frequency of the side being driven
+ * @param f2 log2 frequency of the other side
+ * @param hz_f1 analogExp2 of f1
+ * @param hz_f2 analogExp2 of f2
+ */
+inline float analogModelVoltage(float a, float b, float d, float e, float f, float g, float h, float j, float t, float f1, float f2, float hz_f1, float hz_f2) {
+    float p = oscMulAdd(h, g, f1);
+    p = oscMulAdd(oscMulAdd(b, a, t), p, f1);
+    float val = oscMulAdd(t, p, f1);
+    val = oscMulAdd(val, f, f2);
+    val = oscMulAdd(val, d, hz_f1);
+    val = oscMulAdd(val, e, hz_f2);
+    return val + ANALOG_MODEL_HZ_SCALE / (hz_f1 + j);
+}
+
+inline float analogModelVoltage(const AnalogModel &o, float t, float f1, float f2, float hz_f1, float hz_f2) {
+    return analogModelVoltage(o.a, o.b, o.d, o.e, o.f, o.g, o.h, o.j, t, f1, f2, hz_f1, hz_f2);
+}
+
+#if defined(__aarch64__)
+
+inline float32x4_t analogExp2(float32x4_t x) {
+    x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(ANALOG_EXP2_MIN)), vdupq_n_f32(ANALOG_EXP2_MAX));
+    const int32x4_t n = vcvtnq_s32_f32(x);
+    const float32x4_t r = vsubq_f32(x, vcvtq_f32_s32(n));
+    float32x4_t p = vfmaq_f32(vdupq_n_f32(ANALOG_EXP2_C5), vdupq_n_f32(ANALOG_EXP2_C6), r);
+    p = vfmaq_f32(vdupq_n_f32(ANALOG_EXP2_C4), p, r);
+    p = vfmaq_f32(vdupq_n_f32(ANALOG_EXP2_C3), p, r);
+    p = vfmaq_f32(vdupq_n_f32(ANALOG_EXP2_C2), p, r);
+    p = vfmaq_f32(vdupq_n_f32(ANALOG_EXP2_C1), p, r);
+    p = vfmaq_f32(vdupq_n_f32(1.f), p, r);
+    return vreinterpretq_f32_s32(vaddq_s32(vreinterpretq_s32_f32(p), vshlq_n_s32(n, 23)));
+}
+
+#elif defined(__SSE2__)
+
+static inline __m128 _oscMulAddSse(__m128 a, __m128 b, __m128 c) {
+#ifdef __FMA__
+    return _mm_fmadd_ps(b, c, a);
+#else
+    return _mm_add_ps(a, _mm_mul_ps(b, c));
+#endif
+}
+
+inline __m128 analogExp2(__m128 x) {
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(ANALOG_EXP2_MIN)), _mm_set1_ps(ANALOG_EXP2_MAX));
+
+    // rounds to nearest with the default rounding mode, the same as nearbyint
+    const __m128i n = _mm_cvtps_epi32(x);
+    const __m128 r = _mm_sub_ps(x, _mm_cvtepi32_ps(n));
+    __m128 p = _oscMulAddSse(_mm_set1_ps(ANALOG_EXP2_C5), _mm_set1_ps(ANALOG_EXP2_C6), r);
+    p = _oscMulAddSse(_mm_set1_ps(ANALOG_EXP2_C4), p, r);
+    p = _oscMulAddSse(_mm_set1_ps(ANALOG_EXP2_C3), p, r);
+    p = _oscMulAddSse(_mm_set1_ps(ANALOG_EXP2_C2), p, r);
+    p = _oscMulAddSse(_mm_set1_ps(ANALOG_EXP2_C1), p, r);
+    p = _oscMulAddSse(_mm_set1_ps(1.f), p, r);
+    return _mm_castsi128_ps(_mm_add_epi32(_mm_castps_si128(p), _mm_slli_epi32(n, 23)));
+}
+
+#endif
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
@@ -0,0 +1,89 @@
+/**
+ * @file AnalogOscBatch.cpp
+ * @brief Implementation of the batched analog oscillator models
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+#include "AnalogOscBatch.h"
+#include <cmath>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+void AnalogOscBatch::add(AnalogOscModel &osc, const std::array<float, CV_BUFFER_SIZE> &osc_pitch, const std::array<float, CV_BUFFER_SIZE> &osc_shape, std::array<float, BUFFER_SIZE> &out) {
+
+    // the batch is sized for every osc so this should not happen, but if it does generate the samples directly
+    if (_num_lanes >= ANALOG_OSC_BATCH_LANES) {
+        osc.runNormal(osc_pitch, osc_shape, out);
+        return;
+    }
+    const uint lane = _num_lanes++;
+    _lanes[lane] = {&osc, osc_pitch.data(), osc_shape.data(), out.data()};
+    _model_up.set(lane, osc._osc_up, osc._track_osc_up);
+    _model_down.set(lane, osc._osc_down, osc._track_osc_down);
+    if (osc.print) {
+        printf("\n a osc: %f", osc_pitch[0]);
+        osc.print = false;
+    }
+}
+
+void AnalogOscBatch::run() {
+    if (_num_lanes == 0) {
+        return;
+    }
+
+    // work out the frequency of each side of the oscs, this updates the osc state the same way runNormal() does
+    for (uint l = 0; l < _num_lanes; l++) {
+        const Lane &lane = _lanes[l];
+        AnalogOscModel &osc = *lane.osc;
+        float sum_up = 0;
+        float sum_down = 0;
+        for (uint i = 0; i < CV_BUFFER_SIZE; i++) {
+            float freq_up;
+            float freq_down;
+            osc.shapeFreqs(lane.pitch[i] * noteGain, lane.shape[i], freq_up, freq_down);
+            _freq_up[i][l] = freq_up;
+            _freq_down[i][l] = freq_down;
+            float delta1 = (osc._prev_pitch_up - freq_up);
+            float delta2 = (osc._prev_pitch_down - freq_down);
+            osc._osc_f_delta += std::abs(delta1) + std::abs(delta2);
+            osc._prev_pitch_up = freq_up;
+            osc._prev_pitch_down = freq_down;
+            sum_up += freq_up;
+            sum_down += freq_down;
+        }
+        osc._ave_prev_freq_down = sum_down / ((float)CV_BUFFER_SIZE);
+        osc._ave_prev_freq_up = sum_up / ((float)CV_BUFFER_SIZE);
+    }
+
+    // fill the rest of the last vector with a default model running at a safe frequency
+    const uint num_vector_lanes = ((_num_lanes + ANALOG_OSC_BATCH_WIDTH - 1) / ANALOG_OSC_BATCH_WIDTH) * ANALOG_OSC_BATCH_WIDTH;
+    for (uint l = _num_lanes; l < num_vector_lanes; l++) {
+        _model_up.set(l, AnalogModel(), 0.f);
+        _model_down.set(l, AnalogModel(), 0.f);
+        for (uint i = 0; i < CV_BUFFER_SIZE; i++) {
+            _freq_up[i][l] = _freq_down[i][l] = 10.f;
+        }
+    }
+
+    // evaluate the models for all the oscs
+    for (uint i = 0; i < CV_BUFFER_SIZE; i++) {
+        analogOscVoltages(_model_up, _model_down, _freq_up[i].data(), _freq_down[i].data(), _v_up[i].data(), _v_down[i].data(), num_vector_lanes);
+    }
+
+    // write the voltages to each osc mux slot
+    for (uint l = 0; l < _num_lanes; l++) {
+        const Lane &lane = _lanes[l];
+        float *out_up = lane.out + lane.osc->mux_offset_up;
+        float *out_down = lane.out + lane.osc->mux_offset_down;
+        for (uint i = 0; i < CV_BUFFER_SIZE; i++) {
+            out_up[i * CV_MUX_INC] = _v_up[i][l];
+            out_down[i * CV_MUX_INC] = _v_down[i][l];
+        }
+    }
+}
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
@@ -0,0 +1,194 @@
+/**
+ * @file AnalogOscBatch.h
+ * @brief Batched generation of the normal state samples for all the analog oscillator models.
+ *
+ * Each oscillator still runs its own state machine, and oscillators in the normal state are then added to the
+ * batch as lanes. The model coefficients and tracking offsets of the lanes are stored as arrays across the lanes,
+ * so the models are evaluated for 4 oscillators at once with NEON or SSE, with a scalar fallback. The exp2 of the
+ * frequency of each side is shared by the up and down models.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+#pragma once
+
+#include "AnalogModelEval.h"
+#include "AnalogOscGen.h"
+#include "common.h"
+#include <array>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+// number of oscillators evaluated per vector
+constexpr uint ANALOG_OSC_BATCH_WIDTH = 4;
+
+// lanes for both oscillators of every voice, rounded up to a whole vector
+constexpr uint ANALOG_OSC_BATCH_LANES = ((NUM_VOICES * 2 + ANALOG_OSC_BATCH_WIDTH - 1) / ANALOG_OSC_BATCH_WIDTH) * ANALOG_OSC_BATCH_WIDTH;
+
+typedef std::array<float, ANALOG_OSC_BATCH_LANES> AnalogOscLanes;
+
+/**
+ * @brief AnalogModel coefficients and the tracking offset for each lane. The i coefficient is not used by the model
+ *
+ */
+struct AnalogModelLanes {
+    alignas(16) AnalogOscLanes a;
+    alignas(16) AnalogOscLanes b;
+    alignas(16) AnalogOscLanes d;
+    alignas(16) AnalogOscLanes e;
+    alignas(16) AnalogOscLanes f;
+    alignas(16) AnalogOscLanes g;
+    alignas(16) AnalogOscLanes h;
+    alignas(16) AnalogOscLanes j;
+    alignas(16) AnalogOscLanes track;
+
+    void set(uint lane, const AnalogModel &model, float track_offset) {
+        a[lane] = model.a;
+        b[lane] = model.b;
+        d[lane] = model.d;
+        e[lane] = model.e;
+        f[lane] = model.f;
+        g[lane] = model.g;
+        h[lane] = model.h;
+        j[lane] = model.j;
+        track[lane] = track_offset;
+    }
+};
+
+/**
+ * @brief Scalar reference for the model voltages of each lane, the vector versions must match this bit for bit.
+ * Each side of the osc is driven by its own model, and both models use the frequency of both sides
+ *
+ * @param up model driving the up side of each lane
+ * @param down model driving the down side of each lane
+ * @param f_up log2 frequency of the up side
+ * @param f_down log2 frequency of the down side
+ * @param v_up up side voltage of each lane
+ * @param v_down down side voltage of each lane
+ * @param num_lanes number of lanes, a multiple of ANALOG_OSC_BATCH_WIDTH
+ */
+inline void analogOscVoltagesScalar(const AnalogModelLanes &up, const AnalogModelLanes &down, const float *f_up, const float *f_down, float *v_up, float *v_down, uint num_lanes) {
+    for (uint l = 0; l < num_lanes; l++) {
+        const float hz_up = analogExp2(f_up[l]);
+        const float hz_down = analogExp2(f_down[l]);
+        v_up[l] = analogModelVoltage(up.a[l], up.b[l], up.d[l], up.e[l], up.f[l], up.g[l], up.h[l], up.j[l], up.track[l], f_up[l], f_down[l], hz_up, hz_down);
+        v_down[l] = analogModelVoltage(down.a[l], down.b[l], down.d[l], down.e[l], down.f[l], down.g[l], down.h[l], down.j[l], down.track[l], f_down[l], f_up[l], hz_down, hz_up);
+    }
+}
+
+#if defined(__aarch64__)
+
+// same order of the sums as analogModelVoltage()
+static inline float32x4_t _analogModelVoltageNeon(const AnalogModelLanes &m, uint l, float32x4_t f1, float32x4_t f2, float32x4_t hz_f1, float32x4_t hz_f2) {
+    const float32x4_t t = vld1q_f32(&m.track[l]);
+    float32x4_t p = vfmaq_f32(vld1q_f32(&m.h[l]), vld1q_f32(&m.g[l]), f1);
+    p = vfmaq_f32(vfmaq_f32(vld1q_f32(&m.b[l]), vld1q_f32(&m.a[l]), t), p, f1);
+    float32x4_t val = vfmaq_f32(t, p, f1);
+    val = vfmaq_f32(val, vld1q_f32(&m.f[l]), f2);
+    val = vfmaq_f32(val, vld1q_f32(&m.d[l]), hz_f1);
+    val = vfmaq_f32(val, vld1q_f32(&m.e[l]), hz_f2);
+    return vaddq_f32(val, vdivq_f32(vdupq_n_f32(ANALOG_MODEL_HZ_SCALE), vaddq_f32(hz_f1, vld1q_f32(&m.j[l]))));
+}
+
+inline void analogOscVoltages(const AnalogModelLanes &up, const AnalogModelLanes &down, const float *f_up, const float *f_down, float *v_up, float *v_down, uint num_lanes) {
+    for (uint l = 0; l < num_lanes; l += ANALOG_OSC_BATCH_WIDTH) {
+        const float32x4_t f_up_v = vld1q_f32(f_up + l);
+        const float32x4_t f_down_v = vld1q_f32(f_down + l);
+        const float32x4_t hz_up = analogExp2(f_up_v);
+        const float32x4_t hz_down = analogExp2(f_down_v);
+        vst1q_f32(v_up + l, _analogModelVoltageNeon(up, l, f_up_v, f_down_v, hz_up, hz_down));
+        vst1q_f32(v_down + l, _analogModelVoltageNeon(down, l, f_down_v, f_up_v, hz_down, hz_up));
+    }
+}
+
+#elif defined(__SSE2__)
+
+// same order of the sums as analogModelVoltage()
+static inline __m128 _analogModelVoltageSse(const AnalogModelLanes &m, uint l, __m128 f1, __m128 f2, __m128 hz_f1, __m128 hz_f2) {
+    const __m128 t = _mm_load_ps(&m.track[l]);
+    __m128 p = _oscMulAddSse(_mm_load_ps(&m.h[l]), _mm_load_ps(&m.g[l]), f1);
+    p = _oscMulAddSse(_oscMulAddSse(_mm_load_ps(&m.b[l]), _mm_load_ps(&m.a[l]), t), p, f1);
+    __m128 val = _oscMulAddSse(t, p, f1);
+    val = _oscMulAddSse(val, _mm_load_ps(&m.f[l]), f2);
+    val = _oscMulAddSse(val, _mm_load_ps(&m.d[l]), hz_f1);
+    val = _oscMulAddSse(val, _mm_load_ps(&m.e[l]), hz_f2);
+    return _mm_add_ps(val, _mm_div_ps(_mm_set1_ps(ANALOG_MODEL_HZ_SCALE), _mm_add_ps(hz_f1, _mm_load_ps(&m.j[l]))));
+}
+
+inline void analogOscVoltages(const AnalogModelLanes &up, const AnalogModelLanes &down, const float *f_up, const float *f_down, float *v_up, float *v_down, uint num_lanes) {
+    for (uint l = 0; l < num_lanes; l += ANALOG_OSC_BATCH_WIDTH) {
+        const __m128 f_up_v = _mm_loadu_ps(f_up + l);
+        const __m128 f_down_v = _mm_loadu_ps(f_down + l);
+        const __m128 hz_up = analogExp2(f_up_v);
+        const __m128 hz_down = analogExp2(f_down_v);
+        _mm_storeu_ps(v_up + l, _analogModelVoltageSse(up, l, f_up_v, f_down_v, hz_up, hz_down));
+        _mm_storeu_ps(v_down + l, _analogModelVoltageSse(down, l, f_down_v, f_up_v, hz_down, hz_up));
+    }
+}
+
+#else
+
+inline void analogOscVoltages(const AnalogModelLanes &up, const AnalogModelLanes &down, const float *f_up, const float *f_down, float *v_up, float *v_down, uint num_lanes) {
+    analogOscVoltagesScalar(up, down, f_up, f_down, v_up, v_down, num_lanes);
+}
+
+#endif
+
+class AnalogOscBatch {
+  public:
+    AnalogOscBatch() = default;
+    ~AnalogOscBatch() = default;
+
+    /**
+     * @brief Remove all the oscillators, call at the start of each buffer
+     *
+     */
+    void clear() {
+        _num_lanes = 0;
+    }
+
+    /**
+     * @brief Add an oscillator that returned true from AnalogOscModel::runState(). The model coefficients and
+     * tracking offsets are copied so the osc must not be retuned until the batch has run
+     *
+     */
+    void add(AnalogOscModel &osc, const std::array<float, CV_BUFFER_SIZE> &osc_pitch, const std::array<float, CV_BUFFER_SIZE> &osc_shape, std::array<float, BUFFER_SIZE> &out);
+
+    /**
+     * @brief Generate the samples for all the oscillators in the batch. AnalogOscModel::finishRun() must then be
+     * called for each of them
+     *
+     */
+    void run();
+
+    uint size() const {
+        return _num_lanes;
+    }
+
+  private:
+    struct Lane {
+        AnalogOscModel *osc;
+        const float *pitch;
+        const float *shape;
+        float *out;
+    };
+
+    typedef std::array<AnalogOscLanes, CV_BUFFER_SIZE> SampleLanes;
+
+    std::array<Lane, ANALOG_OSC_BATCH_LANES> _lanes;
+    uint _num_lanes = 0;
+    AnalogModelLanes _model_up;
+    AnalogModelLanes _model_down;
+    alignas(16) SampleLanes _freq_up;
+    alignas(16) SampleLanes _freq_down;
+    alignas(16) SampleLanes _v_up;
+    alignas(16) SampleLanes _v_down;
+};
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
@@ -8,6 +8,7 @@
  */
 
 #include "AnalogOscGen.h"
+#include "NinaFileWriter.h"
 #include <cmath>
 
 #include <iostream>
@@ -21,7 +22,6 @@ AnalogOscModel::AnalogOscModel(uint voice_num, uint osc_num) :
     _voice_num(voice_num), _osc_num(osc_num) {
     // Reset the data
     reset();
-    loadCalibration();
 }
 
 AnalogOscModel::~AnalogOscModel() {
@@ -82,6 +82,14 @@ void AnalogOscModel::tuningFeedback(float count_up, float count_down) {
 }
 
 void AnalogOscModel::run(const std::array<float, CV_BUFFER_SIZE> &osc_pitch, const std::array<float, CV_BUFFER_SIZE> &osc_shape, std::array<float, BUFFER_SIZE> &out) {
+    if (runState(out)) {
+        runNormal(osc_pitch, osc_shape, out);
+    }
+    finishRun(out);
+}
+
+bool AnalogOscModel::runState(std::array<float, BUFFER_SIZE> &out) {
+    bool normal = false;
     float voltage_up, voltage_down;
     float vup = -1;
     float vdown = -1;
@@ -89,6 +97,12 @@ void AnalogOscModel::run(const std::array<float, CV_BUFFER_SIZE> &osc_pitch, con
     float track_down = -5;
     bool local_print = print;
 
+    // pick up a model from the osc refit
+    if (const CalStoreOscModel *model = _published_model.load(std::memory_order_acquire)) {
+        setModel(*model);
+        _published_model.store(nullptr, std::memory_order_release);
+    }
+
     if (_debug) {
         // printf("state: %d", _osc_state);
         //_debug--;
@@ -155,7 +169,7 @@ void AnalogOscModel::run(const std::array<float, CV_BUFFER_SIZE> &osc_pitch, con
                 _sync_counter = 300;
                 if (_voice_num == 0) {
                 }
-                return;
+                return false;
             }
 
             // increment the output voltage for each osc side that freq is stil too low
@@ -180,7 +194,7 @@ void AnalogOscModel::run(const std::array<float, CV_BUFFER_SIZE> &osc_pitch, con
                     }
                     _osc_state = Restart;
                     _sync_counter = 300;
-                    return;
+                    return false;
                 }
 
                 // oscillators are running, so we now adjust the model until we match the current operating conditions
@@ -298,42 +312,8 @@ void AnalogOscModel::run(const std::array<float, CV_BUFFER_SIZE> &osc_pitch, con
             _error_gain = 0;
         }
 
-        // TODO: [NINA-256] remove .at notation to increase performance
-        // could also change how all these arrays are accessed? does it make any difference?
-        auto it_f = osc_pitch.begin();
-        auto it_sh = osc_shape.begin();
-
-        float sum_up = 0;
-        float sum_down = 0;
-        int i = 0;
-
-        while (it_f != osc_pitch.end()) {
-            // TODO: [NINA-264] this loop currently doesn't seem to unroll. pragma unroll doesn't help
-            constexpr float num = 3;
-            auto &v_up = out[i + mux_offset_up];
-            auto &v_down = out[i + mux_offset_down];
-            float freq_up;
-            float freq_down;
-            generateOscSignals((*it_f) * noteGain, *it_sh, v_up, v_down, freq_up, freq_down);
-            if (print) {
-                printf("\n a osc: %f", *it_f);
-                print = false;
-            }
-            float delta1 = (_prev_pitch_up - freq_up);
-            float delta2 = (_prev_pitch_down - freq_down);
-            _osc_f_delta += std::abs(delta1) + std::abs(delta2);
-            _prev_pitch_up = freq_up;
-            _prev_pitch_down = freq_down;
-            sum_up += freq_up;
-            sum_down += freq_down;
-            i += CV_MUX_INC;
-            it_f++;
-            it_sh++;
-        }
-        // we use a log sum of the frequency going to each oscillator for the feedback calculation. this should give us a more accurate representation of the desired frequency.
-        _ave_prev_freq_down = sum_down / ((float)CV_BUFFER_SIZE);
-        _ave_prev_freq_up = sum_up / ((float)CV_BUFFER_SIZE);
-
+        // the samples are generated by runNormal() or the osc batch
+        normal = true;
         break;
     }
 
@@ -357,7 +337,6 @@ void AnalogOscModel::run(const std::array<float, CV_BUFFER_SIZE> &osc_pitch, con
 
         // if we have recorded all the mesurements then go back to the tuningmeasure state
         if (_tuning_counter >= mes_size2) {
-            // if the old file hasn't been written yet, then we break to wait for the next loop
             calWrite();
             _osc_state = TuningMeasure;
             _sync_counter = (int)(0.1 * BUFFER_RATE);
@@ -428,6 +407,54 @@ void AnalogOscModel::run(const std::array<float, CV_BUFFER_SIZE> &osc_pitch, con
     default: {
     }
     }
+    _finish_pending = true;
+    return normal;
+}
+
+void AnalogOscModel::runNormal(const std::array<float, CV_BUFFER_SIZE> &osc_pitch, const std::array<float, CV_BUFFER_SIZE> &osc_shape, std::array<float, BUFFER_SIZE> &out) {
+    // TODO: [NINA-256] remove .at notation to increase performance
+    // could also change how all these arrays are accessed? does it make any difference?
+    auto it_f = osc_pitch.begin();
+    auto it_sh = osc_shape.begin();
+
+    float sum_up = 0;
+    float sum_down = 0;
+    int i = 0;
+
+    while (it_f != osc_pitch.end()) {
+        // TODO: [NINA-264] this loop currently doesn't seem to unroll. pragma unroll doesn't help
+        constexpr float num = 3;
+        auto &v_up = out[i + mux_offset_up];
+        auto &v_down = out[i + mux_offset_down];
+        float freq_up;
+        float freq_down;
+        generateOscSignals((*it_f) * noteGain, *it_sh, v_up, v_down, freq_up, freq_down);
+        if (print) {
+            printf("\n a osc: %f", *it_f);
+            print = false;
+        }
+        float delta1 = (_prev_pitch_up - freq_up);
+        float delta2 = (_prev_pitch_down - freq_down);
+        _osc_f_delta += std::abs(delta1) + std::abs(delta2);
+        _prev_pitch_up = freq_up;
+        _prev_pitch_down = freq_down;
+        sum_up += freq_up;
+        sum_down += freq_down;
+        i += CV_MUX_INC;
+        it_f++;
+        it_sh++;
+    }
+    // we use a log sum of the frequency going to each oscillator for the feedback calculation. this should give us a more accurate representation of the desired frequency.
+    _ave_prev_freq_down = sum_down / ((float)CV_BUFFER_SIZE);
+    _ave_prev_freq_up = sum_up / ((float)CV_BUFFER_SIZE);
+}
+
+void AnalogOscModel::finishRun(std::array<float, BUFFER_SIZE> &out) {
+    // the state machine returns early when it restarts the osc, in which case there is nothing to finish
+    if (!_finish_pending) {
+        return;
+    }
+    _finish_pending = false;
 
     constexpr int fb_timout_thresh = (int)(10 * ((float)CV_SAMPLE_RATE) / 8.0);
     if ((_new_fb > fb_timout_thresh)) {
@@ -454,72 +481,60 @@ void AnalogOscModel::voice_deallocated() {
     _voice_allocated = false;
 }
 
-void AnalogOscModel::loadCalibration() {
+bool AnalogOscModel::loadCalibration(CalStoreOscModel &model) {
 
-    // Load the calibration from a file in the tuning folder
+    // Load the model written by the tuning tool from a file in the calibration folder
     std::stringstream fpath;
     std::fstream file_handler;
     fpath << path << "voice_" << _voice_num << "_osc_" << _osc_num << ".model";
     file_handler.open(fpath.str(), std::ios::in);
-    // std::cout << fpath.str();
-    if (file_handler.is_open()) {
-        std::string line;
-        std::getline(file_handler, line);
-        std::stringstream iss(line);
-        std::array<float, 10> model;
-        for (int i = 0; i < 10; i++) {
-            iss >> model[i];
-        }
-        _osc_up.a = model[0];
-        _osc_up.b = model[1];
-        _osc_up.c = model[2];
-        _osc_up.d = model[3];
-        _osc_up.e = model[4];
-        _osc_up.f = model[5];
-        _osc_up.g = model[6];
-        _osc_up.h = model[7];
-
-        std::getline(file_handler, line);
-
-        std::istringstream iss2(line);
-        for (int i = 0; i < 10; i++) {
-            iss2 >> model[i];
-        }
-        _osc_down.a = model[0];
-        _osc_down.b = model[1];
-        _osc_down.c = model[2];
-        _osc_down.d = model[3];
-        _osc_down.e = model[4];
-        _osc_down.f = model[5];
-        _osc_down.g = model[6];
-        _osc_down.h = model[7];
-
-        for (int i = 0; i < 10; i++) {
-            // printf("\nmodel num %d\t%e", i, model[i]);
-        }
-
-        file_handler.close();
-    } else {
+    if (!file_handler.is_open()) {
         printf("osc load fail %d\n", _voice_num);
+        return false;
     }
+    std::string line;
+    std::getline(file_handler, line);
+    std::istringstream iss(line);
+    for (auto &coeff : model.up) {
+        iss >> coeff;
+    }
+    std::getline(file_handler, line);
+    std::istringstream iss2(line);
+    for (auto &coeff : model.down) {
+        iss2 >> coeff;
+    }
+    file_handler.close();
+    return !iss.fail() && !iss2.fail();
 }
 
-void AnalogOscModel::calWrite() {
-    std::stringstream fpath;
-    std::fstream file_handler;
-    fpath << path_data << "voice_" << _voice_num << "_osc_" << _osc_num << ".txt";
+static void _setModel(AnalogModel &model, const std::array<float, CAL_STORE_MODEL_SIZE> &coeffs) {
+
+    // The tuning tool fits i and j, but the model only uses a to h
+    model.a = coeffs[0];
+    model.b = coeffs[1];
+    model.c = coeffs[2];
+    model.d = coeffs[3];
+    model.e = coeffs[4];
+    model.f = coeffs[5];
+    model.g = coeffs[6];
+    model.h = coeffs[7];
+}
 
-    file_handler.open(fpath.str(), std::ios::out | std::ios::app);
-    std::cout << fpath.str();
-    if (file_handler.is_open()) {
-        for (int i = 0; i < mes_size2; i++) {
+static std::array<float, CAL_STORE_MODEL_SIZE> _getModel(const AnalogModel &model) {
+    return {model.a, model.b, model.c, model.d, model.e, model.f, model.g, model.h, model.i, model.j};
+}
 
-            file_handler << mes_results.at(i * 4) << ", " << mes_results.at(i * 4 + 1) << ", " << mes_results.at(i * 4 + 2) << ", " << mes_results.at(i * 4 + 3) << std::endl;
-        }
-        file_handler << std::endl;
-        printf("\nwritedone:%d:%d", _voice_num, _osc_num);
-        file_handler.close();
-    } else {
+void AnalogOscModel::setModel(const CalStoreOscModel &model) {
+    _setModel(_osc_up, model.up);
+    _setModel(_osc_down, model.down);
+}
+
+CalStoreOscModel AnalogOscModel::getModel() const {
+    return {_getModel(_osc_up), _getModel(_osc_down)};
+}
+
+void AnalogOscModel::calWrite() {
+    if (!FileWriter::getInstance().post(FileWriteType::OSC_TUNING, _voice_num * 2 + _osc_num, mes_results)) {
         printf("\nIO error\n");
     }
 }
@@ -551,19 +566,7 @@ const std::array<float, 2 * mes_size2> AnalogOscModel::generate_tune_steps() {
 
 inline float AnalogOscModel::calcVoltage(const float f1, const float f2,
     const float t, const AnalogModel &o) {
-
-    const float hz_f1 = std::exp2f((float)f1); // exp2f32(f1);
-    const float hz_f2 = std::exp2f((float)f2);
-    const float hz_f1_2 = f1 * f1;
-    const float hz_f1_3 = hz_f1_2 * f1;
-    const float hz_f1_4 = hz_f1_3 * f1;
-
-    // const float hz_f2_2 = hz_f2 * hz_f2;
-    // const float hz_f2_3 = hz_f2_2 * hz_f2;
-    // const float hz_f2_4 = hz_f2_3 * hz_f2;
-
-    float val = o.e * hz_f2 + t + (o.a * t + o.b) * f1 + o.f * f2 + o.d * hz_f1 + o.h * hz_f1_2 + o.g * hz_f1_3 + 0 * o.i * hz_f1_4 + 0.001 / (hz_f1 + o.j);
-    return (float)val;
+    return analogModelVoltage(o, t, f1, f2, analogExp2(f1), analogExp2(f2));
 }
 
 void AnalogOscModel::runTuning() { _tuning = true; }
@@ -634,6 +637,16 @@ void AnalogOscModel::calcFeedback() {
 }
 
 void AnalogOscModel::generateOscSignals(const float &freq, const float &shape_in, float &v_up, float &v_down, float &freq_up, float &freq_down) {
+    shapeFreqs(freq, shape_in, freq_up, freq_down);
+
+    // both models use the frequency of each side in Hz, so only work it out once
+    const float hz_up = analogExp2(freq_up);
+    const float hz_down = analogExp2(freq_down);
+    v_up = analogModelVoltage(_osc_up, _track_osc_up, freq_up, freq_down, hz_up, hz_down);
+    v_down = analogModelVoltage(_osc_down, _track_osc_down, freq_down, freq_up, hz_down, hz_up);
+}
+
+void AnalogOscModel::shapeFreqs(const float freq, const float shape_in, float &freq_up, float &freq_down) {
 
     float shape = shape_in;
     constexpr float shape_m = 3;
@@ -660,8 +673,6 @@ void AnalogOscModel::generateOscSignals(const float &freq, const float &shape_in
     freq_c = freq < freq_low_clip ? freq_low_clip : freq;
     freq_up = freq_c + shape_up;
     freq_down = freq + shape_down;
-    v_up = calcVoltage(freq_up, freq_down, _track_osc_up, _osc_up);
-    v_down = calcVoltage(freq_down, freq_up, _track_osc_down, _osc_down);
 }
 
 } // namespace Nina
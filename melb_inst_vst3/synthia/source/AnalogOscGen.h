@@ -8,10 +8,13 @@
  */
 #pragma once
 
+#include "AnalogModelEval.h"
+#include "NinaCalStore.h"
 #include "SynthMath.h"
 #include "common.h"
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cmath>
 #include <deque>
 #include <fstream>
@@ -23,6 +26,8 @@ namespace Steinberg {
 namespace Vst {
 namespace Nina {
 
+class AnalogOscBatch;
+
 /**
  * @brief Enum to define the states that the oscillator model can be ing
  *
@@ -113,19 +118,6 @@ class OscErrorIir2 {
  */
 static constexpr int mes_size2 = 2;
 
-struct AnalogModel {
-    float a = -1.9e-2f;
-    float b = 5.2e-2f;
-    float c = -9.6e-8f;
-    float d = 1e-7f;
-    float e = -4.4e-9f;
-    float f = -2.5e-5f;
-    float g = -9.2e-16f;
-    float h = 3.3e-11f;
-    float i = 1.1e-20f;
-    float j = 0.0f;
-};
-
 class AnalogOscModel {
 
   public:
@@ -142,6 +134,26 @@ class AnalogOscModel {
      * @param input_2 input array for OSC shape signals. returns signal for osc down
      */
     void run(const std::array<float, CV_BUFFER_SIZE> &input_1, const std::array<float, CV_BUFFER_SIZE> &input_2, std::array<float, BUFFER_SIZE> &out);
+
+    /**
+     * @brief runs the osc state machine for a buffer. In the normal state the output samples are not generated, the
+     * caller must generate them with runNormal() or an AnalogOscBatch and then call finishRun()
+     *
+     * @return true if the osc is in the normal state and the output samples need to be generated
+     */
+    bool runState(std::array<float, BUFFER_SIZE> &out);
+
+    /**
+     * @brief generates the normal state output samples
+     *
+     */
+    void runNormal(const std::array<float, CV_BUFFER_SIZE> &input_1, const std::array<float, CV_BUFFER_SIZE> &input_2, std::array<float, BUFFER_SIZE> &out);
+
+    /**
+     * @brief checks the feedback timeout and applies the osc disable once the output samples are generated
+     *
+     */
+    void finishRun(std::array<float, BUFFER_SIZE> &out);
     void calcFeedback();
     void resetCounter();
     void setTuningGain(float gain);
@@ -181,15 +193,38 @@ class AnalogOscModel {
         _dump = true;
     }
 
+
+    /**
+     * @brief Post the tuning measurements to the file writer, realtime safe
+     *
+     */
     void calWrite();
     void generateOscSignals(const float &freq, const float &shape, float &v_up, float &v_down, float &freq_up, float &freq_down);
 
     /**
-     * @brief run this with a thread to save tuning data
+     * @brief Read the model written by the tuning tool, this does not change the model used by the osc
+     *
+     * @return true if the model file was read
+     */
+    bool loadCalibration(CalStoreOscModel &model);
+
+    void setModel(const CalStoreOscModel &model);
+    CalStoreOscModel getModel() const;
+
+    /**
+     * @brief Hand a new model to the osc from another thread, realtime safe. The osc copies the model at the start
+     * of its next buffer, so the model must not be changed until modelTaken() returns true
      *
+     * @return false if the osc has not taken the last model yet
      */
-    void fileThread();
-    void loadCalibration();
+    bool publishModel(const CalStoreOscModel *model) {
+        const CalStoreOscModel *taken = nullptr;
+        return _published_model.compare_exchange_strong(taken, model, std::memory_order_release, std::memory_order_relaxed);
+    }
+
+    bool modelTaken() const {
+        return _published_model.load(std::memory_order_acquire) == nullptr;
+    }
 
     bool enable_logging = false;
     // Logger * logger = 0;
@@ -198,6 +233,9 @@ class AnalogOscModel {
     bool print = false;
 
   private:
+    // the batch generates the normal state samples, so it updates the same state as runNormal()
+    friend class AnalogOscBatch;
+
     // delta error decays to 50% in delta decay time seconds
     static constexpr float normal_gain = 1;
     static constexpr float delta_decay_time = 0.01;
@@ -245,7 +283,6 @@ class AnalogOscModel {
     bool _write_to_file = false;
     bool _write_done = false;
     float _freq_osc_up = 20.0f;
-    std::thread _file_writer;
     float _freq_osc_down = 20.0f;
     float _track_osc_up = -3.0f;
     float _track_osc_down = -3.0f;
@@ -258,6 +295,7 @@ class AnalogOscModel {
     float _osc_shape_mod = 0.0f;
     float _osc_pitch_offset = 0.0f;
     AnalogModel _osc_up, _osc_down;
+    std::atomic<const CalStoreOscModel *> _published_model = nullptr;
 
     int _tuning_counter = 0;
     int error_counter = 0;
@@ -306,6 +344,8 @@ class AnalogOscModel {
 
     static constexpr float warm_up_freq = (100.0f);
     float calcVoltage(const float freq, const float freq_2, const float track_offset, const AnalogModel &osc);
+    void shapeFreqs(const float freq, const float shape_in, float &freq_up, float &freq_down);
+    bool _finish_pending = false;
     float _find_sync_up, _find_sync_down;
     float error_old = 0.0f;
     float error_old2 = 0.0f;
@@ -5,6 +5,7 @@
  * @copyright Copyright (c) 2022-2023 Melbourne Instruments, Australia
  */
 #include "AnalogVoice.h"
+#include "NinaFileWriter.h"
 
 namespace Steinberg {
 namespace Vst {
@@ -35,65 +36,115 @@ void AnalogVoice::runTuning(float osc_1_up, float osc_1_down, float osc_2_up, fl
 
 void AnalogVoice::generateVoiceBuffers(VoiceOutput &output) {
     const auto &input = _input;
+    if (_startVoice(output)) {
+        _osc_0.run(input.osc_1_pitch, input.osc_1_shape, *output.output_1);
+        _osc_1.run(input.osc_2_pitch, input.osc_2_shape, *output.output_1);
+        _finishVoice(output);
+    }
+}
+
+void AnalogVoice::startVoiceBuffers(VoiceOutput &output, AnalogOscBatch &osc_batch) {
+    const auto &input = _input;
+    _buffer_enabled = _startVoice(output);
+    if (_buffer_enabled) {
+        if (_osc_0.runState(*output.output_1)) {
+            osc_batch.add(_osc_0, input.osc_1_pitch, input.osc_1_shape, *output.output_1);
+        }
+        if (_osc_1.runState(*output.output_1)) {
+            osc_batch.add(_osc_1, input.osc_2_pitch, input.osc_2_shape, *output.output_1);
+        }
+    }
+}
+
+void AnalogVoice::finishVoiceBuffers(VoiceOutput &output) {
+    if (_buffer_enabled) {
+        _osc_0.finishRun(*output.output_1);
+        _osc_1.finishRun(*output.output_1);
+        _finishVoice(output);
+    }
+}
+
+bool AnalogVoice::_startVoice(VoiceOutput &output) {
+    const auto &input = _input;
+
+    // pick up a calibration reload from the file writer
+    if (const CalStoreVoice *record = _published_cal.load(std::memory_order_acquire)) {
+        _applyCalibration(*record);
+        _published_cal.store(nullptr, std::memory_order_release);
+    }
     if (!_blacklisted && _voice_allocated_to_layer) {
 
         // osc can only be in sync mode when its running normally
         _osc_1.OscSynced((input.hard_sync[0] && _osc_1.isNormal()));
         _filter.run(input.filt_cut, input.filt_res, *output.output_2);
-        _tri_0.runVca<false>(input.tri_1_lev, *output.output_1);
-        _tri_1.runVca<false>(input.tri_2_lev, *output.output_1);
-        _sqr_0.runVca<false>(input.sqr_1_lev, *output.output_1);
-        _sqr_1.runVca<false>(input.sqr_2_lev, *output.output_1);
-        const float left_sum = _left.runVca<true>(input.vca_l, *output.output_2);
-        const float right_sum = _right.runVca<true>(input.vca_r, *output.output_2);
-        _xor.runVca<false>(input.xor_lev, *output.output_2);
-        _osc_0.run(input.osc_1_pitch, input.osc_1_shape, *output.output_1);
-        _osc_1.run(input.osc_2_pitch, input.osc_2_shape, *output.output_1);
-        // generate the bit array for the switched signals. also see FPGA buffer config
-
-        bool mute_l = false;
-        bool mute_r = false;
-        _mute_allowed = (_mute_allowed || _input._last_allocated) && (!_disable_mutes);
-
-        // if the LR level of the voice is below the thresh for the whole buffer, then mute the output
-        mute_l = (std::abs(left_sum) + std::abs(right_sum) < 0.0001) && _mute_allowed;
-        mute_r = (std::abs(left_sum) + std::abs(right_sum) < 0.0001) && _mute_allowed;
-        _mute_allowed = (mute_l) && (mute_r);
-
-        for (int i = 0; i < CV_BUFFER_SIZE; i++) {
-            int bit_array =
-                ((int)(input.mute_1[i] || mute_l) << VoiceBitMap::VOICE_MUTE_L) +
-                ((int)(input.mute_2[i] || mute_r) << VoiceBitMap::VOICE_MUTE_R) +
-                ((int)(input.mute_3[i] || mute_l) << VoiceBitMap::VOICE_MUTE_3) +
-                ((int)(input.mute_4[i] || mute_r) << VoiceBitMap::VOICE_MUTE_4) +
-                ((int)input.hard_sync[i] << VoiceBitMap::HARD_SYNC) +
-                ((int)(!input.sub_osc[i]) << VoiceBitMap::SUB_OSC_EN_N) +
-                ((int)input.overdrive[i] << VoiceBitMap::DRIVE_EN_N) +
-                ((int)false << VoiceBitMap::FILTER_TYPE) +
-                ((int)_main_out_mute_l << VoiceBitMap::MIX_MUTE_L) +
-                ((int)_main_out_mute_r << VoiceBitMap::MIX_MUTE_R);
-            const auto float_bit_array = (float)((((double)bit_array) + 0.1) / (double)((2 << 22) - 1));
-            (*(output.output_2))[i * CV_MUX_INC + Cv1BitArray] = float_bit_array;
-            // if the osc are not both in normal mode yet, then disable the voice outputs
-            if ((!_osc_0.isNormal()) || (!_osc_1.isNormal()))
-
-            {
-                (*(output.output_2))[i * CV_MUX_INC + Cv1BitArray] = disable_voice_bits;
-            }
-        }
+        return true;
+    }
 
-    } else {
+    // when voice is disabled, mute the output, but still run the oscillator at a lowish freq and 50% shape
+    _disable_pitch.fill(1.2);
+    _disable_shape.fill(0);
+    _osc_0.run(_disable_pitch, _disable_shape, *output.output_1);
+    _osc_1.run(_disable_pitch, _disable_shape, *output.output_1);
+    for (int i = 0; i < CV_BUFFER_SIZE; i++) {
+
+        (*(output.output_2))[i * CV_MUX_INC + Cv1BitArray] = disable_voice_bits;
+    }
+    return false;
+}
 
-        // when voice is disabled, mute the output, but still run the oscillator at a lowish freq and 50% shape
-        _disable_pitch.fill(1.2);
-        _disable_shape.fill(0);
-        _osc_0.run(_disable_pitch, _disable_shape, *output.output_1);
-        _osc_1.run(_disable_pitch, _disable_shape, *output.output_1);
-        for (int i = 0; i < CV_BUFFER_SIZE; i++) {
+void AnalogVoice::_finishVoice(VoiceOutput &output) {
+    const auto &input = _input;
 
-            (*(output.output_2))[i * CV_MUX_INC + Cv1BitArray] = disable_voice_bits;
-        }
+    // integrated vca levels for the buffer, used for muting
+    float left_sum = 0;
+    float right_sum = 0;
+    for (int i = 0; i < CV_BUFFER_SIZE; i++) {
+        left_sum += input.vca_l[i];
+        right_sum += input.vca_r[i];
+    }
+
+    // generate the bit array for the switched signals. also see FPGA buffer config
+
+    bool mute_l = false;
+    bool mute_r = false;
+    _mute_allowed = (_mute_allowed || _input._last_allocated) && (!_disable_mutes);
+
+    // if the LR level of the voice is below the thresh for the whole buffer, then mute the output
+    mute_l = (std::abs(left_sum) + std::abs(right_sum) < 0.0001) && _mute_allowed;
+    mute_r = (std::abs(left_sum) + std::abs(right_sum) < 0.0001) && _mute_allowed;
+    _mute_allowed = (mute_l) && (mute_r);
+
+    // if the osc are not both in normal mode yet, then disable the voice outputs
+    const bool disable_outputs = (!_osc_0.isNormal()) || (!_osc_1.isNormal());
+    alignas(16) std::array<float, CV_BUFFER_SIZE> bits;
+    for (int i = 0; i < CV_BUFFER_SIZE; i++) {
+        int bit_array =
+            ((int)(input.mute_1[i] || mute_l) << VoiceBitMap::VOICE_MUTE_L) +
+            ((int)(input.mute_2[i] || mute_r) << VoiceBitMap::VOICE_MUTE_R) +
+            ((int)(input.mute_3[i] || mute_l) << VoiceBitMap::VOICE_MUTE_3) +
+            ((int)(input.mute_4[i] || mute_r) << VoiceBitMap::VOICE_MUTE_4) +
+            ((int)input.hard_sync[i] << VoiceBitMap::HARD_SYNC) +
+            ((int)(!input.sub_osc[i]) << VoiceBitMap::SUB_OSC_EN_N) +
+            ((int)input.overdrive[i] << VoiceBitMap::DRIVE_EN_N) +
+            ((int)false << VoiceBitMap::FILTER_TYPE) +
+            ((int)_main_out_mute_l << VoiceBitMap::MIX_MUTE_L) +
+            ((int)_main_out_mute_r << VoiceBitMap::MIX_MUTE_R);
+        const auto float_bit_array = (float)((((double)bit_array) + 0.1) / (double)((2 << 22) - 1));
+        bits[i] = disable_outputs ? disable_voice_bits : float_bit_array;
     }
+
+    // write all the vca levels and the bit array into the mux frames in one pass
+    const VcaMuxInput vca_input = {
+        {input.sqr_1_lev.data(), input.tri_1_lev.data(), input.sqr_2_lev.data(), input.tri_2_lev.data()},
+        {_sqr_0.muxOffset(), _tri_0.muxOffset(), _sqr_1.muxOffset(), _tri_1.muxOffset()},
+        input.xor_lev.data(),
+        input.vca_l.data(),
+        input.vca_r.data(),
+        bits.data(),
+        _xor.muxOffset(),
+        _left.muxOffset(),
+        _right.muxOffset()};
+    vcaMuxWrite(vca_input, *output.output_1, *output.output_2);
 }
 
 void AnalogVoice::runOscTuning() {
@@ -106,49 +157,67 @@ void AnalogVoice::stopOscTuning() {
     _osc_1.stopTuning();
 };
 
+static std::array<float, CAL_STORE_FILTER_SIZE> _filterToRecord(const FilterCalValues &f) {
+    return {f.fc_high_clip, f.fc_low_clip, f.fc_gain, f.fc_offset, f.fc_temp_track, f.res_high_clip, f.res_zero_offset, f.res_gain, f.res_low_clip, f.base_temp, f.a, f.c};
+}
+
+static FilterCalValues _filterFromRecord(const std::array<float, CAL_STORE_FILTER_SIZE> &r) {
+    FilterCalValues f;
+    f.fc_high_clip = r[0];
+    f.fc_low_clip = r[1];
+    f.fc_gain = r[2];
+    f.fc_offset = r[3];
+    f.fc_temp_track = r[4];
+    f.res_high_clip = r[5];
+    f.res_zero_offset = r[6];
+    f.res_gain = r[7];
+    f.res_low_clip = r[8];
+    f.base_temp = r[9];
+    f.a = r[10];
+    f.c = r[11];
+    return f;
+}
+
 void AnalogVoice::loadCalibration() {
-    std::fstream file_handler;
-    std::stringstream fpath;
-    fpath << path << "voice_" << _voice_num << ".cal";
-
-    file_handler.open(fpath.str(), std::ios::in);
-    if (file_handler.is_open()) {
-        std::string line;
-        std::getline(file_handler, line);
-        std::istringstream iss(line);
-        float vca_cal_1, vca_cal_2, vca_cal_3, vca_cal_4, vca_cal_5, main_vca_cal_1, main_vca_cal_2, blacklist;
-
-        FilterCalValues f;
-        if (!(iss >> vca_cal_1 >> vca_cal_2 >> vca_cal_3 >> vca_cal_4 >>
-                vca_cal_5 >> main_vca_cal_1 >> main_vca_cal_2 >>
-                f.fc_low_clip >> f.fc_high_clip >> f.fc_gain >>
-                f.fc_offset >> f.fc_temp_track >> f.res_low_clip >>
-                f.res_high_clip >> f.res_gain >> f.res_zero_offset >> blacklist)) {
-            printf("\nfailed voice cal load %d ", _voice_num);
-        }
+    _applyCalibration(_readCalibration(false));
+}
 
-        _tri_0.setZeroOffset(vca_cal_1);
-        _sqr_0.setZeroOffset(vca_cal_2);
-        _tri_1.setZeroOffset(vca_cal_3);
-        _sqr_1.setZeroOffset(vca_cal_4);
-        _xor.setZeroOffset(vca_cal_5);
-        _left.setZeroOffset(main_vca_cal_1);
-        _right.setZeroOffset(main_vca_cal_2);
-        file_handler.close();
+bool AnalogVoice::reloadCalibration() {
+    // only the writer thread publishes, so the record is not in use once the voice has taken the last one
+    if (_published_cal.load(std::memory_order_acquire) != nullptr) {
+        return false;
+    }
+    _reload_record = _readCalibration(true);
+    _published_cal.store(&_reload_record, std::memory_order_release);
+    return true;
+}
 
-        std::stringstream fpath_filter;
-        fpath_filter << path << "voice_" << _voice_num << "_filter.model";
-        file_handler.open(fpath_filter.str(), std::ios::in);
-        if (file_handler.is_open()) {
-            std::getline(file_handler, line);
-            std::istringstream iss2(line);
-            if (!(iss2 >> f.a >> f.c >> f.base_temp)) {
-                printf("\nfailed filter cal load %d ", _voice_num);
-            }
-        }
+CalStoreVoice AnalogVoice::_readCalibration(bool reload) {
+    auto &store = CalStore::getInstance();
+    CalStoreVoice record = store.voice(_voice_num);
 
-        _filter.setCal(f);
-        if (blacklist > 0.5) {
+    // Import anything the store does not have from the text files. On a reload the models written by the tuning
+    // tools are imported again, as they may have been updated
+    uint32_t import = ~record.valid;
+    if (reload) {
+        import |= CAL_STORE_FILTER_MODEL_VALID | CAL_STORE_OSC_VALID | (CAL_STORE_OSC_VALID << 1);
+    }
+    if (_importCalibration(record, import)) {
+        store.setVoice(_voice_num, record);
+    }
+    return record;
+}
+
+void AnalogVoice::_applyCalibration(const CalStoreVoice &record) {
+    if (record.valid & CAL_STORE_VOICE_VALID) {
+        _tri_0.setZeroOffset(record.mix_vca[0]);
+        _sqr_0.setZeroOffset(record.mix_vca[1]);
+        _tri_1.setZeroOffset(record.mix_vca[2]);
+        _sqr_1.setZeroOffset(record.mix_vca[3]);
+        _xor.setZeroOffset(record.mix_vca[4]);
+        _left.setZeroOffset(record.main_vca[0]);
+        _right.setZeroOffset(record.main_vca[1]);
+        if (record.blacklisted) {
             _blacklisted = true;
             _osc_0.osc_disable = true;
             _osc_1.osc_disable = true;
@@ -158,36 +227,86 @@ void AnalogVoice::loadCalibration() {
     } else {
         printf("\nIO error\n");
     }
-    _osc_0.loadCalibration();
-    _osc_1.loadCalibration();
+    if (record.valid & (CAL_STORE_VOICE_VALID | CAL_STORE_FILTER_MODEL_VALID)) {
+        _filter.setCal(_filterFromRecord(record.filter));
+    }
+    if (record.valid & CAL_STORE_OSC_VALID) {
+        _osc_0.setModel(record.osc[0]);
+    }
+    if (record.valid & (CAL_STORE_OSC_VALID << 1)) {
+        _osc_1.setModel(record.osc[1]);
+    }
 };
 
+bool AnalogVoice::_importCalibration(CalStoreVoice &record, uint32_t parts) {
+    const uint32_t valid = record.valid;
+    FilterCalValues f;
+    if (valid & (CAL_STORE_VOICE_VALID | CAL_STORE_FILTER_MODEL_VALID)) {
+        f = _filterFromRecord(record.filter);
+    }
+    std::fstream file_handler;
+    if (parts & CAL_STORE_VOICE_VALID) {
+        std::stringstream fpath;
+        fpath << path << "voice_" << _voice_num << ".cal";
+        file_handler.open(fpath.str(), std::ios::in);
+        if (file_handler.is_open()) {
+            std::string line;
+            std::getline(file_handler, line);
+            std::istringstream iss(line);
+            float blacklist;
+            auto &vca = record.mix_vca;
+            if (iss >> vca[0] >> vca[1] >> vca[2] >> vca[3] >> vca[4] >> record.main_vca[0] >> record.main_vca[1] >>
+                f.fc_low_clip >> f.fc_high_clip >> f.fc_gain >>
+                f.fc_offset >> f.fc_temp_track >> f.res_low_clip >>
+                f.res_high_clip >> f.res_gain >> f.res_zero_offset >> blacklist) {
+                record.blacklisted = blacklist > 0.5;
+                record.valid |= CAL_STORE_VOICE_VALID;
+            } else {
+                printf("\nfailed voice cal load %d ", _voice_num);
+            }
+            file_handler.close();
+        }
+    }
+    if (parts & CAL_STORE_FILTER_MODEL_VALID) {
+        std::stringstream fpath_filter;
+        fpath_filter << path << "voice_" << _voice_num << "_filter.model";
+        file_handler.open(fpath_filter.str(), std::ios::in);
+        if (file_handler.is_open()) {
+            std::string line;
+            std::getline(file_handler, line);
+            std::istringstream iss(line);
+            if (iss >> f.a >> f.c >> f.base_temp) {
+                record.valid |= CAL_STORE_FILTER_MODEL_VALID;
+            } else {
+                printf("\nfailed filter cal load %d ", _voice_num);
+            }
+            file_handler.close();
+        }
+    }
+    record.filter = _filterToRecord(f);
+    if ((parts & CAL_STORE_OSC_VALID) && _osc_0.loadCalibration(record.osc[0])) {
+        record.valid |= CAL_STORE_OSC_VALID;
+    }
+    if ((parts & (CAL_STORE_OSC_VALID << 1)) && _osc_1.loadCalibration(record.osc[1])) {
+        record.valid |= CAL_STORE_OSC_VALID << 1;
+    }
+    return (record.valid != valid) || (parts & valid);
+}
+
 void AnalogVoice::reEvaluateMutes() {
     _mute_allowed = true;
 }
 
 void AnalogVoice::saveCalibration() {
-    std::fstream file_handler;
-    std::stringstream fpath;
-    fpath << path << "voice_" << _voice_num << ".cal";
-    file_handler.open(fpath.str(), std::ios::out | std::ios::trunc);
-    if (file_handler.is_open()) {
-        float vca_cal_1, vca_cal_2, vca_cal_3, vca_cal_4, vca_cal_5, main_vca_cal_1,
-            main_vca_cal_2, filter_offset, filter_scale, filter_t_coff;
-        vca_cal_1 = _tri_0.getZeroOffset();
-        vca_cal_2 = _sqr_0.getZeroOffset();
-        vca_cal_3 = _tri_1.getZeroOffset();
-        vca_cal_4 = _sqr_1.getZeroOffset();
-        vca_cal_5 = _xor.getZeroOffset();
-        main_vca_cal_1 = _left.getZeroOffset();
-        main_vca_cal_2 = _right.getZeroOffset();
-        float blacklist = (float)((int)_blacklisted);
-        FilterCalValues f = _filter.getCal();
-
-        file_handler << " " << vca_cal_1 << " " << vca_cal_2 << " " << vca_cal_3 << " " << vca_cal_4 << " " << vca_cal_5 << " " << main_vca_cal_1 << " " << main_vca_cal_2 << " " << f.fc_low_clip << " " << f.fc_high_clip << " " << f.fc_gain << " " << f.fc_offset << " " << f.fc_temp_track << " " << f.res_low_clip << " " << f.res_high_clip << " " << f.res_gain << " " << f.res_zero_offset << " " << blacklist;
-        file_handler.close();
-        printf("\nsaved cal to file");
-    } else {
+
+    // The file writer merges this into the cal store and saves it, the models in the record are not used
+    CalStoreVoice record = {};
+    record.mix_vca = {_tri_0.getZeroOffset(), _sqr_0.getZeroOffset(), _tri_1.getZeroOffset(), _sqr_1.getZeroOffset(), _xor.getZeroOffset()};
+    record.main_vca = {_left.getZeroOffset(), _right.getZeroOffset()};
+    record.filter = _filterToRecord(_filter.getCal());
+    record.blacklisted = _blacklisted;
+    record.valid = CAL_STORE_VOICE_VALID;
+    if (!FileWriter::getInstance().post(FileWriteType::CAL_VOICE, _voice_num, record)) {
         printf("\nfileIOerror");
     }
 };
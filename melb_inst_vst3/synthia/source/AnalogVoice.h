@@ -10,11 +10,13 @@
 #pragma once
 
 #include "AnalogFiltGen.h"
+#include "AnalogOscBatch.h"
 #include "AnalogOscGen.h"
 #include "DsVca.h"
 #include "NinaLogger.h"
 #include "common.h"
 #include <array>
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -189,11 +191,38 @@ class AnalogVoice {
         float osc_2_down);
     void runOscTuning();
     void stopOscTuning();
+
+    /**
+     * @brief Apply the calibration from the cal store. Any calibration missing from the store is imported from the
+     * text files. The store must be saved after this if it is dirty
+     *
+     */
     void loadCalibration();
+
+    /**
+     * @brief Reload the calibration, the models written by the tuning tools are imported again. Called by the file
+     * writer thread, the record is handed to the voice through an atomic pointer and applied at the start of its
+     * next buffer
+     *
+     * @return false if the voice has not taken the last reload yet
+     */
+    bool reloadCalibration();
+
+    AnalogOscModel &osc(uint osc_num) {
+        return osc_num == 0 ? _osc_0 : _osc_1;
+    }
     void saveCalibration();
     VoiceInput &getVoiceInputBuffers();
     void generateVoiceBuffers(VoiceOutput &output);
 
+    /**
+     * @brief Batched version of generateVoiceBuffers(), the normal state osc samples of the voice are added to the
+     * batch. The batch must be run before finishVoiceBuffers() is called
+     *
+     */
+    void startVoiceBuffers(VoiceOutput &output, AnalogOscBatch &osc_batch);
+    void finishVoiceBuffers(VoiceOutput &output);
+
     void setUnitTestMode() {
         _osc_1.setUnitTestMode();
         _osc_0.setUnitTestMode();
@@ -283,6 +312,9 @@ class AnalogVoice {
     bool _voice_allocated_to_layer = false;
     bool _disable_mutes = false;
 
+    // set if the voice was running when the buffer was started
+    bool _buffer_enabled = false;
+
     Logger *logger;
     VoiceInput _input;
     VoiceInput _output_store;
@@ -297,10 +329,30 @@ class AnalogVoice {
     Vca<Cv1AmpL, false> _left;
     Vca<Cv1AmpR, false> _right;
     AnalogFiltCal _filter = {};
+    CalStoreVoice _reload_record = {};
+    std::atomic<const CalStoreVoice *> _published_cal = nullptr;
 
     // when voices are disabled the osc will run at appx ~500hz and with a squarish shape so they can still be tracked
     std::array<float, CV_BUFFER_SIZE> _disable_pitch;
     std::array<float, CV_BUFFER_SIZE> _disable_shape;
+
+    bool _startVoice(VoiceOutput &output);
+    void _finishVoice(VoiceOutput &output);
+
+    /**
+     * @brief Read the given parts of the calibration from the text files into the record
+     *
+     * @return true if the record was changed
+     */
+    bool _importCalibration(CalStoreVoice &record, uint32_t parts);
+
+    /**
+     * @brief Read the calibration from the cal store, importing anything it does not have from the text files. On
+     * a reload the models written by the tuning tools are imported again
+     *
+     */
+    CalStoreVoice _readCalibration(bool reload);
+    void _applyCalibration(const CalStoreVoice &record);
 };
 
 } // namespace Nina
@@ -29,6 +29,8 @@
 
 class Chorus {
   public:
+    static constexpr int MAX_BLOCK_SIZE = 128;
+
     float *delayLineStart;
     float *delayLineEnd;
     float *writePtr;
@@ -52,6 +54,11 @@ class Chorus {
     // lfo
     float lfoPhase, lfoStepSize, lfoSign;
 
+    // block read positions
+    int blockReadPos1[MAX_BLOCK_SIZE];
+    int blockReadPos2[MAX_BLOCK_SIZE];
+    float blockFracs[MAX_BLOCK_SIZE];
+
     Chorus(float sampleRate, float phase, float rate, float delayTime) {
         this->rate = rate;
         this->sampleRate = sampleRate;
@@ -124,6 +131,55 @@ class Chorus {
         return delayLineOutput;
     }
 
+    // Block version of process, numSamples must be no more than MAX_BLOCK_SIZE
+    void process(const float *input, float *output, int numSamples) {
+        prepareBlock(input, numSamples);
+        for (int i = 0; i < numSamples; i++) {
+            output[i] = readBlock(i);
+        }
+    }
+
+    // Get the read positions for a block and write the input block to the delayline, numSamples must be no
+    // more than MAX_BLOCK_SIZE. The whole block is written before it is read, which is the same as the per
+    // sample order as long as the shortest delay is at least 1 sample and the longest delay plus the block fits
+    // in the delayline
+    void prepareBlock(const float *input, int numSamples) {
+        const int writePos = (int)(writePtr - delayLineStart);
+
+        // Get the delay times, with the lfo stepped and the delay worked out per sample exactly as in the per
+        // sample path
+        for (int i = 0; i < numSamples; i++) {
+            const float delay = (nextLFO() * 0.3f + 0.4f) * delayTime * sampleRate * 0.001f;
+
+            // the delay is always positive so truncating is the same as floor
+            const int delayInt = (int)delay;
+            int pos = writePos + i - delayInt;
+            pos = pos < 0 ? pos + delayLineLength : pos;
+            pos = pos >= delayLineLength ? pos - delayLineLength : pos;
+            blockReadPos1[i] = pos;
+            blockReadPos2[i] = pos == 0 ? delayLineLength - 1 : pos - 1;
+            blockFracs[i] = delay - (float)delayInt;
+        }
+
+        // Write the input block to the delayline
+        for (int i = 0; i < numSamples; i++) {
+            *writePtr = input[i];
+            if (++writePtr >= delayLineEnd) {
+                writePtr = delayLineStart;
+            }
+        }
+    }
+
+    // Read sample i of the block set up by prepareBlock, with the allpass interpolation and low pass. The
+    // samples must be read in order
+    inline float readBlock(int i) {
+        const float a = 1 - blockFracs[i];
+        delayLineOutput = delayLineStart[blockReadPos2[i]] + delayLineStart[blockReadPos1[i]] * a - a * z1;
+        z1 = delayLineOutput;
+        lp->tick(&delayLineOutput, 0.95f);
+        return delayLineOutput;
+    }
+
     inline float nextLFO() {
         if (lfoPhase >= 1.0f) {
             lfoSign = -1.0f;
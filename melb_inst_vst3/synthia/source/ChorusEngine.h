@@ -111,6 +111,40 @@ class ChorusEngine {
         *out_l += resultL * 1.4f * _vol;
         *out_r += resultR * 1.4f * _vol;
     }
+
+    // Block version of process, sums the chorus output into the output buffers. The chorus lines are read
+    // in the same loop so their filters run in parallel
+    inline void process(const float *in_l, const float *in_r, float *out_l, float *out_r, int numSamples) {
+        for (int start = 0; start < numSamples; start += Chorus::MAX_BLOCK_SIZE) {
+            const int n = (numSamples - start) < Chorus::MAX_BLOCK_SIZE ? (numSamples - start) : Chorus::MAX_BLOCK_SIZE;
+            if (isChorus1Enabled) {
+                chorus1L->prepareBlock(in_l + start, n);
+                chorus1R->prepareBlock(in_r + start, n);
+            }
+            if (isChorus2Enabled) {
+                chorus2L->prepareBlock(in_l + start, n);
+                chorus2R->prepareBlock(in_r + start, n);
+            }
+            for (int i = 0; i < n; i++) {
+                float resultL = 0.0f;
+                float resultR = 0.0f;
+                if (isChorus1Enabled) {
+                    resultL += chorus1L->readBlock(i);
+                    resultR += chorus1R->readBlock(i);
+                    dcBlock1L->tick(&resultL, 0.01f);
+                    dcBlock1R->tick(&resultR, 0.01f);
+                }
+                if (isChorus2Enabled) {
+                    resultL += chorus2L->readBlock(i);
+                    resultR += chorus2R->readBlock(i);
+                    dcBlock2L->tick(&resultL, 0.01f);
+                    dcBlock2R->tick(&resultR, 0.01f);
+                }
+                out_l[start + i] += resultL * 1.4f * _vol;
+                out_r[start + i] += resultR * 1.4f * _vol;
+            }
+        }
+    }
 };
 
 #endif
@@ -10,6 +10,10 @@
 
 #include "SynthMath.h"
 #include "common.h"
+#include <array>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 namespace Steinberg {
 namespace Vst {
@@ -37,6 +41,14 @@ class Vca {
         return _offset;
     }
 
+    /**
+     * @brief Offset added to the level when it is written to the mux, the offset is subtracted for inverted vcas
+     *
+     */
+    float muxOffset() const {
+        return INVERT ? -_offset : _offset;
+    }
+
     /**
      * @brief applies the vca calibration to the input data
      *
@@ -69,6 +81,121 @@ class Vca {
     float _gain_down = 1;
 };
 
+// the writer builds the upper half of each mux frame, which holds these slots
+static_assert(CV_MUX_INC == 8);
+static_assert(CV_BUFFER_SIZE % 4 == 0);
+static_assert((Cv0MixOsc1Sq == 4) && (Cv0MixOsc1Tri == 5) && (Cv0MixOsc2Sq == 6) && (Cv0MixOsc2Tri == 7));
+static_assert((Cv1AmpL == 4) && (Cv1AmpR == 5) && (Cv1Unused == 6) && (Cv1BitArray == 7));
+
+/**
+ * @brief Levels and offsets for all the vcas of a voice. The cv0 arrays are in mux slot order from Cv0MixOsc1Sq,
+ * the offsets are the vca mux offsets
+ */
+struct VcaMuxInput {
+    std::array<const float *, 4> cv0_levels;
+    std::array<float, 4> cv0_offsets;
+    const float *xor_level;
+    const float *left_level;
+    const float *right_level;
+    const float *bit_array;
+    float xor_offset;
+    float left_offset;
+    float right_offset;
+};
+
+/**
+ * @brief Scalar reference for the vca mux writer, the vector writers must match this exactly
+ *
+ */
+inline void vcaMuxWriteScalar(const VcaMuxInput &in, std::array<float, BUFFER_SIZE> &out_1, std::array<float, BUFFER_SIZE> &out_2) {
+    for (uint i = 0; i < CV_BUFFER_SIZE; i++) {
+        float *frame_1 = &out_1[i * CV_MUX_INC];
+        float *frame_2 = &out_2[i * CV_MUX_INC];
+        for (uint slot = 0; slot < 4; slot++) {
+            frame_1[Cv0MixOsc1Sq + slot] = in.cv0_levels[slot][i] + in.cv0_offsets[slot];
+        }
+        frame_2[Cv1MixXor] = in.xor_level[i] + in.xor_offset;
+        frame_2[Cv1AmpL] = in.left_level[i] + in.left_offset;
+        frame_2[Cv1AmpR] = in.right_level[i] + in.right_offset;
+        frame_2[Cv1BitArray] = in.bit_array[i];
+    }
+}
+
+#if defined(__aarch64__)
+
+/**
+ * @brief NEON vca mux writer. The levels for 4 CV samples are transposed in registers so the vca half of each
+ * frame is written with a single store
+ */
+inline void vcaMuxWrite(const VcaMuxInput &in, std::array<float, BUFFER_SIZE> &out_1, std::array<float, BUFFER_SIZE> &out_2) {
+    const float32x4_t offsets_1 = vld1q_f32(in.cv0_offsets.data());
+    const float offsets_2_data[4] = {in.left_offset, in.right_offset, 0.f, 0.f};
+    const float32x4_t offsets_2 = vld1q_f32(offsets_2_data);
+    auto transpose = [](float32x4_t a, float32x4_t b, float32x4_t c, float32x4_t d, float32x4_t *rows) {
+        const float32x4x2_t ab = vtrnq_f32(a, b);
+        const float32x4x2_t cd = vtrnq_f32(c, d);
+        rows[0] = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+        rows[1] = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+        rows[2] = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+        rows[3] = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+    };
+    for (uint i = 0; i < CV_BUFFER_SIZE; i += 4) {
+        float32x4_t rows[4];
+        transpose(vld1q_f32(in.cv0_levels[0] + i), vld1q_f32(in.cv0_levels[1] + i), vld1q_f32(in.cv0_levels[2] + i), vld1q_f32(in.cv0_levels[3] + i), rows);
+        for (uint k = 0; k < 4; k++) {
+            vst1q_f32(&out_1[(i + k) * CV_MUX_INC + Cv0MixOsc1Sq], vaddq_f32(rows[k], offsets_1));
+        }
+
+        // the unused slot is passed through
+        float unused[4];
+        for (uint k = 0; k < 4; k++) {
+            unused[k] = out_2[(i + k) * CV_MUX_INC + Cv1Unused];
+        }
+        transpose(vld1q_f32(in.left_level + i), vld1q_f32(in.right_level + i), vld1q_f32(unused), vld1q_f32(in.bit_array + i), rows);
+        for (uint k = 0; k < 4; k++) {
+            vst1q_f32(&out_2[(i + k) * CV_MUX_INC + Cv1AmpL], vaddq_f32(rows[k], offsets_2));
+            out_2[(i + k) * CV_MUX_INC + Cv1MixXor] = in.xor_level[i + k] + in.xor_offset;
+        }
+    }
+}
+
+#elif defined(__SSE2__)
+
+/**
+ * @brief SSE vca mux writer. The levels for 4 CV samples are transposed in registers so the vca half of each
+ * frame is written with a single store
+ */
+inline void vcaMuxWrite(const VcaMuxInput &in, std::array<float, BUFFER_SIZE> &out_1, std::array<float, BUFFER_SIZE> &out_2) {
+    const __m128 offsets_1 = _mm_loadu_ps(in.cv0_offsets.data());
+    const __m128 offsets_2 = _mm_setr_ps(in.left_offset, in.right_offset, 0.f, 0.f);
+    for (uint i = 0; i < CV_BUFFER_SIZE; i += 4) {
+        __m128 rows[4] = {_mm_loadu_ps(in.cv0_levels[0] + i), _mm_loadu_ps(in.cv0_levels[1] + i), _mm_loadu_ps(in.cv0_levels[2] + i), _mm_loadu_ps(in.cv0_levels[3] + i)};
+        _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+        for (uint k = 0; k < 4; k++) {
+            _mm_storeu_ps(&out_1[(i + k) * CV_MUX_INC + Cv0MixOsc1Sq], _mm_add_ps(rows[k], offsets_1));
+        }
+
+        // the unused slot is passed through
+        rows[0] = _mm_loadu_ps(in.left_level + i);
+        rows[1] = _mm_loadu_ps(in.right_level + i);
+        rows[2] = _mm_setr_ps(out_2[i * CV_MUX_INC + Cv1Unused], out_2[(i + 1) * CV_MUX_INC + Cv1Unused], out_2[(i + 2) * CV_MUX_INC + Cv1Unused], out_2[(i + 3) * CV_MUX_INC + Cv1Unused]);
+        rows[3] = _mm_loadu_ps(in.bit_array + i);
+        _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+        for (uint k = 0; k < 4; k++) {
+            _mm_storeu_ps(&out_2[(i + k) * CV_MUX_INC + Cv1AmpL], _mm_add_ps(rows[k], offsets_2));
+            out_2[(i + k) * CV_MUX_INC + Cv1MixXor] = in.xor_level[i + k] + in.xor_offset;
+        }
+    }
+}
+
+#else
+
+inline void vcaMuxWrite(const VcaMuxInput &in, std::array<float, BUFFER_SIZE> &out_1, std::array<float, BUFFER_SIZE> &out_2) {
+    vcaMuxWriteScalar(in, out_1, out_2);
+}
+
+#endif
+
 } // namespace Nina
 } // namespace Vst
 } // namespace Steinberg
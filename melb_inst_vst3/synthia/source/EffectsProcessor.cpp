@@ -10,6 +10,7 @@
 #include "EffectsProcessor.h"
 #include "EffectsController.h"
 #include "GuiMsgQueue.h"
+#include "NinaRuntimeOptions.h"
 #include "base/source/fstreamer.h"
 #include "pluginterfaces/base/ftypes.h"
 #include "pluginterfaces/base/futils.h"
@@ -31,15 +32,20 @@ FUID EffectsProcessor::uid(0xE19B5E2C, 0xB84B403E, 0xA466809E, 0x3D96323A);
 EffectsProcessor::EffectsProcessor() {
     setControllerClass(EffectsController::uid);
     _changed_param_ids.reserve(NumEffectsParams * 10);
-    for (auto &item : _delay_buffer) {
-        item = 0.0;
-    }
 
     _reverb.setPreset(0);
     _delay_left.setLevel(0.7);
     _delay_left.setLFO(0.4, 6);
     _delay_right.setLevel(0.7);
     _delay_right.setLFO(0.65, 6);
+
+    // apply the runtime options to the effects
+    const auto &options = RuntimeOptions::getInstance();
+    if (options.delay_packed_storage) {
+        _delay_left.setPackedStorage(true);
+        _delay_right.setPackedStorage(true);
+    }
+    setSampleAccurateAutomation(options.sample_accurate_automation);
     cengine.setChorus1LfoRate(.3);
     cengine.setChorus2LfoRate(.7);
     _reverb.setInGain(0.9);
@@ -119,6 +125,11 @@ tresult PLUGIN_API EffectsProcessor::process(ProcessData &data) {
     processEvents(data.inputEvents);
     processParameterChanges(data.inputParameterChanges);
     processAudio(data);
+
+    // apply any param points that were not reached, if the delay was not run this buffer
+    _applyParamPoints(BUFFER_SIZE);
+    _num_param_points = 0;
+    _next_param_point = 0;
     _global_tempo = (float)(data.processContext->tempo) / 60.f;
     _delay_left.setTempo(_global_tempo);
     _delay_right.setTempo(_global_tempo);
@@ -144,18 +155,52 @@ bool EffectsProcessor::processParameterChanges(IParameterChanges *param_changes)
                 // Get the param ID and if valid process
                 ParamID paramId = mask_param_id(queue->getParameterId());
                 if (paramId < EffectsParamOrder::NumEffectsParams) {
+                    // In sample accurate mode the delay params are applied at each point of the queue as the delay
+                    // runs, the points at the start of the buffer are applied now
+                    const int32 num_points = queue->getPointCount();
+                    if (_sample_accurate_automation && _isSegmentedParam(paramId) &&
+                        (_num_param_points + num_points <= MAX_PARAM_CHANGE_POINTS)) {
+                        for (int32 p = 0; p < num_points; p++) {
+                            int32 point_offset;
+                            ParamValue point_value;
+                            if (queue->getPoint(p, point_offset, point_value) != kResultOk) {
+                                continue;
+                            }
+                            if (point_offset <= 0) {
+                                if (_setParam(paramId, point_value)) {
+                                    _changed_param_ids.push_back(paramId);
+                                }
+                            } else {
+                                _param_points[_num_param_points++] = ParamChangePoint(paramId, point_value, std::min(point_offset, BUFFER_SIZE - 1));
+                            }
+                        }
+                        continue;
+                    }
+
                     // Get the last (latest) point value in the queue, any previous values
                     // are not processed
                     int32 sampleOffset;
                     ParamValue value;
-                    queue->getPoint((queue->getPointCount() - 1), sampleOffset, value);
+                    queue->getPoint((num_points - 1), sampleOffset, value);
 
-                    // Set the param value and add to the vector of param IDs changed
-                    _params[paramId] = value;
-                    _changed_param_ids.push_back(paramId);
+                    // Set the param value and add to the vector of param IDs changed, if it has changed
+                    if (_setParam(paramId, value)) {
+                        _changed_param_ids.push_back(paramId);
+                    }
                 }
             }
 
+            // order the points by offset, an insertion sort keeps the points for each param in order and does not
+            // allocate
+            for (uint i = 1; i < _num_param_points; i++) {
+                const ParamChangePoint point = _param_points[i];
+                uint j = i;
+                for (; (j > 0) && (_param_points[j - 1].offset > point.offset); j--) {
+                    _param_points[j] = _param_points[j - 1];
+                }
+                _param_points[j] = point;
+            }
+
             // Update the parameters
             _updateParams();
             return true;
@@ -248,25 +293,40 @@ void EffectsProcessor::processAudio(ProcessData &data) {
     }
     bool prev_slot_processing = false;
     for (uint fx_row = 0; fx_row < (last_slot + 1); fx_row++) {
+        const float input_peak = fxPeak(fx_in_l, fx_in_r);
+
+        // run an effect unless it has gone idle, while its tail is playing out measure what it adds to the output
+        auto run_fx = [&](FxActivity &activity, auto process) {
+            if (!activity.start(input_peak)) {
+                return;
+            }
+            if (activity.tail()) {
+                std::copy(fx_sum_l, fx_sum_l + BUFFER_SIZE, _fx_tail_l.begin());
+                std::copy(fx_sum_r, fx_sum_r + BUFFER_SIZE, _fx_tail_r.begin());
+                process();
+                activity.end(fxPeakDifference(fx_sum_l, fx_sum_r, _fx_tail_l.data(), _fx_tail_r.data()));
+            } else {
+                process();
+            }
+        };
 
         bool slot_has_processing = (_chorus_slot == fx_row) || (_delay_slot == fx_row) || (_reverb_slot == fx_row);
 
         bool final_slot = (last_slot == fx_row);
         float dry_passthough;
-        float level_sum = 0;
+        float other_level = 0;
         if (_chorus_slot == fx_row) {
-            level_sum += _chorus_level;
+            other_level += _chorus_level;
         }
         if (_reverb_slot == fx_row) {
-            level_sum += _reverb_level;
+            other_level += _reverb_level;
         }
+        float level_sum = other_level;
         if (_delay_slot == fx_row) {
             level_sum += delay_level;
         }
-        dry_passthough = level_sum < 1.0f ? 1.0 - level_sum : 0;
-        if (final_slot && !(prev_slot_processing)) {
-            dry_passthough = 0.f;
-        }
+        const bool dry_enabled = !(final_slot && !(prev_slot_processing));
+        dry_passthough = _dryLevel(level_sum, dry_enabled);
 
         _dry_level_filtered = param_smooth(dry_passthough, _dry_level_filtered);
         prev_slot_processing = slot_has_processing;
@@ -279,24 +339,30 @@ void EffectsProcessor::processAudio(ProcessData &data) {
 
         // chorus processing
         if ((fx_row == _chorus_slot)) {
-            cengine.setVol(chorus_level);
-            for (int i = 0; i < BUFFER_SIZE; i++) {
-                cengine.process(&fx_in_l[i], &fx_in_r[i], &fx_sum_l[i], &fx_sum_r[i]);
-            }
+            run_fx(_chorus_activity, [&]() {
+                cengine.setVol(chorus_level);
+                cengine.process(fx_in_l, fx_in_r, fx_sum_l, fx_sum_r, BUFFER_SIZE);
+            });
         }
         // delay processing
         if ((fx_row == _delay_slot)) {
-            _delay_left.run(fx_in_l, fx_sum_l);
-            _delay_right.run(fx_in_r, fx_sum_r);
+            run_fx(_delay_activity, [&]() {
+                if (_num_param_points > 0) {
+                    _runDelaySegments(fx_in_l, fx_in_r, fx_sum_l, fx_sum_r, other_level, dry_enabled);
+                } else {
+                    BBDDelay::runStereo(_delay_left, _delay_right, fx_in_l, fx_in_r, fx_sum_l, fx_sum_r);
+                }
+            });
         }
 
         // reverb processing
         if ((fx_row == _reverb_slot)) {
-
-            _limiter_2.run(fx_in_l, fx_in_r, fx_in_l, fx_in_r);
-            float *in[2] = {fx_in_l, fx_in_r};
-            float *out[2] = {fx_sum_l, fx_sum_r};
-            _reverb.run(in, out, BUFFER_SIZE);
+            run_fx(_reverb_activity, [&]() {
+                _limiter_2.run(fx_in_l, fx_in_r, fx_in_l, fx_in_r);
+                float *in[2] = {fx_in_l, fx_in_r};
+                float *out[2] = {fx_sum_l, fx_sum_r};
+                _reverb.run(in, out, BUFFER_SIZE);
+            });
         }
         for (int i = 0; i < BUFFER_SIZE; i++) {
 
@@ -361,90 +427,154 @@ void EffectsProcessor::_updateParams() {
     // reset the fx if the mode has changed to avoid noise etc
 
     for (auto &change : _changed_param_ids) {
-        switch (change) {
-        case EffectsParamOrder::reverbTone:
-            _reverb.setTone(_params[EffectsParamOrder::reverbTone]);
-            break;
-        case EffectsParamOrder::reverbDecay:
-            _reverb.setDecay(_params[reverbDecay]);
-            _output_duck = true;
-            break;
-        case EffectsParamOrder::reverbShimmer:
-            _reverb.setShimmer(_params[reverbShimmer]);
-            break;
-        case EffectsParamOrder::tempoSync:
-            _tempo_sync = _params[tempoSync] > 0.25;
-            _delay_left.setTempoSync(_tempo_sync);
-            _delay_right.setTempoSync(_tempo_sync);
-            break;
-        case EffectsParamOrder::reverbEarlyMix:
-            _reverb.setDistance(_params[EffectsParamOrder::reverbEarlyMix]);
-            break;
-        case EffectsParamOrder::reverbPreDelay:
-            _reverb.setPreDelay(_params[reverbPreDelay]);
-            _output_duck = true;
-            break;
-        case EffectsParamOrder::reverbPreset:
-            _reverb.setPreset(_params[reverbPreset]);
-            _output_duck = true;
-            break;
-        case EffectsParamOrder::volume:
-            _limiter.setVolume(_volume);
-            break;
-        case EffectsParamOrder::chorusLevel:
-            _chorus_level = _params[chorusLevel];
-            break;
-        case EffectsParamOrder::delaySlot: {
-            float slot = std::round(_params[delaySlot] * FX_SLOTS);
-            _delay_slot = (uint)slot;
-        }
-        case EffectsParamOrder::chorusSlot: {
-            float slot = std::round(_params[chorusSlot] * FX_SLOTS);
-            _chorus_slot = (uint)slot;
-        }
-        case EffectsParamOrder::reverbSlot: {
-            float slot = std::round(_params[reverbSlot] * FX_SLOTS);
-            _reverb_slot = (uint)slot;
+        _updateParam(change);
+    }
+}
+
+bool EffectsProcessor::_setParam(ParamID param_id, float value) {
+    if (_params_set.test(param_id) && (_params[param_id] == value)) {
+        return false;
+    }
+    _params[param_id] = value;
+    _params_set.set(param_id);
+    return true;
+}
+
+bool EffectsProcessor::_isSegmentedParam(ParamID param_id) {
+    switch (param_id) {
+    case EffectsParamOrder::delayFeedback:
+    case EffectsParamOrder::delayTime:
+    case EffectsParamOrder::delayTimeSync:
+    case EffectsParamOrder::delayTone:
+    case EffectsParamOrder::delayLevel:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void EffectsProcessor::_applyParamPoints(uint offset) {
+    while ((_next_param_point < _num_param_points) && (_param_points[_next_param_point].offset <= offset)) {
+        const ParamChangePoint &point = _param_points[_next_param_point++];
+        if (_setParam(point.param_id, point.value)) {
+            _updateParam(point.param_id);
         }
+    }
+}
 
-        case EffectsParamOrder::delayLevel:
-            _delay_left.setDelayMixAmount(_params[delayLevel]);
-            _delay_right.setDelayMixAmount(_params[delayLevel]);
-            _delay_level = _params[delayLevel];
-        case EffectsParamOrder::ReverbLevel:
-            _reverb.setwetDry(_params[ReverbLevel]);
-            _reverb_level = _params[ReverbLevel];
-
-        case EffectsParamOrder::delayFeedback:
-            _delay_left.setFB(_params[EffectsParamOrder::delayFeedback]);
-            _delay_right.setFB(_params[EffectsParamOrder::delayFeedback]);
-            break;
-        case EffectsParamOrder::delayTime:
-            _delay_left.setTime(_params[EffectsParamOrder::delayTime]);
-            _delay_right.setTime(_params[EffectsParamOrder::delayTime]);
-            break;
-        case EffectsParamOrder::delayTimeSync:
-            _delay_left.setTimeSync(_params[EffectsParamOrder::delayTimeSync]);
-            _delay_right.setTimeSync(_params[EffectsParamOrder::delayTimeSync]);
-            break;
-        case EffectsParamOrder::delayTone:
-            _delay_left.setFilter(_params[EffectsParamOrder::delayTone]);
-            _delay_right.setFilter(_params[EffectsParamOrder::delayTone]);
-            break;
-        case EffectsParamOrder::chorusmode: {
-            const float cmode = _params[chorusmode];
-            if (cmode < 1.f / 3.f) {
-                _chorus_mode = I;
-            } else if (cmode < 2.f / 3.f) {
-                _chorus_mode = II;
-            } else {
-                _chorus_mode = I_II;
+float EffectsProcessor::_dryLevel(float level_sum, bool dry_enabled) {
+    if (!dry_enabled) {
+        return 0.f;
+    }
+    return level_sum < 1.0f ? 1.0 - level_sum : 0;
+}
+
+void EffectsProcessor::_runDelaySegments(float *input_l, float *input_r, float *output_l, float *output_r, float other_level, bool dry_enabled) {
+    // split the buffer at the param points, the points at the start of each segment are applied before it is run
+    const float buffer_dry = _dryLevel(other_level + _delay_level, dry_enabled);
+    _delay_left.startSegments();
+    _delay_right.startSegments();
+    uint start = 0;
+    while (start < BUFFER_SIZE) {
+        _applyParamPoints(start);
+        const uint end = (_next_param_point < _num_param_points) ? _param_points[_next_param_point].offset : BUFFER_SIZE;
+
+        // the output was filled with the dry signal at the level from the start of the buffer, correct it for a
+        // level change
+        const float dry_change = _dryLevel(other_level + _delay_level, dry_enabled) - buffer_dry;
+        if (dry_change != 0.f) {
+            for (uint i = start; i < end; i++) {
+                output_l[i] += dry_change * input_l[i];
+                output_r[i] += dry_change * input_r[i];
             }
-            cengine.setEnablesChorus((_chorus_mode == I) || (_chorus_mode == I_II), (_chorus_mode == II) || (_chorus_mode == I_II));
-        } break;
-        default:
-            break;
         }
+        _delay_left.runSegment(input_l, output_l, start, end);
+        _delay_right.runSegment(input_r, output_r, start, end);
+        start = end;
+    }
+}
+
+void EffectsProcessor::_updateParam(ParamID param_id) {
+    switch (param_id) {
+    case EffectsParamOrder::reverbTone:
+        _reverb.setTone(_params[EffectsParamOrder::reverbTone]);
+        break;
+    case EffectsParamOrder::reverbDecay:
+        _reverb.setDecay(_params[reverbDecay]);
+        break;
+    case EffectsParamOrder::reverbShimmer:
+        _reverb.setShimmer(_params[reverbShimmer]);
+        break;
+    case EffectsParamOrder::tempoSync:
+        _tempo_sync = _params[tempoSync] > 0.25;
+        _delay_left.setTempoSync(_tempo_sync);
+        _delay_right.setTempoSync(_tempo_sync);
+        break;
+    case EffectsParamOrder::reverbEarlyMix:
+        _reverb.setDistance(_params[EffectsParamOrder::reverbEarlyMix]);
+        break;
+    case EffectsParamOrder::reverbPreDelay:
+        _reverb.setPreDelay(_params[reverbPreDelay]);
+        break;
+    case EffectsParamOrder::reverbPreset:
+        _reverb.setPreset(_params[reverbPreset]);
+        break;
+    case EffectsParamOrder::volume:
+        _limiter.setVolume(_volume);
+        break;
+    case EffectsParamOrder::chorusLevel:
+        _chorus_level = _params[chorusLevel];
+        break;
+    case EffectsParamOrder::delaySlot: {
+        float slot = std::round(_params[delaySlot] * FX_SLOTS);
+        _delay_slot = (uint)slot;
+    } break;
+    case EffectsParamOrder::chorusSlot: {
+        float slot = std::round(_params[chorusSlot] * FX_SLOTS);
+        _chorus_slot = (uint)slot;
+    } break;
+    case EffectsParamOrder::reverbSlot: {
+        float slot = std::round(_params[reverbSlot] * FX_SLOTS);
+        _reverb_slot = (uint)slot;
+    } break;
+    case EffectsParamOrder::delayLevel:
+        _delay_left.setDelayMixAmount(_params[delayLevel]);
+        _delay_right.setDelayMixAmount(_params[delayLevel]);
+        _delay_level = _params[delayLevel];
+        break;
+    case EffectsParamOrder::ReverbLevel:
+        _reverb.setwetDry(_params[ReverbLevel]);
+        _reverb_level = _params[ReverbLevel];
+        break;
+    case EffectsParamOrder::delayFeedback:
+        _delay_left.setFB(_params[EffectsParamOrder::delayFeedback]);
+        _delay_right.setFB(_params[EffectsParamOrder::delayFeedback]);
+        break;
+    case EffectsParamOrder::delayTime:
+        _delay_left.setTime(_params[EffectsParamOrder::delayTime]);
+        _delay_right.setTime(_params[EffectsParamOrder::delayTime]);
+        break;
+    case EffectsParamOrder::delayTimeSync:
+        _delay_left.setTimeSync(_params[EffectsParamOrder::delayTimeSync]);
+        _delay_right.setTimeSync(_params[EffectsParamOrder::delayTimeSync]);
+        break;
+    case EffectsParamOrder::delayTone:
+        _delay_left.setFilter(_params[EffectsParamOrder::delayTone]);
+        _delay_right.setFilter(_params[EffectsParamOrder::delayTone]);
+        break;
+    case EffectsParamOrder::chorusmode: {
+        const float cmode = _params[chorusmode];
+        if (cmode < 1.f / 3.f) {
+            _chorus_mode = I;
+        } else if (cmode < 2.f / 3.f) {
+            _chorus_mode = II;
+        } else {
+            _chorus_mode = I_II;
+        }
+        cengine.setEnablesChorus((_chorus_mode == I) || (_chorus_mode == I_II), (_chorus_mode == II) || (_chorus_mode == I_II));
+    } break;
+    default:
+        break;
     }
 }
 } // namespace Nina
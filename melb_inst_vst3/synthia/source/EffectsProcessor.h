@@ -14,6 +14,7 @@
 #include "NinaDelay.h"
 #include "NinaEffectsLimiter.h"
 #include "NinaExpander.h"
+#include "NinaFxActivity.h"
 #include "NinaLogger.h"
 #include "NinaReverb.h"
 #include "common.h"
@@ -21,6 +22,7 @@
 #include "public.sdk/source/vst/vstaudioeffect.h"
 #include "public.sdk/source/vst/vstparameters.h"
 #include <atomic>
+#include <bitset>
 #include <thread>
 
 namespace Steinberg {
@@ -98,6 +100,20 @@ class EffectsProcessor : public AudioEffect {
      */
     tresult PLUGIN_API process(ProcessData &data);
 
+    /**
+     * @brief Enable sample accurate automation. When enabled every point of the delay param queues is applied at its
+     * offset, with the delay run in segments between the points, otherwise only the last point is used
+     *
+     * @param enable true to enable
+     */
+    void setSampleAccurateAutomation(bool enable) {
+        _sample_accurate_automation = enable;
+    }
+
+    bool sampleAccurateAutomation() const {
+        return _sample_accurate_automation;
+    }
+
     /**
      * @brief Create a Instance object
      *
@@ -133,15 +149,23 @@ class EffectsProcessor : public AudioEffect {
     float _reverb_level = 1;
     float _dry_level_filtered = 0;
     NinaExpander _expander;
+    FxActivity _chorus_activity{CHORUS_TAIL_HOLD};
+    FxActivity _delay_activity{DELAY_TAIL_HOLD};
+    FxActivity _reverb_activity{REVERB_TAIL_HOLD};
+    std::array<float, BUFFER_SIZE> _fx_tail_l;
+    std::array<float, BUFFER_SIZE> _fx_tail_r;
     uint _delay_slot = 0;
     uint _chorus_slot = 0;
     ;
     uint _reverb_slot = 0;
 
+    // time each effect keeps running after its output goes silent, this covers the longest gap in its output
+    static constexpr float CHORUS_TAIL_HOLD = 0.1f;
+    static constexpr float DELAY_TAIL_HOLD = (DELAY_MAX_TIME + DELAY_MAX_LFO_DEPTH) / (float)SAMPLE_RATE + 0.1f;
+    static constexpr float REVERB_TAIL_HOLD = 1.f;
+
     static constexpr float SERVO_CUT = 0.1f;
     static constexpr float SERVO_RATE = (2.f * M_PI * SERVO_CUT * (1 / (float)SAMPLE_RATE)) / (2.f * M_PI * SERVO_CUT * (1 / (float)SAMPLE_RATE) + 1);
-    static constexpr int DELAY_SIZE = 323766; // 705600; //95998; //32766;  //set max delay time at max sample rate
-    std::array<float, DELAY_SIZE + 2> _delay_buffer;
 
     consteval float sample_rate() { return 96000.f; }
 
@@ -194,7 +218,52 @@ class EffectsProcessor : public AudioEffect {
      */
     void _updateParams();
 
+    /**
+     * @brief Run the setters for a single param that has changed
+     */
+    void _updateParam(ParamID param_id);
+
+    /**
+     * @brief Set a param value
+     *
+     * @return true if the value is different to the current value
+     */
+    bool _setParam(ParamID param_id, float value);
+
+    /**
+     * @brief Check if a param is applied part way through the buffer in sample accurate mode, only the delay runs
+     * in segments so only the delay params are
+     */
+    static bool _isSegmentedParam(ParamID param_id);
+
+    /**
+     * @brief Apply the sample accurate param points up to and including the offset
+     */
+    void _applyParamPoints(uint offset);
+
+    /**
+     * @brief Find the dry level passed through an fx slot
+     *
+     * @param level_sum sum of the levels of the effects in the slot
+     * @param dry_enabled false if the slot passes no dry signal
+     */
+    static float _dryLevel(float level_sum, bool dry_enabled);
+
+    /**
+     * @brief Run the delays with the buffer split at the sample accurate param points, the dry signal already in the
+     * output follows the delay level points
+     *
+     * @param other_level sum of the levels of the other effects in the delay slot
+     * @param dry_enabled false if the delay slot passes no dry signal
+     */
+    void _runDelaySegments(float *input_l, float *input_r, float *output_l, float *output_r, float other_level, bool dry_enabled);
+
     std::vector<ParamID> _changed_param_ids;
+    std::bitset<EffectsParamOrder::NumEffectsParams> _params_set;
+    bool _sample_accurate_automation = false;
+    std::array<ParamChangePoint, MAX_PARAM_CHANGE_POINTS> _param_points;
+    uint _num_param_points = 0;
+    uint _next_param_point = 0;
 };
 
 } // namespace Nina
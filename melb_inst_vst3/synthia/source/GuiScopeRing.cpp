@@ -0,0 +1,158 @@
+/**
+ * @file GuiScopeRing.cpp
+ * @brief Shared memory ring used to pass the scope frames to the GUI.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+
+#include "GuiScopeRing.h"
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Constants
+constexpr uint GUI_SCOPE_RING_READ_RETRIES = Steinberg::Vst::Nina::GUI_SCOPE_RING_NUM_FRAMES;
+constexpr mode_t GUI_SCOPE_RING_MODE = 0660;
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+GuiScopeRing::~GuiScopeRing() {
+    // Unmap the ring if open
+    close();
+}
+
+bool GuiScopeRing::open(const char *name) {
+    close();
+
+    // Create the shared memory segment, or open one left by an instance that didn't shut down. The mode is set
+    // again as the umask may have cleared the group bits, or an older segment may have other access
+    int fd = ::shm_open(name, (O_CREAT | O_RDWR), GUI_SCOPE_RING_MODE);
+    if (fd == -1) {
+        return false;
+    }
+    ::fchmod(fd, GUI_SCOPE_RING_MODE);
+    if (::ftruncate(fd, sizeof(GuiScopeRingLayout)) != 0) {
+        ::close(fd);
+        return false;
+    }
+    void *mem = ::mmap(nullptr, sizeof(GuiScopeRingLayout), (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+
+    // Keep the ring resident so the audio thread never takes a page fault writing to it
+    ::mlock(mem, sizeof(GuiScopeRingLayout));
+    _ring = static_cast<GuiScopeRingLayout *>(mem);
+    _name = name;
+
+    // Carry on from the last frame if the segment is already valid, so an attached GUI doesn't see the
+    // sequence go backwards, otherwise initialise it
+    GuiScopeRingHeader &header = _ring->header;
+    if ((header.magic == GUI_SCOPE_RING_MAGIC) && (header.version == GUI_SCOPE_RING_VERSION) &&
+        (header.num_frames == GUI_SCOPE_RING_NUM_FRAMES) && (header.frame_size == GUI_SAMPLES_SIZE)) {
+        _write_seq = header.write_seq.load(std::memory_order_acquire);
+    } else {
+        header.magic = 0;
+        header.write_seq.store(0, std::memory_order_relaxed);
+        for (auto &frame : _ring->frames) {
+            frame.seq.store(0, std::memory_order_relaxed);
+            std::memset(frame.samples, 0, sizeof(frame.samples));
+        }
+        header.version = GUI_SCOPE_RING_VERSION;
+        header.num_frames = GUI_SCOPE_RING_NUM_FRAMES;
+        header.frame_size = GUI_SAMPLES_SIZE;
+        std::atomic_thread_fence(std::memory_order_release);
+        header.magic = GUI_SCOPE_RING_MAGIC;
+        _write_seq = 0;
+    }
+    return true;
+}
+
+void GuiScopeRing::close() {
+    // Unlink the segment as well, so it doesn't outlive the processor
+    if (_ring) {
+        ::munmap(_ring, sizeof(GuiScopeRingLayout));
+        ::shm_unlink(_name);
+        _ring = nullptr;
+    }
+}
+
+GuiScopeRingReader::~GuiScopeRingReader() {
+    // Unmap the ring if open
+    close();
+}
+
+bool GuiScopeRingReader::open(const char *name) {
+    close();
+
+    // Open the segment created by the processor
+    int fd = ::shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat st;
+    if ((::fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(GuiScopeRingLayout))) {
+        ::close(fd);
+        return false;
+    }
+    void *mem = ::mmap(nullptr, sizeof(GuiScopeRingLayout), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+
+    // Check the layout matches before using it
+    auto ring = static_cast<const GuiScopeRingLayout *>(mem);
+    const GuiScopeRingHeader &header = ring->header;
+    if ((header.magic != GUI_SCOPE_RING_MAGIC) || (header.version != GUI_SCOPE_RING_VERSION) ||
+        (header.num_frames != GUI_SCOPE_RING_NUM_FRAMES) || (header.frame_size != GUI_SAMPLES_SIZE)) {
+        ::munmap(mem, sizeof(GuiScopeRingLayout));
+        return false;
+    }
+    _ring = ring;
+    _read_seq = header.write_seq.load(std::memory_order_acquire);
+    return true;
+}
+
+void GuiScopeRingReader::close() {
+    if (_ring) {
+        ::munmap(const_cast<GuiScopeRingLayout *>(_ring), sizeof(GuiScopeRingLayout));
+        _ring = nullptr;
+    }
+}
+
+bool GuiScopeRingReader::readLatest(float *samples) {
+    if (!_ring) {
+        return false;
+    }
+
+    // Retry if the writer laps the frame while it is being copied, the next attempt picks up the newer frame
+    for (uint retry = 0; retry < GUI_SCOPE_RING_READ_RETRIES; retry++) {
+        const uint64_t write_seq = _ring->header.write_seq.load(std::memory_order_acquire);
+        if (write_seq == _read_seq) {
+            return false;
+        }
+        const uint64_t frame_num = write_seq - 1;
+        const GuiScopeFrame &frame = _ring->frames[frame_num % GUI_SCOPE_RING_NUM_FRAMES];
+        const uint64_t seq = frame.seq.load(std::memory_order_acquire);
+        if (seq != (2 * frame_num + 2)) {
+            continue;
+        }
+        std::memcpy(samples, frame.samples, sizeof(frame.samples));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (frame.seq.load(std::memory_order_relaxed) == seq) {
+            _read_seq = write_seq;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
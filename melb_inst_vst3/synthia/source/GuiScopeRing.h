@@ -0,0 +1,141 @@
+/**
+ * @file GuiScopeRing.h
+ * @brief Shared memory ring used to pass the scope frames to the GUI.
+ *
+ * The audio thread is the only writer and publishes each frame straight into the ring, the GUI maps the same
+ * segment read only and polls the write sequence, so neither side makes a syscall per frame and the writer
+ * never waits on the reader. Each frame has its own sequence counter, odd while it is being written, so the
+ * reader can tell if a frame was overwritten while it was copying it.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+
+#pragma once
+
+#include "common.h"
+#include <atomic>
+#include <cstdint>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+constexpr char GUI_SCOPE_RING_NAME[] = "/nina_scope_ring";
+constexpr uint32_t GUI_SCOPE_RING_MAGIC = 0x4e534352; // "NSCR"
+constexpr uint32_t GUI_SCOPE_RING_VERSION = 1;
+constexpr uint32_t GUI_SCOPE_RING_NUM_FRAMES = 8;
+
+struct GuiScopeRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_frames;
+    uint32_t frame_size;
+
+    // number of frames published, the latest frame is at (write_seq - 1) % num_frames
+    alignas(64) std::atomic<uint64_t> write_seq;
+};
+
+struct GuiScopeFrame {
+    // 2n + 1 while frame n is being written, 2n + 2 once it is complete
+    alignas(64) std::atomic<uint64_t> seq;
+    float samples[GUI_SAMPLES_SIZE];
+};
+
+struct GuiScopeRingLayout {
+    GuiScopeRingHeader header;
+    GuiScopeFrame frames[GUI_SCOPE_RING_NUM_FRAMES];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the scope ring counters must be lock free to be shared between processes");
+
+/**
+ * @brief Writer side of the scope ring, owned by the processor
+ */
+class GuiScopeRing {
+  public:
+    GuiScopeRing() = default;
+    ~GuiScopeRing();
+
+    /**
+     * @brief Create and map the shared memory segment, readable and writable by the owner and group only. Not
+     * realtime safe
+     *
+     * @param name shared memory segment name
+     * @return true if the ring is ready to publish frames
+     */
+    bool open(const char *name = GUI_SCOPE_RING_NAME);
+
+    /**
+     * @brief Unmap and unlink the shared memory segment. A reader still attached keeps its mapping but sees
+     * no new frames, and has to reopen the ring once the processor is recreated
+     *
+     */
+    void close();
+
+    bool isOpen() const {
+        return _ring != nullptr;
+    }
+
+    /**
+     * @brief Get the frame to write the next samples into, realtime safe. The frame must be published before
+     * the next call
+     *
+     * @return float* GUI_SAMPLES_SIZE samples
+     */
+    float *beginFrame() {
+        GuiScopeFrame &frame = _ring->frames[_write_seq % GUI_SCOPE_RING_NUM_FRAMES];
+        frame.seq.store(2 * _write_seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return frame.samples;
+    }
+
+    /**
+     * @brief Publish the frame from beginFrame to the reader, realtime safe
+     *
+     */
+    void publishFrame() {
+        GuiScopeFrame &frame = _ring->frames[_write_seq % GUI_SCOPE_RING_NUM_FRAMES];
+        frame.seq.store(2 * _write_seq + 2, std::memory_order_release);
+        _write_seq++;
+        _ring->header.write_seq.store(_write_seq, std::memory_order_release);
+    }
+
+  private:
+    GuiScopeRingLayout *_ring = nullptr;
+    const char *_name = GUI_SCOPE_RING_NAME;
+    uint64_t _write_seq = 0;
+};
+
+/**
+ * @brief Reader side of the scope ring, for the GUI process
+ */
+class GuiScopeRingReader {
+  public:
+    GuiScopeRingReader() = default;
+    ~GuiScopeRingReader();
+
+    /**
+     * @brief Map the shared memory segment created by the processor
+     *
+     * @param name shared memory segment name
+     * @return true if the ring is mapped and valid
+     */
+    bool open(const char *name = GUI_SCOPE_RING_NAME);
+    void close();
+
+    /**
+     * @brief Copy the latest frame if there is a new one since the last read, never blocks
+     *
+     * @param samples GUI_SAMPLES_SIZE samples
+     * @return true if a new frame was copied
+     */
+    bool readLatest(float *samples);
+
+  private:
+    const GuiScopeRingLayout *_ring = nullptr;
+    uint64_t _read_seq = 0;
+};
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
@@ -550,6 +550,9 @@ Layer::Layer(uint num_voices, uint first_voice, std::array<AnalogVoice, NUM_VOIC
         }
         param_id++;
     }
+    for (auto &attr : _layer_param_attrs.state_attrs) {
+        attr.always_active = (attr.transform_fn == _transformFineTune) || (attr.transform_fn == _currentMorphValue);
+    }
 }
 
 void Layer::_clearNotes() {
@@ -648,9 +651,21 @@ const std::vector<ParamChange> &Layer::run() {
 
         // Transform the value and save in the layer state params
     }
+    _layer_params.common_params_changed = _common_params_changed;
+    _common_params_changed = false;
+
+    // Every param has to be processed if the morph or layer state changed, or while morphing as the morph
+    // function exports its value each buffer. Otherwise only process the params which are still active
+    const bool process_all = _layer_state_change || morphing || (morphing != _morphing) || (_cur_morph_value != _run_morph_value);
+    uint num_changed = 0;
 
     // Process each Layer state parameter
     for (uint i = 0; i < NinaParams::NUM_LAYER_STATE_PARAMS; i++) {
+        auto &attr = _layer_param_attrs.state_attrs[i];
+        if (!process_all && !attr.active && !attr.always_active) {
+            continue;
+        }
+
         // If there was a layer state change reset automation setting for this parameter
         if (_layer_state_change) {
             _layer_param_attrs.state_attrs[i].automate = true;
@@ -670,17 +685,69 @@ const std::vector<ParamChange> &Layer::run() {
 
         // processing for voice morph
         {
+            const float prev_a_smooth = _state_a_smooth[i];
+            const float prev_b_smooth = _state_b_smooth[i];
+            const float prev_a_transform = _state_a_transform[i];
+            const float prev_b_transform = _state_b_transform[i];
+            const float prev_value = _layer_params.state_params[i];
+
+            if (attr.sample_accurate) {
+                // The voices follow the automation points through this buffer, so the smoothers of the automated
+                // state jump straight to the final value
+                if (!attr.automate || (_layer_state == STATE_A)) {
+                    _state_a_smooth[i] = _state_a_params[i];
+                } else {
+                    attr.smooth_fn(_state_a_params[i], _state_a_smooth[i], *this);
+                }
+                if (!attr.automate || (_layer_state == STATE_B)) {
+                    _state_b_smooth[i] = _state_b_params[i];
+                } else {
+                    attr.smooth_fn(_state_b_params[i], _state_b_smooth[i], *this);
+                }
+            } else {
+                _layer_param_attrs.state_attrs[i].smooth_fn(_state_a_params[i], _state_a_smooth[i], *this);
 
-            _layer_param_attrs.state_attrs[i].smooth_fn(_state_a_params[i], _state_a_smooth[i], *this);
-
-            _layer_param_attrs.state_attrs[i].smooth_fn(_state_b_params[i], _state_b_smooth[i], *this);
+                _layer_param_attrs.state_attrs[i].smooth_fn(_state_b_params[i], _state_b_smooth[i], *this);
+            }
 
             _state_a_transform[i] = _layer_param_attrs.state_attrs[i].transform_fn(_state_a_smooth[i], *this);
             _state_b_transform[i] = _layer_param_attrs.state_attrs[i].transform_fn(_state_b_smooth[i], *this);
 
             _layer_params.state_params[i] = _layer_param_attrs.state_attrs[i].transform_fn(value, *this);
+
+            // The voices only need to re-morph the params whose transformed A/B values have changed
+            const bool transform_changed = (_state_a_transform[i] != prev_a_transform) || (_state_b_transform[i] != prev_b_transform);
+            if (transform_changed) {
+                _layer_params.changed_state_params[num_changed++] = i;
+            }
+
+            // If the smoothers didn't move then they have converged (or can no longer move in float precision),
+            // so the next run would give exactly the same result and the param can be skipped until it changes
+            attr.active = transform_changed || (_state_a_smooth[i] != prev_a_smooth) || (_state_b_smooth[i] != prev_b_smooth) ||
+                          (_layer_params.state_params[i] != prev_value);
+        }
+    }
+    _layer_params.num_changed_state_params = num_changed;
+    _layer_params.state_params_run_count++;
+
+    // Transform the automation curves for the voices, the state that isn't automated holds its current value
+    for (uint n = 0; n < _num_automation_curves; n++) {
+        const auto &curve = _automation_curves[n];
+        const uint i = curve.index;
+        auto &attr = _layer_param_attrs.state_attrs[i];
+        auto &automated = _layer_params.automated_state_params[n];
+        const bool follow_a = !attr.automate || (_layer_state == STATE_A);
+        const bool follow_b = !attr.automate || (_layer_state == STATE_B);
+        automated.index = i;
+        for (uint k = 0; k < CV_BUFFER_SIZE; k++) {
+            const float value = attr.transform_fn(curve.values[k], *this);
+            automated.a_values[k] = follow_a ? value : _state_a_transform[i];
+            automated.b_values[k] = follow_b ? value : _state_b_transform[i];
         }
+        attr.sample_accurate = false;
     }
+    _layer_params.num_automated_state_params = _num_automation_curves;
+    _num_automation_curves = 0;
 
     // Add a param change if we are leaving morph mode
     // Note we export this param change to any notification listeners
@@ -692,6 +759,7 @@ const std::vector<ParamChange> &Layer::run() {
     _morphing = morphing;
     _layer_params.morph_pos = param_smooth(_cur_morph_value, _layer_params.morph_pos);
     _prev_morph_value = _cur_morph_value;
+    _run_morph_value = _cur_morph_value;
     _layer_state_change = false;
 
     // Set various composite parameters that depend on multiple values
@@ -806,6 +874,56 @@ void Layer::updateParams(uint num_changes, const ParamChange *changed_params) {
     }
 }
 
+void Layer::updateParamPoints(uint num_points, const ParamChangePoint *points) {
+    // The final value of each param has already been set by updateParams, here the points are turned into a curve
+    // the voices can follow through the buffer. The points for each param are contiguous and in offset order
+    uint i = 0;
+    while (i < num_points) {
+        const ParamChangePoint *param_points = &points[i];
+        uint num_param_points = 1;
+        while ((i + num_param_points < num_points) && (points[i + num_param_points].param_id == param_points->param_id)) {
+            num_param_points++;
+        }
+        i += num_param_points;
+
+        // Only smoothed layer state params are followed, the rest are stepped params and the last value is enough
+        const uint param_id = mask_param_id(param_points->param_id);
+        if (!is_layer_param(param_points->param_id, _layer_num) || (param_id < NinaParams::FIRST_LAYER_STATE_PARAM) ||
+            (param_id >= NinaParams::FIRST_LAYER_STATE_PARAM + NinaParams::NUM_LAYER_STATE_PARAMS)) {
+            continue;
+        }
+        const uint index = LAYER_STATE_PARAMID_TO_INDEX(param_id);
+        auto &attr = _layer_param_attrs.state_attrs[index];
+        if ((attr.smooth_fn != _defaultSmooth) || attr.sample_accurate || (_num_automation_curves >= MAX_AUTOMATED_STATE_PARAMS)) {
+            continue;
+        }
+
+        // Ramp linearly from the current smoothed value through each point, and hold the last point to the end
+        // of the buffer. Each CV sample takes the value at its end so the last one is the final param value
+        auto &curve = _automation_curves[_num_automation_curves++];
+        curve.index = index;
+        uint prev_offset = 0;
+        float prev_value = (_layer_state == STATE_A) ? _state_a_smooth[index] : _state_b_smooth[index];
+        uint p = 0;
+        for (uint k = 0; k < CV_BUFFER_SIZE; k++) {
+            const uint pos = (k + 1) * CV_MUX_INC;
+            while ((p < num_param_points) && (param_points[p].offset <= pos)) {
+                prev_offset = param_points[p].offset;
+                prev_value = param_points[p].value;
+                p++;
+            }
+            float value = prev_value;
+            if (p < num_param_points) {
+                const float frac = (float)(pos - prev_offset) / (float)(param_points[p].offset - prev_offset);
+                value = prev_value + (param_points[p].value - prev_value) * frac;
+            }
+            curve.values[k] = value;
+        }
+        attr.sample_accurate = true;
+        attr.active = true;
+    }
+}
+
 void Layer::polyPressureEvent(Steinberg::Vst::PolyPressureEvent poly_event) {
     if (!_midiNoteFilter(poly_event.channel, poly_event.pitch)) {
         return;
@@ -1065,6 +1183,17 @@ void Layer::setMorphMode(MorphMode mode) {
     _morph_mode = mode;
 }
 
+void Layer::getSnapshot(NinaParams::LayerSnapshot &snapshot) const {
+    // The common params are the set values, before any smoothing
+    snapshot.layer_state = (_layer_state == STATE_A) ? 0.0f : 1.0f;
+    snapshot.morph_value = _cur_morph_value;
+    for (uint i = 0; i < NinaParams::NUM_LAYER_COMMON_PARAMS; i++) {
+        snapshot.common_params[i] = _layer_param_attrs.common_attrs[i].set_value;
+    }
+    snapshot.state_a_params = _state_a_params;
+    snapshot.state_b_params = _state_b_params;
+}
+
 void Layer::_resetActiveVoices() {
     // Reset the active voices
     _active_voices.clear();
@@ -1099,12 +1228,14 @@ void Layer::_setCurrentStateParam(ParamID param_id, float value) {
 
 void inline Layer::_commonParamUpdate(ParamID param_id, float value) {
     _setCommonParam(param_id, value);
+    _common_params_changed = true;
     uint val = LAYER_COMMON_PARAMID_TO_INDEX(param_id);
     _layer_param_attrs.common_attrs[val].update_fn(value, *this);
 }
 
 void inline Layer::_stateParamUpdate(ParamID param_id, float value) {
     _setCurrentStateParam(param_id, value);
+    _layer_param_attrs.state_attrs[LAYER_STATE_PARAMID_TO_INDEX(param_id)].active = true;
     _layer_param_attrs.state_attrs[LAYER_STATE_PARAMID_TO_INDEX(param_id)].update_fn(value, *this);
     if (((_cur_morph_value > MORPH_ZERO_THRESH) && (_cur_morph_value < MORPH_ONE_THRESH)) ||
         ((_cur_morph_value <= MORPH_ZERO_THRESH) && (_layer_state == STATE_B)) ||
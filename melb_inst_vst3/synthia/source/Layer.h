@@ -66,6 +66,17 @@ class Layer {
         float prev_morphed_val = 0;
         bool automate = true;
 
+        // set while the param is changing or its smoother is still converging, cleared once run() produces
+        // the same outputs twice in a row
+        bool active = true;
+
+        // transforms that read other layer state can't be skipped when their own value settles
+        bool always_active = false;
+
+        // set when the param has automation points this buffer, the smoothers are skipped and the voices follow
+        // the points instead
+        bool sample_accurate = false;
+
         StateParamAttr() {}
 
         StateParamAttr(ParamID p, MorphFn m, UpdateFn u, SmoothFn s, TransformFn t) {
@@ -86,11 +97,18 @@ class Layer {
     ~Layer() = default;
     const std::vector<ParamChange> &run();
     void setNumVoices(uint first_voice, uint num_voices);
+
+    uint getNumVoices() {
+        return _num_voices;
+    }
+
     void updateParams(uint num_changes, const ParamChange *changed_params);
+    void updateParamPoints(uint num_points, const ParamChangePoint *points);
     void allocateVoices(const MidiNote &note);
     void freeVoices(const MidiNote &note);
     void setMorphValue(float value);
     void setMorphMode(MorphMode mode);
+    void getSnapshot(NinaParams::LayerSnapshot &snapshot) const;
 
     void setOsc3Slow(bool slow) {
         _layer_params.osc_3_slow_mode = slow;
@@ -308,6 +326,15 @@ class Layer {
     uint _mpe_last_ch = 1;
     float _cur_morph_value = 0.0f;
     float _prev_morph_value = 0.0f;
+    float _run_morph_value = 0.0f;
+
+    // raw value of each automated state param at the end of each CV sample, built from the automation points
+    struct AutomationCurve {
+        uint index;
+        std::array<float, CV_BUFFER_SIZE> values;
+    };
+    std::array<AutomationCurve, MAX_AUTOMATED_STATE_PARAMS> _automation_curves;
+    uint _num_automation_curves = 0;
     NinaParams::OutputRouting _output_routing = NinaParams::OutputRouting::St_1_2_3_4;
     MorphMode _morph_mode = MorphMode::DANCE;
     std::vector<MidiNote> _held_notes;
@@ -340,6 +367,7 @@ class Layer {
     std::array<float, CV_BUFFER_SIZE> &_cv_3 = _high_input_buffers._cv_in_3;
     std::array<float, CV_BUFFER_SIZE> &_cv_4 = _high_input_buffers._cv_in_4;
     bool _layer_state_change = false;
+    bool _common_params_changed = true;
     int _midi_note_start = 0;
     int _midi_note_end = 127;
     bool _channel_filter_en = false;
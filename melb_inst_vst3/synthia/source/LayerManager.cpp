@@ -15,7 +15,6 @@ namespace Nina {
 void LayerManager::processAudio(ProcessData &data) {
     float *cv_ch_0_outputs[NUM_VOICES];
     float *cv_ch_1_outputs[NUM_VOICES];
-    float *tuning_input = data.inputs->channelBuffers32[6];
 
     _global_tempo = (float)(data.processContext->tempo) / 60.0;
 
@@ -43,22 +42,23 @@ void LayerManager::processAudio(ProcessData &data) {
 
     if (!_run_cal) {
         bool gpio = false;
-        for (uint i = 0; i < NUM_LAYERS; i++) {
-            _layers[i].run();
-        }
-        for (uint i = 0; i < NUM_LAYERS; i++) {
-            _layers[i].runWt();
-        }
-        for (uint i = 0; i < NUM_LAYERS; ++i) {
-            _layers[i].runVoices();
+        if (_layer_scheduler.enabled()) {
+            // run the layers in parallel, this returns once all the layers are done
+            _layer_scheduler.run();
+        } else {
+            for (uint i = 0; i < NUM_LAYERS; i++) {
+                _layers[i].run();
+            }
+            for (uint i = 0; i < NUM_LAYERS; i++) {
+                _layers[i].runWt();
+            }
+            for (uint i = 0; i < NUM_LAYERS; ++i) {
+                _layers[i].runVoices();
+            }
         }
 
         // Get the output for each voice
-        for (uint i = 0; i < NUM_VOICES; i++) {
-            _analog_voices.at(i).runTuning(tuning_input[i * 4 + 1], tuning_input[i * 4 + 0], tuning_input[i * 4 + 3], tuning_input[i * 4 + 2]);
-            VoiceOutput output = {reinterpret_cast<std::array<float, BUFFER_SIZE> *>(data.outputs[0].channelBuffers32[i * 2 + 12]), reinterpret_cast<std::array<float, BUFFER_SIZE> *>(data.outputs[0].channelBuffers32[i * 2 + 13])};
-            _analog_voices[i].generateVoiceBuffers(output);
-        }
+        _runAnalogVoices(data);
         // Are there any param changes (from the current layer) to return?
         uint num_of_changes = _param_changes[_current_layer].size();
 
@@ -83,11 +83,27 @@ void LayerManager::processAudio(ProcessData &data) {
         _calibrator.run(_input_buffers.mix_left, _input_buffers.mix_right);
 
         // run the analog voices;
-        for (uint i = 0; i < NUM_VOICES; i++) {
-            _analog_voices.at(i).runTuning(tuning_input[i * 4 + 1], tuning_input[i * 4 + 0], tuning_input[i * 4 + 3], tuning_input[i * 4 + 2]);
-            VoiceOutput output = {reinterpret_cast<std::array<float, BUFFER_SIZE> *>(data.outputs[0].channelBuffers32[i * 2 + 12]), reinterpret_cast<std::array<float, BUFFER_SIZE> *>(data.outputs[0].channelBuffers32[i * 2 + 13])};
-            _analog_voices[i].generateVoiceBuffers(output);
-        }
+        _runAnalogVoices(data);
+    }
+}
+
+void LayerManager::_runAnalogVoices(ProcessData &data) {
+    float *tuning_input = data.inputs->channelBuffers32[6];
+    auto voice_output = [&data](uint voice) {
+        return VoiceOutput(reinterpret_cast<std::array<float, BUFFER_SIZE> *>(data.outputs[0].channelBuffers32[voice * 2 + 12]), reinterpret_cast<std::array<float, BUFFER_SIZE> *>(data.outputs[0].channelBuffers32[voice * 2 + 13]));
+    };
+
+    // run the osc state machines, the oscs in the normal state are generated together by the batch
+    _osc_batch.clear();
+    for (uint i = 0; i < NUM_VOICES; i++) {
+        _analog_voices.at(i).runTuning(tuning_input[i * 4 + 1], tuning_input[i * 4 + 0], tuning_input[i * 4 + 3], tuning_input[i * 4 + 2]);
+        VoiceOutput output = voice_output(i);
+        _analog_voices[i].startVoiceBuffers(output, _osc_batch);
+    }
+    _osc_batch.run();
+    for (uint i = 0; i < NUM_VOICES; i++) {
+        VoiceOutput output = voice_output(i);
+        _analog_voices[i].finishVoiceBuffers(output);
     }
 }
 
@@ -98,6 +114,9 @@ void LayerManager::updateParams(uint num_changes, const ParamChange *changed_par
 
         // calculate the actual param id, removeing the select layer bits
         const uint param_id = get_param_id(pc);
+        if (param_id < NinaParams::NUM_GLOBAL_PARAMS) {
+            _global_param_values[param_id] = pc.value;
+        }
 
         // handy param printer
         // if (param_id < NinaParams::ModMatrixEntries) {
@@ -184,12 +203,7 @@ void LayerManager::updateParams(uint num_changes, const ParamChange *changed_par
 
         case NinaParams::Layer1NumVoices: {
             // Set the layer 1 number of voices
-            uint num_voices = std::round(changed_params[i].value * (NUM_VOICES + 1));
-            if (num_voices > NUM_VOICES) {
-                num_voices = NUM_VOICES;
-            }
-
-            _layer_voices.at(_current_layer) = num_voices;
+            _layer_voices.at(_current_layer) = _layerNumVoices(changed_params[i].value);
             _reEvaluateLayerVoices();
         } break;
 
@@ -342,17 +356,92 @@ void LayerManager::updateParams(uint num_changes, const ParamChange *changed_par
     }
 }
 
+void LayerManager::updateParamPoints(uint num_points, const ParamChangePoint *points) {
+    // Only the layer state params follow the points, so pass them straight to the layers
+    for (auto &layer : _layers) {
+        layer.updateParamPoints(num_points, points);
+    }
+}
+
+void LayerManager::getSnapshot(NinaParams::PatchSnapshot &snapshot) const {
+    snapshot.global_params = _global_param_values;
+    for (uint i = 0; i < NUM_LAYERS; i++) {
+        _layers[i].getSnapshot(snapshot.layers[i]);
+    }
+}
+
+uint LayerManager::snapshotParamChanges(const NinaParams::PatchSnapshot &snapshot, ParamChange *changes) {
+    uint num_changes = 0;
+
+    // Global params, the morphing state is only exported and the morph value is set per layer
+    for (uint i = 0; i < NinaParams::NUM_GLOBAL_PARAMS; i++) {
+        if ((i != NinaParams::Morphing) && (i != NinaParams::MorphValue)) {
+            changes[num_changes++] = ParamChange(i, snapshot.global_params[i]);
+        }
+    }
+
+    for (uint layer = 0; layer < NUM_LAYERS; layer++) {
+        const auto &layer_snapshot = snapshot.layers[layer];
+
+        // Common params, skipping the state change, the one shot triggers, the calibration params and the live
+        // performance controls
+        changes[num_changes++] = make_param_layer(ParamChange(NinaParams::LayerState, 0.0f), layer);
+        for (uint i = 0; i < NinaParams::NUM_LAYER_COMMON_PARAMS; i++) {
+            const uint param_id = NinaParams::FIRST_LAYER_COMMON_PARAM + i;
+            if ((param_id >= NinaParams::AllRunTuning) && (param_id <= NinaParams::TriggerPrint)) {
+                continue;
+            }
+            switch (param_id) {
+            case NinaParams::LayerState:
+            case NinaParams::LayerLoading:
+            case NinaParams::AllNotesOff:
+            case NinaParams::MpeX:
+            case NinaParams::MpeY:
+            case NinaParams::MpeZ:
+            case NinaParams::MidiPitchBend:
+            case NinaParams::MidiModWheel:
+            case NinaParams::MidiAftertouch:
+            case NinaParams::MidiPolyAT:
+            case NinaParams::MidiExpression:
+            case NinaParams::Sustain:
+                break;
+            default:
+                changes[num_changes++] = make_param_layer(ParamChange(param_id, layer_snapshot.common_params[i]), layer);
+                break;
+            }
+        }
+
+        // The state params are set in the current state, so select each state in turn
+        for (uint i = 0; i < NinaParams::NUM_LAYER_STATE_PARAMS; i++) {
+            changes[num_changes++] = make_param_layer(ParamChange(NinaParams::FIRST_LAYER_STATE_PARAM + i, layer_snapshot.state_a_params[i]), layer);
+        }
+        changes[num_changes++] = make_param_layer(ParamChange(NinaParams::LayerState, 1.0f), layer);
+        for (uint i = 0; i < NinaParams::NUM_LAYER_STATE_PARAMS; i++) {
+            changes[num_changes++] = make_param_layer(ParamChange(NinaParams::FIRST_LAYER_STATE_PARAM + i, layer_snapshot.state_b_params[i]), layer);
+        }
+        changes[num_changes++] = make_param_layer(ParamChange(NinaParams::LayerState, layer_snapshot.layer_state), layer);
+        changes[num_changes++] = make_param_layer(ParamChange(NinaParams::MorphValue, layer_snapshot.morph_value), layer);
+    }
+    return num_changes;
+}
+
+void LayerManager::loadSnapshot(const NinaParams::PatchSnapshot &snapshot, uint num_changes, const ParamChange *changes) {
+    updateParams(num_changes, changes);
+
+    // The voice count param only applies to the current layer, so set the voices of every layer here
+    for (uint layer = 0; layer < NUM_LAYERS; layer++) {
+        _layer_voices.at(layer) = _layerNumVoices(snapshot.layers[layer].common_params[LAYER_COMMON_PARAMID_TO_INDEX(NinaParams::Layer1NumVoices)]);
+    }
+    _reEvaluateLayerVoices();
+}
+
 void LayerManager::writeTemps() {
-    std::stringstream file;
-    file << "/udata/nina/tuning/cal_info.dat";
-    std::ofstream out;
-    out.open(file.str(), std::ios::out | std::ios::trunc | std::ios::binary);
-    std::vector<float> data;
+    std::array<float, NUM_VOICES + 1> data;
     for (uint i = 0; i < NUM_VOICES; i++) {
-        data.push_back(_analog_voices.at(i).getAveOscLevel());
+        data[i] = _analog_voices.at(i).getAveOscLevel();
     }
-    data.push_back((int)(_calibrator.isTestRunning()));
-    out.write(reinterpret_cast<const char *>(data.data()), sizeof(float) * (data.size()));
+    data[NUM_VOICES] = (int)(_calibrator.isTestRunning());
+    FileWriter::getInstance().post(FileWriteType::CAL_INFO, 0, data);
 }
 
 void LayerManager::_reEvaluateLayerVoices() {
@@ -7,7 +7,11 @@
  */
 #pragma once
 #include "Layer.h"
+#include "LayerScheduler.h"
 #include "NinaCalSequencer.h"
+#include "NinaCalStore.h"
+#include "NinaFileWriter.h"
+#include "NinaOscModelFit.h"
 #include "NinaParameters.h"
 #include "common.h"
 #include "pluginterfaces/vst/ivstaudioprocessor.h"
@@ -26,6 +30,9 @@ enum class CvInputModes {
 
 constexpr uint MAX_PARAM_CHANGES = 256;
 
+// most param changes a patch snapshot expands to, every param of both states plus the state and morph changes
+constexpr uint MAX_SNAPSHOT_PARAM_CHANGES = NinaParams::NUM_GLOBAL_PARAMS + NUM_LAYERS * (NinaParams::NUM_LAYER_COMMON_PARAMS + NinaParams::NUM_LAYER_STATE_PARAMS * 2 + 4);
+
 class LayerManager {
   public:
     LayerManager() {
@@ -51,11 +58,24 @@ class LayerManager {
         for (auto &voice : _analog_voices) {
             voice.setMuteDisable(disable_mutes);
         }
+
+        // start the file writer, this also saves any calibration the voices imported from the old text files and
+        // does the calibration reloads
+        std::array<AnalogVoice *, NUM_VOICES> voices;
+        for (uint i = 0; i < voices.size(); i++) {
+            voices[i] = &_analog_voices.at(i);
+        }
+        FileWriter::getInstance().setVoices(voices);
+        FileWriter::getInstance().start();
     }
 
-    ~LayerManager() = default;
+    ~LayerManager() {
+        OscModelFitter::getInstance().stop();
+        FileWriter::getInstance().stop();
+    }
     void processAudio(ProcessData &data);
     void updateParams(uint num_changes, const ParamChange *changed_params);
+    void updateParamPoints(uint num_points, const ParamChangePoint *points);
     void allocateVoices(MidiNote note);
     void freeVoices(MidiNote note);
 
@@ -93,9 +113,88 @@ class LayerManager {
 
     void writeTemps();
 
+    /**
+     * @brief Set the number of realtime worker threads used to run the layers, 0 runs them all on the audio thread
+     *
+     * @param num_workers
+     */
+    void setLayerWorkers(uint num_workers) {
+        _layer_scheduler.start(num_workers);
+    }
+
+    /**
+     * @brief Get the patch state of the synth. Reads the live layer state, so only call it from the audio thread
+     * or while the audio is inactive
+     *
+     * @param snapshot
+     */
+    void getSnapshot(NinaParams::PatchSnapshot &snapshot) const;
+
+    /**
+     * @brief Expand a snapshot into the param changes that load it. Doesn't touch the layer manager so it can be
+     * run off the audio thread
+     *
+     * @param snapshot
+     * @param changes array of at least MAX_SNAPSHOT_PARAM_CHANGES
+     * @return uint number of changes
+     */
+    static uint snapshotParamChanges(const NinaParams::PatchSnapshot &snapshot, ParamChange *changes);
+
+    /**
+     * @brief Load a whole patch in one pass, from the changes made by snapshotParamChanges. This is about 5000
+     * param changes and takes around 100 us on a desktop, a few times that on the target, which fits in one
+     * buffer. It runs on the audio thread as the layers aren't locked, and splitting it over buffers would play
+     * a mix of the old and new patch
+     *
+     * @param snapshot
+     * @param num_changes
+     * @param changes
+     */
+    void loadSnapshot(const NinaParams::PatchSnapshot &snapshot, uint num_changes, const ParamChange *changes);
+
+    /**
+     * @brief Start refitting the osc models from the osc tuning measurements
+     *
+     */
+    void startOscRefit() {
+        std::array<AnalogOscModel *, NUM_VOICES * 2> oscs;
+        for (uint i = 0; i < oscs.size(); i++) {
+            oscs[i] = &_analog_voices.at(i / 2).osc(i % 2);
+        }
+        OscModelFitter::getInstance().start(oscs);
+    }
+
+    /**
+     * @brief Calibrate the vcas of all the voices at once rather than one voice at a time
+     *
+     * @param parallel
+     */
+    void setParallelCal(bool parallel) {
+        _calibrator.setParallelCal(parallel);
+    }
+
+    /**
+     * @brief Enable sample accurate automation. When enabled the processor passes every point of the param queues
+     * to updateParamPoints and the voices follow them at the CV sample rate, otherwise only the last point is used
+     *
+     * @param enable
+     */
+    void setSampleAccurateAutomation(bool enable) {
+        _sample_accurate_automation = enable;
+    }
+
+    bool sampleAccurateAutomation() const {
+        return _sample_accurate_automation;
+    }
+
+    /**
+     * @brief Reload the calibration of all the voices. The reload reads files and takes the cal store lock, so it is
+     * posted to the file writer and the voices apply it at the start of a later buffer
+     *
+     */
     void loadCal() {
-        for (auto &voice : _analog_voices) {
-            voice.loadCalibration();
+        if (!FileWriter::getInstance().post(FileWriteType::CAL_RELOAD, 0, true)) {
+            printf("\nfileIOerror");
         }
     }
 
@@ -111,7 +210,12 @@ class LayerManager {
     }
 
     void _reEvaluateLayerVoices();
+
+    static uint _layerNumVoices(float val) {
+        return std::min((uint)std::round(val * (NUM_VOICES + 1)), (uint)NUM_VOICES);
+    }
     void _reCalcCvs();
+    void _runAnalogVoices(ProcessData &data);
     void _setCvParams1();
     void _setCvParams2();
     void _setCvParams3();
@@ -133,6 +237,7 @@ class LayerManager {
         AnalogVoice(10),
         AnalogVoice(11)};
     uint _current_layer = 0;
+    AnalogOscBatch _osc_batch;
     NinaCalSequencer _calibrator = NinaCalSequencer(_analog_voices, _high_res_audio_outputs);
     std::array<float, CV_BUFFER_SIZE> _cv_1;
     std::array<float, CV_BUFFER_SIZE> _cv_2;
@@ -141,11 +246,16 @@ class LayerManager {
     NinaParams::AudioInputBuffers _input_buffers = NinaParams::AudioInputBuffers(_cv_1, _cv_2, _cv_3, _cv_4);
     std::array<uint, NUM_LAYERS> _layer_voices = {0};
     NinaParams::GlobalParams _global_params;
+
+    // the last value of each global param as received, for the patch snapshot
+    NinaParams::GlobalParams _global_param_values = {0};
     std::array<Layer, NUM_LAYERS> _layers = {
         Layer(0, 0, _analog_voices, _high_res_audio_outputs, _input_buffers, _param_changes[0], _global_params),
         Layer(0, 0, _analog_voices, _high_res_audio_outputs, _input_buffers, _param_changes[1], _global_params),
         Layer(0, 0, _analog_voices, _high_res_audio_outputs, _input_buffers, _param_changes[2], _global_params),
         Layer(0, 0, _analog_voices, _high_res_audio_outputs, _input_buffers, _param_changes[3], _global_params)};
+    LayerScheduler _layer_scheduler = LayerScheduler(_layers);
+    bool _sample_accurate_automation = false;
     float _cv_1_offset = 0;
     float _cv_2_offset = 0;
     float _cv_3_offset = 0;
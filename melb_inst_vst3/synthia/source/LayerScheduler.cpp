@@ -0,0 +1,116 @@
+/**
+ * @file LayerScheduler.cpp
+ * @brief Realtime worker pool that runs the layers in parallel each buffer.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+#include "LayerScheduler.h"
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+static inline void cpuRelax() {
+#ifdef __x86_64__
+    __builtin_ia32_pause();
+#else
+    asm volatile("yield");
+#endif
+}
+
+void LayerScheduler::start(uint num_workers) {
+    stop();
+
+    // no point running more workers than there are spare cores
+    uint num_cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    num_workers = std::min({num_workers, MAX_LAYER_WORKERS, num_cpus - 1});
+    _exit_workers = false;
+    for (uint i = 0; i < num_workers; i++) {
+        _workers.emplace_back(&LayerScheduler::_workerLoop, this, i);
+    }
+}
+
+void LayerScheduler::stop() {
+    if (_workers.size() > 0) {
+        // wake all the workers so they can exit
+        _exit_workers = true;
+        _generation.fetch_add(1);
+        _generation.notify_all();
+        for (auto &worker : _workers) {
+            worker.join();
+        }
+        _workers.clear();
+    }
+}
+
+void LayerScheduler::run() {
+    // run the busiest layers first so the jobs finish at roughly the same time
+    std::stable_sort(_job_order.begin(), _job_order.end(), [this](uint a, uint b) {
+        return _layers[a].getNumVoices() > _layers[b].getNumVoices();
+    });
+
+    // post the buffer to the workers
+    _jobs_done.store(0);
+    _next_job.store(0);
+    _generation.fetch_add(1);
+    _generation.notify_all();
+
+    // take jobs on the audio thread as well, then wait for the workers to finish
+    _runJobs();
+    while (_jobs_done.load(std::memory_order_acquire) < NUM_LAYERS) {
+        cpuRelax();
+    }
+}
+
+void LayerScheduler::_runJobs() {
+    uint job;
+    while ((job = _next_job.fetch_add(1)) < NUM_LAYERS) {
+        Layer &layer = _layers[_job_order[job]];
+        layer.run();
+        layer.runWt();
+        layer.runVoices();
+        _jobs_done.fetch_add(1, std::memory_order_release);
+    }
+}
+
+void LayerScheduler::_workerLoop(uint worker_num) {
+    // pin each worker to its own core, leaving core 0 for the audio thread
+    uint num_cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET((worker_num + 1) % num_cpus, &cpu_set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+        printf("\nlayer worker %d: could not set cpu affinity", worker_num);
+    }
+    sched_param param = {};
+    param.sched_priority = LAYER_WORKER_PRIORITY;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+        printf("\nlayer worker %d: could not set realtime priority", worker_num);
+    }
+
+    uint generation = _generation.load();
+    while (!_exit_workers) {
+        // spin for a short time waiting for the next buffer, then block until it is posted
+        uint spins = 0;
+        uint current;
+        while ((current = _generation.load(std::memory_order_acquire)) == generation) {
+            if (++spins < LAYER_WORKER_SPIN_COUNT) {
+                cpuRelax();
+            } else {
+                _generation.wait(generation);
+            }
+        }
+        generation = current;
+        if (_exit_workers) {
+            break;
+        }
+        _runJobs();
+    }
+}
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
@@ -0,0 +1,81 @@
+/**
+ * @file LayerScheduler.h
+ * @brief Realtime worker pool that runs the layers in parallel each buffer.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+#pragma once
+#include "Layer.h"
+#include "common.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+// max number of worker threads, the audio thread also runs layers so this leaves 1 core per layer
+constexpr uint MAX_LAYER_WORKERS = NUM_LAYERS - 1;
+
+// realtime priority of the workers, just below the audio thread
+constexpr int LAYER_WORKER_PRIORITY = 70;
+
+// number of polls a worker spins for before blocking on the next buffer
+constexpr uint LAYER_WORKER_SPIN_COUNT = 2000;
+
+/**
+ * @brief Runs Layer::run, runWt and runVoices for each layer as an independent job. Layers only share
+ * read only data during these calls, and each layer drives a separate set of analog voices, so the results
+ * are the same as running them in order. Voices within a layer are kept on the one thread, as the global
+ * lfo phase is written by the first voice and read by the others.
+ *
+ * The audio thread posts a buffer to the workers, takes jobs itself and then waits on a barrier until all
+ * the layers have been run, so the analog voices can be run as normal afterwards.
+ */
+class LayerScheduler {
+  public:
+    LayerScheduler(std::array<Layer, NUM_LAYERS> &layers) :
+        _layers(layers) {}
+
+    ~LayerScheduler() {
+        stop();
+    }
+
+    /**
+     * @brief Start the worker threads, 0 workers runs all the layers on the audio thread
+     *
+     * @param num_workers number of worker threads to start
+     */
+    void start(uint num_workers);
+
+    /**
+     * @brief Stop and join all the worker threads
+     */
+    void stop();
+
+    bool enabled() {
+        return _workers.size() > 0;
+    }
+
+    /**
+     * @brief Run all the layers for this buffer, returns when every layer has been run
+     */
+    void run();
+
+  private:
+    std::array<Layer, NUM_LAYERS> &_layers;
+    std::vector<std::thread> _workers;
+    std::array<uint, NUM_LAYERS> _job_order = {0, 1, 2, 3};
+    std::atomic<uint> _generation = 0;
+    std::atomic<uint> _next_job = NUM_LAYERS;
+    std::atomic<uint> _jobs_done = 0;
+    std::atomic<bool> _exit_workers = false;
+
+    void _runJobs();
+    void _workerLoop(uint worker_num);
+};
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
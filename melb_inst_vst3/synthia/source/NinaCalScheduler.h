@@ -0,0 +1,252 @@
+/**
+ * @file NinaCalScheduler.h
+ * @brief Search and scheduling for calibrating the VCA offsets of all the voices at once.
+ *
+ * Each voice has its own search state, and the voices take turns on the shared measurement inputs. A slot starts
+ * with a few buffers for the measurement filters to settle, then the RMS level of each input is measured and passed
+ * to the searches of the voice holding the slot. The next voice with a search still running then takes the inputs.
+ * Voices waiting for a slot already have their next probe value applied, so the VCA has settled by the time the
+ * slot comes round.
+ *
+ * The searches find the minimum of the V shaped level against offset. Each step measures a pair of points to get the
+ * sign of the slope, which brackets the minimum. The next pair is placed at the zero of the line through the pair if
+ * that lands inside the bracket, otherwise the bracket is bisected.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+
+#pragma once
+
+#include "common.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+// max number of measurement inputs used in a slot
+constexpr uint CAL_MAX_CHANNELS = 2;
+
+class CalSearch {
+  public:
+    /**
+     * @brief Start a search for the minimum level
+     *
+     * @param low low end of the offsets to search
+     * @param high high end of the offsets to search
+     * @param delta distance between the pair of points used to find the slope
+     * @param tolerance the search is done when the bracket is narrower than this
+     * @param max_steps max number of pairs to measure
+     */
+    void start(float low, float high, float delta, float tolerance, uint max_steps) {
+        _low = low;
+        _high = high;
+        _delta = delta;
+        _tolerance = tolerance;
+        _max_steps = max_steps;
+        _steps = 0;
+        _second = false;
+        _last_secant = false;
+        _done = false;
+        _point = 0.5f * (_low + _high - _delta);
+        _result = 0.5f * (_low + _high);
+    }
+
+    /**
+     * @brief The offset to apply for the next measurement
+     *
+     */
+    float probe() const {
+        if (_done) {
+            return _result;
+        }
+        return _second ? _point + _delta : _point;
+    }
+
+    /**
+     * @brief Pass in the level measured at probe()
+     *
+     */
+    void measured(float level) {
+        if (_done) {
+            return;
+        }
+        if (!_second) {
+            _level = level;
+            _second = true;
+            return;
+        }
+        _second = false;
+        _steps++;
+
+        // the minimum is below the upper point of the pair if the level is rising, and above the lower point if
+        // it is falling
+        const float width = _high - _low;
+        const float slope = (level - _level) / _delta;
+        if (slope > 0.f) {
+            _high = std::min(_high, _point + _delta);
+        } else if (slope < 0.f) {
+            _low = std::max(_low, _point);
+        } else {
+            _low = _point;
+            _high = _point + _delta;
+        }
+        if ((_high - _low) < _tolerance || _steps >= _max_steps) {
+            _done = true;
+            _result = 0.5f * (_low + _high);
+            return;
+        }
+
+        // the level is close to linear either side of the minimum, so the zero of the line through the pair is
+        // near the minimum. if the last secant step did not halve the bracket then bisect so it always converges
+        bool secant = false;
+        float next = 0.f;
+        if ((slope != 0.f) && !(_last_secant && (_high - _low) > 0.5f * width)) {
+            next = _point - _level / slope - 0.5f * _delta;
+            secant = (next > _low) && (next + _delta < _high);
+        }
+        _point = secant ? next : 0.5f * (_low + _high - _delta);
+        _last_secant = secant;
+    }
+
+    bool done() const {
+        return _done;
+    }
+
+    float result() const {
+        return _result;
+    }
+
+  private:
+    float _low = 0.f;
+    float _high = 0.f;
+    float _delta = 0.f;
+    float _tolerance = 0.f;
+    float _point = 0.f;
+    float _level = 0.f;
+    float _result = 0.f;
+    uint _steps = 0;
+    uint _max_steps = 0;
+    bool _second = false;
+    bool _last_secant = false;
+    bool _done = true;
+};
+
+class CalScheduler {
+  public:
+    /**
+     * @brief Start a new schedule. The searches for each voice must be started after this
+     *
+     * @param num_channels number of measurement inputs
+     * @param settle_buffers buffers at the start of a slot before measuring
+     * @param measure_buffers buffers to measure the level over
+     */
+    void start(uint num_channels, uint settle_buffers, uint measure_buffers) {
+        _num_channels = num_channels;
+        _settle_buffers = settle_buffers;
+        _measure_buffers = measure_buffers;
+        _slot_buffer = 0;
+        _voice = NUM_VOICES - 1;
+        _square_sums.fill(0.f);
+        for (auto &voice_searches : _searches) {
+            for (auto &search : voice_searches) {
+                search = CalSearch();
+            }
+        }
+    }
+
+    CalSearch &search(uint voice, uint channel) {
+        return _searches[voice][channel];
+    }
+
+    /**
+     * @brief Call at the start of each buffer, this gives the inputs to the next voice at the start of a slot
+     *
+     * @return false if all the searches are done
+     */
+    bool startBuffer() {
+        if (_slot_buffer == 0) {
+            for (uint i = 1; i <= NUM_VOICES; i++) {
+                const uint voice = (_voice + i) % NUM_VOICES;
+                if (_voiceRunning(voice)) {
+                    _voice = voice;
+                    return true;
+                }
+            }
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Voice holding the measurement inputs
+     *
+     */
+    uint voice() const {
+        return _voice;
+    }
+
+    /**
+     * @brief Check if this is the first buffer of a slot, the measurement filters should be reset
+     *
+     */
+    bool slotStart() const {
+        return _slot_buffer == 0;
+    }
+
+    bool measuring() const {
+        return _slot_buffer >= _settle_buffers;
+    }
+
+    /**
+     * @brief Add the sum of the squared samples of a measurement input for this buffer
+     *
+     */
+    void addLevel(uint channel, float square_sum) {
+        if (measuring()) {
+            _square_sums[channel] += square_sum;
+        }
+    }
+
+    /**
+     * @brief Call at the end of each buffer
+     *
+     * @return true if the slot has ended and the measured levels have been passed to the searches of the voice
+     */
+    bool endBuffer() {
+        _slot_buffer++;
+        if (_slot_buffer < _settle_buffers + _measure_buffers) {
+            return false;
+        }
+        for (uint channel = 0; channel < _num_channels; channel++) {
+            _searches[_voice][channel].measured(std::sqrt(_square_sums[channel] / (float)(_measure_buffers * BUFFER_SIZE)));
+        }
+        _square_sums.fill(0.f);
+        _slot_buffer = 0;
+        return true;
+    }
+
+  private:
+    bool _voiceRunning(uint voice) const {
+        for (uint channel = 0; channel < _num_channels; channel++) {
+            if (!_searches[voice][channel].done()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::array<std::array<CalSearch, CAL_MAX_CHANNELS>, NUM_VOICES> _searches;
+    std::array<float, CAL_MAX_CHANNELS> _square_sums;
+    uint _num_channels = 1;
+    uint _settle_buffers = 0;
+    uint _measure_buffers = 1;
+    uint _slot_buffer = 0;
+    uint _voice = 0;
+};
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
@@ -398,6 +398,145 @@ void NinaCalSequencer::runMainVca(std::array<float, BUFFER_SIZE> *left, std::arr
     buffer_count++;
 }
 
+void NinaCalSequencer::_startMixSearch(uint voice) {
+    const uint vca = _mix_step.at(voice) % num_mix_vcas;
+    float low = -vca_search_range;
+    float high = vca_search_range;
+
+    // later passes search around the value found by the last pass
+    if (_mix_step.at(voice) >= num_mix_vcas) {
+        const float centre = _mix_offsets.at(voice).at(vca);
+        low = centre - mix_vca_refine_range;
+        high = centre + mix_vca_refine_range;
+    }
+    _scheduler.search(voice, 0).start(low, high, vca_search_delta, vca_search_tolerance, vca_search_max_steps);
+}
+
+void NinaCalSequencer::runMixVcaParallel(std::array<float, BUFFER_SIZE> *left, std::array<float, BUFFER_SIZE> *right) {
+    for (auto output : _high_res_audio_outputs) {
+        output->fill(0);
+    }
+
+    // let the oscs settle before measuring
+    if (_parallel_startup < mix_vca_startup_buffers) {
+        _parallel_startup++;
+        for (auto &controller : _controller) {
+            controller.setOff();
+            controller.run();
+        }
+        return;
+    }
+
+    if (!_scheduler.startBuffer()) {
+        if (!_test_complete) {
+            _test_complete = true;
+            printf("\n save all cal");
+            for (uint i = 0; i < NUM_VOICES; i++) {
+                const auto &offsets = _mix_offsets.at(i);
+                _analog_voices.at(i).setMixVcaOffset(offsets[MixCalTri0], offsets[MixCalTri1], offsets[MixCalSqr0], offsets[MixCalSqr1], offsets[MixCalXor]);
+                printf("\n voice %d vals %f %f %f %f %f", i, offsets[MixCalTri0], offsets[MixCalTri1], offsets[MixCalSqr0], offsets[MixCalSqr1], offsets[MixCalXor]);
+                _analog_voices.at(i).saveCalibration();
+            }
+        }
+        return;
+    }
+    const uint slot_voice = _scheduler.voice();
+    if (_scheduler.slotStart()) {
+        _highpass_mix.reset();
+    }
+
+    // every voice holds the levels it will be measured at, but only the voice with the slot is heard
+    for (uint i = 0; i < NUM_VOICES; i++) {
+        const uint vca = _mix_step.at(i) % num_mix_vcas;
+        std::array<float, num_mix_vcas> levels = _mix_offsets.at(i);
+        levels[vca] = _scheduler.search(i, 0).probe();
+        auto &controller = _controller.at(i);
+        controller.setMixVca(levels[MixCalTri0], levels[MixCalTri1], levels[MixCalSqr0], levels[MixCalSqr1], levels[MixCalXor], mix_vca_shape_1[vca], mix_vca_shape_2[vca]);
+        controller.setMuted(i != slot_voice);
+        controller.run();
+    }
+
+    float square_sum = 0;
+    for (int i = 0; i < BUFFER_SIZE; i++) {
+        const float lin = left->at(i);
+        const float l = lin - _highpass_mix.process(lin);
+        square_sum += l * l;
+    }
+    _scheduler.addLevel(0, square_sum);
+
+    // when the search for a vca is done move on to the next vca
+    if (_scheduler.endBuffer()) {
+        auto &search = _scheduler.search(slot_voice, 0);
+        if (search.done()) {
+            auto &step = _mix_step.at(slot_voice);
+            _mix_offsets.at(slot_voice).at(step % num_mix_vcas) = search.result();
+            printf("\n voice %d mix vca %d val %f", slot_voice, step % num_mix_vcas, search.result());
+            step++;
+            if (step < num_mix_vcas * num_mix_passes) {
+                _startMixSearch(slot_voice);
+            }
+        }
+    }
+}
+
+void NinaCalSequencer::runMainVcaParallel(std::array<float, BUFFER_SIZE> *left, std::array<float, BUFFER_SIZE> *right) {
+    if (!_scheduler.startBuffer()) {
+        if (!_test_complete) {
+            _test_complete = true;
+            printf("\n save all cal");
+            for (uint i = 0; i < NUM_VOICES; i++) {
+                const float offset_l = _scheduler.search(i, 0).result();
+                const float offset_r = _scheduler.search(i, 1).result();
+                _analog_voices.at(i).setMainLVcaOffset(offset_l);
+                _analog_voices.at(i).setMainRVcaOffset(offset_r);
+                printf("\n voice %d vals %f %f", i, offset_l, offset_r);
+                _analog_voices.at(i).saveCalibration();
+            }
+        }
+        return;
+    }
+    const uint slot_voice = _scheduler.voice();
+    if (_scheduler.slotStart()) {
+        _lowpass_l.reset();
+        _highpass_l.reset();
+        _lowpass_r.reset();
+        _highpass_r.reset();
+    }
+
+    // the test tone only goes to the voice with the slot, the other voices hold their next levels
+    for (uint i = 0; i < NUM_VOICES; i++) {
+        if (i != slot_voice) {
+            _high_res_audio_outputs.at(i)->fill(0);
+        }
+        auto &controller = _controller.at(i);
+        controller.setMainOutVca(_scheduler.search(i, 0).probe(), _scheduler.search(i, 1).probe());
+        controller.setMuted(i != slot_voice);
+        controller.run();
+    }
+
+    float square_sum_l = 0;
+    float square_sum_r = 0;
+    for (int i = 0; i < BUFFER_SIZE; i++) {
+        output_sine_phase += 2 * M_PI * 2000. / 96000.;
+        if (output_sine_phase > 2 * M_PI) {
+            output_sine_phase -= 2 * M_PI;
+        }
+        _high_res_audio_outputs.at(slot_voice)->at(i) = 0.1 * std::sin(output_sine_phase);
+
+        float lin = left->at(i);
+        float rin = right->at(i);
+        float rin_lp = _lowpass_r.process(rin);
+        rin = rin_lp - _highpass_r.process(rin);
+        float lin_lp = _lowpass_l.process(lin);
+        lin = lin_lp - _highpass_l.process(lin);
+        square_sum_l += lin * lin;
+        square_sum_r += rin * rin;
+    }
+    _scheduler.addLevel(0, square_sum_l);
+    _scheduler.addLevel(1, square_sum_r);
+    _scheduler.endBuffer();
+}
+
 } // namespace Nina
 } // namespace Vst
 } // namespace Steinberg
@@ -9,6 +9,7 @@
 #pragma once
 
 #include "AnalogVoice.h"
+#include "NinaCalScheduler.h"
 #include "NinaParameters.h"
 #include "NoiseOscillator.h"
 #include "SynthMath.h"
@@ -201,6 +202,15 @@ class VoiceCalController {
         _voice.setOutMuteR(false);
     };
 
+    /**
+     * @brief Mute the voice output, so the voice can hold its cal settings without being heard on the measurement
+     * inputs
+     *
+     */
+    void setMuted(bool mute) {
+        _mute = mute;
+    }
+
     void setOff() {
         _filter = 1;
         _res = 1;
@@ -363,6 +373,43 @@ class NinaCalSequencer {
 
     void runFilter(std::array<float, BUFFER_SIZE> *left, std::array<float, BUFFER_SIZE> *right);
 
+    void runMixVcaParallel(std::array<float, BUFFER_SIZE> *left, std::array<float, BUFFER_SIZE> *right);
+
+    void runMainVcaParallel(std::array<float, BUFFER_SIZE> *left, std::array<float, BUFFER_SIZE> *right);
+
+    void _startMixSearch(uint voice);
+
+    // settings for the parallel vca cals
+    static constexpr uint cal_settle_buffers = 20;
+    static constexpr uint main_vca_measure_buffers = 400;
+    static constexpr uint mix_vca_measure_buffers = 150;
+    static constexpr uint mix_vca_startup_buffers = 10 * 700;
+    static constexpr float vca_search_range = 0.01f;
+    static constexpr float vca_search_delta = 0.00005f;
+    static constexpr float vca_search_tolerance = 0.0001f;
+    static constexpr uint vca_search_max_steps = 16;
+
+    // the mix vcas are searched in this order with the osc shapes that isolate each vca, and then searched again
+    // over a narrower range
+    static constexpr uint num_mix_vcas = 5;
+    static constexpr uint num_mix_passes = 2;
+    static constexpr float mix_vca_refine_range = 0.002f;
+    enum MixVcaCal {
+        MixCalXor = 0,
+        MixCalTri1,
+        MixCalSqr0,
+        MixCalSqr1,
+        MixCalTri0
+    };
+    static constexpr std::array<float, num_mix_vcas> mix_vca_shape_1 = {0.f, 0.f, -0.2f, 1.f, 1.f};
+    static constexpr std::array<float, num_mix_vcas> mix_vca_shape_2 = {0.f, 1.f, 1.f, 0.2f, 0.f};
+
+    CalScheduler _scheduler;
+    bool _parallel_cal = false;
+    uint _parallel_startup = 0;
+    std::array<uint, NUM_VOICES> _mix_step;
+    std::array<std::array<float, num_mix_vcas>, NUM_VOICES> _mix_offsets;
+
   public:
     NinaCalSequencer(std::array<AnalogVoice, NUM_VOICES> &analog_voices, std::array<std::array<float, BUFFER_SIZE> *, NUM_VOICES> &high_res_audio_outputs) :
         _high_res_audio_outputs(high_res_audio_outputs),
@@ -390,6 +437,22 @@ class NinaCalSequencer {
      * @param run
      */
     void startMixCal(bool run) {
+        if (run && _parallel_cal) {
+            printf("\n setup parallel mix cal");
+            _test_complete = false;
+            _testing = MixVcaParallel;
+            _parallel_startup = 0;
+            _scheduler.start(1, cal_settle_buffers, mix_vca_measure_buffers);
+            for (uint i = 0; i < NUM_VOICES; i++) {
+                _analog_voices.at(i).setMixVcaOffset(0, 0, 0, 0, 0);
+                _analog_voices.at(i).setAllocatedToVoice(true);
+                _analog_voices.at(i).setOscTuningGain(0.3);
+                _mix_offsets.at(i).fill(0.f);
+                _mix_step.at(i) = 0;
+                _startMixSearch(i);
+            }
+            return;
+        }
         if (run) {
             printf("\n setup mix cal");
             _voice_counter = 0;
@@ -430,6 +493,22 @@ class NinaCalSequencer {
      * @param run
      */
     void startMainVcaCal(bool run) {
+        if (run && _parallel_cal) {
+            printf("\n setup parallel main vca cal");
+            _test_complete = false;
+            _testing = MainVcaParallel;
+            _scheduler.start(2, cal_settle_buffers, main_vca_measure_buffers);
+            for (uint i = 0; i < NUM_VOICES; i++) {
+                _analog_voices.at(i).setMainLVcaOffset(0);
+                _analog_voices.at(i).setMainRVcaOffset(0);
+                _analog_voices.at(i).setAllocatedToVoice(true);
+                for (uint channel = 0; channel < 2; channel++) {
+                    _scheduler.search(i, channel).start(-vca_search_range, vca_search_range, vca_search_delta, vca_search_tolerance, vca_search_max_steps);
+                }
+            }
+            output_sine_phase = 0;
+            return;
+        }
         if (run) {
             printf("\n setup main vca cal");
             _testing = MainVca;
@@ -482,6 +561,16 @@ class NinaCalSequencer {
 
     void runCal(uint voice_num);
 
+    /**
+     * @brief Calibrate the mix and main vcas of all the voices at once with the cal scheduler, instead of stepping
+     * through the voices one at a time
+     *
+     * @param parallel
+     */
+    void setParallelCal(bool parallel) {
+        _parallel_cal = parallel;
+    }
+
     float stim = 0.95;
     bool _first_pass_l = false;
     bool _first_pass_r = false;
@@ -500,7 +589,9 @@ class NinaCalSequencer {
         NoTest = 0,
         MixVca,
         MainVca,
-        Filter
+        Filter,
+        MixVcaParallel,
+        MainVcaParallel
     };
 
     testRunning _testing = NoTest;
@@ -552,6 +643,14 @@ class NinaCalSequencer {
             runFilter(left, right);
             break;
 
+        case MixVcaParallel:
+            runMixVcaParallel(left, right);
+            break;
+
+        case MainVcaParallel:
+            runMainVcaParallel(left, right);
+            break;
+
         default:
             break;
         }
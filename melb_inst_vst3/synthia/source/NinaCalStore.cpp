@@ -0,0 +1,153 @@
+/**
+ * @file NinaCalStore.cpp
+ * @brief Binary store for the calibration of all the analog voices.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+
+#include "NinaCalStore.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+static constexpr std::array<uint32_t, 256> _crcTable() {
+    std::array<uint32_t, 256> table = {};
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (0xedb88320 ^ (crc >> 1)) : (crc >> 1);
+        }
+        table[i] = crc;
+    }
+    return table;
+}
+
+static constexpr std::array<uint32_t, 256> CRC_TABLE = _crcTable();
+
+uint32_t calStoreCrc32(const uint8_t *data, size_t size) {
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < size; i++) {
+        crc = CRC_TABLE[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
+}
+
+CalStore &CalStore::getInstance() {
+    static CalStore store(CAL_STORE_PATH);
+    return store;
+}
+
+void CalStore::clear() {
+    std::lock_guard<std::mutex> lock(_lock);
+    for (auto &record : _voices) {
+        std::memset(&record, 0, sizeof(record));
+    }
+    _dirty = false;
+}
+
+bool CalStore::load(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if ((::fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(CalStoreHeader))) {
+        ::close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    // Check the store matches this build and the records are intact
+    auto header = static_cast<const CalStoreHeader *>(map);
+    auto records = static_cast<const uint8_t *>(map) + sizeof(CalStoreHeader);
+    constexpr size_t records_size = sizeof(CalStoreVoice) * NUM_VOICES;
+    bool valid = (header->magic == CAL_STORE_MAGIC) && (header->version == CAL_STORE_VERSION) &&
+                 (header->num_voices == NUM_VOICES) && (header->record_size == sizeof(CalStoreVoice)) &&
+                 (size == sizeof(CalStoreHeader) + records_size) && (header->checksum == calStoreCrc32(records, records_size));
+    if (valid) {
+        std::lock_guard<std::mutex> lock(_lock);
+        std::memcpy(_voices.data(), records, records_size);
+        _dirty = false;
+    } else {
+        printf("\ncal store invalid %s", path.c_str());
+    }
+    ::munmap(map, size);
+    return valid;
+}
+
+bool CalStore::save(const std::string &path) {
+    CalStoreHeader header;
+    header.magic = CAL_STORE_MAGIC;
+    header.version = CAL_STORE_VERSION;
+    header.num_voices = NUM_VOICES;
+    header.record_size = sizeof(CalStoreVoice);
+    std::vector<uint8_t> data(sizeof(CalStoreHeader) + sizeof(CalStoreVoice) * NUM_VOICES);
+    {
+        // Take a copy of the records so the lock isn't held while writing
+        std::lock_guard<std::mutex> lock(_lock);
+        header.checksum = calStoreCrc32(reinterpret_cast<const uint8_t *>(_voices.data()), sizeof(CalStoreVoice) * NUM_VOICES);
+        std::memcpy(data.data() + sizeof(header), _voices.data(), sizeof(CalStoreVoice) * NUM_VOICES);
+        _dirty = false;
+    }
+    std::memcpy(data.data(), &header, sizeof(header));
+
+    // Write to a temporary file and make sure it is on the card before it replaces the old store
+    const auto tmp_path = path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0) {
+        _dirty = true;
+        return false;
+    }
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t res = ::write(fd, data.data() + written, data.size() - written);
+        if (res <= 0) {
+            break;
+        }
+        written += res;
+    }
+    const bool synced = (written == data.size()) && (::fsync(fd) == 0);
+    ::close(fd);
+    if (!synced || (::rename(tmp_path.c_str(), path.c_str()) != 0)) {
+        ::unlink(tmp_path.c_str());
+        _dirty = true;
+        return false;
+    }
+    return true;
+}
+
+void CalStore::setVoiceCal(uint voice_num, const CalStoreVoice &record) {
+    std::lock_guard<std::mutex> lock(_lock);
+    auto &voice = _voices.at(voice_num);
+    voice.mix_vca = record.mix_vca;
+    voice.main_vca = record.main_vca;
+    voice.filter = record.filter;
+    voice.blacklisted = record.blacklisted;
+    voice.valid |= CAL_STORE_VOICE_VALID;
+    _dirty = true;
+}
+
+void CalStore::setOscModel(uint voice_num, uint osc_num, const CalStoreOscModel &model) {
+    std::lock_guard<std::mutex> lock(_lock);
+    auto &voice = _voices.at(voice_num);
+    voice.osc.at(osc_num) = model;
+    voice.valid |= CAL_STORE_OSC_VALID << osc_num;
+    _dirty = true;
+}
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
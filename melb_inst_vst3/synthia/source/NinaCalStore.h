@@ -0,0 +1,171 @@
+/**
+ * @file NinaCalStore.h
+ * @brief Binary store for the calibration of all the analog voices.
+ *
+ * The calibration of every voice is kept in a single versioned file with a checksum, which is mapped and read in
+ * one go at startup instead of parsing a text file per voice and oscillator. The file is written to a temporary
+ * file and renamed, so a power cut during a write leaves the last complete store in place.
+ *
+ * The tuning tools still write the osc and filter model text files, these are imported into the store when it
+ * has no model for a voice, or when the calibration is reloaded.
+ *
+ * The records are guarded by a lock, which is never taken on the audio thread. Calibration from the audio thread
+ * is posted to the file writer, which merges it into the store and saves it, and a calibration reload is done on
+ * the file writer thread, which hands the records to the voices.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+
+#pragma once
+
+#include "common.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+constexpr char CAL_STORE_PATH[] = "/udata/nina/calibration/nina_cal.db";
+constexpr uint32_t CAL_STORE_MAGIC = 0x4c41434e; // "NCAL"
+constexpr uint32_t CAL_STORE_VERSION = 1;
+constexpr uint CAL_STORE_NUM_OSCS = 2;
+constexpr uint CAL_STORE_MODEL_SIZE = 10;
+constexpr uint CAL_STORE_FILTER_SIZE = 12;
+
+/**
+ * @brief Flags for the parts of a voice record that hold calibration
+ *
+ */
+enum CalStoreValid : uint32_t {
+    // vca offsets, filter cal values and the blacklist flag, which are written by the voice
+    CAL_STORE_VOICE_VALID = 1 << 0,
+
+    // filter model written by the filter tuning tool
+    CAL_STORE_FILTER_MODEL_VALID = 1 << 1,
+
+    // osc models written by the osc tuning tool, one flag for each osc
+    CAL_STORE_OSC_VALID = 1 << 2
+};
+
+struct CalStoreOscModel {
+    std::array<float, CAL_STORE_MODEL_SIZE> up;
+    std::array<float, CAL_STORE_MODEL_SIZE> down;
+};
+
+/**
+ * @brief Calibration record for a voice. The mix vcas are in the same order as the voice cal text file, tri 0,
+ * sqr 0, tri 1, sqr 1, xor. The filter values are in the order of FilterCalValues
+ *
+ */
+struct CalStoreVoice {
+    uint32_t valid;
+    uint32_t blacklisted;
+    std::array<float, 5> mix_vca;
+    std::array<float, 2> main_vca;
+    std::array<float, CAL_STORE_FILTER_SIZE> filter;
+    std::array<CalStoreOscModel, CAL_STORE_NUM_OSCS> osc;
+};
+
+struct CalStoreHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_voices;
+    uint32_t record_size;
+    uint32_t checksum;
+};
+
+/**
+ * @brief CRC-32 of a block of bytes, used to check the store
+ *
+ */
+uint32_t calStoreCrc32(const uint8_t *data, size_t size);
+
+class CalStore {
+  public:
+    CalStore() {
+        clear();
+    }
+
+    CalStore(const std::string &path) {
+        clear();
+        load(path);
+    }
+
+    ~CalStore() = default;
+
+    /**
+     * @brief Store shared by the analog voices, this is loaded from CAL_STORE_PATH on first use
+     *
+     */
+    static CalStore &getInstance();
+
+    void clear();
+
+    /**
+     * @brief Load the store from a file, the file is checked and the records are only replaced if it is valid
+     *
+     * @return true if the store was loaded
+     */
+    bool load(const std::string &path);
+
+    /**
+     * @brief Write the store to a file. It is written to a temporary file first and then renamed over the old
+     * file
+     *
+     * @return true if the store was written
+     */
+    bool save(const std::string &path);
+
+    bool save() {
+        return save(CAL_STORE_PATH);
+    }
+
+    CalStoreVoice voice(uint voice_num) {
+        std::lock_guard<std::mutex> lock(_lock);
+        return _voices.at(voice_num);
+    }
+
+    /**
+     * @brief Update the record for a voice, the store is marked dirty until it is saved
+     *
+     */
+    void setVoice(uint voice_num, const CalStoreVoice &record) {
+        std::lock_guard<std::mutex> lock(_lock);
+        _voices.at(voice_num) = record;
+        _dirty = true;
+    }
+
+    /**
+     * @brief Update the part of the record for a voice that is set by the voice, the vca offsets, the filter cal
+     * values and the blacklist flag. The models written by the tuning tools are kept
+     *
+     */
+    void setVoiceCal(uint voice_num, const CalStoreVoice &record);
+
+    /**
+     * @brief Update the model of an osc, used by the osc refit
+     *
+     */
+    void setOscModel(uint voice_num, uint osc_num, const CalStoreOscModel &model);
+
+    /**
+     * @brief Check if there are records that have not been saved
+     *
+     */
+    bool dirty() const {
+        return _dirty;
+    }
+
+  private:
+    std::mutex _lock;
+    std::array<CalStoreVoice, NUM_VOICES> _voices;
+    std::atomic<bool> _dirty = false;
+};
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
@@ -18,6 +18,7 @@
  *
  */
 #pragma once
+#include "NinaDelayStorage.h"
 #include "NinaParameters.h"
 #include "SynthMath.h"
 #include "common.h"
@@ -26,7 +27,15 @@ namespace Steinberg {
 namespace Vst {
 namespace Nina {
 
+// full scale of the delay time param, the longest delay is 80% of this
 static constexpr int DELAY_SIZE = (int)(2.0 * SAMPLE_RATE);
+static constexpr float DELAY_MAX_TIME = 0.8f * (float)DELAY_SIZE;
+static constexpr float DELAY_MAX_LFO_AMOUNT = 6.f;
+static constexpr float DELAY_MAX_LFO_DEPTH = 100.f * DELAY_MAX_LFO_AMOUNT * 0.4f;
+
+// the line holds the longest lfo modulated read, the sample after it for the interpolation and the sample being
+// written
+static constexpr uint DELAY_STORAGE_SIZE = (uint)(DELAY_MAX_TIME + DELAY_MAX_LFO_DEPTH) + 3;
 static constexpr int TEMPO_SYNC_STEPS = NinaParams::TempoSyncMultipliers::num_sync_tempos;
 
 class BBDDelay {
@@ -75,17 +84,31 @@ class BBDDelay {
      *
      */
     void reset() {
-        _delay_buffer.fill(0);
+        _storage.clear();
+    }
+
+    /**
+     * @brief Store the delay line as 16 bit ints rather than floats. This reallocates and clears the line so must
+     * not be called from the audio thread
+     *
+     * @param packed true to use the packed storage
+     */
+    void setPackedStorage(bool packed) {
+        _storage.setPacked(packed);
+    }
+
+    bool packedStorage() const {
+        return _storage.packed();
     }
 
     void setLFO(float rate, float amount) {
         _lfo_rate = rate;
-        _lfo_amount_set = amount;
+        _lfo_amount_set = std::clamp(amount, 0.f, DELAY_MAX_LFO_AMOUNT);
         _lfo_phase_inc = 628.31853f * (float)fastpow2(3.4 * ((float)(3.0f * _lfo_rate - 2.0f))) / (float)SAMPLE_RATE;
     }
 
     void setLFOGain(float gain) {
-        _lfo_amount_set = gain;
+        _lfo_amount_set = std::clamp(gain, 0.f, DELAY_MAX_LFO_AMOUNT);
     }
 
     void setLevel(float level) {
@@ -99,22 +122,164 @@ class BBDDelay {
     int buf_counter = 0;
 
     void run(float *(input), float *output) {
+        _startBlock();
+        _runSamples(input, output);
+    }
+
+    /**
+     * @brief Start a buffer that is run in segments with runSegment, so the params can be changed part way through
+     * the buffer. The lfo is still updated once per buffer
+     *
+     */
+    void startSegments() {
+        _startBlock();
+    }
+
+    /**
+     * @brief Run part of a buffer started with startSegments, the segments must be run in order and cover the
+     * whole buffer
+     *
+     * @param input input buffer
+     * @param output output buffer, the delay output is summed into this
+     * @param start first sample of the segment
+     * @param end sample after the end of the segment
+     */
+    void runSegment(float *(input), float *output, uint start, uint end) {
+        if (start > 0) {
+            // pick up a time change from this sample, the rest of the buffer glides towards the new time
+            const float time = _time;
+            calc_time();
+            if (_time != time) {
+                _updateLoop(start);
+            }
+        }
+        _block_wet = _wet_mix;
+        _runSamples(input, output, start, end);
+    }
+
+    /**
+     * @brief Run a left and right delay together a buffer at a time. The read positions and interpolated reads for
+     * the whole buffer are done first, which is possible when the delay is longer than the buffer, then the
+     * feedback filters are run with the channels interleaved and the saturation is run over both channels in one
+     * loop. Falls back to the sample by sample path for shorter delays
+     *
+     * @param left the left delay
+     * @param right the right delay
+     * @param input_l left input
+     * @param input_r right input
+     * @param output_l left output, the delay output is summed into this
+     * @param output_r right output, the delay output is summed into this
+     */
+    static void runStereo(BBDDelay &left, BBDDelay &right, float *input_l, float *input_r, float *output_l, float *output_r) {
+        left._startBlock();
+        right._startBlock();
+        if (!left._blockReadsAhead() || !right._blockReadsAhead()) {
+            left._runSamples(input_l, output_l);
+            right._runSamples(input_r, output_r);
+            return;
+        }
+        left._readBlock();
+        right._readBlock();
+
+        // dc blocking and tone filters, the two recursions are interleaved so they overlap
+        alignas(16) float loop_in[2 * BUFFER_SIZE];
+        float highpass_l = left._highpass_state;
+        float highpass_r = right._highpass_state;
+        float filt_l = left._filt_Y1;
+        float filt_r = right._filt_Y1;
+        for (int buf_i = 0; buf_i < BUFFER_SIZE; buf_i++) {
+            float tmp_l = input_l[buf_i] * left._gain_smooth + left._feedback * left._block_out[buf_i];
+            float tmp_r = input_r[buf_i] * right._gain_smooth + right._feedback * right._block_out[buf_i];
+            tmp_l = tmp_l - highpass_l;
+            tmp_r = tmp_r - highpass_r;
+            highpass_l += highpass_gain * tmp_l;
+            highpass_r += highpass_gain * tmp_r;
+            filt_l = left._filt_a0 * tmp_l + left._filt_b1 * filt_l;
+            filt_r = right._filt_a0 * tmp_r + right._filt_b1 * filt_r;
+            loop_in[buf_i] = filt_l;
+            loop_in[BUFFER_SIZE + buf_i] = filt_r;
+        }
+        left._highpass_state = highpass_l;
+        right._highpass_state = highpass_r;
+        left._filt_Y1 = filt_l;
+        right._filt_Y1 = filt_r;
+
+        // in loop saturation, there is no dependency between the samples so both channels are done in one loop
+        for (int i = 0; i < 2 * BUFFER_SIZE; i++) {
+            loop_in[i] = _saturate(loop_in[i]);
+        }
+        left._writeBlock(loop_in, output_l);
+        right._writeBlock(loop_in + BUFFER_SIZE, output_r);
+    }
+
+    void calc_time() {
+        float time = _delay_time_setting;
+
+        if (_tempo_sync) {
+            time = _delay_time_setting_sync;
+            int time_multiplier_set = std::round((TEMPO_SYNC_STEPS) * (1 - time)) - 1;
+            float time_multiplier = _tempo_settings.getTempoSyncMultiplier(time_multiplier_set);
+            float time = 1.f / (_tempo * time_multiplier);
+            float time_samples = time * SAMPLE_RATE;
+            time_samples = time_samples > DELAY_MAX_TIME ? DELAY_MAX_TIME : time_samples;
+            time_samples = time_samples < 1 ? 1 : time_samples;
+            _time = time_samples;
+        } else {
+
+            _time_setting = time;
+            constexpr float time_offset = 0.18;
+            constexpr float time_gain = 1;
+            time = time_offset + (time_gain - time_offset) * time;
+            _time = time * time * DELAY_MAX_TIME;
+        }
+    }
+
+  private:
+    void _startBlock() {
         calc_time();
         buf_counter++;
-        _lfo_amount = 100 * _lfo_amount_set * (0.2 + 0.2 * _time_setting);
         // update the delay line
-        float loop_buffer = _loop_buffer;
-        _loop_buffer += 0.01 * (_time - _loop_buffer - 0 * _lfo_amount - _lfo_amount * (float)std::sin(_lfo_phase));
-        // find the size of the linear step for the loop increment
-        float delay_loop_inc = (1.0 / (float)BUFFER_SIZE) * (_loop_buffer - loop_buffer);
+        _block_loop = _loop_buffer;
+        _segment_loop = _block_loop;
+        _block_lfo = std::sin(_lfo_phase);
+        _updateLoop(0);
         _gain_smooth = param_smooth(_gain, _gain_smooth);
-        float wet = _wet_mix;
+        _block_wet = _wet_mix;
 
         _lfo_phase += _lfo_phase_inc;
         if (_lfo_phase > 2 * M_PI) {
             _lfo_phase -= 2 * M_PI;
         }
-        for (int buf_i = 0; buf_i < BUFFER_SIZE; buf_i++) {
+    }
+
+    /**
+     * @brief Set the end of buffer loop position and the linear step to it from the start sample, the loop moves
+     * towards the delay time by the part of the buffer left to run
+     *
+     * @param start first sample the step is used from
+     */
+    void _updateLoop(uint start) {
+        _lfo_amount = 100 * _lfo_amount_set * (0.2 + 0.2 * _time_setting);
+        const float remaining = (float)(BUFFER_SIZE - start) / (float)BUFFER_SIZE;
+        _loop_buffer = _segment_loop + remaining * 0.01 * (_time - _segment_loop - 0 * _lfo_amount - _lfo_amount * _block_lfo);
+        // find the size of the linear step for the loop increment
+        _block_loop_inc = (1.0 / (float)(BUFFER_SIZE - start)) * (_loop_buffer - _segment_loop);
+    }
+
+    void _runSamples(float *(input), float *output, uint start = 0, uint end = BUFFER_SIZE) {
+        if (_storage.packed()) {
+            _runSamples<true>(input, output, start, end);
+        } else {
+            _runSamples<false>(input, output, start, end);
+        }
+    }
+
+    template <bool PACKED>
+    void _runSamples(float *(input), float *output, uint start, uint end) {
+        float loop_buffer = _segment_loop;
+        const float delay_loop_inc = _block_loop_inc;
+        const float wet = _block_wet;
+        for (uint buf_i = start; buf_i < end; buf_i++) {
             // get input
             const float input_sample = input[buf_i] * _gain_smooth;
             float tmp = 0;
@@ -122,28 +287,22 @@ class BBDDelay {
             loop_buffer += delay_loop_inc;
 
             // delay positions
-            _buffer_ptr--;
-            if (_buffer_ptr < 0)
-                _buffer_ptr = DELAY_SIZE;
+            _buffer_ptr = (_buffer_ptr - 1) & Storage::MASK;
 
-            int l = std::floor(loop_buffer);
+            // the lfo can take a short delay below zero, so limit the read to the oldest sample in the line
+            const float read_pos = std::max(loop_buffer, 0.f);
+            int l = std::floor(read_pos);
 
             // get remainder for lin interp
-            tmp = loop_buffer - (float)l;
+            tmp = read_pos - (float)l;
 
-            l += _buffer_ptr;
-            if (l > DELAY_SIZE)
-                l -= (DELAY_SIZE + 1);
+            const uint pos = (_buffer_ptr + (uint)l) & Storage::MASK;
 
             // delay output
-            float delay_out = _delay_buffer[l];
+            float delay_out = _storage.read<PACKED>(pos);
 
             // linear interp
-            l++;
-            if (l > DELAY_SIZE) {
-                l = 0;
-            }
-            delay_out += tmp * (_delay_buffer[l] - delay_out);
+            delay_out += tmp * (_storage.read<PACKED>((pos + 1) & Storage::MASK) - delay_out);
 
             // dc blocking filter to stop dc components accumulating when feedback is greater than 1
             tmp = input_sample + _feedback * delay_out;
@@ -155,56 +314,91 @@ class BBDDelay {
             tmp = filter_out;
             _filt_Y1 = filter_out;
 
-            float log_input_level = _clipper_amp_dB * fastlog2(std::abs(tmp));
-            if (log_input_level > _threshold_dB) {
-                float over_dB = log_input_level - _threshold_dB;
-                over_dB = _clipper_linear_coeff * over_dB + _clipper_squared_coeff * over_dB * over_dB;
-                log_input_level = std::min<float>(_threshold_dB + over_dB, _limit_dB);
-            }
-
-            tmp = fastpow2(log_input_level / _clipper_amp_dB) * std::copysignf(1.0, tmp);
             // delay input
-            _delay_buffer[_buffer_ptr] = tmp;
+            _storage.write<PACKED>(_buffer_ptr, _saturate(tmp));
 
             // sum output into output buffer
             output[buf_i] += delay_out * wet;
         }
+        _segment_loop = loop_buffer;
     }
 
-    void calc_time() {
-        float time = _delay_time_setting;
+    /**
+     * @brief Check if every read in the buffer is older than the samples written in the buffer, so the reads can
+     * all be done before the writes
+     *
+     */
+    bool _blockReadsAhead() const {
+        const float first = _block_loop + _block_loop_inc;
+        const float last = _block_loop + _block_loop_inc * (float)BUFFER_SIZE;
+        return std::min(first, last) >= (float)BUFFER_SIZE;
+    }
 
-        if (_tempo_sync) {
-            time = _delay_time_setting_sync;
-            int time_multiplier_set = std::round((TEMPO_SYNC_STEPS) * (1 - time)) - 1;
-            float time_multiplier = _tempo_settings.getTempoSyncMultiplier(time_multiplier_set);
-            float time = 1.f / (_tempo * time_multiplier);
-            float time_samples = time * SAMPLE_RATE;
-            time_samples = time_samples > ((float)DELAY_SIZE * 0.8) ? ((float)DELAY_SIZE * 0.8f) : time_samples;
-            time_samples = time_samples < 1 ? 1 : time_samples;
-            _time = time_samples;
+    void _readBlock() {
+        if (_storage.packed()) {
+            _readBlock<true>();
         } else {
+            _readBlock<false>();
+        }
+    }
 
-            _time_setting = time;
-            constexpr float time_offset = 0.18;
-            constexpr float time_gain = 1;
-            time = time_offset + (time_gain - time_offset) * time;
-            _time = time * time * (float)DELAY_SIZE * 0.8;
+    template <bool PACKED>
+    void _readBlock() {
+        // the read positions follow the same steps as the sample path so the results match
+        alignas(16) float loop_pos[BUFFER_SIZE];
+        float loop_buffer = _block_loop;
+        for (int buf_i = 0; buf_i < BUFFER_SIZE; buf_i++) {
+            loop_buffer += _block_loop_inc;
+            loop_pos[buf_i] = loop_buffer;
+        }
+        for (int buf_i = 0; buf_i < BUFFER_SIZE; buf_i++) {
+            const int l = std::floor(loop_pos[buf_i]);
+            const float frac = loop_pos[buf_i] - (float)l;
+            const uint pos = (_buffer_ptr - (uint)(buf_i + 1) + (uint)l) & Storage::MASK;
+            const float delay_out = _storage.read<PACKED>(pos);
+            _block_out[buf_i] = delay_out + frac * (_storage.read<PACKED>((pos + 1) & Storage::MASK) - delay_out);
         }
     }
 
-  private:
+    void _writeBlock(const float *loop_in, float *output) {
+        if (_storage.packed()) {
+            _writeBlock<true>(loop_in, output);
+        } else {
+            _writeBlock<false>(loop_in, output);
+        }
+    }
+
+    template <bool PACKED>
+    void _writeBlock(const float *loop_in, float *output) {
+        for (int buf_i = 0; buf_i < BUFFER_SIZE; buf_i++) {
+            _buffer_ptr = (_buffer_ptr - 1) & Storage::MASK;
+            _storage.write<PACKED>(_buffer_ptr, loop_in[buf_i]);
+            output[buf_i] += _block_out[buf_i] * _block_wet;
+        }
+    }
+
+    static float _saturate(float tmp) {
+        float log_input_level = _clipper_amp_dB * fastlog2(std::abs(tmp));
+        if (log_input_level > _threshold_dB) {
+            float over_dB = log_input_level - _threshold_dB;
+            over_dB = _clipper_linear_coeff * over_dB + _clipper_squared_coeff * over_dB * over_dB;
+            log_input_level = std::min<float>(_threshold_dB + over_dB, _limit_dB);
+        }
+        return fastpow2(log_input_level / _clipper_amp_dB) * std::copysignf(1.0, tmp);
+    }
+
     static constexpr float cutoff_frequency = 200.0;
     static constexpr float highpass_gain = cutoff_frequency / (float)(2.f * M_PI * SAMPLE_RATE);
     static constexpr float max_gain = 2.5;
+    using Storage = DelayStorage<DELAY_STORAGE_SIZE>;
     float _highpass_state = 0;
-    std::array<float, DELAY_SIZE + 2> _delay_buffer;
-    float _clipper_amp_dB = 8.6562;
-    float _baseline_threshold_dB = -9.0;
-    float _clipper_linear_coeff = 1.017;
-    float _clipper_squared_coeff = -0.025;
-    float _limit_dB = -6.9;
-    float _threshold_dB = _baseline_threshold_dB + _limit_dB;
+    Storage _storage;
+    static constexpr float _clipper_amp_dB = 8.6562;
+    static constexpr float _baseline_threshold_dB = -9.0;
+    static constexpr float _clipper_linear_coeff = 1.017;
+    static constexpr float _clipper_squared_coeff = -0.025;
+    static constexpr float _limit_dB = -6.9;
+    static constexpr float _threshold_dB = _baseline_threshold_dB + _limit_dB;
 
     float _filt_a0 = 0;
     float _filt_a1 = 0;
@@ -225,12 +419,18 @@ class BBDDelay {
     float _lfo_phase_inc = 0;
     float _lfo_phase = 0;
     float _loop_buffer = 0;
+    float _block_loop = 0;
+    float _segment_loop = 0;
+    float _block_loop_inc = 0;
+    float _block_lfo = 0;
+    float _block_wet = 1;
+    float _block_out[BUFFER_SIZE];
     float _env = 0;
     float _rel = 0;
     float _gain = 0;
     float _gain_smooth = 0;
     float _wet_mix = 1;
-    int _buffer_ptr = 0;
+    uint _buffer_ptr = 0;
     bool _tempo_sync = false;
     float _tempo = 1.f;
     float _delay_time_setting = 0;
@@ -0,0 +1,117 @@
+/**
+ * @file NinaDelayStorage.h
+ * @brief Ring buffer storage for the delay lines.
+ *
+ * The ring is rounded up to a power of two so the read and write positions wrap with a mask instead of a compare
+ * and branch. The samples can be stored as floats, or packed into 16 bit ints to halve the memory and cache
+ * footprint of the line, which suits the BBD character of the delay as the in loop saturation already bounds the
+ * samples well inside full scale.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+
+#pragma once
+
+#include "common.h"
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <memory>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+// memory available to a single delay line, in bytes
+constexpr uint DELAY_STORAGE_BUDGET = 1024 * 1024;
+
+// level stored as full scale when the samples are packed
+constexpr float DELAY_PACKED_FULL_SCALE = 1.f;
+
+template <uint MIN_SIZE>
+class DelayStorage {
+  public:
+    static constexpr uint SIZE = std::bit_ceil(MIN_SIZE);
+    static constexpr uint MASK = SIZE - 1;
+    static_assert(SIZE * sizeof(float) <= DELAY_STORAGE_BUDGET, "delay line is over the memory budget");
+
+    DelayStorage() {
+        setPacked(false);
+    }
+
+    ~DelayStorage() = default;
+
+    /**
+     * @brief Select float or 16 bit packed storage. This allocates the line so should not be called from the audio
+     * thread
+     *
+     * @param packed true to store the samples as 16 bit ints
+     */
+    void setPacked(bool packed) {
+        if (packed) {
+            _samples.reset();
+            _packed_samples = std::make_unique<int16_t[]>(SIZE);
+        } else {
+            _packed_samples.reset();
+            _samples = std::make_unique<float[]>(SIZE);
+        }
+        _packed = packed;
+        clear();
+    }
+
+    bool packed() const {
+        return _packed;
+    }
+
+    /**
+     * @brief Memory used by the line in bytes
+     *
+     */
+    uint bytes() const {
+        return SIZE * (_packed ? sizeof(int16_t) : sizeof(float));
+    }
+
+    void clear() {
+        if (_packed) {
+            std::fill(_packed_samples.get(), _packed_samples.get() + SIZE, 0);
+        } else {
+            std::fill(_samples.get(), _samples.get() + SIZE, 0.f);
+        }
+    }
+
+    /**
+     * @brief Read a sample, the position must already be wrapped with MASK
+     *
+     */
+    template <bool PACKED>
+    float read(uint pos) const {
+        if constexpr (PACKED) {
+            return (float)_packed_samples[pos] * (DELAY_PACKED_FULL_SCALE / 32767.f);
+        } else {
+            return _samples[pos];
+        }
+    }
+
+    /**
+     * @brief Write a sample, the position must already be wrapped with MASK
+     *
+     */
+    template <bool PACKED>
+    void write(uint pos, float sample) {
+        if constexpr (PACKED) {
+            const float scaled = std::clamp(sample * (32767.f / DELAY_PACKED_FULL_SCALE), -32767.f, 32767.f);
+            _packed_samples[pos] = (int16_t)std::lrint(scaled);
+        } else {
+            _samples[pos] = sample;
+        }
+    }
+
+  private:
+    std::unique_ptr<float[]> _samples;
+    std::unique_ptr<int16_t[]> _packed_samples;
+    bool _packed = false;
+};
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
@@ -0,0 +1,150 @@
+/**
+ * @file NinaDynamics.h
+ * @brief Shared block kernel for the expander and limiters in the effects chain.
+ *
+ * The detectors run over the whole buffer in branch free loops, then the gain computer is only evaluated once per
+ * control step of DYNAMICS_CONTROL_DIV samples and the gain is interpolated across the step. Gain reductions are
+ * applied from the start of the step they are detected in, so a limiter never lets a peak through between control
+ * points.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+
+#pragma once
+
+#include "SynthMath.h"
+#include "common.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+constexpr uint DYNAMICS_CONTROL_DIV = 8;
+constexpr uint DYNAMICS_CONTROL_STEPS = BUFFER_SIZE / DYNAMICS_CONTROL_DIV;
+static_assert(BUFFER_SIZE % DYNAMICS_CONTROL_DIV == 0);
+
+typedef std::array<float, DYNAMICS_CONTROL_STEPS> DynamicsControl;
+
+/**
+ * @brief Find the peak of both channels over each control step
+ *
+ */
+inline void dynamicsStereoPeak(const float *input_l, const float *input_r, DynamicsControl &peak) {
+    for (uint step = 0; step < DYNAMICS_CONTROL_STEPS; step++) {
+        const float *step_l = input_l + step * DYNAMICS_CONTROL_DIV;
+        const float *step_r = input_r + step * DYNAMICS_CONTROL_DIV;
+        float step_peak = 0.f;
+        for (uint i = 0; i < DYNAMICS_CONTROL_DIV; i++) {
+            step_peak = std::max(step_peak, std::max(std::abs(step_l[i]), std::abs(step_r[i])));
+        }
+        peak[step] = step_peak;
+    }
+}
+
+/**
+ * @brief Peak detector that holds the peak for a fixed window, then releases exponentially. Runs at the control
+ * rate on the peaks found by dynamicsStereoPeak
+ *
+ */
+class DynamicsPeakHold {
+  public:
+    /**
+     * @param hold_samples length of the hold window in samples
+     * @param release_fac per sample release coefficient
+     */
+    DynamicsPeakHold(int hold_samples, float release_fac) :
+        _hold_steps(hold_samples / (int)DYNAMICS_CONTROL_DIV), _release_fac(std::pow(release_fac, (float)DYNAMICS_CONTROL_DIV)) {}
+
+    void run(const DynamicsControl &peak, DynamicsControl &envelope) {
+        for (uint step = 0; step < DYNAMICS_CONTROL_STEPS; step++) {
+            _timer++;
+            if (_timer > _hold_steps) {
+                _timer = 0;
+                _held = 0.f;
+            }
+            _held = std::max(_held, peak[step]);
+            _envelope = _envelope < _held ? _held : _held + _release_fac * (_envelope - _held);
+            envelope[step] = _envelope;
+        }
+    }
+
+  private:
+    int _hold_steps;
+    float _release_fac;
+    int _timer = 0;
+    float _held = 0.f;
+    float _envelope = 0.f;
+};
+
+/**
+ * @brief Leaky integrator of the power of both channels, sampled at the end of each control step. The integrator is
+ * decimated exactly by weighting the samples in each step with the powers of the time constant
+ *
+ */
+class DynamicsPowerDetector {
+  public:
+    DynamicsPowerDetector(float time_const) : _step_decay(std::pow(time_const, (float)DYNAMICS_CONTROL_DIV)) {
+        float weight = 1.f;
+        for (int i = DYNAMICS_CONTROL_DIV - 1; i >= 0; i--) {
+            _weights[i] = weight;
+            weight *= time_const;
+        }
+    }
+
+    void run(const float *input_l, const float *input_r, DynamicsControl &power) {
+        alignas(16) float square_sum[BUFFER_SIZE];
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            square_sum[i] = input_l[i] * input_l[i] + input_r[i] * input_r[i];
+        }
+        for (uint step = 0; step < DYNAMICS_CONTROL_STEPS; step++) {
+            float step_sum = 0.f;
+            for (uint i = 0; i < DYNAMICS_CONTROL_DIV; i++) {
+                step_sum += _weights[i] * square_sum[step * DYNAMICS_CONTROL_DIV + i];
+            }
+            _state = _step_decay * _state + step_sum;
+            power[step] = _state;
+        }
+    }
+
+  private:
+    float _step_decay;
+    std::array<float, DYNAMICS_CONTROL_DIV> _weights;
+    float _state = 0.f;
+};
+
+/**
+ * @brief Apply the control rate gains to a stereo buffer, interpolating across each step. If ATTACK_STEP is set
+ * then a falling gain is applied from the start of the step instead of being interpolated
+ *
+ * @param gain the gain at the end of each control step
+ * @param last_gain the gain at the end of the previous buffer, updated to the last gain
+ */
+template <bool ATTACK_STEP>
+inline void dynamicsApplyGain(const DynamicsControl &gain, float &last_gain, const float *input_l, const float *input_r, float *output_l, float *output_r) {
+    alignas(16) float sample_gain[BUFFER_SIZE];
+    constexpr float interp_step = 1.f / (float)DYNAMICS_CONTROL_DIV;
+    float start = last_gain;
+    for (uint step = 0; step < DYNAMICS_CONTROL_STEPS; step++) {
+        const float end = gain[step];
+        if constexpr (ATTACK_STEP) {
+            start = end < start ? end : start;
+        }
+        const float inc = (end - start) * interp_step;
+        for (uint i = 0; i < DYNAMICS_CONTROL_DIV; i++) {
+            sample_gain[step * DYNAMICS_CONTROL_DIV + i] = start + inc * (float)(i + 1);
+        }
+        start = end;
+    }
+    last_gain = start;
+    for (uint i = 0; i < BUFFER_SIZE; i++) {
+        output_l[i] = input_l[i] * sample_gain[i];
+        output_r[i] = input_r[i] * sample_gain[i];
+    }
+}
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
@@ -8,6 +8,7 @@
  *
  */
 #pragma once
+#include "NinaDynamics.h"
 #include "SynthMath.h"
 #include "common.h"
 
@@ -36,46 +37,26 @@ class NinaLimiter {
     void reCalculate();
 
     void run(float *input_l, float *input_r, float *output_l, float *output_r) {
-        float output1;
         _vol_smooth = param_smooth(_vol, _vol_smooth);
-        for (uint sample_i = 0; sample_i < BUFFER_SIZE; sample_i++) {
-            const float left_in = input_l[sample_i] * _vol_smooth;
-            const float right_in = input_r[sample_i] * _vol_smooth;
-            float max_abs_sample = std::max<float>(std::abs(left_in), std::abs(right_in));
-            _timer_1++;
-            _timer_2++;
-            if (_timer_1 > hold_samples) {
-                _timer_1 = 0;
-                _current_max_1 = 0;
-            }
-            _current_max_1 = std::max<float>(_current_max_1, max_abs_sample);
-            if (_timer_2 > hold_samples) {
-                _timer_2 = 0;
-                _current_max_2 = 0;
-            }
-            _current_max_2 = std::max<float>(_current_max_2, max_abs_sample);
-
-            _env_time = std::max<float>(_current_max_1, _current_max_2);
-            _envelope = _envelope < _env_time ? _env_time : _env_time + release_fac * (_envelope - _env_time);
-            float gain = output_gain;
-            if (_envelope > lim_thresh_linear) {
-                gain = lim_thresh_linear_gain / _envelope;
-            }
-            output1 = gain;
-            output_l[sample_i] = left_in * gain;
-            output_r[sample_i] = right_in * gain;
+        DynamicsControl peak;
+        dynamicsStereoPeak(input_l, input_r, peak);
+        for (auto &step_peak : peak) {
+            step_peak *= _vol_smooth;
+        }
+        DynamicsControl gain;
+        _peak_hold.run(peak, gain);
+        for (auto &step_gain : gain) {
+            const float envelope = step_gain;
+            step_gain = _vol_smooth * (envelope > lim_thresh_linear ? lim_thresh_linear_gain / envelope : output_gain);
         }
+        dynamicsApplyGain<true>(gain, _gain, input_l, input_r, output_l, output_r);
     }
 
   private:
     float _vol = 1;
     float _vol_smooth = 1;
-    int _timer_1 = 0;
-    int _timer_2 = 0;
-    float _current_max_1 = 0;
-    float _current_max_2 = 0;
-    float _env_time = 0;
-    float _envelope = 0;
+    float _gain = output_gain;
+    DynamicsPeakHold _peak_hold{hold_samples, release_fac};
 };
 
 // limiting threshold, set experimentally, lance
@@ -97,46 +78,25 @@ class OutputLimiter {
     void reCalculate();
 
     void run(float *input_l, float *input_r, float *output_l, float *output_r) {
-        float output1;
-        float gain = out_output_gain * _output_gain;
-        for (uint sample_i = 0; sample_i < BUFFER_SIZE; sample_i++) {
-            const float left_in = input_l[sample_i] * output_limiter_pregain;
-            const float right_in = input_r[sample_i] * output_limiter_pregain;
-            float max_abs_sample = std::max<float>(std::abs(left_in), std::abs(right_in));
-            _timer_1++;
-            _timer_2++;
-            if (_timer_1 > hold_samples) {
-                _timer_1 = 0;
-                _current_max_1 = 0;
-            }
-            _current_max_1 = std::max<float>(_current_max_1, max_abs_sample);
-            if (_timer_2 > hold_samples) {
-                _timer_2 = 0;
-                _current_max_2 = 0;
-            }
-            _current_max_2 = std::max<float>(_current_max_2, max_abs_sample);
-
-            _env_time = std::max<float>(_current_max_1, _current_max_2);
-            _envelope = _envelope < _env_time ? _env_time : _env_time + release_fac * (_envelope - _env_time);
-            if (_envelope > out_lim_thresh_linear) {
-                gain = out_lim_thresh_linear_gain / _envelope;
-            }
-            output1 = gain;
-            output_l[sample_i] = left_in * gain;
-            output_r[sample_i] = right_in * gain;
+        DynamicsControl peak;
+        dynamicsStereoPeak(input_l, input_r, peak);
+        for (auto &step_peak : peak) {
+            step_peak *= output_limiter_pregain;
         }
+        DynamicsControl gain;
+        _peak_hold.run(peak, gain);
+        const float max_gain = out_output_gain * _output_gain;
+        for (auto &step_gain : gain) {
+            const float envelope = step_gain;
+            step_gain = output_limiter_pregain * (envelope > out_lim_thresh_linear ? out_lim_thresh_linear_gain / envelope : max_gain);
+        }
+        dynamicsApplyGain<true>(gain, _gain, input_l, input_r, output_l, output_r);
     }
 
   private:
-    float _vol = 1;
-    float _vol_smooth = 1;
-    int _timer_1 = 0;
     float _output_gain = 1;
-    int _timer_2 = 0;
-    float _current_max_1 = 0;
-    float _current_max_2 = 0;
-    float _env_time = 0;
-    float _envelope = 0;
+    float _gain = output_limiter_pregain * out_output_gain;
+    DynamicsPeakHold _peak_hold{hold_samples, release_fac};
 };
 } // namespace Nina
 } // namespace Vst
@@ -8,6 +8,7 @@
  */
 
 #pragma once
+#include "NinaDynamics.h"
 #include "NinaParameters.h"
 #include "SynthMath.h"
 #include "common.h"
@@ -26,35 +27,33 @@ constexpr float RMS_TIME_CONST = std::pow(37.f / 100.f, 1.f / RMS_SAMPLE);
 static_assert(RMS_TIME_CONST > 0);
 
 class NinaExpander {
-    float _rms_1 = 0;
-    float _rms_2 = 0;
-    int counter = 0;
+    DynamicsPowerDetector _detector{RMS_TIME_CONST};
+    float _gain = 1.f;
 
   public:
     NinaExpander() {
     }
 
     void process(float *input_1, float *input_2) {
-        for (uint i = 0; i < BUFFER_SIZE; ++i) {
-            float &sample_1 = input_1[i];
-            float &sample_2 = input_2[i];
+        // integrate the square sum of the 2 channels with a simple LPF, the square root of this approximates the
+        // response of a RMS detector
+        DynamicsControl power;
+        _detector.run(input_1, input_2, power);
 
-            // calulate the square sum of the 2 channels, then integrate with a simple LPF and square, this approximates the response of a RMS detector
-            const float ave = sample_1 * sample_1 + sample_2 * sample_2;
-            _rms_1 = ave + RMS_TIME_CONST * _rms_1;
-            float rms = sqrtf32(_rms_1);
+        DynamicsControl gain;
+        for (uint step = 0; step < DYNAMICS_CONTROL_STEPS; step++) {
+            float rms = sqrtf32(power[step]);
 
             // calculate a dB based gain reduction depending on the amount the RMS level is lower than the threshold
             float db_under_thresh = fastlog2(rms / LIN_THRESH);
             db_under_thresh = db_under_thresh > 0 ? 0.f : db_under_thresh;
             db_under_thresh = db_under_thresh < MAX_GR ? MAX_GR : db_under_thresh;
             const float gain_reduction = db_under_thresh * (RATIO - 1.f) / RATIO;
-            float gain_linear = fastpow2(gain_reduction);
-
-            // apply the gain reduction
-            sample_1 *= gain_linear;
-            sample_2 *= gain_linear;
+            gain[step] = fastpow2(gain_reduction);
         }
+
+        // apply the gain reduction
+        dynamicsApplyGain<false>(gain, _gain, input_1, input_2, input_1, input_2);
     }
 };
 
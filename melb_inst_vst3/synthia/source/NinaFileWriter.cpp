@@ -0,0 +1,220 @@
+/**
+ * @file NinaFileWriter.cpp
+ * @brief Low priority service that does the calibration and tuning file writes for the audio thread.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+
+#include "NinaFileWriter.h"
+#include "AnalogVoice.h"
+#include "NinaOscModelFit.h"
+#include <cstdio>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+FileWriter::FileWriter() {
+    for (uint i = 0; i < FILE_WRITER_QUEUE_SIZE; i++) {
+        _queue[i].seq.store(i, std::memory_order_relaxed);
+    }
+}
+
+FileWriter::~FileWriter() {
+    stop();
+}
+
+FileWriter &FileWriter::getInstance() {
+    static FileWriter writer;
+    return writer;
+}
+
+void FileWriter::start() {
+    if (!_thread.joinable()) {
+        _exit_thread = false;
+        _thread = std::thread(&FileWriter::_writerLoop, this);
+    }
+}
+
+void FileWriter::stop() {
+    if (_thread.joinable()) {
+        _exit_thread = true;
+        _thread.join();
+    }
+}
+
+bool FileWriter::_post(FileWriteType type, uint index, const void *data, uint size) {
+    // Claim a cell, the cell sequence matches the position when it is free to write
+    uint pos = _post_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+        cell = &_queue[pos & (FILE_WRITER_QUEUE_SIZE - 1)];
+        const int diff = (int)(cell->seq.load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (_post_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the queue is full
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = _post_pos.load(std::memory_order_relaxed);
+        }
+    }
+    cell->record.type = type;
+    cell->record.index = index;
+    cell->record.size = size;
+    std::memcpy(cell->record.data.data(), data, size);
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool FileWriter::_pop(FileWriteRecord &record) {
+    Cell &cell = _queue[_read_pos & (FILE_WRITER_QUEUE_SIZE - 1)];
+    if ((int)(cell.seq.load(std::memory_order_acquire) - (_read_pos + 1)) < 0) {
+        return false;
+    }
+    record = cell.record;
+    cell.seq.store(_read_pos + FILE_WRITER_QUEUE_SIZE, std::memory_order_release);
+    _read_pos++;
+    return true;
+}
+
+void FileWriter::_collect(const FileWriteRecord &record) {
+    switch (record.type) {
+    case FileWriteType::OSC_TUNING: {
+        // Each measurement is a line of 4 values, with a blank line after each set
+        if (record.index < _tuning_data.size()) {
+            const float *values = reinterpret_cast<const float *>(record.data.data());
+            std::stringstream text;
+            for (uint i = 0; i + 3 < record.size / sizeof(float); i += 4) {
+                text << values[i] << ", " << values[i + 1] << ", " << values[i + 2] << ", " << values[i + 3] << "\n";
+            }
+            text << "\n";
+            _tuning_data[record.index] += text.str();
+            _pending = true;
+
+            // the measurements are also used to refit the osc model if enabled
+            auto &fitter = OscModelFitter::getInstance();
+            if (fitter.running()) {
+                fitter.addMeasurements(record.index, values, record.size / sizeof(float));
+            }
+        }
+        break;
+    }
+
+    case FileWriteType::CAL_INFO:
+        _cal_info = record;
+        _cal_info_pending = true;
+        break;
+
+    case FileWriteType::CAL_VOICE: {
+        CalStoreVoice voice;
+        std::memcpy(&voice, record.data.data(), sizeof(voice));
+        CalStore::getInstance().setVoiceCal(record.index, voice);
+        _pending = true;
+        break;
+    }
+
+    case FileWriteType::CAL_RELOAD:
+        _cal_reload_pending.fill(true);
+        break;
+    }
+}
+
+void FileWriter::_reloadCal() {
+    // a voice that has not applied its last reload yet is tried again on the next poll
+    for (uint i = 0; i < NUM_VOICES; i++) {
+        if (_cal_reload_pending[i] && (!_voices[i] || _voices[i]->reloadCalibration())) {
+            _cal_reload_pending[i] = false;
+        }
+    }
+}
+
+void FileWriter::_writeCalInfo() {
+    if (_cal_info_pending) {
+        std::stringstream fpath;
+        fpath << _tuning_path << "cal_info.dat";
+        std::ofstream file(fpath.str(), std::ios::out | std::ios::trunc | std::ios::binary);
+        file.write(reinterpret_cast<const char *>(_cal_info.data.data()), _cal_info.size);
+        _cal_info_pending = false;
+    }
+}
+
+void FileWriter::_flush() {
+    for (uint i = 0; i < _tuning_data.size(); i++) {
+        if (_tuning_data[i].empty()) {
+            continue;
+        }
+        std::stringstream fpath;
+        fpath << _tuning_path << "voice_" << i / 2 << "_osc_" << i % 2 << ".txt";
+        std::ofstream file(fpath.str(), std::ios::out | std::ios::app);
+        if (file.is_open()) {
+            file << _tuning_data[i];
+            printf("\nwritedone:%d:%d", i / 2, i % 2);
+        } else {
+            printf("\nIO error\n");
+        }
+        _tuning_data[i].clear();
+    }
+    auto &store = CalStore::getInstance();
+    if (store.dirty()) {
+        if (store.save()) {
+            printf("\nsaved cal to file");
+        } else {
+            printf("\nfileIOerror");
+        }
+    }
+    uint dropped = _dropped.exchange(0);
+    if (dropped > 0) {
+        printf("\nfile writer: %d writes dropped", dropped);
+    }
+    _pending = false;
+}
+
+void FileWriter::_writerLoop() {
+    // The writes can wait, so only run when nothing else needs the cpu. This also drops any realtime priority
+    // inherited from the thread that started the writer
+    sched_param param = {};
+    param.sched_priority = 0;
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0) {
+        printf("\nfile writer: could not set idle priority");
+    }
+
+    while (true) {
+        const bool exit = _exit_thread;
+        FileWriteRecord record;
+        while (_pop(record)) {
+            _collect(record);
+        }
+        _writeCalInfo();
+        _reloadCal();
+
+        // The voices can also leave the store dirty when they import calibration from the text files
+        if (CalStore::getInstance().dirty()) {
+            _pending = true;
+        }
+        if (_pending) {
+            if (_pending_since == Clock::time_point()) {
+                _pending_since = Clock::now();
+            }
+            if (exit || (Clock::now() - _pending_since) >= FILE_WRITER_FLUSH_TIME) {
+                _flush();
+                _pending_since = Clock::time_point();
+            }
+        }
+        if (exit) {
+            break;
+        }
+        std::this_thread::sleep_for(FILE_WRITER_POLL_TIME);
+    }
+}
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
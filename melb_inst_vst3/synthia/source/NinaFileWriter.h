@@ -0,0 +1,158 @@
+/**
+ * @file NinaFileWriter.h
+ * @brief Low priority service that does the calibration and tuning file writes for the audio thread.
+ *
+ * The audio thread posts fixed size records to a lock free queue and never touches the file system. A single low
+ * priority thread drains the queue and collects the records. Writes that replace a file are polled by the
+ * calibration scripts, so they are written on the poll they are collected in, keeping only the latest record.
+ * Appends to the same file are gathered and flushed once they have waited for FILE_WRITER_FLUSH_TIME, and on
+ * stop, so a burst of posts turns into one write per file. The thread also does
+ * the calibration reloads, which read the tuning tool files and update the cal store.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+
+#pragma once
+
+#include "NinaCalStore.h"
+#include "common.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <type_traits>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+// number of records the queue holds, must be a power of 2
+constexpr uint FILE_WRITER_QUEUE_SIZE = 64;
+
+// max size of the data in a record
+constexpr uint FILE_WRITER_MAX_DATA = 256;
+
+// how often the writer thread checks the queue
+constexpr std::chrono::milliseconds FILE_WRITER_POLL_TIME(50);
+
+// how long posted writes are collected before they are written
+constexpr std::chrono::milliseconds FILE_WRITER_FLUSH_TIME(1000);
+
+constexpr char FILE_WRITER_TUNING_PATH[] = "/udata/nina/tuning/";
+
+static_assert((FILE_WRITER_QUEUE_SIZE & (FILE_WRITER_QUEUE_SIZE - 1)) == 0, "the file writer queue size must be a power of 2");
+
+enum class FileWriteType : uint {
+    // osc tuning measurements, appended to the tuning data file of the osc. The index is voice * 2 + osc
+    OSC_TUNING,
+
+    // level of each voice and the test state, replaces the cal info file
+    CAL_INFO,
+
+    // the calibration values of a voice that are set by the voice, merged into the cal store. The index is the
+    // voice number
+    CAL_VOICE,
+
+    // reload the calibration of all the voices, there is no data
+    CAL_RELOAD
+};
+
+struct FileWriteRecord {
+    FileWriteType type;
+    uint index;
+    uint size;
+    alignas(8) std::array<uint8_t, FILE_WRITER_MAX_DATA> data;
+};
+
+class AnalogVoice;
+
+class FileWriter {
+  public:
+    FileWriter();
+    ~FileWriter();
+
+    /**
+     * @brief Writer shared by the voices and the layer manager
+     *
+     */
+    static FileWriter &getInstance();
+
+    /**
+     * @brief Set the voices that a CAL_RELOAD reloads, must be called before the writer thread is started
+     *
+     */
+    void setVoices(const std::array<AnalogVoice *, NUM_VOICES> &voices) {
+        _voices = voices;
+    }
+
+    /**
+     * @brief Set the folder the tuning files are written to, must be called before the writer thread is started
+     *
+     */
+    void setTuningPath(const std::string &path) {
+        _tuning_path = path;
+    }
+
+    /**
+     * @brief Start the writer thread, records posted before this are written once it starts
+     *
+     */
+    void start();
+
+    /**
+     * @brief Write everything posted so far and stop the writer thread
+     *
+     */
+    void stop();
+
+    /**
+     * @brief Post a record to the writer, realtime safe. This can be called from any thread
+     *
+     * @return false if the queue is full and the record was dropped
+     */
+    template <typename T>
+    bool post(FileWriteType type, uint index, const T &data) {
+        static_assert(std::is_trivially_copyable_v<T>, "file writer data must be trivially copyable");
+        static_assert(sizeof(T) <= FILE_WRITER_MAX_DATA, "file writer data is too large");
+        return _post(type, index, &data, sizeof(T));
+    }
+
+  private:
+    struct Cell {
+        std::atomic<uint> seq;
+        FileWriteRecord record;
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    std::array<Cell, FILE_WRITER_QUEUE_SIZE> _queue;
+    std::atomic<uint> _post_pos = 0;
+    std::atomic<uint> _dropped = 0;
+    uint _read_pos = 0;
+    std::thread _thread;
+    std::atomic<bool> _exit_thread = false;
+
+    // writes collected by the writer thread
+    std::string _tuning_path = FILE_WRITER_TUNING_PATH;
+    std::array<std::string, NUM_VOICES * 2> _tuning_data;
+    FileWriteRecord _cal_info;
+    bool _cal_info_pending = false;
+    std::array<AnalogVoice *, NUM_VOICES> _voices = {};
+    std::array<bool, NUM_VOICES> _cal_reload_pending = {};
+    bool _pending = false;
+    Clock::time_point _pending_since;
+
+    bool _post(FileWriteType type, uint index, const void *data, uint size);
+    bool _pop(FileWriteRecord &record);
+    void _collect(const FileWriteRecord &record);
+    void _flush();
+    void _writeCalInfo();
+    void _reloadCal();
+    void _writerLoop();
+};
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
@@ -0,0 +1,104 @@
+/**
+ * @file NinaFxActivity.h
+ * @brief Tail aware activity tracking for the effects, so an effect can be skipped once it has nothing to output.
+ *
+ * An effect is active while its input has signal, whatever its level, so its state always follows the input and a
+ * level raised later plays the effect as it would have sounded. Once the input goes silent the effect keeps running
+ * so its tail plays out and its own output is measured. When the output has been
+ * below the silence threshold for the hold time the effect goes idle and is no longer processed. The hold time
+ * covers the longest gap the effect can have in its output, such as the delay time, so a pending echo is not lost.
+ * Any signal at the input wakes the effect up again, its state was left near silent so it resumes without a
+ * click.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+
+#pragma once
+
+#include "common.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+// peak level treated as silence, about -100dB
+constexpr float FX_SILENCE_THRESHOLD = 1e-5f;
+
+/**
+ * @brief Peak of a stereo buffer
+ *
+ */
+inline float fxPeak(const float *left, const float *right) {
+    float peak = 0.f;
+    for (uint i = 0; i < BUFFER_SIZE; i++) {
+        peak = std::max(peak, std::max(std::abs(left[i]), std::abs(right[i])));
+    }
+    return peak;
+}
+
+/**
+ * @brief Peak of the difference between two stereo buffers, used to find the level an effect added to its output
+ *
+ */
+inline float fxPeakDifference(const float *left, const float *right, const float *prev_left, const float *prev_right) {
+    float peak = 0.f;
+    for (uint i = 0; i < BUFFER_SIZE; i++) {
+        peak = std::max(peak, std::max(std::abs(left[i] - prev_left[i]), std::abs(right[i] - prev_right[i])));
+    }
+    return peak;
+}
+
+class FxActivity {
+  public:
+    /**
+     * @param hold_time time the output must stay silent before the effect goes idle, in seconds
+     */
+    FxActivity(float hold_time) :
+        _hold_buffers((uint)std::ceil(hold_time * (float)BUFFER_RATE)) {}
+
+    /**
+     * @brief Update the input state at the start of the buffer
+     *
+     * @param input_peak peak level of the effect input
+     * @return true if the effect needs to be processed this buffer
+     */
+    bool start(float input_peak) {
+        _tail = input_peak < FX_SILENCE_THRESHOLD;
+        if (!_tail) {
+            _silent_buffers = 0;
+        }
+        return !idle();
+    }
+
+    /**
+     * @brief Check if the output needs to be measured, which is only needed while the tail is playing out
+     *
+     */
+    bool tail() const {
+        return _tail && !idle();
+    }
+
+    /**
+     * @brief Update the output state after processing a tail buffer
+     *
+     * @param output_peak peak level the effect added to its output
+     */
+    void end(float output_peak) {
+        _silent_buffers = (output_peak < FX_SILENCE_THRESHOLD) ? (_silent_buffers + 1) : 0;
+    }
+
+    bool idle() const {
+        return _silent_buffers >= _hold_buffers;
+    }
+
+  private:
+    uint _hold_buffers;
+    uint _silent_buffers = 0;
+    bool _tail = false;
+};
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
@@ -18,48 +18,71 @@ NinaMatrix::~NinaMatrix(){};
 
 float dummy = 0;
 
-void NinaMatrix::run_slow_slots() {
+void NinaMatrix::compile(bool keep_zero_gains) {
+    // slow routes, the sums for fast dsts are cached and added to the fast sums each sample
+    uint route = 0;
     int fast_dst_counter = 0;
     for (int i = 0; i < matrix_destinations; ++i) {
-#ifdef MATRIX_DBG
-        bool printing = (i == 4);
-        printing = true;
-#endif
         bool fast_dst = false;
         if (_matrix_dests[i] == _fast_dst[fast_dst_counter]) {
             fast_dst = true;
         }
-        float sum = 0.0f;
+        _slow_route_start[i] = route;
         for (int j = 0; j < matrix_sources; ++j) {
-            sum += ((*(_matrix_srcs[(j)])) * (*_gains[(j * matrix_destinations + i)]));
-#ifdef MATRIX_DBG
-            if (print && printing) {
-                printf("\n");
-                printf(NinaParams::_modMatrixSrcTitles[(j)]);
-                printf("\t\t\t");
-                printf(NinaParams::_modMatrixDstTitles[i]);
-                printf("\t\t%f * %f  %f ", *_matrix_srcs.at(j), *_gains.at(j * matrix_destinations + i), sum);
+            const float *gain = _gains[(j * matrix_destinations + i)];
+            if (keep_zero_gains || (*gain != 0.0f)) {
+                _slow_routes[route++] = {_matrix_srcs[j], gain};
             }
-#endif
         }
 
         if (fast_dst) {
-            _dst_cache[fast_dst_counter] = sum;
+            _slow_route_dsts[i] = &_dst_cache[fast_dst_counter];
             if (fast_dst_counter < (NinaParams::NUM_FAST_DST - 1)) {
                 fast_dst_counter++;
             }
         } else {
-            *(_matrix_dests[i]) = sum;
+            _slow_route_dsts[i] = _matrix_dests[i];
+        }
+    }
+    _slow_route_start[matrix_destinations] = route;
+    _num_slow_route_dsts = matrix_destinations;
+
+    // fast routes
+    route = 0;
+    for (uint dst = 0; dst < NinaParams::NUM_FAST_DST; ++dst) {
+        _fast_route_start[dst] = route;
+        for (uint src = 0; src < NinaParams::NUM_FAST_SRC; ++src) {
+            const float *gain = _fast_gains[(src * NinaParams::NUM_FAST_DST + dst)];
+            if (keep_zero_gains || (*gain != 0.0f)) {
+                _fast_routes[route++] = {_fast_src[src], gain};
+            }
         }
     }
+    _fast_route_start[NinaParams::NUM_FAST_DST] = route;
+
+#ifdef MATRIX_DBG
+    if (print) {
+        printf("\nvoice %d matrix: %d slow routes, %d fast routes", voicen, _slow_route_start[matrix_destinations], route);
+    }
+#endif
+}
+
+void NinaMatrix::run_slow_slots() {
+    for (uint i = 0; i < _num_slow_route_dsts; ++i) {
+        float sum = 0.0f;
+        for (uint r = _slow_route_start[i]; r < _slow_route_start[i + 1]; ++r) {
+            sum += (*_slow_routes[r].src) * (*_slow_routes[r].gain);
+        }
+        *(_slow_route_dsts[i]) = sum;
+    }
     print = false;
 }
 
 void NinaMatrix::run_fast_slots() const {
     for (uint dst = 0; dst < NinaParams::NUM_FAST_DST; ++dst) {
         float sum = 0;
-        for (uint src = 0; src < NinaParams::NUM_FAST_SRC; ++src) {
-            sum += *(_fast_src[src]) * (*_fast_gains[(src * NinaParams::NUM_FAST_DST + dst)]);
+        for (uint r = _fast_route_start[dst]; r < _fast_route_start[dst + 1]; ++r) {
+            sum += (*_fast_routes[r].src) * (*_fast_routes[r].gain);
         }
         *(_fast_dst[dst]) = sum + _dst_cache[(dst)];
     }
@@ -44,6 +44,14 @@ class NinaMatrix {
 
     void set_gain_addr(int source_num, int dest_num, float *gain);
 
+    /**
+     * @brief rebuild the lists of active routes from the current gains. must be called whenever a gain may have
+     * changed to or from zero, routes with a zero gain are skipped when the slots are run
+     *
+     * @param keep_zero_gains keep the routes with a zero gain, for gains that will change before the next compile
+     */
+    void compile(bool keep_zero_gains = false);
+
     /**
      * @brief calculate the sum of mod_gain * slot_dst_pairs for each dst and apply. also add the cached slow sum
      *
@@ -58,6 +66,11 @@ class NinaMatrix {
     bool print = false;
 
   private:
+    struct Route {
+        const float *src;
+        const float *gain;
+    };
+
     float zero = 0.0f;
 
     const std::array<float *, NinaParams::NUM_FAST_DST> &_fast_dst;
@@ -67,6 +80,14 @@ class NinaMatrix {
     const std::array<float *, matrix_sources> &_matrix_srcs;
     const std::array<float *, matrix_destinations * matrix_sources> &_gains;
     std::array<float, NinaParams::NUM_FAST_DST> _dst_cache = {0.0};
+
+    // active routes for each dst, in source order so the sums are the same as a full pass over the matrix
+    std::array<Route, matrix_destinations * matrix_sources> _slow_routes;
+    std::array<uint, matrix_destinations + 1> _slow_route_start = {0};
+    std::array<float *, matrix_destinations> _slow_route_dsts;
+    uint _num_slow_route_dsts = 0;
+    std::array<Route, NinaParams::NUM_FAST_SRC * NinaParams::NUM_FAST_DST> _fast_routes;
+    std::array<uint, NinaParams::NUM_FAST_DST + 1> _fast_route_start = {0};
 };
 
 } // namespace Nina
@@ -0,0 +1,354 @@
+/**
+ * @file NinaOscModelFit.cpp
+ * @brief On device refit of the analog oscillator models from the osc tuning measurements.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+
+#include "NinaOscModelFit.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <pthread.h>
+#include <sched.h>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+// index of each fitted coefficient in the model, and the first tracking offset in the params
+constexpr std::array<uint, OSC_FIT_NUM_COEFFS> OSC_FIT_COEFF_INDEX = {0, 1, 3, 4, 5, 6, 7};
+constexpr uint OSC_FIT_OFFSET_PARAM = OSC_FIT_NUM_COEFFS;
+
+// errors above which measurements are dropped on each pass of the fit, the first pass uses them all
+constexpr std::array<double, 3> OSC_FIT_OUTLIER_LIMITS = {0.0, 0.01, 0.005};
+
+constexpr double OSC_FIT_START_LAMBDA = 1e-3;
+constexpr double OSC_FIT_MAX_LAMBDA = 1e12;
+constexpr double OSC_FIT_MIN_LAMBDA = 1e-12;
+constexpr double OSC_FIT_TOLERANCE = 1e-12;
+
+constexpr std::chrono::milliseconds OSC_FIT_POLL_TIME(100);
+
+// model voltage for a point, this matches analogModelVoltage() with the j coefficient at 0 as the osc uses it
+static inline double _modelVoltage(const std::vector<double> &p, double t, double f1, double f2, double hz_f1, double hz_f2) {
+    return t + (p[0] * t + p[1]) * f1 + p[4] * f2 + p[2] * hz_f1 + p[3] * hz_f2 + p[6] * f1 * f1 + p[5] * f1 * f1 * f1 + ANALOG_MODEL_HZ_SCALE / hz_f1;
+}
+
+bool OscModelFit::fit(const std::vector<OscFitMeasurement> &measurements, CalStoreOscModel &model) {
+    bool up_ok = _fitSide(measurements, true, model.up, _rms_up);
+    bool down_ok = _fitSide(measurements, false, model.down, _rms_down);
+    return up_ok && down_ok;
+}
+
+bool OscModelFit::_fitSide(const std::vector<OscFitMeasurement> &measurements, bool up, std::array<float, CAL_STORE_MODEL_SIZE> &coeffs, float &rms) {
+    // Get the log2 frequency of each side, skipping measurements that are too fast to be measured reliably. The
+    // groups are renumbered so every group has at least one measurement
+    constexpr float min_period = 1.f / OSC_FIT_MAX_FREQ;
+    _points.clear();
+    _num_groups = 0;
+    uint last_group = -1;
+    for (uint m = 0; m < measurements.size(); m++) {
+        const auto &mes = measurements[m];
+        if (!(mes.period_up > min_period) || !(mes.period_down > min_period) || !std::isfinite(mes.period_up) || !std::isfinite(mes.period_down)) {
+            continue;
+        }
+        if (m / OSC_FIT_GROUP_SIZE != last_group) {
+            last_group = m / OSC_FIT_GROUP_SIZE;
+            _num_groups++;
+        }
+        const double f_up = std::log2(1.0 / mes.period_up);
+        const double f_down = std::log2(1.0 / mes.period_down);
+        Point point;
+        point.v = up ? mes.v_up : mes.v_down;
+        point.f1 = up ? f_up : f_down;
+        point.f2 = up ? f_down : f_up;
+        point.hz_f1 = std::exp2(point.f1);
+        point.hz_f2 = std::exp2(point.f2);
+        point.group = _num_groups - 1;
+        point.used = true;
+        _points.push_back(point);
+    }
+    if (_points.size() < OSC_FIT_MIN_MEASUREMENTS / 2) {
+        return false;
+    }
+
+    // Start from the current model with no tracking offsets
+    _params.assign(OSC_FIT_OFFSET_PARAM + _num_groups, 0.0);
+    for (uint i = 0; i < OSC_FIT_NUM_COEFFS; i++) {
+        _params[i] = coeffs[OSC_FIT_COEFF_INDEX[i]];
+    }
+    for (auto limit : OSC_FIT_OUTLIER_LIMITS) {
+        if (limit > 0.0) {
+            for (auto &point : _points) {
+                const double t = _params[OSC_FIT_OFFSET_PARAM + point.group];
+                point.used = std::abs(point.v - _modelVoltage(_params, t, point.f1, point.f2, point.hz_f1, point.hz_f2)) < limit;
+            }
+        }
+        _levenbergMarquardt();
+    }
+
+    // Only use the fit if most of the measurements fit it well
+    uint num_used = 0;
+    for (const auto &point : _points) {
+        num_used += point.used ? 1 : 0;
+    }
+    rms = num_used > 0 ? std::sqrt(_cost(_params) / num_used) : INFINITY;
+    if ((num_used < _points.size() / 2) || !(rms < OSC_FIT_MAX_RMS_ERROR)) {
+        return false;
+    }
+    for (uint i = 0; i < OSC_FIT_NUM_COEFFS; i++) {
+        coeffs[OSC_FIT_COEFF_INDEX[i]] = _params[i];
+    }
+    return true;
+}
+
+double OscModelFit::_cost(const std::vector<double> &params) {
+    double cost = 0.0;
+    for (const auto &point : _points) {
+        if (point.used) {
+            const double t = params[OSC_FIT_OFFSET_PARAM + point.group];
+            const double r = point.v - _modelVoltage(params, t, point.f1, point.f2, point.hz_f1, point.hz_f2);
+            cost += r * r;
+        }
+    }
+    return cost;
+}
+
+void OscModelFit::_levenbergMarquardt() {
+    const uint n = _params.size();
+    _jtj.resize(n * n);
+    _jtr.resize(n);
+    _solve.resize(n * n);
+    _step.resize(n);
+    _trial.resize(n);
+    std::vector<double> scale(n);
+    double lambda = OSC_FIT_START_LAMBDA;
+    double cost = _cost(_params);
+    for (uint iteration = 0; iteration < OSC_FIT_MAX_ITERATIONS; iteration++) {
+        // Build the normal equations, each point only depends on the coefficients and the offset of its group
+        std::fill(_jtj.begin(), _jtj.end(), 0.0);
+        std::fill(_jtr.begin(), _jtr.end(), 0.0);
+        for (const auto &point : _points) {
+            if (!point.used) {
+                continue;
+            }
+            const uint offset_param = OSC_FIT_OFFSET_PARAM + point.group;
+            const double t = _params[offset_param];
+            const double f1_2 = point.f1 * point.f1;
+            const std::array<double, OSC_FIT_NUM_COEFFS + 1> jacobian = {t * point.f1, point.f1, point.hz_f1, point.hz_f2, point.f2, f1_2 * point.f1, f1_2, 1.0 + _params[0] * point.f1};
+            std::array<uint, OSC_FIT_NUM_COEFFS + 1> index = {0, 1, 2, 3, 4, 5, 6, offset_param};
+            const double r = point.v - _modelVoltage(_params, t, point.f1, point.f2, point.hz_f1, point.hz_f2);
+            for (uint i = 0; i < jacobian.size(); i++) {
+                _jtr[index[i]] += jacobian[i] * r;
+                for (uint j = 0; j < jacobian.size(); j++) {
+                    _jtj[index[i] * n + index[j]] += jacobian[i] * jacobian[j];
+                }
+            }
+        }
+
+        // The coefficients are on very different scales, so scale the equations to a unit diagonal before solving
+        for (uint i = 0; i < n; i++) {
+            scale[i] = _jtj[i * n + i] > 0.0 ? 1.0 / std::sqrt(_jtj[i * n + i]) : 1.0;
+        }
+
+        // Increase the damping until a step reduces the error
+        bool improved = false;
+        double new_cost = cost;
+        while (lambda < OSC_FIT_MAX_LAMBDA) {
+            for (uint i = 0; i < n; i++) {
+                for (uint j = 0; j < n; j++) {
+                    _solve[i * n + j] = _jtj[i * n + j] * scale[i] * scale[j];
+                }
+                _solve[i * n + i] += lambda;
+                _step[i] = _jtr[i] * scale[i];
+            }
+            if (_cholesky(n)) {
+                for (uint i = 0; i < n; i++) {
+                    _trial[i] = _params[i] + _step[i] * scale[i];
+                }
+                new_cost = _cost(_trial);
+                if (new_cost < cost) {
+                    improved = true;
+                    _params.swap(_trial);
+                    lambda = std::max(lambda * 0.1, OSC_FIT_MIN_LAMBDA);
+                    break;
+                }
+            }
+            lambda *= 10.0;
+        }
+        if (!improved) {
+            break;
+        }
+        const bool converged = (cost - new_cost) <= OSC_FIT_TOLERANCE * cost;
+        cost = new_cost;
+        if (converged) {
+            break;
+        }
+    }
+}
+
+bool OscModelFit::_cholesky(uint n) {
+    // Factor _solve in place into L L^T, then solve for _step
+    for (uint j = 0; j < n; j++) {
+        double diag = _solve[j * n + j];
+        for (uint k = 0; k < j; k++) {
+            diag -= _solve[j * n + k] * _solve[j * n + k];
+        }
+        if (!(diag > 0.0)) {
+            return false;
+        }
+        diag = std::sqrt(diag);
+        _solve[j * n + j] = diag;
+        for (uint i = j + 1; i < n; i++) {
+            double sum = _solve[i * n + j];
+            for (uint k = 0; k < j; k++) {
+                sum -= _solve[i * n + k] * _solve[j * n + k];
+            }
+            _solve[i * n + j] = sum / diag;
+        }
+    }
+    for (uint i = 0; i < n; i++) {
+        double sum = _step[i];
+        for (uint k = 0; k < i; k++) {
+            sum -= _solve[i * n + k] * _step[k];
+        }
+        _step[i] = sum / _solve[i * n + i];
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        double sum = _step[i];
+        for (uint k = i + 1; k < n; k++) {
+            sum -= _solve[k * n + i] * _step[k];
+        }
+        _step[i] = sum / _solve[i * n + i];
+    }
+    return true;
+}
+
+OscModelFitter::~OscModelFitter() {
+    stop();
+}
+
+OscModelFitter &OscModelFitter::getInstance() {
+    static OscModelFitter fitter;
+    return fitter;
+}
+
+void OscModelFitter::start(const std::array<AnalogOscModel *, NUM_VOICES * 2> &oscs) {
+    stop();
+    for (uint i = 0; i < oscs.size(); i++) {
+        _oscs[i] = OscState();
+        _oscs[i].osc = oscs[i];
+    }
+    _exit_thread = false;
+    _running = true;
+    _thread = std::thread(&OscModelFitter::_fitterLoop, this);
+}
+
+void OscModelFitter::stop() {
+    if (_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            _exit_thread = true;
+        }
+        _wake.notify_all();
+        _thread.join();
+    }
+    _running = false;
+}
+
+void OscModelFitter::addMeasurements(uint index, const float *results, uint num_values) {
+    if (index >= _oscs.size()) {
+        return;
+    }
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        auto &state = _oscs[index];
+        for (uint i = 0; i + 3 < num_values; i += 4) {
+            state.measurements.push_back({results[i], results[i + 1], results[i + 2], results[i + 3]});
+            state.new_measurements++;
+        }
+
+        // drop whole groups so the measurements stay in the same groups
+        while (state.measurements.size() > OSC_FIT_MAX_MEASUREMENTS) {
+            for (uint i = 0; i < OSC_FIT_GROUP_SIZE && !state.measurements.empty(); i++) {
+                state.measurements.pop_front();
+            }
+        }
+        wake = (state.measurements.size() >= OSC_FIT_MIN_MEASUREMENTS) && (state.new_measurements >= OSC_FIT_REFIT_MEASUREMENTS);
+    }
+    if (wake) {
+        _wake.notify_all();
+    }
+}
+
+void OscModelFitter::_publish(uint index) {
+    // The osc copies the published model at the start of a buffer, so it can only be rewritten once it is taken
+    auto &state = _oscs[index];
+    if (state.pending && state.osc && state.osc->modelTaken()) {
+        state.published = state.pending_model;
+        state.osc->publishModel(&state.published);
+        state.pending = false;
+    }
+}
+
+void OscModelFitter::_fitterLoop() {
+    // The refit can take as long as it needs, so only run when nothing else needs the cpu. This also drops any
+    // realtime priority inherited from the thread that started the fitter
+    sched_param param = {};
+    param.sched_priority = 0;
+    if (pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0) {
+        printf("\nosc fitter: could not set idle priority");
+    }
+
+    std::vector<OscFitMeasurement> measurements;
+    std::unique_lock<std::mutex> lock(_lock);
+    while (!_exit_thread) {
+        // hand over any models the oscs were not ready for
+        for (uint i = 0; i < _oscs.size(); i++) {
+            _publish(i);
+        }
+
+        // refit the next osc with enough new measurements
+        uint index = 0;
+        while ((index < _oscs.size()) && !((_oscs[index].measurements.size() >= OSC_FIT_MIN_MEASUREMENTS) && (_oscs[index].new_measurements >= OSC_FIT_REFIT_MEASUREMENTS))) {
+            index++;
+        }
+        if (index == _oscs.size()) {
+            _wake.wait_for(lock, OSC_FIT_POLL_TIME);
+            continue;
+        }
+        auto &state = _oscs[index];
+        measurements.assign(state.measurements.begin(), state.measurements.end());
+        state.new_measurements = 0;
+        lock.unlock();
+
+        // start from the stored model if there is one
+        const uint voice = index / 2;
+        const uint osc = index % 2;
+        const auto record = CalStore::getInstance().voice(voice);
+        CalStoreOscModel model = record.osc[osc];
+        if (!(record.valid & (CAL_STORE_OSC_VALID << osc))) {
+            const AnalogModel default_model;
+            model.up = model.down = {default_model.a, default_model.b, default_model.c, default_model.d, default_model.e, default_model.f, default_model.g, default_model.h, default_model.i, default_model.j};
+        }
+        const bool fitted = _fit.fit(measurements, model);
+        printf("\nosc refit %d %d: %s, rms error %e %e", voice, osc, fitted ? "ok" : "failed", _fit.rmsErrorUp(), _fit.rmsErrorDown());
+        if (fitted) {
+            // the file writer saves the store
+            CalStore::getInstance().setOscModel(voice, osc, model);
+        }
+
+        lock.lock();
+        if (fitted) {
+            state.pending_model = model;
+            state.pending = true;
+            _publish(index);
+        }
+    }
+}
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
@@ -0,0 +1,174 @@
+/**
+ * @file NinaOscModelFit.h
+ * @brief On device refit of the analog oscillator models from the osc tuning measurements.
+ *
+ * This does the same fit as osc_tuning_routine.py. Each side of an osc is fitted separately, the model coefficients
+ * a to h are fitted together with a tracking offset for each group of measurements, which takes up the drift of the
+ * osc while the measurements were taken. Levenberg-Marquardt is used as the offsets multiply the a coefficient.
+ * Measurements that fit badly are dropped and the fit is run again, first at 10mV and then at 5mV.
+ *
+ * The fitter service collects the measurements from the file writer and refits an osc on an idle priority thread
+ * once it has enough new measurements. The new model is handed to the osc through an atomic pointer, which the osc
+ * picks up at the start of its next buffer, and is saved in the cal store.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+
+#pragma once
+
+#include "AnalogOscGen.h"
+#include "NinaCalStore.h"
+#include "common.h"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+// number of measurements that share a tracking offset, the same as the tuning routine
+constexpr uint OSC_FIT_GROUP_SIZE = 4;
+
+// measurements needed before an osc is refitted, and how many new ones trigger the next refit
+constexpr uint OSC_FIT_MIN_MEASUREMENTS = 64;
+constexpr uint OSC_FIT_REFIT_MEASUREMENTS = 32;
+
+// measurements kept for each osc, the oldest groups are dropped after this
+constexpr uint OSC_FIT_MAX_MEASUREMENTS = 512;
+
+// measurements where either side is above this frequency are not used
+constexpr float OSC_FIT_MAX_FREQ = 80000.f;
+
+// a refit is only used if the rms error of the measurements that are kept is below this
+constexpr float OSC_FIT_MAX_RMS_ERROR = 0.002f;
+
+constexpr uint OSC_FIT_MAX_ITERATIONS = 50;
+
+// number of model coefficients fitted, a b d e f g h
+constexpr uint OSC_FIT_NUM_COEFFS = 7;
+
+/**
+ * @brief An osc tuning measurement, the voltages applied to each side and the measured period of each side
+ *
+ */
+struct OscFitMeasurement {
+    float v_up;
+    float v_down;
+    float period_up;
+    float period_down;
+};
+
+class OscModelFit {
+  public:
+    OscModelFit() = default;
+    ~OscModelFit() = default;
+
+    /**
+     * @brief Fit both sides of an osc model to the measurements
+     *
+     * @param measurements measurements in the order they were taken
+     * @param model the starting model, this is updated with the fitted model
+     * @return true if both sides fitted with an rms error below OSC_FIT_MAX_RMS_ERROR
+     */
+    bool fit(const std::vector<OscFitMeasurement> &measurements, CalStoreOscModel &model);
+
+    float rmsErrorUp() const {
+        return _rms_up;
+    }
+
+    float rmsErrorDown() const {
+        return _rms_down;
+    }
+
+  private:
+    struct Point {
+        double v;
+        double f1;
+        double f2;
+        double hz_f1;
+        double hz_f2;
+        uint group;
+        bool used;
+    };
+
+    std::vector<Point> _points;
+    std::vector<double> _params;
+    std::vector<double> _trial;
+    std::vector<double> _jtj;
+    std::vector<double> _jtr;
+    std::vector<double> _solve;
+    std::vector<double> _step;
+    uint _num_groups = 0;
+    float _rms_up = 0.f;
+    float _rms_down = 0.f;
+
+    bool _fitSide(const std::vector<OscFitMeasurement> &measurements, bool up, std::array<float, CAL_STORE_MODEL_SIZE> &coeffs, float &rms);
+    double _cost(const std::vector<double> &params);
+    void _levenbergMarquardt();
+    bool _cholesky(uint n);
+};
+
+class OscModelFitter {
+  public:
+    OscModelFitter() = default;
+    ~OscModelFitter();
+
+    /**
+     * @brief Fitter shared by the oscs, it is only started if the refit is enabled
+     *
+     */
+    static OscModelFitter &getInstance();
+
+    /**
+     * @brief Start the fitter thread, the oscs are refitted once they are added here
+     *
+     * @param oscs every osc, in the order voice 0 osc 0, voice 0 osc 1, voice 1 osc 0 and so on
+     */
+    void start(const std::array<AnalogOscModel *, NUM_VOICES * 2> &oscs);
+    void stop();
+
+    bool running() const {
+        return _running;
+    }
+
+    /**
+     * @brief Add the results of an osc tuning step, called by the file writer. Not realtime safe
+     *
+     * @param index voice * 2 + osc
+     * @param results 4 values for each measurement, the voltages and periods of the up and down sides
+     * @param num_values number of values in the results
+     */
+    void addMeasurements(uint index, const float *results, uint num_values);
+
+  private:
+    struct OscState {
+        AnalogOscModel *osc = nullptr;
+        std::deque<OscFitMeasurement> measurements;
+        uint new_measurements = 0;
+
+        // the model handed to the osc, this is only written once the osc has taken the last one
+        CalStoreOscModel published;
+        bool pending = false;
+        CalStoreOscModel pending_model;
+    };
+
+    std::array<OscState, NUM_VOICES * 2> _oscs;
+    std::mutex _lock;
+    std::condition_variable _wake;
+    std::thread _thread;
+    std::atomic<bool> _running = false;
+    bool _exit_thread = false;
+    OscModelFit _fit;
+
+    void _fitterLoop();
+    void _publish(uint index);
+};
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
@@ -442,6 +442,37 @@ class NinaParams {
         float mpe_z_fall_coeff = 1;
         float morph_mod_fb = 0;
         float morph_pos = 0;
+
+        // state params whose transformed A/B values changed in the last layer run
+        std::array<uint, NUM_LAYER_STATE_PARAMS> changed_state_params;
+        uint num_changed_state_params = 0;
+        uint state_params_run_count = 0;
+        bool common_params_changed = true;
+
+        // state params following sample accurate automation this buffer, with the transformed A/B value for
+        // each CV sample
+        struct AutomatedStateParam {
+            uint index;
+            std::array<float, CV_BUFFER_SIZE> a_values;
+            std::array<float, CV_BUFFER_SIZE> b_values;
+        };
+        std::array<AutomatedStateParam, MAX_AUTOMATED_STATE_PARAMS> automated_state_params;
+        uint num_automated_state_params = 0;
+    };
+
+    // patch state of a layer, as saved in the processor state
+    struct LayerSnapshot {
+        float layer_state = 0;
+        float morph_value = 0;
+        LayerCommonParams common_params = {0};
+        LayerStateParams state_a_params = {0};
+        LayerStateParams state_b_params = {0};
+    };
+
+    // patch state of the whole synth, the global params are the raw param values
+    struct PatchSnapshot {
+        GlobalParams global_params = {0};
+        std::array<LayerSnapshot, NUM_LAYERS> layers;
     };
 
     struct AudioInputBuffers {
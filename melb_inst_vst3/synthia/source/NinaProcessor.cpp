@@ -8,6 +8,7 @@
 
 #include "NinaController.h"
 #include "NinaParameters.h"
+#include "NinaRuntimeOptions.h"
 #include "NinaVoice.h"
 #include "base/source/fstreamer.h"
 #include "pluginterfaces/base/ftypes.h"
@@ -15,6 +16,7 @@
 #include "pluginterfaces/base/ibstream.h"
 #include "pluginterfaces/base/ustring.h"
 #include "pluginterfaces/vst/ivstparameterchanges.h"
+#include <algorithm>
 #include <chrono>
 #include <math.h>
 
@@ -26,6 +28,12 @@ namespace Nina {
 // Constants
 constexpr int MAX_MIDI_NOTES = 12;
 
+// The processor state is a header followed by the raw param values of the patch, the header holds the number of
+// params in each group so states saved with fewer params can still be loaded
+constexpr uint32 STATE_MAGIC = 0x534e494e; // "NINS"
+constexpr uint32 STATE_VERSION = 1;
+constexpr auto STATE_PUBLISH_TIMEOUT = std::chrono::milliseconds(50);
+
 //#define PRINTSIGNALS
 
 FUID Processor::uid(0xB9A3DB09, 0xBD554308, 0xACA1EF6F, 0xB02E9187);
@@ -37,11 +45,27 @@ Processor::Processor() {
     _exit_print_thread = false;
     _printThread = new std::thread(&Processor::debugPrinting, this, print_data1, print_data2, print_data3);
 #endif
-    // start the GUI message thread & init scope vars/note storage
+    // init scope vars/note storage
     _exit_gui_msg_thread = false;
     _gui_buffer_complete = false;
+    _gui_samples_ready = false;
     _current_gui_samples.store(_gui_samples_1);
-    _gui_msg_thread = new std::thread(&Processor::_processGuiMsg, this);
+
+    // apply the runtime options to the synth
+    const auto &options = RuntimeOptions::getInstance();
+    _layer_manager.setLayerWorkers(options.layer_workers);
+    _layer_manager.setSampleAccurateAutomation(options.sample_accurate_automation);
+    _layer_manager.setParallelCal(options.parallel_cal);
+    if (options.osc_refit) {
+        _layer_manager.startOscRefit();
+    }
+    _layer_manager.getSnapshot(_state_published);
+
+    // publish the scope frames straight to the shared memory ring if enabled, otherwise start the GUI
+    // message thread
+    if (!options.gui_scope_shm || !_scope_ring.open()) {
+        _gui_msg_thread = new std::thread(&Processor::_processGuiMsg, this);
+    }
 
     // preallocate max notes * max midi channels
     _held_midi_notes.reserve(127 * 16);
@@ -63,7 +87,9 @@ Processor::~Processor() {
         // Stop the GUI message thread
         _exit_gui_msg_thread = true;
         _gui_msg_thread->join();
+        delete _gui_msg_thread;
     }
+    _scope_ring.close();
 }
 
 tresult PLUGIN_API Processor::initialize(FUnknown *context) {
@@ -120,13 +146,69 @@ tresult PLUGIN_API Processor::initialize(FUnknown *context) {
 }
 
 tresult PLUGIN_API Processor::setState(IBStream *fileStream) {
+    IBStreamer streamer(fileStream, kLittleEndian);
+    uint32 magic, version, num_global, num_layers, num_common, num_state;
+    if (!streamer.readInt32u(magic) || (magic != STATE_MAGIC) || !streamer.readInt32u(version) || (version > STATE_VERSION) ||
+        !streamer.readInt32u(num_global) || !streamer.readInt32u(num_layers) || !streamer.readInt32u(num_common) || !streamer.readInt32u(num_state)) {
+        return kResultFalse;
+    }
+
+    // Start from the current patch so any params missing from an older state keep their values, and skip any
+    // params a newer state has that we don't know about
+    NinaParams::PatchSnapshot snapshot;
+    _readState(snapshot);
+    auto read_params = [&streamer](float *params, uint num_saved, uint num_params) {
+        if (!streamer.readFloatArray(params, std::min(num_saved, num_params))) {
+            return false;
+        }
+        float skip;
+        for (uint i = num_params; i < num_saved; i++) {
+            if (!streamer.readFloat(skip)) {
+                return false;
+            }
+        }
+        return true;
+    };
+    if (!read_params(snapshot.global_params.data(), num_global, NinaParams::NUM_GLOBAL_PARAMS)) {
+        return kResultFalse;
+    }
+    for (uint i = 0; i < std::min(num_layers, (uint32)NUM_LAYERS); i++) {
+        auto &layer = snapshot.layers[i];
+        if (!streamer.readFloat(layer.layer_state) || !streamer.readFloat(layer.morph_value) ||
+            !read_params(layer.common_params.data(), num_common, NinaParams::NUM_LAYER_COMMON_PARAMS) ||
+            !read_params(layer.state_a_params.data(), num_state, NinaParams::NUM_LAYER_STATE_PARAMS) ||
+            !read_params(layer.state_b_params.data(), num_state, NinaParams::NUM_LAYER_STATE_PARAMS)) {
+            return kResultFalse;
+        }
+    }
 
+    // Expand the snapshot here so the audio thread only has to apply the changes
+    while (_state_lock.test_and_set(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+    _state_snapshot = snapshot;
+    _num_state_changes = LayerManager::snapshotParamChanges(_state_snapshot, _state_changes);
+    _state_pending.store(true, std::memory_order_release);
+    _state_lock.clear(std::memory_order_release);
     return kResultTrue;
 }
 
 tresult PLUGIN_API Processor::getState(IBStream *fileStream) {
-
-    return kResultTrue;
+    NinaParams::PatchSnapshot snapshot;
+    _readState(snapshot);
+
+    IBStreamer streamer(fileStream, kLittleEndian);
+    bool ok = streamer.writeInt32u(STATE_MAGIC) && streamer.writeInt32u(STATE_VERSION) &&
+              streamer.writeInt32u(NinaParams::NUM_GLOBAL_PARAMS) && streamer.writeInt32u(NUM_LAYERS) &&
+              streamer.writeInt32u(NinaParams::NUM_LAYER_COMMON_PARAMS) && streamer.writeInt32u(NinaParams::NUM_LAYER_STATE_PARAMS) &&
+              streamer.writeFloatArray(snapshot.global_params.data(), NinaParams::NUM_GLOBAL_PARAMS);
+    for (const auto &layer : snapshot.layers) {
+        ok = ok && streamer.writeFloat(layer.layer_state) && streamer.writeFloat(layer.morph_value) &&
+             streamer.writeFloatArray(layer.common_params.data(), NinaParams::NUM_LAYER_COMMON_PARAMS) &&
+             streamer.writeFloatArray(layer.state_a_params.data(), NinaParams::NUM_LAYER_STATE_PARAMS) &&
+             streamer.writeFloatArray(layer.state_b_params.data(), NinaParams::NUM_LAYER_STATE_PARAMS);
+    }
+    return ok ? kResultTrue : kResultFalse;
 }
 
 tresult PLUGIN_API Processor::setBusArrangements(SpeakerArrangement *inputs,
@@ -150,19 +232,27 @@ tresult PLUGIN_API Processor::canProcessSampleSize(int32 symbolicSampleSize) {
 }
 
 tresult PLUGIN_API Processor::setActive(TBool state) {
-    if (state) {
-    } else {
+    // The audio thread isn't running here, so the live state can be copied directly
+    while (_state_lock.test_and_set(std::memory_order_acquire)) {
+        std::this_thread::yield();
     }
+    _layer_manager.getSnapshot(_state_published);
+    _state_lock.clear(std::memory_order_release);
+    _active.store(state, std::memory_order_release);
 
     // call base class method
     return AudioEffect::setActive(state);
 }
 
 tresult PLUGIN_API Processor::process(ProcessData &data) {
+    // Load any new patch state before the events and param changes for this buffer
+    _loadPendingState();
+
     // Process all events
     processEvents(data.inputEvents);
     processParameterChanges(data.inputParameterChanges);
     processAudio(data);
+    _publishState();
 
     return kResultTrue;
 }
@@ -175,6 +265,8 @@ bool Processor::processParameterChanges(IParameterChanges *param_changes) {
         if (count > 0) {
             // Process each param change
             _num_changed_params = 0;
+            _num_changed_param_points = 0;
+            const bool sample_accurate = _layer_manager.sampleAccurateAutomation();
             for (int32 i = 0; i < count; i++) {
                 // Get the queue of changes for this parameter, if no queue is
                 // returned then skip this parameter change
@@ -189,7 +281,21 @@ bool Processor::processParameterChanges(IParameterChanges *param_changes) {
                 // are not processed
                 int32 sampleOffset;
                 ParamValue value;
-                queue->getPoint((queue->getPointCount() - 1), sampleOffset, value);
+                const int32 num_points = queue->getPointCount();
+                queue->getPoint((num_points - 1), sampleOffset, value);
+
+                // In sample accurate mode keep every point of the queue as well, unless it is a single point
+                // at the start of the buffer which is the same as just using the last value
+                if (sample_accurate && ((num_points > 1) || (sampleOffset > 0)) &&
+                    (_num_changed_param_points + num_points <= MAX_PARAM_CHANGE_POINTS)) {
+                    for (int32 p = 0; p < num_points; p++) {
+                        int32 point_offset;
+                        ParamValue point_value;
+                        if (queue->getPoint(p, point_offset, point_value) == kResultOk) {
+                            _changed_param_points[_num_changed_param_points++] = ParamChangePoint(paramId, point_value, std::clamp(point_offset, 0, BUFFER_SIZE - 1));
+                        }
+                    }
+                }
 
                 // Set the param value and add to the vector of param IDs changed
                 _changed_params[i] = ParamChange(paramId, value);
@@ -313,18 +419,19 @@ void Processor::processAudio(ProcessData &data) {
     // All GUI buffers processed and ready to send samples?
     if (_gui_buffer_complete) {
         // printf("\nbuff send");
+        if (_scope_ring.isOpen()) {
+            // Write the frame straight into the shared memory ring, the GUI always reads the latest frame so
+            // none are skipped here
+            _copyScopeSamples(_scope_ring.beginFrame());
+            _scope_ring.publishFrame();
+            _zero_crossing_detect = false;
+            _gui_buffer_complete = false;
+            _current_samples_written = 0;
+        }
         //  If we haven't processed the previous GUI buffer yet, skip this one
-        if (!_gui_samples_ready) {
+        else if (!_gui_samples_ready) {
             // Load the ring buffer samples into the GUI buffer in the ringbuffer order
-            float *current_samples = _current_gui_samples;
-            uint ring_counter = _scope_ring_end;
-            for (uint i = 0; i < GUI_NUM_SAMPLES; i++) {
-                current_samples[i * 2] = _scope_ringbuffer_l[(ring_counter)];
-                current_samples[i * 2 + 1] = _scope_ringbuffer_r[(ring_counter++)];
-                if (ring_counter == GUI_NUM_SAMPLES) {
-                    ring_counter -= GUI_NUM_SAMPLES;
-                }
-            }
+            _copyScopeSamples(_current_gui_samples);
 
             // Swap the pointer to the other buffer to process the next samples
             if (_current_gui_samples == _gui_samples_1)
@@ -501,9 +608,47 @@ void Processor::handleMidiNoteOffEvent(const MidiNote &midi_note) {
     _layer_manager.freeVoices(midi_note);
 }
 
+void Processor::_loadPendingState() {
+    if (_state_pending.load(std::memory_order_acquire) && !_state_lock.test_and_set(std::memory_order_acquire)) {
+        _layer_manager.loadSnapshot(_state_snapshot, _num_state_changes, _state_changes);
+        _state_pending.store(false, std::memory_order_relaxed);
+        _state_lock.clear(std::memory_order_release);
+    }
+}
+
+void Processor::_publishState() {
+    // A state waiting to load is returned by _readState, so don't replace the copy until it is loaded
+    if (_state_publish_request.load(std::memory_order_acquire) && !_state_pending.load(std::memory_order_acquire) &&
+        !_state_lock.test_and_set(std::memory_order_acquire)) {
+        _layer_manager.getSnapshot(_state_published);
+        _state_publish_request.store(false, std::memory_order_relaxed);
+        _state_lock.clear(std::memory_order_release);
+    }
+}
+
+void Processor::_readState(NinaParams::PatchSnapshot &snapshot) {
+    // Ask the audio thread for a fresh copy, if it doesn't run in time the last copy is used
+    if (_active.load(std::memory_order_acquire)) {
+        _state_publish_request.store(true, std::memory_order_release);
+        const auto start = std::chrono::steady_clock::now();
+        while (_state_publish_request.load(std::memory_order_acquire) && !_state_pending.load(std::memory_order_acquire) &&
+               ((std::chrono::steady_clock::now() - start) < STATE_PUBLISH_TIMEOUT)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    while (_state_lock.test_and_set(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+    snapshot = _state_pending.load(std::memory_order_relaxed) ? _state_snapshot : _state_published;
+    _state_lock.clear(std::memory_order_release);
+}
+
 void Processor::_updateParams() {
     // Apply the param updates to the Layer Manager
     _layer_manager.updateParams(_num_changed_params, _changed_params);
+    if (_num_changed_param_points > 0) {
+        _layer_manager.updateParamPoints(_num_changed_param_points, _changed_param_points);
+    }
 }
 
 } // namespace Nina
@@ -7,6 +7,7 @@
 #pragma once
 #include "AnalogVoice.h"
 #include "GuiMsgQueue.h"
+#include "GuiScopeRing.h"
 #include "LayerManager.h"
 #include "NinaLogger.h"
 #include "NinaParameters.h"
@@ -136,6 +137,30 @@ class Processor : public AudioEffect {
     // array size is slightly bigger than the actual max params sent on a layer load
     ParamChange _changed_params[NinaParams::NUM_PARAMS * 2 * NUM_LAYERS];
 
+    /**
+     * @brief Automation points of the changed params, only filled in sample accurate automation mode
+     */
+    uint _num_changed_param_points = 0;
+    ParamChangePoint _changed_param_points[MAX_PARAM_CHANGE_POINTS];
+
+    /**
+     * @brief Patch state loaded by setState, the audio thread loads it at the start of the next buffer. The lock
+     * is only tried by the audio thread so it never waits on the host thread
+     */
+    NinaParams::PatchSnapshot _state_snapshot;
+    uint _num_state_changes = 0;
+    ParamChange _state_changes[MAX_SNAPSHOT_PARAM_CHANGES];
+    std::atomic<bool> _state_pending = false;
+    std::atomic_flag _state_lock = ATOMIC_FLAG_INIT;
+
+    /**
+     * @brief Copy of the live patch state for getState and setState, so the host thread never reads the layers.
+     * The audio thread copies it at the end of a buffer when asked, or it is copied while the audio is inactive
+     */
+    NinaParams::PatchSnapshot _state_published;
+    std::atomic<bool> _state_publish_request = false;
+    std::atomic<bool> _active = false;
+
     int _unison_voices = 1;
     float _unison_spread = 0;
     float _unison_pan = 0;
@@ -159,8 +184,9 @@ class Processor : public AudioEffect {
     std::atomic<float *> _current_gui_samples;
     std::atomic<bool> _gui_samples_ready;
 
-    std::thread *_gui_msg_thread;
+    std::thread *_gui_msg_thread = nullptr;
     std::atomic<bool> _exit_gui_msg_thread;
+    GuiScopeRing _scope_ring;
     float dc_filter_l = 0;
     float dc_filter_r = 0;
     float phase_offset = 0;
@@ -226,6 +252,18 @@ class Processor : public AudioEffect {
         }
     }
 
+    void _copyScopeSamples(float *samples) {
+        // copy the ring buffer samples interleaved, starting from the oldest sample
+        uint ring_counter = _scope_ring_end;
+        for (uint i = 0; i < GUI_NUM_SAMPLES; i++) {
+            samples[i * 2] = _scope_ringbuffer_l[(ring_counter)];
+            samples[i * 2 + 1] = _scope_ringbuffer_r[(ring_counter++)];
+            if (ring_counter == GUI_NUM_SAMPLES) {
+                ring_counter -= GUI_NUM_SAMPLES;
+            }
+        }
+    }
+
     void _updateScopeGain() {
 
         // dynamically adjust the scope gain based on the number of midi notes coming in
@@ -269,6 +307,25 @@ class Processor : public AudioEffect {
      */
     void _updateParams();
 
+    /**
+     * @brief Load the patch state from the last setState, if there is one and the host thread isn't writing it
+     */
+    void _loadPendingState();
+
+    /**
+     * @brief Copy the live patch state if getState or setState asked for it, called by the audio thread at the end
+     * of a buffer
+     */
+    void _publishState();
+
+    /**
+     * @brief Get the patch state on the host thread, from the copy published by the audio thread. A state set
+     * but not yet loaded is returned as is
+     *
+     * @param snapshot
+     */
+    void _readState(NinaParams::PatchSnapshot &snapshot);
+
     /**
      * @brief Process GUI message thread function
      */
@@ -0,0 +1,303 @@
+/**
+ * @file NinaRenderBench.cpp
+ * @brief Headless render and benchmark tool for the Nina synth engine.
+ *
+ * Drives LayerManager::processAudio outside of Sushi with a scripted stream of
+ * MIDI notes and param changes, writes the rendered wavetable and CV channels
+ * to disk and reports the per-buffer processing time against the buffer budget.
+ *
+ * usage: nina_render_bench [-n num_buffers] [-s script_file] [-o output_file] [-w layer_workers]
+ *
+ * script lines are "<buffer> <command> <args...>", # starts a comment:
+ *   <buffer> on <note> <velocity> [channel]
+ *   <buffer> off <note> [channel]
+ *   <buffer> param <param_id> <value> [offset]
+ *   <buffer> mod <src> <dst> <value> [offset]
+ *
+ * params are sent to layer 0, if a sample offset is given the change is also passed as an automation point.
+ * the points for a param in a buffer must be on consecutive lines in offset order
+ *
+ * the output file is raw float32, per buffer all 36 output channels are written
+ * one after another (12 wavetable channels, then the 12 CV pairs), each BUFFER_SIZE samples
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+#include "LayerManager.h"
+#include "public.sdk/source/vst/hosting/parameterchanges.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace Steinberg::Vst::Nina;
+
+// time available to process a single buffer, in us
+constexpr float BUFFER_BUDGET_US = 1e6f * (float)BUFFER_SIZE / (float)SAMPLE_RATE;
+constexpr uint NUM_OUTPUT_CHANNELS = NUM_VOICES + NUM_VOICES * 2;
+constexpr uint NUM_INPUT_CHANNELS = 7;
+constexpr uint DEFAULT_NUM_BUFFERS = BUFFER_RATE * 10;
+
+enum class BenchEventType {
+    NoteOn,
+    NoteOff,
+    Param
+};
+
+struct BenchEvent {
+    uint buffer;
+    BenchEventType type;
+    uint id;
+    float value;
+    uint channel;
+    int offset;
+};
+
+void addDefaultScript(std::vector<BenchEvent> &events) {
+    // basic patch with both analog oscs, the wavetable and the filter envelope in use
+    auto param = [&events](uint buffer, uint id, float value) {
+        events.push_back({buffer, BenchEventType::Param, id, value, 0, -1});
+    };
+    auto mod = [&param](uint buffer, NinaParams::ModMatrixSrc src, NinaParams::ModMatrixDst dst, float value) {
+        param(buffer, MAKE_MOD_MATRIX_PARAMID(src, dst), value);
+    };
+    mod(0, NinaParams::KeyPitch, NinaParams::Osc1Pitch, 1);
+    mod(0, NinaParams::KeyPitch, NinaParams::Osc2Pitch, 1);
+    mod(0, NinaParams::KeyPitch, NinaParams::Osc3Pitch, 1);
+    mod(0, NinaParams::AmpEnvelope, NinaParams::VcaIn, 1);
+    mod(0, NinaParams::Constant, NinaParams::Osc1Level, 1);
+    mod(0, NinaParams::Constant, NinaParams::Osc2Level, 0.8);
+    mod(0, NinaParams::Constant, NinaParams::Osc3Level, 0.8);
+    mod(0, NinaParams::Constant, NinaParams::Osc1Width, 0.6);
+    mod(0, NinaParams::Constant, NinaParams::Osc2Width, 0.6);
+    mod(0, NinaParams::Constant, NinaParams::FilterCutoff, 0.7);
+    mod(0, NinaParams::FilterEnvelope, NinaParams::FilterCutoff, 0.3);
+    mod(0, NinaParams::Lfo1, NinaParams::Osc3Shape, 0.5);
+    mod(0, NinaParams::Constant, NinaParams::AmpEnvelopeSus, 0.8);
+    mod(0, NinaParams::Constant, NinaParams::AmpEnvelopeAtt, 0.1);
+    mod(0, NinaParams::Constant, NinaParams::AmpEnvelopeRel, 0.3);
+    mod(0, NinaParams::Constant, NinaParams::AmpEnvelopeLevel, 1);
+    mod(0, NinaParams::Constant, NinaParams::FilterEnvelopeLevel, 1);
+    param(0, NinaParams::NumUnison, 0);
+
+    // play a 12 note chord every second, sweeping the cutoff while it is held
+    for (uint buffer = BUFFER_RATE / 10; buffer + BUFFER_RATE <= DEFAULT_NUM_BUFFERS; buffer += BUFFER_RATE) {
+        for (uint note = 0; note < NUM_VOICES; note++) {
+            events.push_back({buffer, BenchEventType::NoteOn, 36 + note * 5, 0.8, 0, -1});
+        }
+        for (uint step = 0; step < BUFFER_RATE / 2; step += 10) {
+            mod(buffer + step, NinaParams::Constant, NinaParams::FilterCutoff, 0.3 + step / (float)BUFFER_RATE);
+        }
+        for (uint note = 0; note < NUM_VOICES; note++) {
+            events.push_back({buffer + BUFFER_RATE * 3 / 4, BenchEventType::NoteOff, 36 + note * 5, 0, 0, -1});
+        }
+    }
+}
+
+bool loadScript(const std::string &filename, std::vector<BenchEvent> &events) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        printf("\ncould not open script %s", filename.c_str());
+        return false;
+    }
+    std::string line;
+    uint line_num = 0;
+    while (std::getline(file, line)) {
+        line_num++;
+        line = line.substr(0, line.find('#'));
+        std::stringstream ss(line);
+        BenchEvent event = {0, BenchEventType::Param, 0, 0, 0, -1};
+        std::string cmd;
+        if (!(ss >> event.buffer >> cmd)) {
+            continue;
+        }
+        bool valid = false;
+        if (cmd == "on") {
+            event.type = BenchEventType::NoteOn;
+            valid = (bool)(ss >> event.id >> event.value);
+            ss >> event.channel;
+        } else if (cmd == "off") {
+            event.type = BenchEventType::NoteOff;
+            valid = (bool)(ss >> event.id);
+            ss >> event.channel;
+        } else if (cmd == "param") {
+            valid = (bool)(ss >> event.id >> event.value);
+        } else if (cmd == "mod") {
+            uint src, dst;
+            valid = (bool)(ss >> src >> dst >> event.value) && src < NinaParams::NumSrcs && dst < NinaParams::NumDsts;
+            if (valid) {
+                event.id = MAKE_MOD_MATRIX_PARAMID((NinaParams::ModMatrixSrc)src, (NinaParams::ModMatrixDst)dst);
+            }
+        }
+        int offset;
+        if ((event.type == BenchEventType::Param) && (ss >> offset)) {
+            event.offset = offset;
+            valid = valid && (offset >= 0) && (offset < BUFFER_SIZE);
+        }
+        if (!valid) {
+            printf("\nscript line %d is invalid: %s", line_num, line.c_str());
+            return false;
+        }
+        events.push_back(event);
+    }
+    return true;
+}
+
+float percentile(const std::vector<float> &sorted, float pct) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    uint idx = std::min((uint)(pct / 100.f * (sorted.size() - 1) + 0.5f), (uint)sorted.size() - 1);
+    return sorted[idx];
+}
+
+int main(int argc, char *argv[]) {
+    uint num_buffers = DEFAULT_NUM_BUFFERS;
+    std::string script_file;
+    std::string output_file = "nina_render.raw";
+    uint num_workers = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:o:w:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            num_buffers = std::stoul(optarg);
+            break;
+        case 's':
+            script_file = optarg;
+            break;
+        case 'o':
+            output_file = optarg;
+            break;
+        case 'w':
+            num_workers = std::stoul(optarg);
+            break;
+        default:
+            printf("usage: %s [-n num_buffers] [-s script_file] [-o output_file] [-w layer_workers]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<BenchEvent> events;
+    if (script_file.empty()) {
+        addDefaultScript(events);
+    } else if (!loadScript(script_file, events)) {
+        return 1;
+    }
+    std::stable_sort(events.begin(), events.end(), [](const BenchEvent &a, const BenchEvent &b) { return a.buffer < b.buffer; });
+
+    std::ofstream out(output_file, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        printf("\ncould not open output %s", output_file.c_str());
+        return 1;
+    }
+
+    // setup the process data the same way sushi presents it to the processor
+    LayerManager manager;
+    manager.setUnitTestMode();
+    manager.setLayerWorkers(num_workers);
+    Steinberg::Vst::ProcessData data;
+    Steinberg::Vst::ProcessContext context = {};
+    context.tempo = 120.f;
+    data.processContext = &context;
+    Steinberg::Vst::AudioBusBuffers outputs;
+    Steinberg::Vst::AudioBusBuffers inputs;
+    data.outputs = &outputs;
+    data.inputs = &inputs;
+    data.numSamples = BUFFER_SIZE;
+    Steinberg::Vst::ParameterChanges out_param_changes(NinaParams::NUM_PARAMS);
+    data.outputParameterChanges = &out_param_changes;
+
+    std::vector<float> output_samples(NUM_OUTPUT_CHANNELS * BUFFER_SIZE, 0.f);
+    std::vector<float> input_samples(NUM_INPUT_CHANNELS * BUFFER_SIZE, 0.f);
+    float *output_chs[NUM_OUTPUT_CHANNELS];
+    float *input_chs[NUM_INPUT_CHANNELS];
+    for (uint i = 0; i < NUM_OUTPUT_CHANNELS; i++) {
+        output_chs[i] = output_samples.data() + i * BUFFER_SIZE;
+    }
+    for (uint i = 0; i < NUM_INPUT_CHANNELS; i++) {
+        input_chs[i] = input_samples.data() + i * BUFFER_SIZE;
+    }
+    outputs.numChannels = NUM_OUTPUT_CHANNELS;
+    outputs.channelBuffers32 = output_chs;
+    inputs.numChannels = NUM_INPUT_CHANNELS;
+    inputs.channelBuffers32 = input_chs;
+
+    // the tuning input is read by the osc state machines, hold it at a nominal count so they stay quiet
+    std::fill(input_chs[6], input_chs[6] + BUFFER_SIZE, 1.f);
+
+    std::vector<float> buffer_times;
+    buffer_times.reserve(num_buffers);
+    std::vector<ParamChangePoint> points;
+    points.reserve(MAX_PARAM_CHANGE_POINTS);
+    auto event = events.begin();
+    printf("\nrendering %d buffers to %s", num_buffers, output_file.c_str());
+    for (uint buffer = 0; buffer < num_buffers; buffer++) {
+        // apply any scripted events for this buffer, these are not timed as they happen outside of the process call
+        points.clear();
+        while (event != events.end() && event->buffer <= buffer) {
+            switch (event->type) {
+            case BenchEventType::NoteOn: {
+                Steinberg::Vst::NoteOnEvent note = {};
+                note.channel = event->channel;
+                note.pitch = event->id;
+                note.velocity = event->value;
+                manager.allocateVoices(MidiNote(note));
+                break;
+            }
+            case BenchEventType::NoteOff: {
+                Steinberg::Vst::NoteOffEvent note = {};
+                note.channel = event->channel;
+                note.pitch = event->id;
+                manager.freeVoices(MidiNote(note));
+                break;
+            }
+            case BenchEventType::Param: {
+                ParamChange change = make_param_layer(ParamChange(event->id, event->value), 0);
+                manager.updateParams(1, &change);
+                if (event->offset >= 0) {
+                    points.push_back(ParamChangePoint(change.param_id, event->value, event->offset));
+                }
+                break;
+            }
+            }
+            event++;
+        }
+        if (points.size() > 0) {
+            manager.updateParamPoints(points.size(), points.data());
+        }
+
+        out_param_changes.clearQueue();
+        auto start = std::chrono::steady_clock::now();
+        manager.processAudio(data);
+        auto finish = std::chrono::steady_clock::now();
+        buffer_times.push_back(std::chrono::duration<float, std::micro>(finish - start).count());
+        context.projectTimeSamples += BUFFER_SIZE;
+        out.write(reinterpret_cast<const char *>(output_samples.data()), output_samples.size() * sizeof(float));
+    }
+    out.close();
+
+    // report the buffer time percentiles against the realtime budget
+    std::vector<float> sorted = buffer_times;
+    std::sort(sorted.begin(), sorted.end());
+    uint overruns = std::count_if(sorted.begin(), sorted.end(), [](float t) { return t > BUFFER_BUDGET_US; });
+    float total = 0;
+    for (float t : sorted) {
+        total += t;
+    }
+    printf("\n\nbuffer budget: %.1f us (%d samples @ %d Hz)", BUFFER_BUDGET_US, BUFFER_SIZE, SAMPLE_RATE);
+    printf("\n%-6s %10s %8s", "", "us", "budget");
+    const float pcts[] = {50.f, 90.f, 99.f, 99.9f};
+    for (float pct : pcts) {
+        float t = percentile(sorted, pct);
+        printf("\np%-5g %10.1f %7.1f%%", pct, t, 100.f * t / BUFFER_BUDGET_US);
+    }
+    float max = sorted.empty() ? 0 : sorted.back();
+    float mean = sorted.empty() ? 0 : total / sorted.size();
+    printf("\n%-6s %10.1f %7.1f%%", "max", max, 100.f * max / BUFFER_BUDGET_US);
+    printf("\n%-6s %10.1f %7.1f%%", "mean", mean, 100.f * mean / BUFFER_BUDGET_US);
+    printf("\noverruns: %d of %d buffers\n", overruns, num_buffers);
+    return 0;
+}
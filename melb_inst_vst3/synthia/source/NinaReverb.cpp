@@ -1,349 +1,855 @@
 
 #include "NinaReverb.h"
+#include "AudioFile.h"
+#include <algorithm>
+#include <filesystem>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 namespace Steinberg {
 namespace Vst {
 namespace Nina {
 
-NinaReverb::NinaReverb(/* args */) {
+ReverbModel::ReverbModel(ReverbModes mode) :
+    _mode(mode) {
     input_lpf_0.mute();
     input_lpf_1.mute();
     input_hpf_0.mute();
     input_hpf_1.mute();
+    _params.fill(0.f);
+    for (auto &line : _predelay_line) {
+        line.assign(REVERB_PREDELAY_SIZE, 0.f);
+    }
+
+    // only create the algorithms used by this mode
+    switch (mode) {
+    case ReverbModes::room:
+        _early = std::make_unique<fv3::earlyref_f>();
+        _early->loadPresetReflection(FV3_EARLYREF_PRESET_1);
+        _early->setMuteOnChange(false);
+        _early->setdryr(0); // mute dry signal
+        _early->setwet(0);  // 0dB
+        _early->setwidth(0.8);
+        _early->setLRDelay(0.3);
+        _early->setLRCrossApFreq(750, 4);
+        _early->setDiffusionApFreq(150, 4);
+        _early->setSampleRate(sampleRate);
+
+        _late = std::make_unique<fv3::progenitor2_f>();
+        _late->setMuteOnChange(false);
+        _late->setwet(0);      // 0dB
+        _late->setdryr(0.001); // mute dry signal
+        _late->setwidth(1.0);
+        _late->setSampleRate(sampleRate);
+        break;
+
+    case ReverbModes::plate:
+        _strev = std::make_unique<fv3::strev_f>();
+        _strev->setdryr(0);
+        _strev->setwetr(1);
+        _strev->setMuteOnChange(false);
+        _strev->setdccutfreq(6);
+        _strev->setspinlimit(12);
+        _strev->setspindiff(0.15);
+        _strev->setSampleRate(sampleRate);
+        break;
+
+    case ReverbModes::ir:
+        // the tail partitions are processed on the convolver threads, which are created here and run at the
+        // priority of the thread creating the model
+        _conv = std::make_unique<fv3::irmodel3p_f>();
+        _conv->setFragmentSize(REVERB_IR_HEAD_SIZE, REVERB_IR_TAIL_FACTOR);
+        _conv->setprocessoptions(FV3_IR_MUTE_DRY | FV3_IR_SKIP_FILTER);
+        _conv->setwet(0); // 0dB
+        _conv->setwidth(1.0);
+        break;
 
-    early.loadPresetReflection(FV3_EARLYREF_PRESET_1);
-    early.setMuteOnChange(false);
-    early.setdryr(0); // mute dry signal
-    early.setwet(0);  // 0dB
-    early.setwidth(0.8);
-    early.setLRDelay(0.3);
-    early.setLRCrossApFreq(750, 4);
-    early.setDiffusionApFreq(150, 4);
-    early.setSampleRate(sampleRate);
-    early_send = 0.20;
-
-    late.setMuteOnChange(false);
-    late.setwet(0);      // 0dB
-    late.setdryr(0.001); // mute dry signal
-    late.setwidth(1.0);
-    early.setSampleRate(sampleRate);
-    late.setSampleRate(sampleRate);
-    nrev.setdryr(0);
-    nrev.setwetr(1);
-    nrev.setMuteOnChange(false);
-    nrev.setSampleRate(sampleRate);
-
-    nrevb.setdryr(0);
-    nrevb.setwetr(1);
-    nrevb.setMuteOnChange(false);
-    nrevb.setSampleRate(sampleRate);
-
-    strev.setdryr(0);
-    strev.setwetr(1);
-    strev.setMuteOnChange(false);
-    strev.setdccutfreq(6);
-    strev.setspinlimit(12);
-    strev.setspindiff(0.15);
-    strev.setSampleRate(sampleRate);
-    early_hall.loadPresetReflection(FV3_EARLYREF_PRESET_1);
-    early_hall.setMuteOnChange(false);
-    early_hall.setdryr(0); // mute dry signal
-    early_hall.setwet(0);  // 0dB
-    early_hall.setwidth(0.8);
-    early_hall.setLRDelay(0.3);
-    early_hall.setLRCrossApFreq(750, 4);
-    early_hall.setDiffusionApFreq(150, 4);
-    early_hall.setSampleRate(sampleRate);
-
-    late_hall.setMuteOnChange(false);
-    late_hall.setwet(0);  // 0dB
-    late_hall.setdryr(0); // mute dry signal
-    late_hall.setwidth(1.0);
-    late_hall.setSampleRate(sampleRate);
-    model = &nrevb;
+    case ReverbModes::hall:
+    default:
+        _early = std::make_unique<fv3::earlyref_f>();
+        _early->loadPresetReflection(FV3_EARLYREF_PRESET_1);
+        _early->setMuteOnChange(false);
+        _early->setdryr(0); // mute dry signal
+        _early->setwet(0);  // 0dB
+        _early->setwidth(0.8);
+        _early->setLRDelay(0.3);
+        _early->setLRCrossApFreq(750, 4);
+        _early->setDiffusionApFreq(150, 4);
+        _early->setSampleRate(sampleRate);
+
+        _late_hall = std::make_unique<fv3::zrev2_f>();
+        _late_hall->setMuteOnChange(false);
+        _late_hall->setwet(0);  // 0dB
+        _late_hall->setdryr(0); // mute dry signal
+        _late_hall->setwidth(1.0);
+        _late_hall->setSampleRate(sampleRate);
+        break;
+    }
 
     setInputLPF(20000);
     setInputHPF(20);
-};
+}
 
-NinaReverb::~NinaReverb() {
+void ReverbModel::setInputLPF(float freq) {
+    if (freq < 0) {
+        freq = 0;
+    } else if (freq > sampleRate / 2.0) {
+        freq = sampleRate / 2.0;
+    }
+
+    input_lpf_0.setLPF_BW(freq, sampleRate);
+    input_lpf_1.setLPF_BW(freq, sampleRate);
 }
 
-void NinaReverb::run(float **inputs, float **final_outputs, uint32_t frames) {
-    if (_hard_mute) {
-        for (int i = 0; i < BUFFER_SIZE; i++) {
-            outputs[0][i] = 0.f;
-            outputs[1][i] = 0.f;
-        }
-        _pitch_shift.reset();
+void ReverbModel::setInputHPF(float freq) {
+    if (freq < 0) {
+        freq = 0;
+    } else if (freq > sampleRate / 2.0) {
+        freq = sampleRate / 2.0;
+    }
 
-        input_hpf_0.mute();
-        input_hpf_1.mute();
-        input_lpf_0.mute();
-        input_lpf_1.mute();
-        early_hall.mute();
-        late_hall.mute();
-        early.mute();
-        late.mute();
-        nrev.mute();
-        nrevb.mute();
-        strev.mute();
-    }
-    for (uint32_t index = 0; index < paramCount; index++) {
-        if (_invalidated_params[index]) {
-            oldParams[index] = newParams[index];
-            float value = newParams[index];
-
-            switch (index) {
-            case paramWet:
-                // do something?
-                break;
-            case paramDry:
-                break;
-            case paramEarly:
-                early_level = (_early_setting * 1.5) * (value / 100.0);
-                break;
-            case paramEarlySend:
-                early_send = (value / 100.0);
-                break;
-            case paramLate:
-                late_level = (value / 100.0);
-                break;
-            case paramSize:
-                early.setRSFactor(value / 10.0);
-                late.setRSFactor(value / 10.0);
-                early_hall.setRSFactor(value / 10.0);
-                late_hall.setRSFactor(value / 80.0);
-                late.setbassboost(newParams[paramBoost] / 20.0 / pow(newParams[paramDecay], 1.5) * (newParams[paramSize] / 10.0));
-                break;
-            case paramWidth:
-                strev.setwidth(value / 120.0);
-                nrev.setwidth(value / 120.0);
-                nrevb.setwidth(value / 120.0);
-                early.setwidth(value / 120.0);
-                late.setwidth(value / 100.0);
-                early_hall.setwidth(value / 100.0);
-                late_hall.setwidth(value / 100.0);
-                break;
-            case paramPredelay:
-
-                strev.setPreDelay(value);
-                nrev.setPreDelay(value);
-                nrevb.setPreDelay(value);
-                late.setPreDelay(value);
-                late_hall.setPreDelay(value);
-                // printf("\n set predelayu %f", value);
-                break;
-            case paramDecay:
-                late_hall.setrt60(value);
-                strev.setrt60(value);
-                nrev.setrt60(value);
-                nrevb.setrt60(value);
-                late.setrt60(value);
-                late.setbassboost(newParams[paramBoost] / 20.0 / pow(newParams[paramDecay], 1.5) * (newParams[paramSize] / 10.0));
-                break;
-            case paramDiffuse:
-                late_hall.setidiffusion1(value / 140.0);
-                late_hall.setapfeedback(value / 140.0);
-                late.setidiffusion1(value / 120.0);
-                late.setodiffusion1(value / 120.0);
-                break;
-            case paramSpin:
-                late_hall.setspin(value);
-                late.setspin(value);
-                late.setspin2(std::sqrt(100.0 - (10.0 - value) * (10.0 - value)) / 2.0);
-                strev.setspin(value);
-
-                break;
-            case paramModulation: {
-                float mod = value + 0.001;
-                late_hall.setspinfactor(mod);
-                late_hall.setlfofactor(mod);
-            } break;
-            case paramWander:
-                late_hall.setwander(value);
-                strev.setwander(value / 200.0 + 0.1);
-                late.setwander(value / 200.0 + 0.1);
-                late.setwander2(value / 200.0 + 0.1);
-                strev.setspindiff(value / 1000.f);
-                strev.setwander(value / 200.f + 0.00);
-                strev.setmodulationnoise1(value / 200.f);
-                strev.setmodulationnoise2(value / 200.f);
-
-                break;
-            case paramHighXover:
-                late_hall.setxover_high(value);
-                break;
-            case paramHighMult: {
-                float mult_high = _tone_setting + 0.5;
-                late_hall.setrt60_factor_high(mult_high * value);
-            } break;
-            case paramLowXover:
-                late_hall.setxover_low(value);
-                break;
-            case paramLowMult: {
-                float mult_low = 1.5 - _tone_setting;
-                late_hall.setrt60_factor_low(mult_low * value);
-            } break;
-            case paramInHighCut: {
-                float mult_high = _tone_setting + 0.5;
-                late_hall.setoutputlpf(mult_high * value);
-                early_hall.setoutputlpf(mult_high * value);
-                setInputLPF(value);
-            } break;
-            case paramEarlyDamp: {
-                float mult_high = _tone_setting + 0.5;
-                nrev.setDampLpf(mult_high * value);
-                nrevb.setDampLpf(mult_high * value);
-                strev.setdamp(mult_high * value);
-                strev.setoutputdamp(mult_high * value);
-                early.setoutputlpf(value * mult_high);
-                // printf("\n early damp: %f", value * mult_high);
-            } break;
-            case paramLateDamp: {
-                float mult_high = _tone_setting + 0.5;
-                late.setdamp(mult_high * value);
-                late.setoutputdamp(mult_high * value);
-            } break;
-            case paramBoost:
-                late.setbassboost(newParams[paramBoost] / 20.0 / pow(newParams[paramDecay], 1.5) * (newParams[paramSize] / 10.0));
-                break;
-            case paramBoostLPF:
-                late.setdamp2(newParams[paramBoostLPF]);
-                break;
-            case paramInLowCut: {
-                float mult_low = 1.5 - _tone_setting;
-                early_hall.setoutputhpf(value);
-                late_hall.setoutputhpf(value);
-                strev.setdccutfreq(mult_low * value);
-                early.setoutputhpf(mult_low * value);
-                setInputHPF(value);
-            } break;
-            case paramTone:
-                break;
-            }
-            if (index == paramInternalAlgo) {
-                fv3::revbase_f *previous = model;
-                int algorithm = value;
-                if (algorithm == ALGORITHM_NREV) {
-                    model = &nrev;
-                } else if (algorithm == ALGORITHM_NREV_B) {
-                    model = &nrevb;
-                } else if (algorithm == ALGORITHM_STREV) {
-                    model = &strev;
-                }
-                if (model != previous) {
-                    previous->mute();
-                }
-            }
+    input_hpf_0.setHPF_BW(freq, sampleRate);
+    input_hpf_1.setHPF_BW(freq, sampleRate);
+}
+
+void ReverbModel::mute() {
+    input_hpf_0.mute();
+    input_hpf_1.mute();
+    input_lpf_0.mute();
+    input_lpf_1.mute();
+    if (_early) {
+        _early->mute();
+    }
+    if (_late) {
+        _late->mute();
+    }
+    if (_strev) {
+        _strev->mute();
+    }
+    if (_late_hall) {
+        _late_hall->mute();
+    }
+    if (_conv) {
+        _conv->mute();
+    }
+    for (auto &line : _predelay_line) {
+        std::fill(line.begin(), line.end(), 0.f);
+    }
+    _predelay = _predelay_target;
+}
+
+bool ReverbModel::loadImpulse(const std::string &filename) {
+    AudioFile<float> file;
+    if (!_conv || !file.load(filename) || (file.getNumChannels() == 0) || (file.getNumSamplesPerChannel() < 2)) {
+        return false;
+    }
+
+    // resample the IR to the engine rate and limit the length, a mono IR is used for both channels
+    const auto &file_l = file.samples[0];
+    const auto &file_r = file.samples[file.getNumChannels() > 1 ? 1 : 0];
+    const uint file_length = file.getNumSamplesPerChannel();
+    const double ratio = (double)file.getSampleRate() / (double)SAMPLE_RATE;
+    const uint length = std::min((uint)((double)(file_length - 1) / ratio) + 1, (uint)(REVERB_IR_MAX_TIME * SAMPLE_RATE));
+    std::vector<float> ir_l(length);
+    std::vector<float> ir_r(length);
+    double energy = 0.0;
+    for (uint i = 0; i < length; i++) {
+        const double pos = (double)i * ratio;
+        const uint index = std::min((uint)pos, file_length - 2);
+        const float frac = (float)(pos - (double)index);
+        ir_l[i] = file_l[index] + frac * (file_l[index + 1] - file_l[index]);
+        ir_r[i] = file_r[index] + frac * (file_r[index + 1] - file_r[index]);
+        energy += 0.5 * ((double)ir_l[i] * ir_l[i] + (double)ir_r[i] * ir_r[i]);
+    }
+    if (energy <= 0.0) {
+        return false;
+    }
+
+    // normalise to unity energy so the IR presets sit at a similar level to the algorithms
+    const float gain = (float)(1.0 / std::sqrt(energy));
+    for (uint i = 0; i < length; i++) {
+        ir_l[i] *= gain;
+        ir_r[i] *= gain;
+    }
+    try {
+        _conv->loadImpulse(ir_l.data(), ir_r.data(), length);
+    } catch (const std::bad_alloc &) {
+        return false;
+    }
+    return _conv->getImpulseSize() > 0;
+}
+
+void ReverbModel::update(const std::array<float, paramCount> &params, float tone, float early_setting, bool apply_all) {
+    const bool tone_changed = apply_all || (tone != _tone_setting);
+    const bool early_changed = apply_all || (early_setting != _early_setting);
+    _tone_setting = tone;
+    _early_setting = early_setting;
+
+    // update all the values first, as some params depend on others
+    std::array<bool, paramCount> changed;
+    for (uint index = 0; index < paramCount; index++) {
+        changed[index] = apply_all || (params[index] != _params[index]);
+        _params[index] = params[index];
+    }
+
+    // the tone and early settings scale some of the params
+    if (tone_changed) {
+        changed[paramHighMult] = true;
+        changed[paramLowMult] = true;
+        changed[paramEarlyDamp] = true;
+        changed[paramLateDamp] = true;
+    }
+    if (early_changed) {
+        changed[paramEarly] = true;
+    }
+    for (uint index = 0; index < paramCount; index++) {
+        if (changed[index]) {
+            _applyParam(index);
         }
     }
-    _invalidated_params.fill(false);
+}
 
-    if (_hard_mute) {
-        _hard_mute = false;
-        return;
+void ReverbModel::_applyParam(uint index) {
+    const float value = _params[index];
+    const float mult_high = _tone_setting + 0.5;
+    const float mult_low = 1.5 - _tone_setting;
+    const float bass_boost = _params[paramBoost] / 20.0 / pow(_params[paramDecay], 1.5) * (_params[paramSize] / 10.0);
+
+    // params used by all the algorithms
+    switch (index) {
+    case paramEarly:
+        _early_level = (_early_setting * 1.5) * (value / 100.0);
+        break;
+    case paramEarlySend:
+        _early_send = (value / 100.0);
+        break;
+    case paramLate:
+        _late_level = (value / 100.0);
+        break;
+    case paramInHighCut:
+        setInputLPF(value);
+        break;
+    case paramInLowCut:
+        setInputHPF(value);
+        break;
+    case paramPredelay:
+        _predelay_target = (uint)(std::clamp(value, 0.f, REVERB_MAX_PREDELAY) * sampleRate / 1000.f);
+        break;
+    default:
+        break;
+    }
+
+    switch (_mode) {
+    case ReverbModes::room:
+        switch (index) {
+        case paramSize:
+            _early->setRSFactor(value / 10.0);
+            _late->setRSFactor(value / 10.0);
+            _late->setbassboost(bass_boost);
+            break;
+        case paramWidth:
+            _early->setwidth(value / 120.0);
+            _late->setwidth(value / 100.0);
+            break;
+        case paramDecay:
+            _late->setrt60(value);
+            _late->setbassboost(bass_boost);
+            break;
+        case paramDiffuse:
+            _late->setidiffusion1(value / 120.0);
+            _late->setodiffusion1(value / 120.0);
+            break;
+        case paramSpin:
+            _late->setspin(value);
+            _late->setspin2(std::sqrt(100.0 - (10.0 - value) * (10.0 - value)) / 2.0);
+            break;
+        case paramWander:
+            _late->setwander(value / 200.0 + 0.1);
+            _late->setwander2(value / 200.0 + 0.1);
+            break;
+        case paramEarlyDamp:
+            _early->setoutputlpf(value * mult_high);
+            break;
+        case paramLateDamp:
+            _late->setdamp(mult_high * value);
+            _late->setoutputdamp(mult_high * value);
+            break;
+        case paramBoost:
+            _late->setbassboost(bass_boost);
+            break;
+        case paramBoostLPF:
+            _late->setdamp2(value);
+            break;
+        case paramInLowCut:
+            _early->setoutputhpf(mult_low * value);
+            break;
+        default:
+            break;
+        }
+        break;
+
+    case ReverbModes::plate:
+        switch (index) {
+        case paramWidth:
+            _strev->setwidth(value / 120.0);
+            break;
+        case paramDecay:
+            _strev->setrt60(value);
+            break;
+        case paramSpin:
+            _strev->setspin(value);
+            break;
+        case paramWander:
+            _strev->setspindiff(value / 1000.f);
+            _strev->setwander(value / 200.f + 0.00);
+            _strev->setmodulationnoise1(value / 200.f);
+            _strev->setmodulationnoise2(value / 200.f);
+            break;
+        case paramEarlyDamp:
+            _strev->setdamp(mult_high * value);
+            _strev->setoutputdamp(mult_high * value);
+            break;
+        case paramInLowCut:
+            _strev->setdccutfreq(mult_low * value);
+            break;
+        default:
+            break;
+        }
+        break;
+
+    case ReverbModes::ir:
+        switch (index) {
+        case paramWidth:
+            _conv->setwidth(value / 100.0);
+            break;
+        case paramHighMult:
+        case paramInHighCut:
+            // the IR has its own decay, so the tone only sets the input filter
+            setInputLPF(mult_high * _params[paramInHighCut]);
+            break;
+        default:
+            break;
+        }
+        break;
+
+    case ReverbModes::hall:
+    default:
+        switch (index) {
+        case paramSize:
+            _early->setRSFactor(value / 10.0);
+            _late_hall->setRSFactor(value / 80.0);
+            break;
+        case paramWidth:
+            _early->setwidth(value / 100.0);
+            _late_hall->setwidth(value / 100.0);
+            break;
+        case paramDecay:
+            _late_hall->setrt60(value);
+            break;
+        case paramDiffuse:
+            _late_hall->setidiffusion1(value / 140.0);
+            _late_hall->setapfeedback(value / 140.0);
+            break;
+        case paramSpin:
+            _late_hall->setspin(value);
+            break;
+        case paramModulation: {
+            float mod = value + 0.001;
+            _late_hall->setspinfactor(mod);
+            _late_hall->setlfofactor(mod);
+        } break;
+        case paramWander:
+            _late_hall->setwander(value);
+            break;
+        case paramHighXover:
+            _late_hall->setxover_high(value);
+            break;
+        case paramHighMult:
+            _late_hall->setrt60_factor_high(mult_high * value);
+            break;
+        case paramLowXover:
+            _late_hall->setxover_low(value);
+            break;
+        case paramLowMult:
+            _late_hall->setrt60_factor_low(mult_low * value);
+            break;
+        case paramInHighCut:
+            _late_hall->setoutputlpf(mult_high * value);
+            _early->setoutputlpf(mult_high * value);
+            break;
+        case paramInLowCut:
+            _early->setoutputhpf(value);
+            _late_hall->setoutputhpf(value);
+            break;
+        default:
+            break;
+        }
+        break;
     }
+}
+
+void ReverbModel::process(float **inputs, float in_gain, const float *shimmer_l, const float *shimmer_r, float shimmer_gain) {
     // run the input filtering for all reverb algos
     for (uint32_t i = 0; i < BUFFER_SIZE; i++) {
         filtered_input_buffer[0][i] = in_gain * input_lpf_0.process(input_hpf_0.process(inputs[0][i]));
         filtered_input_buffer[1][i] = in_gain * input_lpf_1.process(input_hpf_1.process(inputs[1][i]));
     }
 
-    bufc++;
-    if (bufc % 700 == 0) {
-        // printf("\n mode: %d %f %f wander stuff %f %f %f ", _mode, early_level, late_level, strev.getwander(), strev.getmodulationnoise1(), strev.getmodulationnoise2());
-    }
-    const auto tmp = _mode;
-    switch (tmp) {
+    switch (_mode) {
     case ReverbModes::room:
-        /* code */
-        {
-            early.processreplace(
-                const_cast<float *>(filtered_input_buffer[0]),
-                const_cast<float *>(filtered_input_buffer[1]),
-                early_out_buffer[0],
-                early_out_buffer[1],
-                BUFFER_SIZE);
-
-            for (uint32_t i = 0; i < BUFFER_SIZE; i++) {
-                late_in_buffer[0][i] = early_send * early_out_buffer[0][i] + filtered_input_buffer[0][i] + _shimmer_gain * _pitch_shift_left[i];
-                late_in_buffer[1][i] = early_send * early_out_buffer[1][i] + filtered_input_buffer[1][i] + _shimmer_gain * _pitch_shift_right[i];
-            }
-            late.processreplace(
-                const_cast<float *>(late_in_buffer[0]),
-                const_cast<float *>(late_in_buffer[1]),
-                late_out_buffer[0],
-                late_out_buffer[1],
-                BUFFER_SIZE);
-        }
-        if (bufc % 700 == 0) {
-            // printf("\n");
-            for (int i = 0; i < BUFFER_SIZE; i++) {
-                // printf(" %f", late_out_buffer[0][i]);
-            }
+        _early->processreplace(
+            const_cast<float *>(filtered_input_buffer[0]),
+            const_cast<float *>(filtered_input_buffer[1]),
+            early_out_buffer[0],
+            early_out_buffer[1],
+            BUFFER_SIZE);
+        for (uint32_t i = 0; i < BUFFER_SIZE; i++) {
+            late_in_buffer[0][i] = _early_send * early_out_buffer[0][i] + filtered_input_buffer[0][i] + shimmer_gain * shimmer_l[i];
+            late_in_buffer[1][i] = _early_send * early_out_buffer[1][i] + filtered_input_buffer[1][i] + shimmer_gain * shimmer_r[i];
         }
+        _late->processreplace(
+            const_cast<float *>(late_in_buffer[0]),
+            const_cast<float *>(late_in_buffer[1]),
+            late_out_buffer[0],
+            late_out_buffer[1],
+            BUFFER_SIZE);
         break;
 
-    case ReverbModes::plate: {
-
+    case ReverbModes::plate:
         for (uint32_t i = 0; i < BUFFER_SIZE; i++) {
-            filtered_input_buffer[0][i] += _shimmer_gain * _pitch_shift_left[i];
-            filtered_input_buffer[1][i] += _shimmer_gain * _pitch_shift_right[i];
+            filtered_input_buffer[0][i] += shimmer_gain * shimmer_l[i];
+            filtered_input_buffer[1][i] += shimmer_gain * shimmer_r[i];
         }
-        early_level = 0.f;
-        strev.processreplace(
+        _early_level = 0.f;
+        _strev->processreplace(
             const_cast<float *>(filtered_input_buffer[0]),
             const_cast<float *>(filtered_input_buffer[1]),
             late_out_buffer[0],
             late_out_buffer[1],
             BUFFER_SIZE);
+        break;
 
-    } break;
+    case ReverbModes::ir:
+        for (uint32_t i = 0; i < BUFFER_SIZE; i++) {
+            filtered_input_buffer[0][i] += shimmer_gain * shimmer_l[i];
+            filtered_input_buffer[1][i] += shimmer_gain * shimmer_r[i];
+        }
+        _early_level = 0.f;
+        _conv->processreplace(
+            filtered_input_buffer[0],
+            filtered_input_buffer[1],
+            late_out_buffer[0],
+            late_out_buffer[1],
+            BUFFER_SIZE);
+        break;
 
-    case ReverbModes::hall: {
-        early_hall.processreplace(
+    case ReverbModes::hall:
+    default:
+        _early->processreplace(
             const_cast<float *>(filtered_input_buffer[0]),
             const_cast<float *>(filtered_input_buffer[1]),
             early_out_buffer[0],
             early_out_buffer[1],
             BUFFER_SIZE);
         for (uint32_t i = 0; i < BUFFER_SIZE; i++) {
-            late_in_buffer[0][i] = early_send * early_out_buffer[0][i] + filtered_input_buffer[0][i] + _shimmer_gain * _pitch_shift_left[i];
-            late_in_buffer[1][i] = early_send * early_out_buffer[1][i] + filtered_input_buffer[1][i] + _shimmer_gain * _pitch_shift_right[i];
+            late_in_buffer[0][i] = _early_send * early_out_buffer[0][i] + filtered_input_buffer[0][i] + shimmer_gain * shimmer_l[i];
+            late_in_buffer[1][i] = _early_send * early_out_buffer[1][i] + filtered_input_buffer[1][i] + shimmer_gain * shimmer_r[i];
         }
-        late_hall.processreplace(
+        _late_hall->processreplace(
             const_cast<float *>(late_in_buffer[0]),
             const_cast<float *>(late_in_buffer[1]),
             late_out_buffer[0],
             late_out_buffer[1],
             BUFFER_SIZE);
-    } break;
+        break;
+    }
+    _runPredelay();
+}
+
+void ReverbModel::_runPredelay() {
+    constexpr uint mask = REVERB_PREDELAY_SIZE - 1;
+    const uint write = _predelay_write;
+    for (uint c = 0; c < 2; c++) {
+        float *line = _predelay_line[c].data();
+        float *buffer = late_out_buffer[c];
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            line[(write + i) & mask] = buffer[i];
+        }
+        if (_predelay == _predelay_target) {
+            for (uint i = 0; i < BUFFER_SIZE; i++) {
+                buffer[i] = line[(write + i - _predelay) & mask];
+            }
+        } else {
+            // crossfade from the old read position to the new one
+            constexpr float fade_inc = 1.f / (float)BUFFER_SIZE;
+            for (uint i = 0; i < BUFFER_SIZE; i++) {
+                const float fade = fade_inc * (float)(i + 1);
+                buffer[i] = (1.f - fade) * line[(write + i - _predelay) & mask] + fade * line[(write + i - _predelay_target) & mask];
+            }
+        }
+    }
+    _predelay = _predelay_target;
+    _predelay_write = (write + BUFFER_SIZE) & mask;
+}
+
+NinaReverb::NinaReverb(/* args */) {
+    _pitch_shift_left.fill(0.f);
+    _pitch_shift_right.fill(0.f);
+    _pitch_shift.reset();
+    newParams.fill(0.f);
+    setDecay(0.5);
+
+    // any preset with an IR in the IR folder uses it instead of its algorithm
+    for (uint preset = 0; preset < NUM_REVERB_PRESETS; preset++) {
+        auto filename = NINA_REVERB_IR_FILE_PATH("preset_" + std::to_string(preset + 1) + ".wav");
+        std::error_code ec;
+        if (std::filesystem::is_regular_file(filename, ec)) {
+            _preset_irs[preset] = filename;
+        }
+    }
+
+    // create the first preset here so there is always an active model, the rest are created by the pool worker
+    _selected_preset = 0;
+    _mode = _presetMode(0);
+    _mode2 = _presetMode(0);
+    loadPresetParams(0, newParams);
+    auto &slot = _slots[_active_slot];
+    slot.preset = 0;
+    slot.params = newParams;
+    slot.tone_setting = _tone_setting;
+    slot.early_setting = _early_setting;
+    slot.model = _createModel(slot);
+    slot.state = ReverbSlotState::READY;
+    _pool_thread = std::thread(&NinaReverb::_poolWorker, this);
+};
+
+NinaReverb::~NinaReverb() {
+    // stop the pool worker and free the models
+    _exit_pool_thread = true;
+    _pool_requests.fetch_add(1);
+    _pool_requests.notify_all();
+    _pool_thread.join();
+    for (auto &slot : _slots) {
+        delete slot.model;
+        slot.model = nullptr;
+    }
+}
+
+ReverbModes NinaReverb::_presetMode(uint preset) const {
+    return ((preset < NUM_REVERB_PRESETS) && !_preset_irs[preset].empty()) ? ReverbModes::ir : _presetAlgoMode(preset);
+}
+
+ReverbModes NinaReverb::_presetAlgoMode(uint preset) {
+    switch (preset) {
+    case 0:
+        return room;
+    case 1:
+    case 2:
+        return plate;
+    case 3:
+    case 4:
+    default:
+        return hall;
+    }
+}
+
+void NinaReverb::loadPresetParams(uint preset, std::array<float, paramCount> &params) {
+    switch (preset) {
+    case 0:
+        params[Parameters::paramHighXover] = 4000;
+        params[Parameters::paramHighMult] = .5;
+        params[Parameters::paramLowMult] = 1;
+        params[Parameters::paramLowXover] = 800;
+        params[Parameters::paramBoost] = 50;
+        params[Parameters::paramBoostLPF] = 50;
+        params[Parameters::paramDiffuse] = 100;
+        params[Parameters::paramEarly] = 50;
+        params[Parameters::paramEarlyDamp] = 8990;
+        params[Parameters::paramEarlySend] = 100;
+        params[Parameters::paramInHighCut] = 10000;
+        params[Parameters::paramInLowCut] = 150;
+        params[Parameters::paramLate] = 100;
+        params[Parameters::paramLateDamp] = 8000;
+        params[Parameters::paramSize] = 10;
+        params[Parameters::paramSpin] = .4;
+        params[Parameters::paramWander] = 100;
+        params[Parameters::paramWidth] = 80;
+        params[Parameters::paramModulation] = 1;
+        break;
+
+    case 1:
+        params[Parameters::paramBoost] = 50;
+        params[Parameters::paramBoostLPF] = 50;
+        params[Parameters::paramEarly] = 50;
+        params[Parameters::paramHighXover] = 4000;
+        params[Parameters::paramHighMult] = .5;
+        params[Parameters::paramLowXover] = 800;
+        params[Parameters::paramDiffuse] = 100;
+        params[Parameters::paramEarlyDamp] = 1990;
+        params[Parameters::paramEarlySend] = 100;
+        params[Parameters::paramInHighCut] = 4000;
+        params[Parameters::paramInLowCut] = 150;
+        params[Parameters::paramLate] = 100;
+        params[Parameters::paramLateDamp] = 0;
+        params[Parameters::paramSize] = 10;
+        params[Parameters::paramSpin] = .2;
+        params[Parameters::paramWander] = 150;
+        params[Parameters::paramWidth] = 80;
+        params[Parameters::paramInternalAlgo] = 2;
+        break;
+
+    case 2:
+        params[Parameters::paramBoost] = 50;
+        params[Parameters::paramBoostLPF] = 50;
+        params[Parameters::paramEarly] = 50;
+        params[Parameters::paramEarlySend] = 40;
+        params[Parameters::paramHighXover] = 4000;
+        params[Parameters::paramHighMult] = .5;
+        params[Parameters::paramLowXover] = 800;
+        params[Parameters::paramDiffuse] = 100;
+        params[Parameters::paramEarlyDamp] = 1990;
+        params[Parameters::paramInHighCut] = 4000;
+        params[Parameters::paramInLowCut] = 150;
+        params[Parameters::paramLate] = 100;
+        params[Parameters::paramLateDamp] = 0;
+        params[Parameters::paramSize] = 10;
+        params[Parameters::paramSpin] = 0.00;
+        params[Parameters::paramWander] = 0.00;
+        params[Parameters::paramWidth] = 80;
+        params[Parameters::paramInternalAlgo] = 2;
+        break;
+
+    case 3:
+        params[Parameters::paramBoost] = 50;
+        params[Parameters::paramBoostLPF] = 50;
+        params[Parameters::paramDiffuse] = 90;
+        params[Parameters::paramEarly] = 50;
+        params[Parameters::paramEarlyDamp] = 0;
+        params[Parameters::paramEarlySend] = 40;
+        params[Parameters::paramInHighCut] = 4000;
+        params[Parameters::paramInLowCut] = 20;
+        params[Parameters::paramLate] = 100;
+        params[Parameters::paramLateDamp] = 0;
+        params[Parameters::paramSize] = 50;
+        params[Parameters::paramSpin] = .1;
+        params[Parameters::paramWander] = 10;
+        params[Parameters::paramWidth] = 100;
+        params[Parameters::paramHighXover] = 4000;
+        params[Parameters::paramHighMult] = .5;
+        params[Parameters::paramLowXover] = 800;
+        params[Parameters::paramLowMult] = 2.5;
+        params[Parameters::paramModulation] = 0.1;
+        break;
+
+    case 4:
+        params[Parameters::paramBoost] = 50;
+        params[Parameters::paramBoostLPF] = 50;
+        params[Parameters::paramDiffuse] = 90;
+        params[Parameters::paramEarly] = 50;
+        params[Parameters::paramEarlyDamp] = 0;
+        params[Parameters::paramEarlySend] = 40;
+        params[Parameters::paramInHighCut] = 4000;
+        params[Parameters::paramInLowCut] = 20;
+        params[Parameters::paramLate] = 100;
+        params[Parameters::paramLateDamp] = 0;
+        params[Parameters::paramSize] = 50;
+        params[Parameters::paramSpin] = .4;
+        params[Parameters::paramWander] = 50;
+        params[Parameters::paramWidth] = 100;
+        params[Parameters::paramHighXover] = 4000;
+        params[Parameters::paramHighMult] = .5;
+        params[Parameters::paramLowXover] = 800;
+        params[Parameters::paramLowMult] = 2.5;
+        params[Parameters::paramModulation] = 0.5;
+        break;
+
     default:
         break;
     }
-    float local_early_level = early_level;
-    float local_late_level = late_level;
+}
+
+ReverbModel *NinaReverb::_createModel(const ReverbModelSlot &slot) const {
+    // fall back to the preset algorithm if the IR can't be loaded
+    auto model = new ReverbModel(_presetMode(slot.preset));
+    if ((_presetMode(slot.preset) == ReverbModes::ir) && !model->loadImpulse(_preset_irs[slot.preset])) {
+        delete model;
+        model = new ReverbModel(_presetAlgoMode(slot.preset));
+    }
+    model->update(slot.params, slot.tone_setting, slot.early_setting, true);
+    model->mute();
+    return model;
+}
+
+uint NinaReverb::_requestModel(uint preset) {
+    for (uint i = 0; i < NUM_REVERB_SLOTS; i++) {
+        auto &slot = _slots[i];
+        if (slot.state.load(std::memory_order_acquire) == ReverbSlotState::FREE) {
+            // the model is created with the current settings, anything else changed while it is being created is
+            // applied when it is faded in
+            slot.preset = preset;
+            slot.params = newParams;
+            loadPresetParams(preset, slot.params);
+            slot.tone_setting = _tone_setting;
+            slot.early_setting = _early_setting;
+            slot.state.store(ReverbSlotState::REQUESTED, std::memory_order_release);
+            _pool_requests.fetch_add(1, std::memory_order_release);
+            _pool_requests.notify_one();
+            return i;
+        }
+    }
+
+    // no free slots, try again on the next buffer
+    return NO_REVERB_SLOT;
+}
+
+void NinaReverb::_releaseModel(uint slot_num) {
+    auto &slot = _slots[slot_num];
+    if (slot.state.load(std::memory_order_acquire) == ReverbSlotState::READY) {
+        slot.state.store(ReverbSlotState::RELEASING, std::memory_order_release);
+        _pool_requests.fetch_add(1, std::memory_order_release);
+        _pool_requests.notify_one();
+    }
+}
+
+void NinaReverb::_updatePool() {
+    // advance the crossfade, the old model is released once it is faded out
+    if (_fading && (_fade_pos >= 1.f)) {
+        _fading = false;
+    }
+
+    // drop the pending model if a different preset has been selected since it was requested
+    if ((_pending_slot != NO_REVERB_SLOT) && (_slots[_pending_slot].preset != _selected_preset)) {
+        _pending_slot = NO_REVERB_SLOT;
+    }
+
+    // get a model for the selected preset
+    if ((_pending_slot == NO_REVERB_SLOT) && (_selected_preset != _slots[_active_slot].preset)) {
+        if ((_next_slot != NO_REVERB_SLOT) && (_slots[_next_slot].preset == _selected_preset)) {
+            _pending_slot = _next_slot;
+            _next_slot = NO_REVERB_SLOT;
+        } else {
+            _pending_slot = _requestModel(_selected_preset);
+        }
+    }
+
+    // start fading to the pending model once it is ready, with any params changed while it was being created
+    if (!_fading && (_pending_slot != NO_REVERB_SLOT)) {
+        auto &slot = _slots[_pending_slot];
+        if (slot.state.load(std::memory_order_acquire) == ReverbSlotState::READY) {
+            slot.model->update(newParams, _tone_setting, _early_setting);
+            _fading_slot = _active_slot;
+            _active_slot = _pending_slot;
+            _pending_slot = NO_REVERB_SLOT;
+            _fading = true;
+            _fade_pos = -REVERB_PRIME_TIME / REVERB_CROSSFADE_TIME;
+        }
+    }
+
+    // keep the next preset ready
+    const uint next_preset = (_slots[_active_slot].preset + 1) % NUM_REVERB_PRESETS;
+    if ((_next_slot != NO_REVERB_SLOT) && (_slots[_next_slot].preset != next_preset)) {
+        _next_slot = NO_REVERB_SLOT;
+    }
+    const bool next_pending = (_pending_slot != NO_REVERB_SLOT) && (_slots[_pending_slot].preset == next_preset);
+    if ((_next_slot == NO_REVERB_SLOT) && !next_pending) {
+        _next_slot = _requestModel(next_preset);
+    }
+
+    // free any models that are no longer used
+    for (uint i = 0; i < NUM_REVERB_SLOTS; i++) {
+        if ((i != _active_slot) && (i != _pending_slot) && (i != _next_slot) && !(_fading && (i == _fading_slot))) {
+            _releaseModel(i);
+        }
+    }
+}
+
+void NinaReverb::_poolWorker() {
+    // run below the audio and layer threads, the IR convolver threads inherit this when the models are created
+    sched_param param = {};
+    if (pthread_setschedparam(pthread_self(), SCHED_OTHER, &param) != 0) {
+        printf("\nreverb pool: could not set normal priority");
+    }
+    ::setpriority(PRIO_PROCESS, ::gettid(), REVERB_POOL_NICE);
+
+    uint requests = _pool_requests.load();
+    while (!_exit_pool_thread) {
+        for (auto &slot : _slots) {
+            const auto state = slot.state.load(std::memory_order_acquire);
+            if (state == ReverbSlotState::REQUESTED) {
+                // create and prime the model
+                slot.model = _createModel(slot);
+                slot.state.store(ReverbSlotState::READY, std::memory_order_release);
+            } else if (state == ReverbSlotState::RELEASING) {
+                delete slot.model;
+                slot.model = nullptr;
+                slot.state.store(ReverbSlotState::FREE, std::memory_order_release);
+            }
+        }
+
+        // wait for the next request
+        _pool_requests.wait(requests);
+        requests = _pool_requests.load();
+    }
+}
+
+void NinaReverb::run(float **inputs, float **final_outputs, uint32_t frames) {
+    _updatePool();
+    ReverbModel *model = _slots[_active_slot].model;
     if (_hard_mute) {
-        local_early_level = 0.f;
-        local_late_level = 0.f;
+        // drop any crossfade and silence the active model
+        _fading = false;
+        _pitch_shift.reset();
+        _pitch_shift_left.fill(0.f);
+        _pitch_shift_right.fill(0.f);
+        model->mute();
         _hard_mute = false;
+        return;
     }
-    local_early_level = 0;
-
-    for (uint32_t i = 0; i < BUFFER_SIZE; i++) {
-        outputs[0][i] = local_early_level * early_out_buffer[0][i];
-        outputs[1][i] = local_early_level * early_out_buffer[1][i];
+    if (_selected_preset == _slots[_active_slot].preset) {
+        model->update(newParams, _tone_setting, _early_setting);
+    } else {
+        // a new preset is waiting to be faded in, keep the active model on its own preset settings
+        _preset_params = newParams;
+        loadPresetParams(_slots[_active_slot].preset, _preset_params);
+        model->update(_preset_params, _tone_setting, _early_setting);
     }
+    model->process(inputs, in_gain, _pitch_shift_left.data(), _pitch_shift_right.data(), _shimmer_gain);
 
     _mix_smooth = Nina::param_smooth(_wet_dry_mix, _mix_smooth);
     const float wet = _mix_smooth;
-    for (uint32_t i = 0; i < BUFFER_SIZE; i++) {
-
-        outputs[0][i] = (outputs[0][i] + local_late_level * late_out_buffer[0][i]) * wet;
-        outputs[1][i] = (outputs[1][i] + local_late_level * late_out_buffer[1][i]) * wet;
+    if (_fading) {
+        // equal power crossfade from the old model tail to the new model, the gains are interpolated across
+        // the buffer. The fade starts below 0 so the new model tail can build up before it is heard
+        ReverbModel *fading_model = _slots[_fading_slot].model;
+        fading_model->process(inputs, in_gain, _pitch_shift_left.data(), _pitch_shift_right.data(), _shimmer_gain);
+        const float fade_start = std::max(_fade_pos, 0.f);
+        const float fade_end = std::clamp(_fade_pos + FADE_INC, 0.f, 1.f);
+        const float in_start = std::sin(fade_start * (float)M_PI_2);
+        const float out_start = std::cos(fade_start * (float)M_PI_2);
+        const float in_inc = (std::sin(fade_end * (float)M_PI_2) - in_start) / (float)BUFFER_SIZE;
+        const float out_inc = (std::cos(fade_end * (float)M_PI_2) - out_start) / (float)BUFFER_SIZE;
+        const float level_in = model->lateLevel();
+        const float level_out = fading_model->lateLevel();
+        for (uint32_t i = 0; i < BUFFER_SIZE; i++) {
+            const float gain_in = in_start + in_inc * (float)(i + 1);
+            const float gain_out = out_start + out_inc * (float)(i + 1);
+            for (uint c = 0; c < 2; c++) {
+                late_mix_buffer[c][i] = gain_in * model->late_out_buffer[c][i] + gain_out * fading_model->late_out_buffer[c][i];
+                outputs[c][i] = (gain_in * level_in * model->late_out_buffer[c][i] + gain_out * level_out * fading_model->late_out_buffer[c][i]) * wet;
+            }
+        }
+        _fade_pos = std::min(_fade_pos + FADE_INC, 1.f);
+        _pitch_shift.run(late_mix_buffer[0], late_mix_buffer[1]);
+    } else {
+        const float late_level = model->lateLevel();
+        for (uint32_t i = 0; i < BUFFER_SIZE; i++) {
+            outputs[0][i] = (late_level * model->late_out_buffer[0][i]) * wet;
+            outputs[1][i] = (late_level * model->late_out_buffer[1][i]) * wet;
+        }
+        _pitch_shift.run(model->late_out_buffer[0], model->late_out_buffer[1]);
     }
-    _pitch_shift.run(late_out_buffer[0], late_out_buffer[1]);
 
     constexpr float ms_filter_cutoff = 400.f;
     constexpr float om3 = (ms_filter_cutoff * M_PI * 2.0) / ((float)SAMPLE_RATE);
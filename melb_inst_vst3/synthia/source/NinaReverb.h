@@ -3,11 +3,17 @@
 #include "SynthMath.h"
 #include "common.h"
 #include "freeverb/earlyref.hpp"
+#include "freeverb/irmodel3p.hpp"
 #include "freeverb/nrev.hpp"
 #include "freeverb/nrevb.hpp"
 #include "freeverb/progenitor2.hpp"
 #include "freeverb/strev.hpp"
 #include "freeverb/zrev2.hpp"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace Steinberg {
 namespace Vst {
@@ -102,7 +108,8 @@ enum ReverbModes {
     hall,
     plate,
     room,
-    shimmer
+    shimmer,
+    ir
 };
 
 enum PlateAlgos {
@@ -174,85 +181,226 @@ static inline bool d_isNotEqual(const T &v1, const T &v2) {
     return std::abs(v1 - v2) >= std::numeric_limits<T>::epsilon();
 }
 
+constexpr uint NUM_REVERB_PRESETS = 5;
+constexpr uint NUM_REVERB_SLOTS = NUM_REVERB_PRESETS + 1;
+constexpr uint NO_REVERB_SLOT = NUM_REVERB_SLOTS;
+constexpr float REVERB_CROSSFADE_TIME = 0.15f;
+constexpr float REVERB_PRIME_TIME = 0.1f;
+
+// the IR head partition is one buffer so the convolution has no latency, the tail partitions are processed by the
+// convolver thread one long fragment behind
+constexpr uint REVERB_IR_HEAD_SIZE = BUFFER_SIZE;
+constexpr uint REVERB_IR_TAIL_FACTOR = 16;
+constexpr float REVERB_IR_MAX_TIME = 8.f;
+constexpr int REVERB_POOL_NICE = 5;
+
+// the predelay line holds the longest predelay the param can set, rounded up to a power of 2 for the wrap
+constexpr float REVERB_MAX_PREDELAY = 600.f;
+constexpr uint REVERB_PREDELAY_SIZE = 65536;
+static_assert(REVERB_PREDELAY_SIZE >= (uint)(REVERB_MAX_PREDELAY * SAMPLE_RATE / 1000) + BUFFER_SIZE);
+
+/**
+ * @brief One reverb algorithm with its own input filters and settings. The pool creates one of these for each
+ * preset that is in use, so only the algorithms in use are allocated. The decay only recalculates coefficients so
+ * it is applied to the running model. The algorithms resize their delay lines to change the predelay, so they
+ * are left at 0 and the model delays the late output with its own line instead, which is allocated for the
+ * longest predelay when the model is created
+ */
+class ReverbModel {
+  public:
+    ReverbModel(ReverbModes mode);
+    ~ReverbModel() = default;
+
+    /**
+     * @brief Apply any params that differ from the last ones applied
+     *
+     * @param params the param values to apply
+     * @param tone the tone setting
+     * @param early_setting the early mix setting
+     * @param apply_all apply all params even if they have not changed
+     */
+    void update(const std::array<float, paramCount> &params, float tone, float early_setting, bool apply_all = false);
+
+    /**
+     * @brief Load the impulse response for an IR model, this allocates the partitions and FFT plans so it must
+     * not be called on the audio thread
+     *
+     * @param filename the IR wav file, mono or stereo
+     * @return true if the IR was loaded
+     */
+    bool loadImpulse(const std::string &filename);
+    void mute();
+    void process(float **inputs, float in_gain, const float *shimmer_l, const float *shimmer_r, float shimmer_gain);
+    void setInputLPF(float freq);
+    void setInputHPF(float freq);
+
+    float lateLevel() const {
+        return _late_level;
+    }
+
+    /**
+     * @brief Get the number of IR tail partitions the convolver threads were late for, only the head of the IR is
+     * output for each of these
+     *
+     * @return unsigned long number of late partitions, always 0 for the algorithms
+     */
+    unsigned long latePartitions() const {
+        return _conv ? _conv->getLatePartitions() : 0;
+    }
+
+    /**
+     * @brief Run the IR tail on the processing thread rather than the convolver threads, so the output does not
+     * depend on the thread timing. Used by the unit tests
+     *
+     */
+    void setSyncTail(bool sync) {
+        if (_conv) {
+            _conv->setSyncTail(sync);
+        }
+    }
+
+    float late_out_buffer[2][BUFFER_SIZE];
+
+  private:
+    static constexpr float sampleRate = SAMPLE_RATE;
+    ReverbModes _mode;
+    std::unique_ptr<fv3::earlyref_f> _early;
+    std::unique_ptr<fv3::progenitor2_f> _late;
+    std::unique_ptr<fv3::strev_f> _strev;
+    std::unique_ptr<fv3::zrev2_f> _late_hall;
+    std::unique_ptr<fv3::irmodel3p_f> _conv;
+    fv3::iir_1st_f input_lpf_0, input_lpf_1, input_hpf_0, input_hpf_1;
+    std::array<float, paramCount> _params;
+    float _tone_setting = 0.5;
+    float _early_setting = 0.5;
+    float _early_level = 0.0;
+    float _early_send = 0.20;
+    float _late_level = 0.0;
+
+    float filtered_input_buffer[2][BUFFER_SIZE];
+    float early_out_buffer[2][BUFFER_SIZE];
+    float late_in_buffer[2][BUFFER_SIZE];
+
+    // predelay line for the late output, a change moves the read position and is crossfaded over one buffer
+    std::array<std::vector<float>, 2> _predelay_line;
+    uint _predelay_write = 0;
+    uint _predelay = 0;
+    uint _predelay_target = 0;
+
+    void _applyParam(uint index);
+    void _runPredelay();
+};
+
+enum class ReverbSlotState {
+    FREE,
+    REQUESTED,
+    READY,
+    RELEASING
+};
+
+/**
+ * @brief A pool slot holding one model. The audio thread requests a model by filling in the settings and setting
+ * the slot to REQUESTED, the pool worker creates the model and sets it to READY. The audio thread owns the model
+ * until it sets the slot to RELEASING, then the worker deletes it
+ */
+struct ReverbModelSlot {
+    std::atomic<ReverbSlotState> state = ReverbSlotState::FREE;
+    ReverbModel *model = nullptr;
+    uint preset = 0;
+    std::array<float, paramCount> params;
+    float tone_setting;
+    float early_setting;
+};
+
 class NinaReverb {
   private:
     float _tone_setting = 0.5;
     float _early_setting = 0.5;
     std::array<float, BUFFER_SIZE> _pitch_shift_left;
     std::array<float, BUFFER_SIZE> _pitch_shift_right;
-    fv3::iir_1st_f input_lpf_0, input_lpf_1, input_hpf_0, input_hpf_1;
     JsPitchAnOctaveUp _pitch_shift = JsPitchAnOctaveUp(_pitch_shift_left, _pitch_shift_right);
-    fv3::earlyref_f early;
-    fv3::progenitor2_f late;
-    fv3::revbase_f *model; // points to one of the following:
-    NRev nrev;
-    NRevB nrevb;
-    fv3::strev_f strev;
-    fv3::earlyref_f early_hall;
-    fv3::zrev2_f late_hall;
-    int bufc = 0;
     float _wet_dry_mix = 0.f;
     float _mix_smooth = 0;
 
-    float filtered_input_buffer[2][BUFFER_SIZE];
-    float early_out_buffer[2][BUFFER_SIZE];
-    float late_in_buffer[2][BUFFER_SIZE];
-    float late_out_buffer[2][BUFFER_SIZE];
+    // IR file for each preset, a preset with an IR uses the convolution model instead of its algorithm
+    std::array<std::string, NUM_REVERB_PRESETS> _preset_irs;
+
+    // model pool, only the active and next presets are kept allocated, plus the old model during a crossfade and
+    // the model for a new preset waiting to be faded in
+    std::array<ReverbModelSlot, NUM_REVERB_SLOTS> _slots;
+    std::thread _pool_thread;
+    std::atomic<uint> _pool_requests = 0;
+    std::atomic<bool> _exit_pool_thread = false;
+    uint _active_slot = 0;
+    uint _fading_slot = NO_REVERB_SLOT;
+    uint _pending_slot = NO_REVERB_SLOT;
+    uint _next_slot = NO_REVERB_SLOT;
+    bool _fading = false;
+    float _fade_pos = 0.f;
+
+    float late_mix_buffer[2][BUFFER_SIZE];
     static constexpr float sampleRate = SAMPLE_RATE;
+    static constexpr float FADE_INC = BUFFER_SIZE / (REVERB_CROSSFADE_TIME * SAMPLE_RATE);
     ReverbModes _mode2;
     uint _mode;
-    float dry_level = 0.0;
-    float early_level = 0.0;
-    float early_send = 0.0;
-    float late_level = 0.0;
-    std::array<float, paramCount> oldParams;
     std::array<float, paramCount> newParams;
-    std::array<bool, paramCount> _invalidated_params;
+    std::array<float, paramCount> _preset_params;
     float in_gain = 0;
     float _shimmer_gain = 0;
     uint _selected_preset = 10000;
     float _ms_eq_filter_state = 0;
     float outputs[2][BUFFER_SIZE];
 
+    static ReverbModes _presetAlgoMode(uint preset);
+    ReverbModes _presetMode(uint preset) const;
+    ReverbModel *_createModel(const ReverbModelSlot &slot) const;
+    uint _requestModel(uint preset);
+    void _releaseModel(uint slot);
+    void _updatePool();
+    void _poolWorker();
+
   public:
     bool _hard_mute = false;
     NinaReverb(/* args */);
     ~NinaReverb();
 
     void reset() {
-        /**
-        strev.mute();
-        late_hall.mute();
-        late.mute();
-        early.mute();
-        early_hall.mute();
-        **/
-
         _pitch_shift.reset();
     };
 
     void run(float **in, float **out, uint frames);
 
-    void setInputLPF(float freq) {
-        if (freq < 0) {
-            freq = 0;
-        } else if (freq > sampleRate / 2.0) {
-            freq = sampleRate / 2.0;
+    /**
+     * @brief Set the params that make up a preset, the other params are left as they are
+     *
+     * @param preset the preset number
+     * @param params the params to update
+     */
+    static void loadPresetParams(uint preset, std::array<float, paramCount> &params);
+
+    /**
+     * @brief Get the number of reverb models currently allocated
+     *
+     * @return uint number of models
+     */
+    uint numModels() const {
+        uint num_models = 0;
+        for (auto &slot : _slots) {
+            num_models += slot.state.load() != ReverbSlotState::FREE ? 1 : 0;
         }
+        return num_models;
+    }
 
-        input_lpf_0.setLPF_BW(freq, sampleRate);
-        input_lpf_1.setLPF_BW(freq, sampleRate);
+    bool crossfading() const {
+        return _fading || (_pending_slot != NO_REVERB_SLOT) || (_selected_preset != _slots[_active_slot].preset);
     }
 
-    void setInputHPF(float freq) {
-        if (freq < 0) {
-            freq = 0;
-        } else if (freq > sampleRate / 2.0) {
-            freq = sampleRate / 2.0;
-        }
+    void setInputLPF(float freq) {
+        _slots[_active_slot].model->setInputLPF(freq);
+    }
 
-        input_hpf_0.setHPF_BW(freq, sampleRate);
-        input_hpf_1.setHPF_BW(freq, sampleRate);
+    void setInputHPF(float freq) {
+        _slots[_active_slot].model->setInputHPF(freq);
     }
 
     void setInGain(float val) {
@@ -269,206 +417,35 @@ class NinaReverb {
 
     void setPreDelay(float val) {
         newParams[Parameters::paramPredelay] = val * 600;
-        _invalidated_params[Parameters::paramPredelay] = true;
     }
 
     void setTone(float val) {
         _tone_setting = val;
-        _invalidated_params[Parameters::paramHighMult] = true;
-        _invalidated_params[Parameters::paramLowMult] = true;
-        _invalidated_params[Parameters::paramEarlyDamp] = true;
-        _invalidated_params[Parameters::paramLateDamp] = true;
     }
 
     void setDistance(float val) {
         _early_setting = val;
-        _invalidated_params[Parameters::paramEarly] = true;
-        ;
     }
 
     void setDecay(float val) {
         newParams[Parameters::paramDecay] = 0.2 + 10 * (val * val);
-        _invalidated_params[Parameters::paramDecay] = true;
     }
 
     void setPreset(float preset) {
         constexpr uint num_presets = 4;
         uint selection = (int)(preset * (float)num_presets);
-        if (selection == _selected_preset) {
+        if ((selection == _selected_preset) || (selection >= NUM_REVERB_PRESETS)) {
             return;
         }
+
+        // the model for the preset is faded in when it is ready
         _selected_preset = selection;
-        _hard_mute = true;
-
-        // invalidate all params so theey are recalculated, execpt a few that we want to be left as is
-        _invalidated_params.fill(true);
-        _invalidated_params[paramPredelay] = false;
-
-        // mute all the reverb processors to avoid noises on changes
-
-        switch (selection) {
-        case 0:
-            /* code */
-
-            _mode = room;
-            _mode2 = room;
-            early.mute();
-            late.mute();
-            newParams[Parameters::paramHighXover] = 4000;
-            newParams[Parameters::paramHighMult] = .5;
-            newParams[Parameters::paramLowMult] = 1;
-            newParams[Parameters::paramLowXover] = 800;
-            newParams[Parameters::paramBoost] = 50;
-            newParams[Parameters::paramBoostLPF] = 50;
-            newParams[Parameters::paramDiffuse] = 100;
-            newParams[Parameters::paramEarly] = 50;
-            newParams[Parameters::paramEarlyDamp] = 8990;
-            newParams[Parameters::paramEarlySend] = 100;
-            newParams[Parameters::paramInHighCut] = 10000;
-            newParams[Parameters::paramInLowCut] = 150;
-            newParams[Parameters::paramLate] = 100;
-            newParams[Parameters::paramLateDamp] = 8000;
-            newParams[Parameters::paramSize] = 10;
-            newParams[Parameters::paramSpin] = .4;
-            newParams[Parameters::paramWander] = 100;
-            newParams[Parameters::paramWidth] = 80;
-            newParams[Parameters::paramModulation] = 1;
-
-            break;
-
-        case 1:
-            _mode = plate;
-            _mode2 = plate;
-            strev.mute();
-            newParams[Parameters::paramBoost] = 50;
-            newParams[Parameters::paramBoostLPF] = 50;
-            newParams[Parameters::paramDiffuse] = 90;
-            newParams[Parameters::paramEarly] = 50;
-            newParams[Parameters::paramEarlyDamp] = 0;
-            newParams[Parameters::paramEarlySend] = 40;
-            newParams[Parameters::paramInHighCut] = 4000;
-            newParams[Parameters::paramInLowCut] = 50;
-            newParams[Parameters::paramLate] = 100;
-            newParams[Parameters::paramLateDamp] = 0;
-            newParams[Parameters::paramSize] = 50;
-            newParams[Parameters::paramWidth] = 100;
-            newParams[Parameters::paramHighXover] = 4000;
-            newParams[Parameters::paramHighMult] = .5;
-            newParams[Parameters::paramLowXover] = 800;
-            newParams[Parameters::paramBoost] = 50;
-            newParams[Parameters::paramBoostLPF] = 50;
-            newParams[Parameters::paramDiffuse] = 100;
-            newParams[Parameters::paramEarlyDamp] = 1990;
-            newParams[Parameters::paramEarlySend] = 100;
-            newParams[Parameters::paramInHighCut] = 4000;
-            newParams[Parameters::paramInLowCut] = 150;
-            newParams[Parameters::paramLate] = 100;
-            newParams[Parameters::paramLateDamp] = 0;
-            newParams[Parameters::paramSize] = 10;
-            newParams[Parameters::paramSpin] = .2;
-            newParams[Parameters::paramWander] = 150;
-            newParams[Parameters::paramWidth] = 80;
-            newParams[Parameters::paramInternalAlgo] = 2;
-            break;
-
-        case 2:
-            strev.mute();
-            _mode = plate;
-            _mode2 = plate;
-            for (uint i = 0; i < BUFFER_SIZE; i++) {
-                filtered_input_buffer[0][i] = 0.f;
-                filtered_input_buffer[1][i] = 0.f;
-            }
-            newParams[Parameters::paramBoost] = 50;
-            newParams[Parameters::paramBoostLPF] = 50;
-            newParams[Parameters::paramDiffuse] = 90;
-            newParams[Parameters::paramEarly] = 50;
-            newParams[Parameters::paramEarlyDamp] = 0;
-            newParams[Parameters::paramEarlySend] = 40;
-            newParams[Parameters::paramInHighCut] = 4000;
-            newParams[Parameters::paramInLowCut] = 50;
-            newParams[Parameters::paramLate] = 100;
-            newParams[Parameters::paramLateDamp] = 0;
-            newParams[Parameters::paramSize] = 50;
-            newParams[Parameters::paramWidth] = 100;
-            newParams[Parameters::paramHighXover] = 4000;
-            newParams[Parameters::paramHighMult] = .5;
-            newParams[Parameters::paramLowXover] = 800;
-            newParams[Parameters::paramBoost] = 50;
-            newParams[Parameters::paramBoostLPF] = 50;
-            newParams[Parameters::paramDiffuse] = 100;
-            newParams[Parameters::paramEarlyDamp] = 1990;
-            newParams[Parameters::paramInHighCut] = 4000;
-            newParams[Parameters::paramInLowCut] = 150;
-            newParams[Parameters::paramLate] = 100;
-            newParams[Parameters::paramLateDamp] = 0;
-            newParams[Parameters::paramSize] = 10;
-            newParams[Parameters::paramSpin] = 0.00;
-            newParams[Parameters::paramWander] = 0.00;
-            newParams[Parameters::paramWidth] = 80;
-            newParams[Parameters::paramInternalAlgo] = 2;
-            break;
-
-        case 3:
-            _mode = hall;
-            _mode2 = hall;
-            early_hall.mute();
-            late_hall.mute();
-
-            newParams[Parameters::paramBoost] = 50;
-            newParams[Parameters::paramBoostLPF] = 50;
-            newParams[Parameters::paramDiffuse] = 90;
-            newParams[Parameters::paramEarly] = 50;
-            newParams[Parameters::paramEarlyDamp] = 0;
-            newParams[Parameters::paramEarlySend] = 40;
-            newParams[Parameters::paramInHighCut] = 4000;
-            newParams[Parameters::paramInLowCut] = 20;
-            newParams[Parameters::paramLate] = 100;
-            newParams[Parameters::paramLateDamp] = 0;
-            newParams[Parameters::paramSize] = 50;
-            newParams[Parameters::paramSpin] = .1;
-            newParams[Parameters::paramWander] = 10;
-            newParams[Parameters::paramWidth] = 100;
-            newParams[Parameters::paramHighXover] = 4000;
-            newParams[Parameters::paramHighMult] = .5;
-            newParams[Parameters::paramLowXover] = 800;
-            newParams[Parameters::paramLowMult] = 2.5;
-            newParams[Parameters::paramModulation] = 0.1;
-            break;
-
-        case 4:
-            _mode = hall;
-            _mode2 = hall;
-            early_hall.mute();
-            late_hall.mute();
-
-            newParams[Parameters::paramBoost] = 50;
-            newParams[Parameters::paramBoostLPF] = 50;
-            newParams[Parameters::paramDiffuse] = 90;
-            newParams[Parameters::paramEarly] = 50;
-            newParams[Parameters::paramEarlyDamp] = 0;
-            newParams[Parameters::paramEarlySend] = 40;
-            newParams[Parameters::paramInHighCut] = 4000;
-            newParams[Parameters::paramInLowCut] = 20;
-            newParams[Parameters::paramLate] = 100;
-            newParams[Parameters::paramLateDamp] = 0;
-            newParams[Parameters::paramSize] = 50;
-            newParams[Parameters::paramSpin] = .4;
-            newParams[Parameters::paramWander] = 50;
-            newParams[Parameters::paramWidth] = 100;
-            newParams[Parameters::paramHighXover] = 4000;
-            newParams[Parameters::paramHighMult] = .5;
-            newParams[Parameters::paramLowXover] = 800;
-            newParams[Parameters::paramLowMult] = 2.5;
-            newParams[Parameters::paramModulation] = 0.5;
-
-            break;
-        default:
-            break;
-        }
+        _mode = _presetMode(selection);
+        _mode2 = _presetMode(selection);
+        loadPresetParams(selection, newParams);
     }
 };
 
 } // namespace Nina
 } // namespace Vst
-} // namespace Steinberg
\ No newline at end of file
+} // namespace Steinberg
@@ -0,0 +1,187 @@
+/**
+ * @file NinaReverbBench.cpp
+ * @brief Benchmark for the reverb models.
+ *
+ * Runs the algorithmic hall and the IR convolution model on noise and reports the audio thread time per buffer
+ * against the buffer budget, and the total CPU used including the convolver tail threads. The IR models are run
+ * with generated IRs of increasing length so the cost per second of IR can be compared with the hall. The buffers
+ * are run in real time, as the convolver tail threads repeat the previous partition when they are late.
+ *
+ * usage: nina_reverb_bench [-n num_buffers] [-i ir_file]
+ *
+ * if an IR file is given it is benchmarked as well as the generated IRs
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+#include "AudioFile.h"
+#include "NinaReverb.h"
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace Steinberg::Vst::Nina;
+
+// time available to process a single buffer, in us
+constexpr float BUFFER_BUDGET_US = 1e6f * (float)BUFFER_SIZE / (float)SAMPLE_RATE;
+constexpr uint DEFAULT_NUM_BUFFERS = BUFFER_RATE * 10;
+constexpr uint WARMUP_BUFFERS = BUFFER_RATE;
+constexpr uint HALL_PRESET = 3;
+constexpr float HALL_DECAY = 2.7f;
+constexpr float GENERATED_IR_TIMES[] = {0.5f, 1.f, 2.f, 4.f, 8.f};
+constexpr char GENERATED_IR_FILE[] = "/tmp/nina_reverb_bench_ir.wav";
+
+struct BenchResult {
+    std::string name;
+    float ir_time;
+    float mean_us;
+    float max_us;
+    float cpu_percent;
+    unsigned long late_partitions;
+};
+
+float cpuTimeUs(clockid_t clock) {
+    timespec ts;
+    ::clock_gettime(clock, &ts);
+    return 1e6f * (float)ts.tv_sec + 1e-3f * (float)ts.tv_nsec;
+}
+
+bool writeGeneratedIr(float ir_time) {
+    // stereo noise with an exponential decay to -60dB over the IR time
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> noise(-1.f, 1.f);
+    const uint length = (uint)(ir_time * SAMPLE_RATE);
+    const float decay = std::pow(0.001f, 1.f / (float)length);
+    AudioFile<float> file;
+    file.setNumChannels(2);
+    file.setNumSamplesPerChannel(length);
+    file.setSampleRate(SAMPLE_RATE);
+    float gain = 1.f;
+    for (uint i = 0; i < length; i++) {
+        file.samples[0][i] = gain * noise(rng);
+        file.samples[1][i] = gain * noise(rng);
+        gain *= decay;
+    }
+    return file.save(GENERATED_IR_FILE);
+}
+
+BenchResult runModel(const std::string &name, ReverbModel &model, float ir_time, uint num_buffers) {
+    std::array<float, paramCount> params;
+    params.fill(0.f);
+    NinaReverb::loadPresetParams(HALL_PRESET, params);
+    params[paramDecay] = HALL_DECAY;
+    model.update(params, 0.5f, 0.5f, true);
+    model.mute();
+
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<float> noise(-0.1f, 0.1f);
+    std::array<float, BUFFER_SIZE> input_l, input_r, shimmer;
+    float *input_fp[2] = {input_l.data(), input_r.data()};
+    shimmer.fill(0.f);
+    auto run_buffer = [&]() {
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            input_l[i] = noise(rng);
+            input_r[i] = noise(rng);
+        }
+        model.process(input_fp, 0.9f, shimmer.data(), shimmer.data(), 0.f);
+    };
+    for (uint b = 0; b < WARMUP_BUFFERS; b++) {
+        run_buffer();
+    }
+
+    // the thread time is the audio thread cost, the process time also includes the convolver tail threads
+    std::vector<float> buffer_times;
+    buffer_times.reserve(num_buffers);
+    const unsigned long late_start = model.latePartitions();
+    const float process_start = cpuTimeUs(CLOCK_PROCESS_CPUTIME_ID);
+    timespec deadline;
+    ::clock_gettime(CLOCK_MONOTONIC, &deadline);
+    for (uint b = 0; b < num_buffers; b++) {
+        const float start = cpuTimeUs(CLOCK_THREAD_CPUTIME_ID);
+        run_buffer();
+        buffer_times.push_back(cpuTimeUs(CLOCK_THREAD_CPUTIME_ID) - start);
+
+        // wait for the next buffer period
+        deadline.tv_nsec += (long)(1000.f * BUFFER_BUDGET_US);
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_nsec -= 1000000000;
+            deadline.tv_sec++;
+        }
+        ::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr);
+    }
+    const float process_time = cpuTimeUs(CLOCK_PROCESS_CPUTIME_ID) - process_start;
+
+    BenchResult result;
+    result.name = name;
+    result.ir_time = ir_time;
+    result.mean_us = 0.f;
+    for (float t : buffer_times) {
+        result.mean_us += t / (float)num_buffers;
+    }
+    result.max_us = *std::max_element(buffer_times.begin(), buffer_times.end());
+    result.cpu_percent = 100.f * process_time / ((float)num_buffers * BUFFER_BUDGET_US);
+    result.late_partitions = model.latePartitions() - late_start;
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    uint num_buffers = DEFAULT_NUM_BUFFERS;
+    std::string ir_file;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            num_buffers = std::max(std::atoi(optarg), 1);
+            break;
+        case 'i':
+            ir_file = optarg;
+            break;
+        default:
+            printf("usage: %s [-n num_buffers] [-i ir_file]\n", argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    std::vector<BenchResult> results;
+    {
+        ReverbModel hall(ReverbModes::hall);
+        results.push_back(runModel("hall", hall, 0.f, num_buffers));
+    }
+    for (float ir_time : GENERATED_IR_TIMES) {
+        ReverbModel ir(ReverbModes::ir);
+        if (!writeGeneratedIr(ir_time) || !ir.loadImpulse(GENERATED_IR_FILE)) {
+            printf("\ncould not create the %.1f s IR", ir_time);
+            continue;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "ir %.1fs", ir_time);
+        results.push_back(runModel(name, ir, ir_time, num_buffers));
+    }
+    ::remove(GENERATED_IR_FILE);
+    if (!ir_file.empty()) {
+        ReverbModel ir(ReverbModes::ir);
+        AudioFile<float> file;
+        if (file.load(ir_file) && ir.loadImpulse(ir_file)) {
+            results.push_back(runModel(ir_file, ir, std::min((float)file.getNumSamplesPerChannel() / (float)file.getSampleRate(), REVERB_IR_MAX_TIME), num_buffers));
+        } else {
+            printf("\ncould not load %s", ir_file.c_str());
+        }
+    }
+
+    printf("\n\nbuffer budget: %.1f us (%d samples @ %d Hz), %d buffers", BUFFER_BUDGET_US, BUFFER_SIZE, SAMPLE_RATE, num_buffers);
+    printf("\nIR head partition %d samples, tail partitions %d samples", REVERB_IR_HEAD_SIZE, REVERB_IR_HEAD_SIZE * REVERB_IR_TAIL_FACTOR);
+    printf("\n%-24s %10s %10s %10s %10s %6s %12s %10s", "", "mean us", "max us", "budget", "total cpu", "late", "cpu per s", "vs hall");
+    const float hall_cpu = results.front().cpu_percent;
+    for (auto &result : results) {
+        printf("\n%-24s %10.1f %10.1f %9.1f%% %9.1f%% %6lu", result.name.c_str(), result.mean_us, result.max_us, 100.f * result.mean_us / BUFFER_BUDGET_US, result.cpu_percent, result.late_partitions);
+        if (result.ir_time > 0.f) {
+            // CPU per second of IR as a multiple of the hall
+            printf(" %11.1f%% %9.2fx", result.cpu_percent / result.ir_time, result.cpu_percent / result.ir_time / hall_cpu);
+        }
+    }
+    printf("\n");
+    return 0;
+}
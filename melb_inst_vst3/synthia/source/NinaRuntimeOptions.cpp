@@ -0,0 +1,66 @@
+/**
+ * @file NinaRuntimeOptions.cpp
+ * @brief Runtime options of the synth, read once from the runtime options file.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+
+#include "NinaRuntimeOptions.h"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+template <typename T>
+static void _readOption(std::istream &fields, const std::string &name, T &value) {
+    T read_value;
+    if (fields >> read_value) {
+        value = read_value;
+    } else {
+        printf("\nruntime options: bad value for %s", name.c_str());
+    }
+}
+
+const RuntimeOptions &RuntimeOptions::getInstance() {
+    static const RuntimeOptions options = []() {
+        std::ifstream file(NINA_RUNTIME_OPTIONS_FILE);
+        return file.is_open() ? parse(file) : RuntimeOptions();
+    }();
+    return options;
+}
+
+RuntimeOptions RuntimeOptions::parse(std::istream &stream) {
+    RuntimeOptions options;
+    std::string line;
+    while (std::getline(stream, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        if (!(fields >> name) || name[0] == '#') {
+            continue;
+        }
+        if (name == "layer_workers") {
+            _readOption(fields, name, options.layer_workers);
+        } else if (name == "sample_accurate_automation") {
+            _readOption(fields, name, options.sample_accurate_automation);
+        } else if (name == "gui_scope_shm") {
+            _readOption(fields, name, options.gui_scope_shm);
+        } else if (name == "delay_packed_storage") {
+            _readOption(fields, name, options.delay_packed_storage);
+        } else if (name == "parallel_cal") {
+            _readOption(fields, name, options.parallel_cal);
+        } else if (name == "osc_refit") {
+            _readOption(fields, name, options.osc_refit);
+        } else {
+            printf("\nruntime options: unknown option %s", name.c_str());
+        }
+    }
+    return options;
+}
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
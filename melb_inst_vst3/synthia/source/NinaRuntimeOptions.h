@@ -0,0 +1,65 @@
+/**
+ * @file NinaRuntimeOptions.h
+ * @brief Runtime options of the synth, read once from the runtime options file.
+ *
+ * The options file has one option per line, the name and then the value, for example "layer_workers 2". Blank
+ * lines and lines starting with # are skipped. Options that are not in the file keep their default, which is the
+ * behaviour without the option. The file is read the first time the options are used, and the processors pass
+ * the options down to the parts of the synth they configure.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+
+#pragma once
+
+#include "common.h"
+#include <istream>
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+#ifdef __x86_64__
+constexpr char NINA_RUNTIME_OPTIONS_FILE[] = "./runtime_options.txt";
+#else
+constexpr char NINA_RUNTIME_OPTIONS_FILE[] = "/udata/nina/runtime_options.txt";
+#endif
+
+struct RuntimeOptions {
+    // number of realtime worker threads that run the layers, 0 runs them all on the audio thread
+    uint layer_workers = 0;
+
+    // follow every point of the host automation queues, used by the synth and the effects
+    bool sample_accurate_automation = false;
+
+    // publish the scope frames through the shared memory ring instead of the GUI message thread
+    bool gui_scope_shm = false;
+
+    // store the effects delay lines as 16 bit ints
+    bool delay_packed_storage = false;
+
+    // calibrate the vcas of all the voices at once
+    bool parallel_cal = false;
+
+    // refit the osc models from the osc tuning measurements
+    bool osc_refit = false;
+
+    /**
+     * @brief Options shared by the processors, read from NINA_RUNTIME_OPTIONS_FILE on first use
+     *
+     */
+    static const RuntimeOptions &getInstance();
+
+    /**
+     * @brief Read the options from a stream in the options file format, unknown options and bad values are
+     * reported and skipped
+     *
+     * @param stream
+     * @return RuntimeOptions
+     */
+    static RuntimeOptions parse(std::istream &stream);
+};
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
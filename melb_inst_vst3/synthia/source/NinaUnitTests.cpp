@@ -40,6 +40,31 @@ int main() {
     // run_test(test_semitone_transpose(), passes, fails);
     // run_test(test_calibration_routine(), passes, fails);
     run_test(run_single_wavetable_save_output(), passes, fails);
+    run_test(wt_kernel_test(), passes, fails);
+    run_test(wt_cache_test(), passes, fails);
+    run_test(snapshot_test(), passes, fails);
+    run_test(scope_ring_test(), passes, fails);
+    run_test(vca_mux_test(), passes, fails);
+    run_test(analog_osc_batch_test(), passes, fails);
+    run_test(analog_model_eval_test(), passes, fails);
+    run_test(osc_model_fit_test(), passes, fails);
+    run_test(cal_scheduler_test(), passes, fails);
+    run_test(cal_store_test(), passes, fails);
+    run_test(file_writer_test(), passes, fails);
+    run_test(file_writer_flush_test(), passes, fails);
+    run_test(cal_reload_test(), passes, fails);
+    run_test(runtime_options_test(), passes, fails);
+    run_test(chorus_block_test(), passes, fails);
+    run_test(delay_block_test(), passes, fails);
+    run_test(delay_segment_test(), passes, fails);
+    run_test(delay_automation_test(), passes, fails);
+    run_test(delay_packed_test(), passes, fails);
+    run_test(dynamics_test(), passes, fails);
+    run_test(fx_activity_test(), passes, fails);
+    run_test(reverb_pool_test(), passes, fails);
+    run_test(reverb_tail_test(), passes, fails);
+    run_test(reverb_ir_test(), passes, fails);
+    run_test(reverb_conv_test(), passes, fails);
     // run_test(wt_alloc_test(), passes, fails);
     //  run_test(filter_gen_test(), passes, fails);
 
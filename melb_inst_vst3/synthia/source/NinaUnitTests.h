@@ -6,13 +6,26 @@
  * Copyright (c) 2023 Melbourne Instruments
  *
  */
+#include "AnalogOscBatch.h"
+#include "ChorusEngine.h"
+#include "DsVca.h"
+#include "GuiScopeRing.h"
 #include "Layer.h"
 #include "LayerManager.h"
+#include "NinaCalScheduler.h"
+#include "NinaCalStore.h"
 #include "NinaDelay.h"
+#include "NinaEffectsLimiter.h"
+#include "NinaExpander.h"
+#include "NinaFileWriter.h"
+#include "NinaOscModelFit.h"
+#include "NinaFxActivity.h"
 #include "NinaReverb.h"
+#include "NinaRuntimeOptions.h"
 #include "NinaVoice.h"
 #include "SynthMath.h"
 #include "WavetableOsc.h"
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 #include <stdlib.h>
@@ -849,6 +862,1321 @@ bool wt_load_run_test() {
     return true;
 }
 
+bool wt_kernel_test() {
+    printf("\nwavetable kernel test");
+    using namespace Steinberg::Vst::Nina;
+
+    // random tables for the A and B waves
+    std::vector<int16_t> table(WAVE_LENGTH * 4);
+    for (auto &sample : table) {
+        sample = (int16_t)((rand() % 65535) - 32767);
+    }
+    WtKernelParams params;
+    params.a_low = table.data();
+    params.a_high = table.data() + WAVE_LENGTH;
+    params.b_low = table.data() + WAVE_LENGTH * 2;
+    params.b_high = table.data() + WAVE_LENGTH * 3;
+    params.gain_a = 0.7;
+    params.gain_b = 0.4;
+    params.vol = 1.3;
+
+    constexpr uint num_samples = 64;
+    std::array<float, num_samples> phases;
+    std::array<float, num_samples> out_ref;
+    std::array<float, num_samples> out_simd;
+    bool pass = true;
+    for (uint run = 0; run < 1000; run++) {
+        // step through the mipmap lengths and a spread of morph positions
+        params.phase_mult = (float)(WAVE_LENGTH >> (run % 5));
+        params.phase_mask = (WAVE_LENGTH >> (run % 5)) - 1;
+        params.morph_frac_a = (float)(rand() % 1000) / 1000.f;
+        params.morph_frac_b = (float)(rand() % 1000) / 1000.f;
+        for (auto &phase : phases) {
+            phase = (float)(rand() % 100000) / 100000.f;
+        }
+        phases[0] = 0.f;
+        phases[1] = std::nextafter(1.f, 0.f);
+
+        float last_ref = wtInterpolateScalar(params, phases.data(), out_ref.data(), num_samples);
+        float last_simd = wtInterpolate(params, phases.data(), out_simd.data(), num_samples);
+
+        // the vector kernels must be bit exact with the scalar reference
+        if (std::memcmp(out_ref.data(), out_simd.data(), sizeof(out_ref)) != 0 || std::memcmp(&last_ref, &last_simd, sizeof(float)) != 0) {
+            printf("\nkernel output mismatch on run %d", run);
+            pass = false;
+            break;
+        }
+
+        // and close to the original per sample implementation
+        for (uint i = 0; i < num_samples; i++) {
+            float pos = phases[i] * params.phase_mult;
+            uint pos_1 = ((uint)std::floor(pos)) & params.phase_mask;
+            uint pos_2 = (pos_1 + 1) & params.phase_mask;
+            float frac = pos - (float)pos_1;
+            float a_1 = _int16SampleToFloat(params.a_low[pos_1]) + (_int16SampleToFloat(params.a_high[pos_1]) - _int16SampleToFloat(params.a_low[pos_1])) * params.morph_frac_a;
+            float a_2 = _int16SampleToFloat(params.a_low[pos_2]) + (_int16SampleToFloat(params.a_high[pos_2]) - _int16SampleToFloat(params.a_low[pos_2])) * params.morph_frac_a;
+            float b_1 = _int16SampleToFloat(params.b_low[pos_1]) + (_int16SampleToFloat(params.b_high[pos_1]) - _int16SampleToFloat(params.b_low[pos_1])) * params.morph_frac_b;
+            float b_2 = _int16SampleToFloat(params.b_low[pos_2]) + (_int16SampleToFloat(params.b_high[pos_2]) - _int16SampleToFloat(params.b_low[pos_2])) * params.morph_frac_b;
+            float out = (params.gain_a * (a_1 + (a_2 - a_1) * frac) + params.gain_b * (b_1 + (b_2 - b_1) * frac)) * 2.f * params.vol;
+            if (std::abs(out - out_ref[i]) > 1e-5) {
+                printf("\nkernel output differs from the original: %f %f", out, out_ref[i]);
+                pass = false;
+                break;
+            }
+        }
+    }
+
+    // time the reference against the vector kernel
+    auto start = std::chrono::steady_clock::now();
+    for (uint run = 0; run < 100000; run++) {
+        wtInterpolateScalar(params, phases.data(), out_ref.data(), num_samples);
+    }
+    auto mid = std::chrono::steady_clock::now();
+    for (uint run = 0; run < 100000; run++) {
+        wtInterpolate(params, phases.data(), out_simd.data(), num_samples);
+    }
+    auto finish = std::chrono::steady_clock::now();
+    printf("\nscalar: %d us, vector: %d us", (int)std::chrono::duration_cast<std::chrono::microseconds>(mid - start).count(), (int)std::chrono::duration_cast<std::chrono::microseconds>(finish - mid).count());
+    return pass;
+}
+
+bool wt_cache_test() {
+    printf("\nwavetable cache test");
+    using namespace Steinberg::Vst::Nina;
+
+    // process a short wavetable of random waves
+    constexpr uint num_waves = 4;
+    std::vector<float> samples(WAVE_LENGTH * num_waves);
+    for (auto &sample : samples) {
+        sample = (float)(rand() % 2000 - 1000) / 1000.f;
+    }
+    auto processed = std::make_unique<Wavetable>();
+    processed->processWaves(num_waves, samples.data());
+
+    // save it to the cache and map it back
+    const std::string cache_path = "/tmp/nina_wt_cache_test.wtc";
+    WavetableCacheKey key = {0x1234, 5678, samples.size() * sizeof(float)};
+    auto mapped = std::make_unique<Wavetable>();
+    auto start = std::chrono::steady_clock::now();
+    bool pass = processed->saveCache(cache_path, key) && mapped->mapCache(cache_path, key);
+    auto finish = std::chrono::steady_clock::now();
+    printf("\nsave and map: %d us", (int)std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count());
+    if (!pass) {
+        printf("\ncould not save and map the cache");
+        return false;
+    }
+    if ((mapped->getNumWaves() != num_waves) || (mapped->getNumSamples() != num_waves * Wavetable::WAVE_MIPMAP_SAMPLES) ||
+        std::memcmp(mapped->getSamples(), processed->getSamples(), mapped->getNumSamples() * sizeof(int16_t)) != 0) {
+        printf("\nmapped wavetable does not match the processed wavetable");
+        pass = false;
+    }
+
+    // a cache for a different version of the source file must not be used
+    auto stale = std::make_unique<Wavetable>();
+    key.source_mtime++;
+    if (stale->mapCache(cache_path, key)) {
+        printf("\nstale cache was mapped");
+        pass = false;
+    }
+
+    // resetting a mapped wavetable goes back to the processed samples
+    mapped->reset();
+    if (mapped->getNumWaves() != 0 || mapped->getNumSamples() != MAX_NUM_WAVES * Wavetable::WAVE_MIPMAP_SAMPLES) {
+        printf("\nreset did not unmap the cache");
+        pass = false;
+    }
+    std::remove(cache_path.c_str());
+    return pass;
+}
+
+bool snapshot_test() {
+    printf("\npatch snapshot test");
+    using namespace Steinberg::Vst::Nina;
+
+    // set up a patch with different A and B states on two of the layers
+    auto manager = std::make_unique<LayerManager>();
+    std::vector<ParamChange> changes;
+    changes.push_back(ParamChange(NinaParams::MasterTune, 0.6));
+    changes.push_back(ParamChange(NinaParams::Cv2Gain, 0.3));
+    for (uint layer = 1; layer < 3; layer++) {
+        changes.push_back(make_param_layer(ParamChange(NinaParams::NumUnison, 0.2 * layer), layer));
+        changes.push_back(make_param_layer(ParamChange(NinaParams::LayerState, 0), layer));
+        changes.push_back(make_param_layer(ParamChange(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::FilterCutoff), 0.1 * layer), layer));
+        changes.push_back(make_param_layer(ParamChange(NinaParams::LayerState, 1), layer));
+        changes.push_back(make_param_layer(ParamChange(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::FilterCutoff), 0.2 * layer), layer));
+        changes.push_back(make_param_layer(ParamChange(NinaParams::MorphValue, 0.25 * layer), layer));
+    }
+    manager->updateParams(changes.size(), changes.data());
+
+    // save the snapshot, then change the patch and check loading the snapshot gives the same patch back. The
+    // layers number themselves as they are created, so a second manager can't be used here
+    auto saved = std::make_unique<NinaParams::PatchSnapshot>();
+    manager->getSnapshot(*saved);
+    changes.clear();
+    changes.push_back(ParamChange(NinaParams::MasterTune, 0.1));
+    for (uint layer = 0; layer < NUM_LAYERS; layer++) {
+        changes.push_back(make_param_layer(ParamChange(NinaParams::NumUnison, 0.9), layer));
+        changes.push_back(make_param_layer(ParamChange(NinaParams::LayerState, 1), layer));
+        changes.push_back(make_param_layer(ParamChange(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::FilterCutoff), 0.9), layer));
+    }
+    manager->updateParams(changes.size(), changes.data());
+
+    std::vector<ParamChange> snapshot_changes(MAX_SNAPSHOT_PARAM_CHANGES);
+    auto start = std::chrono::steady_clock::now();
+    const uint num_changes = LayerManager::snapshotParamChanges(*saved, snapshot_changes.data());
+    manager->loadSnapshot(*saved, num_changes, snapshot_changes.data());
+    auto finish = std::chrono::steady_clock::now();
+    printf("\n%d changes loaded in %d us", num_changes, (int)std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count());
+    auto loaded = std::make_unique<NinaParams::PatchSnapshot>();
+    manager->getSnapshot(*loaded);
+
+    bool pass = true;
+    for (uint i = 0; i < NinaParams::NUM_GLOBAL_PARAMS; i++) {
+        if ((i != NinaParams::Morphing) && (i != NinaParams::MorphValue) && (saved->global_params[i] != loaded->global_params[i])) {
+            printf("\nglobal param %d: %f != %f", i, saved->global_params[i], loaded->global_params[i]);
+            pass = false;
+        }
+    }
+    for (uint layer = 0; layer < NUM_LAYERS; layer++) {
+        const auto &a = saved->layers[layer];
+        const auto &b = loaded->layers[layer];
+        if ((a.layer_state != b.layer_state) || (a.morph_value != b.morph_value) || (a.common_params != b.common_params) ||
+            (a.state_a_params != b.state_a_params) || (a.state_b_params != b.state_b_params)) {
+            printf("\nlayer %d does not match", layer);
+            pass = false;
+        }
+    }
+    return pass;
+}
+
+bool scope_ring_test() {
+    using namespace Steinberg::Vst::Nina;
+    // use a test segment, so the test doesn't replace or unlink the ring of a running processor
+    constexpr char ring_name[] = "/nina_scope_ring_test";
+    GuiScopeRing ring;
+    GuiScopeRingReader reader;
+    if (!ring.open(ring_name) || !reader.open(ring_name)) {
+        printf("\ncould not open the scope ring");
+        return false;
+    }
+
+    // nothing to read until a frame is published
+    std::array<float, GUI_SAMPLES_SIZE> samples;
+    if (reader.readLatest(samples.data())) {
+        printf("\nread a frame before one was published");
+        return false;
+    }
+
+    // publish more frames than the ring holds, the reader should only see the latest
+    constexpr uint num_frames = GUI_SCOPE_RING_NUM_FRAMES + 3;
+    for (uint frame = 0; frame < num_frames; frame++) {
+        float *frame_samples = ring.beginFrame();
+        for (uint i = 0; i < GUI_SAMPLES_SIZE; i++) {
+            frame_samples[i] = (float)(frame * GUI_SAMPLES_SIZE + i);
+        }
+        ring.publishFrame();
+    }
+    if (!reader.readLatest(samples.data())) {
+        printf("\nno frame read");
+        return false;
+    }
+    for (uint i = 0; i < GUI_SAMPLES_SIZE; i++) {
+        if (samples[i] != (float)((num_frames - 1) * GUI_SAMPLES_SIZE + i)) {
+            printf("\nsample %d does not match", i);
+            return false;
+        }
+    }
+    if (reader.readLatest(samples.data())) {
+        printf("\nread the same frame twice");
+        return false;
+    }
+
+    // the segment is removed when the writer closes
+    reader.close();
+    ring.close();
+    if (reader.open(ring_name)) {
+        printf("\nscope ring not unlinked");
+        return false;
+    }
+    return true;
+}
+
+bool analog_osc_batch_test() {
+    using namespace Steinberg::Vst::Nina;
+
+    // one set of oscs is run directly and the other through the batch. two oscs are left in the restart state so
+    // the batch has a partly filled vector
+    constexpr uint num_oscs = NUM_VOICES * 2;
+    std::vector<std::unique_ptr<AnalogOscModel>> direct_oscs;
+    std::vector<std::unique_ptr<AnalogOscModel>> batch_oscs;
+    for (uint osc = 0; osc < num_oscs; osc++) {
+        direct_oscs.push_back(std::make_unique<AnalogOscModel>(osc / 2, osc % 2));
+        batch_oscs.push_back(std::make_unique<AnalogOscModel>(osc / 2, osc % 2));
+        if (osc < num_oscs - 2) {
+            direct_oscs[osc]->setUnitTestMode();
+            batch_oscs[osc]->setUnitTestMode();
+        }
+    }
+
+    std::vector<std::array<float, CV_BUFFER_SIZE>> pitch(num_oscs), shape(num_oscs);
+    std::vector<std::array<float, BUFFER_SIZE>> direct_out(num_oscs), batch_out(num_oscs);
+    AnalogOscBatch batch;
+    float max_error = 0.f;
+    uint max_lanes = 0;
+    bool states_match = true;
+    for (uint buffer = 0; buffer < 200; buffer++) {
+        for (uint osc = 0; osc < num_oscs; osc++) {
+            for (uint i = 0; i < CV_BUFFER_SIZE; i++) {
+                pitch[osc][i] = 1.f + 1.6f * (float)rand() / (float)RAND_MAX;
+                shape[osc][i] = 2.f * (float)rand() / (float)RAND_MAX - 1.f;
+            }
+            direct_out[osc].fill(0.f);
+            batch_out[osc].fill(0.f);
+            direct_oscs[osc]->run(pitch[osc], shape[osc], direct_out[osc]);
+        }
+        batch.clear();
+        for (uint osc = 0; osc < num_oscs; osc++) {
+            if (batch_oscs[osc]->runState(batch_out[osc])) {
+                batch.add(*batch_oscs[osc], pitch[osc], shape[osc], batch_out[osc]);
+            }
+        }
+        max_lanes = std::max(max_lanes, batch.size());
+        batch.run();
+        for (uint osc = 0; osc < num_oscs; osc++) {
+            batch_oscs[osc]->finishRun(batch_out[osc]);
+            states_match = states_match && (direct_oscs[osc]->isNormal() == batch_oscs[osc]->isNormal());
+            for (uint i = 0; i < BUFFER_SIZE; i++) {
+                max_error = std::max(max_error, std::abs(direct_out[osc][i] - batch_out[osc][i]));
+            }
+        }
+    }
+
+    // the batch and the direct model share the model evaluation, so they should match exactly
+    printf("\nanalog osc batch lanes %d, max error %e", max_lanes, max_error);
+    return states_match && (max_lanes == num_oscs - 2) && (max_error == 0.f);
+}
+
+bool analog_model_eval_test() {
+    using namespace Steinberg::Vst::Nina;
+
+    // the model as it was evaluated before, with exp2f and the expanded polynomial
+    auto reference_voltage = [](float f1, float f2, float t, const AnalogModel &o) {
+        const float hz_f1 = std::exp2f(f1);
+        const float hz_f2 = std::exp2f(f2);
+        const float hz_f1_2 = f1 * f1;
+        const float hz_f1_3 = hz_f1_2 * f1;
+        return (float)(o.e * hz_f2 + t + (o.a * t + o.b) * f1 + o.f * f2 + o.d * hz_f1 + o.h * hz_f1_2 + o.g * hz_f1_3 + 0.001 / (hz_f1 + o.j));
+    };
+
+    // exp2 over the range of log2 frequencies the oscs can be driven to, and well past it
+    float max_exp2_error = 0.f;
+    for (float x = -20.f; x < 20.f; x += 0.000731f) {
+        const double exact = std::exp2((double)x);
+        max_exp2_error = std::max(max_exp2_error, (float)(std::abs(analogExp2(x) - exact) / exact));
+    }
+
+    // random models around the default, with the tracking offsets and frequencies the oscs run at
+    AnalogModelLanes up;
+    AnalogModelLanes down;
+    std::vector<AnalogModel> up_models(ANALOG_OSC_BATCH_LANES);
+    std::vector<AnalogModel> down_models(ANALOG_OSC_BATCH_LANES);
+    auto rand_scale = []() { return 0.5f + (float)rand() / (float)RAND_MAX; };
+    for (uint l = 0; l < ANALOG_OSC_BATCH_LANES; l++) {
+        for (auto *model : {&up_models[l], &down_models[l]}) {
+            model->a *= rand_scale();
+            model->b *= rand_scale();
+            model->d *= rand_scale();
+            model->e *= rand_scale();
+            model->f *= rand_scale();
+            model->g *= rand_scale();
+            model->h *= rand_scale();
+            model->j = 0.1f * (float)rand() / (float)RAND_MAX;
+        }
+        up.set(l, up_models[l], 6.f * (float)rand() / (float)RAND_MAX - 3.f);
+        down.set(l, down_models[l], 6.f * (float)rand() / (float)RAND_MAX - 3.f);
+    }
+    float max_error = 0.f;
+    bool vector_match = true;
+    alignas(16) AnalogOscLanes f_up, f_down, v_up, v_down, v_up_ref, v_down_ref;
+    for (uint run = 0; run < 5000; run++) {
+        for (uint l = 0; l < ANALOG_OSC_BATCH_LANES; l++) {
+            f_up[l] = std::log2(15.f) + (std::log2(20000.f) - std::log2(15.f)) * (float)rand() / (float)RAND_MAX;
+            f_down[l] = std::log2(15.f) + (std::log2(20000.f) - std::log2(15.f)) * (float)rand() / (float)RAND_MAX;
+        }
+        analogOscVoltages(up, down, f_up.data(), f_down.data(), v_up.data(), v_down.data(), ANALOG_OSC_BATCH_LANES);
+        analogOscVoltagesScalar(up, down, f_up.data(), f_down.data(), v_up_ref.data(), v_down_ref.data(), ANALOG_OSC_BATCH_LANES);
+        vector_match = vector_match && (std::memcmp(v_up.data(), v_up_ref.data(), sizeof(v_up)) == 0) && (std::memcmp(v_down.data(), v_down_ref.data(), sizeof(v_down)) == 0);
+        for (uint l = 0; l < ANALOG_OSC_BATCH_LANES; l++) {
+            max_error = std::max(max_error, std::abs(v_up[l] - reference_voltage(f_up[l], f_down[l], up.track[l], up_models[l])));
+            max_error = std::max(max_error, std::abs(v_down[l] - reference_voltage(f_down[l], f_up[l], down.track[l], down_models[l])));
+        }
+    }
+
+    // the voltages are up to a few volts, so an error of a few ulp is far below a cent of tuning
+    printf("\nanalog model exp2 max rel error %e, voltage max error %e", max_exp2_error, max_error);
+    return vector_match && (max_exp2_error < 2.5e-7f) && (max_error < 2e-6f);
+}
+
+bool osc_model_fit_test() {
+    using namespace Steinberg::Vst::Nina;
+
+    // measurements from a model away from the default, with drift in the tracking offsets, noise and a few bad
+    // measurements. the fit starts from the default model. the error depends on the noise, so the seed is fixed
+    std::srand(1);
+    AnalogModel true_up;
+    AnalogModel true_down;
+    true_up.b *= 1.05f;
+    true_up.d *= 1.3f;
+    true_up.e *= 0.8f;
+    true_up.h *= 1.2f;
+    true_down.a *= 0.9f;
+    true_down.b *= 0.97f;
+    true_down.f *= 1.4f;
+    true_down.d *= 0.75f;
+    auto voltage = [](const AnalogModel &o, float t, float f1, float f2) {
+        return analogModelVoltage(o, t, f1, f2, analogExp2(f1), analogExp2(f2));
+    };
+    std::vector<OscFitMeasurement> measurements;
+    float offset_up = 0.f;
+    float offset_down = 0.f;
+    for (uint m = 0; m < OSC_FIT_MAX_MEASUREMENTS / 2; m++) {
+        if (m % OSC_FIT_GROUP_SIZE == 0) {
+            offset_up += 0.01f * (float)rand() / (float)RAND_MAX - 0.005f;
+            offset_down += 0.01f * (float)rand() / (float)RAND_MAX - 0.005f;
+        }
+        const float f_up = std::log2(30.f) + (std::log2(15000.f) - std::log2(30.f)) * (float)rand() / (float)RAND_MAX;
+        const float f_down = std::log2(30.f) + (std::log2(15000.f) - std::log2(30.f)) * (float)rand() / (float)RAND_MAX;
+        const float noise = 0.00004f * (float)rand() / (float)RAND_MAX - 0.00002f;
+        const float bad = (m % 37 == 5) ? 0.05f : 0.f;
+        measurements.push_back({voltage(true_up, offset_up, f_up, f_down) + noise + bad, voltage(true_down, offset_down, f_down, f_up) - noise, 1.f / std::exp2(f_up), 1.f / std::exp2(f_down)});
+    }
+    const AnalogModel start;
+    CalStoreOscModel model;
+    model.up = model.down = {start.a, start.b, start.c, start.d, start.e, start.f, start.g, start.h, start.i, start.j};
+    OscModelFit fit;
+    const auto fit_start = std::chrono::steady_clock::now();
+    bool pass = fit.fit(measurements, model);
+    const float fit_time = std::chrono::duration<float>(std::chrono::steady_clock::now() - fit_start).count();
+
+    // the tracking loop takes out a constant offset, so compare the voltages across the range less the mean error
+    AnalogOscModel osc(0, 0);
+    osc.setModel(model);
+    const auto fitted = osc.getModel();
+    AnalogModel fit_up;
+    AnalogModel fit_down;
+    fit_up.a = fitted.up[0], fit_up.b = fitted.up[1], fit_up.d = fitted.up[3], fit_up.e = fitted.up[4], fit_up.f = fitted.up[5], fit_up.g = fitted.up[6], fit_up.h = fitted.up[7];
+    fit_down.a = fitted.down[0], fit_down.b = fitted.down[1], fit_down.d = fitted.down[3], fit_down.e = fitted.down[4], fit_down.f = fitted.down[5], fit_down.g = fitted.down[6], fit_down.h = fitted.down[7];
+    std::vector<float> errors;
+    for (float f1 = std::log2(30.f); f1 < std::log2(15000.f); f1 += 0.25f) {
+        for (float f2 = std::log2(30.f); f2 < std::log2(15000.f); f2 += 0.25f) {
+            errors.push_back(voltage(fit_up, 0.f, f1, f2) - voltage(true_up, 0.f, f1, f2));
+            errors.push_back(voltage(fit_down, 0.f, f1, f2) - voltage(true_down, 0.f, f1, f2));
+        }
+    }
+    float mean_error = 0.f;
+    for (auto error : errors) {
+        mean_error += error / errors.size();
+    }
+    float max_error = 0.f;
+    for (auto error : errors) {
+        max_error = std::max(max_error, std::abs(error - mean_error));
+    }
+
+    // a published model is only taken by the osc at the start of its next buffer
+    CalStoreOscModel published = model;
+    published.up[1] = 0.06f;
+    AnalogOscModel swap_osc(0, 1);
+    pass = pass && swap_osc.publishModel(&published) && !swap_osc.publishModel(&model) && !swap_osc.modelTaken();
+    std::array<float, CV_BUFFER_SIZE> pitch;
+    std::array<float, CV_BUFFER_SIZE> shape;
+    std::array<float, BUFFER_SIZE> out;
+    pitch.fill(1.5f);
+    shape.fill(0.f);
+    out.fill(0.f);
+    swap_osc.run(pitch, shape, out);
+    pass = pass && swap_osc.modelTaken() && (swap_osc.getModel().up[1] == 0.06f);
+
+    printf("\nosc model fit rms %e %e, max error %e, offset %e, %f ms", fit.rmsErrorUp(), fit.rmsErrorDown(), max_error, mean_error, fit_time * 1000.f);
+
+    // this seed gives a max error of 73uV, the bound leaves about 10% for rounding differences between targets
+    return pass && (max_error < 0.00008f);
+}
+
+bool cal_scheduler_test() {
+    using namespace Steinberg::Vst::Nina;
+
+    // each voice has a vca zero point on each channel, and the measured level is a V around it with a noise floor
+    constexpr uint settle = 2;
+    constexpr uint measure = 4;
+    std::array<std::array<float, 2>, NUM_VOICES> zero;
+    for (auto &voice_zero : zero) {
+        for (auto &channel_zero : voice_zero) {
+            channel_zero = 0.016f * (float)rand() / (float)RAND_MAX - 0.008f;
+        }
+    }
+    CalScheduler scheduler;
+    scheduler.start(2, settle, measure);
+    for (uint voice = 0; voice < NUM_VOICES; voice++) {
+        for (uint channel = 0; channel < 2; channel++) {
+            scheduler.search(voice, channel).start(-0.01f, 0.01f, 0.00005f, 0.0001f, 16);
+        }
+    }
+    uint slots = 0;
+    uint max_slots = 0;
+    bool voices_alternate = true;
+    uint last_voice = NUM_VOICES;
+    while (scheduler.startBuffer() && slots < 10000) {
+        const uint voice = scheduler.voice();
+        if (scheduler.slotStart()) {
+            voices_alternate = voices_alternate && (voice != last_voice);
+            last_voice = voice;
+        }
+        for (uint channel = 0; channel < 2; channel++) {
+            const float noise = 0.00001f * (float)rand() / (float)RAND_MAX;
+            const float level = 0.0002f + 0.5f * std::abs(scheduler.search(voice, channel).probe() - zero[voice][channel]) + noise;
+            scheduler.addLevel(channel, level * level * (float)BUFFER_SIZE);
+        }
+        slots += scheduler.endBuffer() ? 1 : 0;
+    }
+    float max_error = 0.f;
+    for (uint voice = 0; voice < NUM_VOICES; voice++) {
+        for (uint channel = 0; channel < 2; channel++) {
+            max_error = std::max(max_error, std::abs(scheduler.search(voice, channel).result() - zero[voice][channel]));
+        }
+    }
+
+    // a fixed step search of 0.0001 would need up to 80 slots per voice just to walk to the zero point
+    printf("\ncal scheduler %d slots for %d voices, max error %f", slots, NUM_VOICES, max_error);
+    return voices_alternate && (max_error < 0.0001f) && (slots <= NUM_VOICES * 2 * 16);
+}
+
+bool cal_store_test() {
+    using namespace Steinberg::Vst::Nina;
+    const std::string store_path = "/tmp/nina_cal_store_test.db";
+
+    // fill every voice with random calibration and write it out
+    CalStore store;
+    for (uint voice = 0; voice < NUM_VOICES; voice++) {
+        CalStoreVoice record = store.voice(voice);
+        record.valid = CAL_STORE_VOICE_VALID | (voice % 2 ? CAL_STORE_OSC_VALID : CAL_STORE_FILTER_MODEL_VALID);
+        record.blacklisted = voice == 3;
+        for (auto &value : record.mix_vca) {
+            value = (float)rand() / (float)RAND_MAX;
+        }
+        for (auto &value : record.filter) {
+            value = (float)rand() / (float)RAND_MAX;
+        }
+        for (auto &osc : record.osc) {
+            for (auto &coeff : osc.up) {
+                coeff = (float)rand() / (float)RAND_MAX;
+            }
+            for (auto &coeff : osc.down) {
+                coeff = (float)rand() / (float)RAND_MAX;
+            }
+        }
+        store.setVoice(voice, record);
+    }
+    bool pass = store.dirty() && store.save(store_path) && !store.dirty();
+
+    // the loaded store should match exactly
+    CalStore loaded;
+    pass = pass && loaded.load(store_path);
+    for (uint voice = 0; voice < NUM_VOICES; voice++) {
+        const CalStoreVoice saved_record = store.voice(voice);
+        const CalStoreVoice loaded_record = loaded.voice(voice);
+        pass = pass && (std::memcmp(&saved_record, &loaded_record, sizeof(CalStoreVoice)) == 0);
+    }
+
+    // voice cal from the file writer keeps the models in the record
+    CalStoreVoice voice_cal = {};
+    voice_cal.mix_vca[0] = 0.25f;
+    voice_cal.blacklisted = 1;
+    loaded.setVoiceCal(0, voice_cal);
+    const CalStoreVoice merged = loaded.voice(0);
+    pass = pass && loaded.dirty() && (merged.mix_vca[0] == 0.25f) && (merged.blacklisted == 1) &&
+           (merged.osc[1].down[9] == store.voice(0).osc[1].down[9]) && (merged.valid == store.voice(0).valid);
+
+    // flip a byte in the last record, the store must be rejected and the old records kept
+    std::fstream file(store_path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(-4, std::ios::end);
+    file.put(0x5a);
+    file.close();
+    CalStore corrupt;
+    pass = pass && !corrupt.load(store_path) && (corrupt.voice(0).valid == 0);
+    pass = pass && !loaded.load(store_path) && (loaded.voice(3).blacklisted == 1);
+    ::unlink(store_path.c_str());
+    return pass;
+}
+
+bool file_writer_test() {
+    using namespace Steinberg::Vst::Nina;
+
+    // the writer is not started, so posts from several threads should fill the queue exactly and then be dropped
+    FileWriter writer;
+    std::atomic<uint> posted = 0;
+    std::vector<std::thread> threads;
+    for (uint t = 0; t < 4; t++) {
+        threads.emplace_back([&writer, &posted, t]() {
+            std::array<float, 8> data;
+            data.fill((float)t);
+            for (uint i = 0; i < FILE_WRITER_QUEUE_SIZE; i++) {
+                if (writer.post(FileWriteType::OSC_TUNING, t, data)) {
+                    posted++;
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    printf("\nfile writer posted %d of %d", posted.load(), FILE_WRITER_QUEUE_SIZE * 4);
+    return posted == FILE_WRITER_QUEUE_SIZE;
+}
+
+bool file_writer_flush_test() {
+    using namespace Steinberg::Vst::Nina;
+    const std::string prefix = "/tmp/nina_file_writer_test_";
+    const std::string cal_info_path = prefix + "cal_info.dat";
+    const std::string tuning_path = prefix + "voice_0_osc_0.txt";
+    std::remove(cal_info_path.c_str());
+    std::remove(tuning_path.c_str());
+    auto exists = [](const std::string &path) { return std::ifstream(path).is_open(); };
+
+    // the cal info replaces a file the cal scripts poll, so it is written on the next poll, while the tuning
+    // appends are held back and gathered into one write
+    FileWriter writer;
+    writer.setTuningPath(prefix);
+    writer.start();
+    const auto start = std::chrono::steady_clock::now();
+    const std::array<float, 4> measurement = {1.f, 2.f, 3.f, 4.f};
+    writer.post(FileWriteType::OSC_TUNING, 0, measurement);
+    writer.post(FileWriteType::OSC_TUNING, 0, measurement);
+    const std::array<float, 2> cal_info = {0.25f, 0.75f};
+    writer.post(FileWriteType::CAL_INFO, 0, cal_info);
+    while (!exists(cal_info_path) && ((std::chrono::steady_clock::now() - start) < FILE_WRITER_FLUSH_TIME)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    const bool cal_info_written = exists(cal_info_path);
+    const bool tuning_held = !exists(tuning_path) && ((std::chrono::steady_clock::now() - start) < FILE_WRITER_FLUSH_TIME);
+
+    // the held appends are written when the writer is stopped
+    writer.post(FileWriteType::OSC_TUNING, 0, measurement);
+    writer.stop();
+    std::array<float, 2> read_info = {};
+    std::ifstream info_file(cal_info_path, std::ios::binary);
+    info_file.read(reinterpret_cast<char *>(read_info.data()), sizeof(read_info));
+    std::ifstream tuning_file(tuning_path);
+    uint measurements = 0;
+    std::string line;
+    while (std::getline(tuning_file, line)) {
+        measurements += (line == "1, 2, 3, 4") ? 1 : 0;
+    }
+    std::remove(cal_info_path.c_str());
+    std::remove(tuning_path.c_str());
+    printf("\nfile writer cal info written %d, tuning held %d, measurements %d", cal_info_written, tuning_held, measurements);
+    return cal_info_written && tuning_held && (read_info == cal_info) && (measurements == 3);
+}
+
+bool cal_reload_test() {
+    using namespace Steinberg::Vst::Nina;
+    AnalogVoice voice{0};
+    std::array<float, BUFFER_SIZE> out_1, out_2;
+    VoiceOutput output{&out_1, &out_2};
+
+    // the writer does the reload when it is stopped, the voice should only take it when it runs its next buffer
+    FileWriter writer;
+    std::array<AnalogVoice *, NUM_VOICES> voices = {};
+    voices[0] = &voice;
+    writer.setVoices(voices);
+    writer.start();
+    const bool posted = writer.post(FileWriteType::CAL_RELOAD, 0, true);
+    writer.stop();
+    const bool published = !voice.reloadCalibration();
+    voice.generateVoiceBuffers(output);
+    const bool taken = voice.reloadCalibration();
+    printf("\ncal reload posted %d published %d taken %d", posted, published, taken);
+    return posted && published && taken;
+}
+
+bool runtime_options_test() {
+    using namespace Steinberg::Vst::Nina;
+
+    // comments, blank lines, unknown options and bad values are skipped, options that aren't set keep their default
+    std::stringstream file("# runtime options\n\nlayer_workers 3\nnot_an_option 1\nsample_accurate_automation 1\ngui_scope_shm 1\ndelay_packed_storage 1\nparallel_cal 1\nosc_refit 1\n");
+    const auto options = RuntimeOptions::parse(file);
+    std::stringstream bad_file("layer_workers many\n");
+    const auto bad_options = RuntimeOptions::parse(bad_file);
+    std::stringstream empty_file("");
+    const auto default_options = RuntimeOptions::parse(empty_file);
+    printf("\nruntime options layer workers %d %d %d", options.layer_workers, bad_options.layer_workers, default_options.layer_workers);
+    return options.layer_workers == 3 && options.sample_accurate_automation && options.gui_scope_shm &&
+           options.delay_packed_storage && options.parallel_cal && options.osc_refit && bad_options.layer_workers == 0 &&
+           default_options.layer_workers == 0 && !default_options.sample_accurate_automation &&
+           !default_options.gui_scope_shm && !default_options.delay_packed_storage && !default_options.parallel_cal &&
+           !default_options.osc_refit;
+}
+
+bool vca_mux_test() {
+    using namespace Steinberg::Vst::Nina;
+    Vca<Cv0MixOsc1Tri, false> tri_0;
+    Vca<Cv0MixOsc2Tri, true> tri_1;
+    Vca<Cv0MixOsc1Sq, false> sqr_0;
+    Vca<Cv0MixOsc2Sq, true> sqr_1;
+    Vca<Cv1MixXor, false> xor_vca;
+    Vca<Cv1AmpL, false> left;
+    Vca<Cv1AmpR, false> right;
+    tri_0.setZeroOffset(0.013f);
+    tri_1.setZeroOffset(-0.021f);
+    sqr_0.setZeroOffset(0.034f);
+    sqr_1.setZeroOffset(0.005f);
+    xor_vca.setZeroOffset(-0.008f);
+    left.setZeroOffset(0.017f);
+    right.setZeroOffset(-0.029f);
+
+    // random levels, and random data in the slots the vcas do not own so any overwrite is caught
+    std::array<std::array<float, CV_BUFFER_SIZE>, 8> levels;
+    for (auto &level : levels) {
+        for (auto &sample : level) {
+            sample = (float)rand() / (float)RAND_MAX;
+        }
+    }
+    std::array<float, BUFFER_SIZE> ref_1, ref_2, out_1, out_2;
+    for (uint i = 0; i < BUFFER_SIZE; i++) {
+        ref_1[i] = out_1[i] = (float)rand() / (float)RAND_MAX;
+        ref_2[i] = out_2[i] = (float)rand() / (float)RAND_MAX;
+    }
+
+    // reference is the strided write of each vca
+    sqr_0.runVca<false>(levels[0], ref_1);
+    tri_0.runVca<false>(levels[1], ref_1);
+    sqr_1.runVca<false>(levels[2], ref_1);
+    tri_1.runVca<false>(levels[3], ref_1);
+    xor_vca.runVca<false>(levels[4], ref_2);
+    left.runVca<false>(levels[5], ref_2);
+    right.runVca<false>(levels[6], ref_2);
+    for (uint i = 0; i < CV_BUFFER_SIZE; i++) {
+        ref_2[i * CV_MUX_INC + Cv1BitArray] = levels[7][i];
+    }
+
+    const VcaMuxInput input = {
+        {levels[0].data(), levels[1].data(), levels[2].data(), levels[3].data()},
+        {sqr_0.muxOffset(), tri_0.muxOffset(), sqr_1.muxOffset(), tri_1.muxOffset()},
+        levels[4].data(),
+        levels[5].data(),
+        levels[6].data(),
+        levels[7].data(),
+        xor_vca.muxOffset(),
+        left.muxOffset(),
+        right.muxOffset()};
+    vcaMuxWrite(input, out_1, out_2);
+    const bool vector_match = (std::memcmp(ref_1.data(), out_1.data(), sizeof(ref_1)) == 0) && (std::memcmp(ref_2.data(), out_2.data(), sizeof(ref_2)) == 0);
+    vcaMuxWriteScalar(input, out_1, out_2);
+    const bool scalar_match = (std::memcmp(ref_1.data(), out_1.data(), sizeof(ref_1)) == 0) && (std::memcmp(ref_2.data(), out_2.data(), sizeof(ref_2)) == 0);
+    printf("\nvca mux writer match %d, scalar match %d", vector_match, scalar_match);
+    return vector_match && scalar_match;
+}
+
+bool chorus_block_test() {
+    using namespace Steinberg::Vst::Nina;
+    ChorusEngine sample_engine(SAMPLE_RATE);
+    ChorusEngine block_engine(SAMPLE_RATE);
+    sample_engine.setEnablesChorus(true, true);
+    block_engine.setEnablesChorus(true, true);
+    sample_engine.setVol(0.8f);
+    block_engine.setVol(0.8f);
+
+    // run a few seconds of a detuned saw pair through both paths, so the lfos go through several peaks
+    std::array<float, BUFFER_SIZE> in_l, in_r, sample_l, sample_r, block_l, block_r;
+    float phase_l = 0.f;
+    float phase_r = 0.f;
+    float max_error = 0.f;
+    double error_sum = 0.0;
+    double signal_sum = 0.0;
+    const uint num_buffers = 4 * SAMPLE_RATE / BUFFER_SIZE;
+    for (uint buffer = 0; buffer < num_buffers; buffer++) {
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            in_l[i] = phase_l * 2.f - 1.f;
+            in_r[i] = phase_r * 2.f - 1.f;
+            phase_l += 220.f / SAMPLE_RATE;
+            phase_r += 221.f / SAMPLE_RATE;
+            phase_l -= (phase_l >= 1.f) ? 1.f : 0.f;
+            phase_r -= (phase_r >= 1.f) ? 1.f : 0.f;
+            sample_l[i] = sample_r[i] = block_l[i] = block_r[i] = 0.f;
+        }
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            sample_engine.process(&in_l[i], &in_r[i], &sample_l[i], &sample_r[i]);
+        }
+        block_engine.process(in_l.data(), in_r.data(), block_l.data(), block_r.data(), BUFFER_SIZE);
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            max_error = std::max(max_error, std::abs(sample_l[i] - block_l[i]));
+            max_error = std::max(max_error, std::abs(sample_r[i] - block_r[i]));
+            error_sum += (sample_l[i] - block_l[i]) * (sample_l[i] - block_l[i]) + (sample_r[i] - block_r[i]) * (sample_r[i] - block_r[i]);
+            signal_sum += sample_l[i] * sample_l[i] + sample_r[i] * sample_r[i];
+        }
+    }
+    const float error_db = 10.f * std::log10(error_sum / signal_sum);
+    printf("\nchorus block max error %f, error %fdB", max_error, error_db);
+
+    // the block path works out the same delays as the per sample path, so only rounding differences are allowed
+    return error_db < -120.f;
+}
+
+bool delay_block_test() {
+    using namespace Steinberg::Vst::Nina;
+    BBDDelay sample_left, sample_right, block_left, block_right;
+    for (BBDDelay *delay : {&sample_left, &sample_right, &block_left, &block_right}) {
+        delay->reset();
+        delay->setLevel(0.7);
+        delay->setFB(0.8);
+        delay->setFilter(0.7);
+        delay->setTime(0.3);
+        delay->setTempo(1.f);
+    }
+    sample_left.setLFO(0.4, 6);
+    block_left.setLFO(0.4, 6);
+    sample_right.setLFO(0.65, 6);
+    block_right.setLFO(0.65, 6);
+
+    // run a saw pair through both paths, then switch to a short tempo synced time so the block path falls back
+    std::array<float, BUFFER_SIZE> in_l, in_r, sample_l, sample_r, block_l, block_r;
+    float phase_l = 0.f;
+    float phase_r = 0.f;
+    float max_error = 0.f;
+    double error_sum = 0.0;
+    double signal_sum = 0.0;
+    const uint num_buffers = 6 * SAMPLE_RATE / BUFFER_SIZE;
+    for (uint buffer = 0; buffer < num_buffers; buffer++) {
+        if (buffer == num_buffers / 2) {
+            for (BBDDelay *delay : {&sample_left, &sample_right, &block_left, &block_right}) {
+                delay->setTempo(400.f);
+                delay->setTimeSync(0.f);
+                delay->setTempoSync(true);
+            }
+        }
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            const bool gate = (buffer % 64) < 8;
+            in_l[i] = gate ? (phase_l * 2.f - 1.f) : 0.f;
+            in_r[i] = gate ? (phase_r * 2.f - 1.f) : 0.f;
+            phase_l += 220.f / SAMPLE_RATE;
+            phase_r += 331.f / SAMPLE_RATE;
+            phase_l -= (phase_l >= 1.f) ? 1.f : 0.f;
+            phase_r -= (phase_r >= 1.f) ? 1.f : 0.f;
+            sample_l[i] = sample_r[i] = block_l[i] = block_r[i] = 0.f;
+        }
+        sample_left.run(in_l.data(), sample_l.data());
+        sample_right.run(in_r.data(), sample_r.data());
+        BBDDelay::runStereo(block_left, block_right, in_l.data(), in_r.data(), block_l.data(), block_r.data());
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            max_error = std::max(max_error, std::abs(sample_l[i] - block_l[i]));
+            max_error = std::max(max_error, std::abs(sample_r[i] - block_r[i]));
+            error_sum += (sample_l[i] - block_l[i]) * (sample_l[i] - block_l[i]) + (sample_r[i] - block_r[i]) * (sample_r[i] - block_r[i]);
+            signal_sum += sample_l[i] * sample_l[i] + sample_r[i] * sample_r[i];
+        }
+    }
+    const float error_db = 10.f * std::log10((error_sum + 1e-30) / signal_sum);
+    printf("\ndelay block max error %f, error %fdB", max_error, error_db);
+    return (signal_sum > 0.0) && (error_db < -100.f);
+}
+
+bool delay_segment_test() {
+    using namespace Steinberg::Vst::Nina;
+    BBDDelay whole, split;
+    for (BBDDelay *delay : {&whole, &split}) {
+        delay->setLevel(0.7);
+        delay->setFB(0.8);
+        delay->setFilter(0.7);
+        delay->setTime(0.3);
+        delay->setLFO(0.4, 6);
+    }
+
+    // running a buffer in segments with no param changes should match running it in one go
+    std::array<float, BUFFER_SIZE> input, whole_out, split_out;
+    float phase = 0.f;
+    float max_error = 0.f;
+    const uint splits[] = {0, 1, 17, 64, 100, 127, BUFFER_SIZE};
+    for (uint buffer = 0; buffer < 4 * BUFFER_RATE; buffer++) {
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            input[i] = ((buffer % 64) < 8) ? (phase * 2.f - 1.f) : 0.f;
+            phase += 220.f / SAMPLE_RATE;
+            phase -= (phase >= 1.f) ? 1.f : 0.f;
+            whole_out[i] = split_out[i] = 0.f;
+        }
+        whole.run(input.data(), whole_out.data());
+        split.startSegments();
+        for (uint s = 0; s + 1 < std::size(splits); s++) {
+            split.runSegment(input.data(), split_out.data(), splits[s], splits[s + 1]);
+        }
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            max_error = std::max(max_error, std::abs(whole_out[i] - split_out[i]));
+        }
+    }
+    printf("\ndelay segment max error %f", max_error);
+    return max_error == 0.f;
+}
+
+bool delay_automation_test() {
+    using namespace Steinberg::Vst::Nina;
+    BBDDelay fixed, automated;
+    for (BBDDelay *delay : {&fixed, &automated}) {
+        delay->setLevel(0.7);
+        delay->setFB(0.5);
+        delay->setFilter(0.7);
+        delay->setTime(0.3);
+        delay->setLFO(0.4, 6);
+    }
+
+    // change the time part way through one buffer and the level part way through a later one, the output should
+    // match the fixed delay up to the change and differ from the sample the change is at
+    constexpr uint time_offset = 64;
+    constexpr uint level_offset = 96;
+    const uint time_buffer = BUFFER_RATE;
+    const uint level_buffer = BUFFER_RATE + 4;
+    std::array<float, BUFFER_SIZE> input, fixed_out, automated_out;
+    float phase = 0.f;
+    float error_before = 0.f;
+    float time_change = 0.f;
+    float level_after = 0.f;
+    for (uint buffer = 0; buffer <= level_buffer; buffer++) {
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            input[i] = phase * 2.f - 1.f;
+            phase += 220.f / SAMPLE_RATE;
+            phase -= (phase >= 1.f) ? 1.f : 0.f;
+            fixed_out[i] = automated_out[i] = 0.f;
+        }
+        fixed.startSegments();
+        fixed.runSegment(input.data(), fixed_out.data(), 0, BUFFER_SIZE);
+        automated.startSegments();
+        if (buffer == time_buffer) {
+            automated.runSegment(input.data(), automated_out.data(), 0, time_offset);
+            automated.setTime(0.8);
+            automated.runSegment(input.data(), automated_out.data(), time_offset, BUFFER_SIZE);
+        } else if (buffer == level_buffer) {
+            automated.runSegment(input.data(), automated_out.data(), 0, level_offset);
+            automated.setDelayMixAmount(0.f);
+            automated.runSegment(input.data(), automated_out.data(), level_offset, BUFFER_SIZE);
+        } else {
+            automated.runSegment(input.data(), automated_out.data(), 0, BUFFER_SIZE);
+        }
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            const float error = std::abs(fixed_out[i] - automated_out[i]);
+            if ((buffer < time_buffer) || ((buffer == time_buffer) && (i < time_offset))) {
+                error_before = std::max(error_before, error);
+            } else if (buffer == time_buffer) {
+                time_change = std::max(time_change, error);
+            } else if ((buffer == level_buffer) && (i >= level_offset)) {
+                level_after = std::max(level_after, std::abs(automated_out[i]));
+            }
+        }
+    }
+    printf("\ndelay automation error before %f, time change %f, level after %f", error_before, time_change, level_after);
+    return (error_before == 0.f) && (time_change > 0.001f) && (level_after == 0.f);
+}
+
+bool delay_packed_test() {
+    using namespace Steinberg::Vst::Nina;
+    BBDDelay float_left, float_right, packed_left, packed_right;
+    packed_left.setPackedStorage(true);
+    packed_right.setPackedStorage(true);
+    for (BBDDelay *delay : {&float_left, &float_right, &packed_left, &packed_right}) {
+        delay->setLevel(0.7);
+        delay->setFB(0.6);
+        delay->setFilter(0.7);
+        delay->setTime(1.f);
+        delay->setLFO(0.4, DELAY_MAX_LFO_AMOUNT);
+    }
+
+    // run the longest delay so the reads wrap around the whole line
+    std::array<float, BUFFER_SIZE> in_l, in_r, float_l, float_r, packed_l, packed_r;
+    float phase = 0.f;
+    double error_sum = 0.0;
+    double signal_sum = 0.0;
+    const uint num_buffers = 5 * SAMPLE_RATE / BUFFER_SIZE;
+    for (uint buffer = 0; buffer < num_buffers; buffer++) {
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            const bool gate = (buffer % 256) < 16;
+            in_l[i] = gate ? 0.5f * std::sin(2.f * (float)M_PI * phase) : 0.f;
+            in_r[i] = gate ? (phase * 2.f - 1.f) : 0.f;
+            phase += 440.f / SAMPLE_RATE;
+            phase -= (phase >= 1.f) ? 1.f : 0.f;
+            float_l[i] = float_r[i] = packed_l[i] = packed_r[i] = 0.f;
+        }
+        BBDDelay::runStereo(float_left, float_right, in_l.data(), in_r.data(), float_l.data(), float_r.data());
+        BBDDelay::runStereo(packed_left, packed_right, in_l.data(), in_r.data(), packed_l.data(), packed_r.data());
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            error_sum += (float_l[i] - packed_l[i]) * (float_l[i] - packed_l[i]) + (float_r[i] - packed_r[i]) * (float_r[i] - packed_r[i]);
+            signal_sum += float_l[i] * float_l[i] + float_r[i] * float_r[i];
+        }
+    }
+    const float error_db = 10.f * std::log10((error_sum + 1e-30) / signal_sum);
+    printf("\ndelay packed storage error %fdB", error_db);
+    return (signal_sum > 0.0) && (error_db < -70.f);
+}
+
+bool dynamics_test() {
+    using namespace Steinberg::Vst::Nina;
+    NinaLimiter limiter;
+    OutputLimiter output_limiter;
+    NinaExpander expander;
+
+    // bursts of a sine with a fast attack so the peaks land between control steps
+    std::array<float, BUFFER_SIZE> in_l, in_r, out_l, out_r, exp_l, exp_r;
+    float phase = 0.f;
+    float limiter_peak = 0.f;
+    float output_limiter_peak = 0.f;
+    float quiet_gain = 0.f;
+    float loud_gain = 0.f;
+    const uint num_buffers = 2 * 2048;
+    for (uint buffer = 0; buffer < num_buffers; buffer++) {
+        const bool loud = (buffer % 2048) < 128;
+        const float level = loud ? 0.5f : 0.0001f;
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            const float window = std::min(1.f, (float)((buffer % 2048) * BUFFER_SIZE + i) / 5.f);
+            in_l[i] = level * window * std::sin(2.f * (float)M_PI * phase);
+            in_r[i] = level * window * std::sin(2.f * (float)M_PI * phase * 1.5f);
+            phase += 997.f / SAMPLE_RATE;
+            phase -= (phase >= 2.f) ? 2.f : 0.f;
+        }
+        exp_l = in_l;
+        exp_r = in_r;
+        expander.process(exp_l.data(), exp_r.data());
+        limiter.run(in_l.data(), in_r.data(), out_l.data(), out_r.data());
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            limiter_peak = std::max(limiter_peak, std::max(std::abs(out_l[i]), std::abs(out_r[i])));
+        }
+        output_limiter.run(in_l.data(), in_r.data(), out_l.data(), out_r.data());
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            output_limiter_peak = std::max(output_limiter_peak, std::max(std::abs(out_l[i]), std::abs(out_r[i])));
+        }
+
+        // measure the expander gain at the end of each burst and each gap, the gaps are long enough for the rms
+        // detector to fully release
+        const uint last = BUFFER_SIZE - 1;
+        if ((buffer % 2048) == 127) {
+            loud_gain = exp_l[last] / in_l[last];
+        } else if ((buffer % 2048) == 2047) {
+            quiet_gain = exp_l[last] / in_l[last];
+        }
+    }
+    const float max_reduction = fastpow2(MAX_GR * (RATIO - 1.f) / RATIO);
+    printf("\nlimiter peak %f (limit %f), output limiter peak %f (limit %f)", limiter_peak, lim_thresh_linear_gain, output_limiter_peak, out_lim_thresh_linear_gain);
+    printf("\nexpander gain loud %f, quiet %f (expected %f)", loud_gain, quiet_gain, max_reduction);
+    bool pass = limiter_peak <= lim_thresh_linear_gain * 1.0001f;
+    pass = pass && (output_limiter_peak <= out_lim_thresh_linear_gain * 1.0001f);
+    pass = pass && (std::abs(loud_gain - 1.f) < 0.001f);
+    pass = pass && (std::abs(quiet_gain - max_reduction) < 0.01f);
+    return pass;
+}
+
+bool fx_activity_test() {
+    using namespace Steinberg::Vst::Nina;
+    BBDDelay ref_left, ref_right, fx_left, fx_right;
+    for (BBDDelay *delay : {&ref_left, &ref_right, &fx_left, &fx_right}) {
+        delay->setLevel(0.7);
+        delay->setFB(0.3);
+        delay->setFilter(0.7);
+        delay->setTime(1.f);
+        delay->setLFO(0.4, 6);
+    }
+    FxActivity activity(DELAY_MAX_TIME / (float)SAMPLE_RATE + 0.1f);
+
+    // a burst, then silence long enough for the echoes to die away, then another burst
+    std::array<float, BUFFER_SIZE> in_l, in_r, ref_l, ref_r, fx_l, fx_r, prev_l, prev_r;
+    float phase = 0.f;
+    float max_error = 0.f;
+    float resumed_peak = 0.f;
+    uint idle_buffers = 0;
+    bool resumed = false;
+    const uint num_buffers = 40 * BUFFER_RATE;
+    const uint second_burst = 30 * BUFFER_RATE;
+    for (uint buffer = 0; buffer < num_buffers; buffer++) {
+        const bool burst = (buffer < BUFFER_RATE / 4) || ((buffer >= second_burst) && (buffer < second_burst + BUFFER_RATE / 4));
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            in_l[i] = burst ? 0.5f * std::sin(2.f * (float)M_PI * phase) : 0.f;
+            in_r[i] = in_l[i];
+            phase += 440.f / SAMPLE_RATE;
+            phase -= (phase >= 1.f) ? 1.f : 0.f;
+            ref_l[i] = ref_r[i] = fx_l[i] = fx_r[i] = 0.f;
+        }
+        BBDDelay::runStereo(ref_left, ref_right, in_l.data(), in_r.data(), ref_l.data(), ref_r.data());
+        if (activity.start(fxPeak(in_l.data(), in_r.data()))) {
+            resumed = resumed || (idle_buffers > 0);
+            prev_l = fx_l;
+            prev_r = fx_r;
+            BBDDelay::runStereo(fx_left, fx_right, in_l.data(), in_r.data(), fx_l.data(), fx_r.data());
+            if (activity.tail()) {
+                activity.end(fxPeakDifference(fx_l.data(), fx_r.data(), prev_l.data(), prev_r.data()));
+            }
+        } else {
+            idle_buffers++;
+        }
+
+        // the lfo was paused while idle so the output only matches the reference up to the second burst
+        if (buffer < second_burst) {
+            for (uint i = 0; i < BUFFER_SIZE; i++) {
+                max_error = std::max(max_error, std::max(std::abs(ref_l[i] - fx_l[i]), std::abs(ref_r[i] - fx_r[i])));
+            }
+        } else if (buffer > second_burst + BUFFER_RATE / 4) {
+            resumed_peak = std::max(resumed_peak, fxPeak(fx_l.data(), fx_r.data()));
+        }
+    }
+
+    // skipping the idle buffers should only lose output below the silence threshold, and the second burst should
+    // still be echoed
+    printf("\nfx activity idle %d of %d buffers, max error %f, echo after resuming %f", idle_buffers, num_buffers, max_error, resumed_peak);
+    return (idle_buffers > 0) && resumed && (max_error < 10.f * FX_SILENCE_THRESHOLD) && (resumed_peak > 0.01f);
+}
+
+bool reverb_pool_test() {
+    using namespace Steinberg::Vst::Nina;
+    NinaReverb reverb;
+    reverb.setPreset(0);
+    reverb.setDecay(0.5);
+    reverb.setwetDry(1.f);
+    reverb.setInGain(0.9);
+
+    std::array<float, BUFFER_SIZE> input_l, input_r, output_l, output_r;
+    float *input_fp[2] = {input_l.data(), input_r.data()};
+    float *output_fp[2] = {output_l.data(), output_r.data()};
+    auto run_buffer = [&]() {
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            input_l[i] = 0.1f * ((float)std::rand() / (float)RAND_MAX - 0.5f);
+            input_r[i] = 0.1f * ((float)std::rand() / (float)RAND_MAX - 0.5f);
+            output_l[i] = 0.f;
+            output_r[i] = 0.f;
+        }
+        reverb.run(input_fp, output_fp, BUFFER_SIZE);
+        float power = 0.f;
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            power += output_l[i] * output_l[i] + output_r[i] * output_r[i];
+        }
+        return power / BUFFER_SIZE;
+    };
+
+    // run the first preset until the reverb has built up and the next preset has been created
+    float power = 0.f;
+    for (uint i = 0; i < SAMPLE_RATE / BUFFER_SIZE; i++) {
+        power = run_buffer();
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    if (reverb.numModels() != 2) {
+        printf("\n%d reverb models allocated, expected 2", reverb.numModels());
+        return false;
+    }
+
+    // switch through the presets, the output should never drop out
+    bool pass = true;
+    for (float preset : {0.75f, 0.25f, 0.5f, 0.f}) {
+        reverb.setPreset(preset);
+        const float start_power = power;
+        float min_power = power;
+        uint buffers = 0;
+        while (reverb.crossfading() && (buffers < SAMPLE_RATE / BUFFER_SIZE)) {
+            power = run_buffer();
+            min_power = std::min(min_power, power);
+            buffers++;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        float end_power = 0.f;
+        for (uint i = 0; i < SAMPLE_RATE / BUFFER_SIZE; i++) {
+            power = run_buffer();
+            end_power += power / (SAMPLE_RATE / BUFFER_SIZE);
+        }
+
+        // the level can dip a little as the tails are not correlated, but should never drop well below the
+        // level of either preset
+        const float ref_power = std::min(start_power, end_power);
+        printf("\npreset %f: switched in %d buffers, min level %fdB, %d models", preset, buffers, 10.f * std::log10(min_power / ref_power), reverb.numModels());
+        if (reverb.crossfading() || (min_power < (ref_power / 8.f)) || (reverb.numModels() > 3)) {
+            pass = false;
+        }
+    }
+
+    // sweep the decay and predelay, they are applied to the running model so there should be no crossfade
+    const float start_power = power;
+    float min_power = power;
+    bool crossfaded = false;
+    for (uint i = 0; i < 256; i++) {
+        reverb.setDecay(0.5f + 0.2f * (float)i / 256.f);
+        reverb.setPreDelay(0.1f * (float)i / 256.f);
+        power = run_buffer();
+        min_power = std::min(min_power, power);
+        crossfaded = crossfaded || reverb.crossfading();
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    printf("\ndecay sweep: min level %fdB, %d models", 10.f * std::log10(min_power / start_power), reverb.numModels());
+    if (crossfaded || (min_power < (start_power / 8.f)) || (reverb.numModels() > 3)) {
+        pass = false;
+    }
+    return pass;
+}
+
+bool reverb_tail_test() {
+    using namespace Steinberg::Vst::Nina;
+
+    // run two reverbs on the same burst of noise, then change the decay and predelay of one of them while the
+    // tail is decaying with no input
+    constexpr uint burst_buffers = SAMPLE_RATE / BUFFER_SIZE;
+    constexpr uint change_buffer = burst_buffers + (SAMPLE_RATE / BUFFER_SIZE) / 5;
+    constexpr uint num_buffers = change_buffer + (SAMPLE_RATE / BUFFER_SIZE) / 2;
+    std::array<NinaReverb, 2> reverbs;
+    for (auto &reverb : reverbs) {
+        reverb.setPreset(0);
+        reverb.setDecay(0.5);
+        reverb.setPreDelay(0.f);
+        reverb.setwetDry(1.f);
+        reverb.setInGain(0.9);
+    }
+    std::array<float, BUFFER_SIZE> input_l, input_r, output_l, output_r;
+    float *input_fp[2] = {input_l.data(), input_r.data()};
+    float *output_fp[2] = {output_l.data(), output_r.data()};
+    std::array<std::array<float, num_buffers>, 2> powers;
+    std::srand(1);
+    for (uint b = 0; b < num_buffers; b++) {
+        for (uint i = 0; i < BUFFER_SIZE; i++) {
+            const bool burst = b < burst_buffers;
+            input_l[i] = burst ? 0.1f * ((float)std::rand() / (float)RAND_MAX - 0.5f) : 0.f;
+            input_r[i] = burst ? 0.1f * ((float)std::rand() / (float)RAND_MAX - 0.5f) : 0.f;
+        }
+        if (b == change_buffer) {
+            reverbs[1].setDecay(0.7);
+            reverbs[1].setPreDelay(0.1);
+        }
+        for (uint r = 0; r < 2; r++) {
+            output_l.fill(0.f);
+            output_r.fill(0.f);
+            reverbs[r].run(input_fp, output_fp, BUFFER_SIZE);
+            float power = 0.f;
+            for (uint i = 0; i < BUFFER_SIZE; i++) {
+                power += output_l[i] * output_l[i] + output_r[i] * output_r[i];
+            }
+            powers[r][b] = power / BUFFER_SIZE;
+        }
+    }
+
+    // the longer decay and predelay both make the tail louder than the unchanged reverb, so the changed tail
+    // should never drop below it
+    float min_ratio = 1.f;
+    for (uint b = change_buffer; b < num_buffers; b++) {
+        min_ratio = std::min(min_ratio, powers[1][b] / powers[0][b]);
+    }
+    const float tail_level = powers[0][num_buffers - 1] / powers[0][burst_buffers - 1];
+    printf("\ntail level %fdB, min level after the change %fdB", 10.f * std::log10(tail_level), 10.f * std::log10(min_ratio));
+    return (tail_level > 1e-4f) && (min_ratio > 0.5f) && !reverbs[1].crossfading();
+}
+
+bool reverb_ir_test() {
+    using namespace Steinberg::Vst::Nina;
+
+    // IR with one tap in the head partition and one in the tail partitions
+    constexpr uint tail_tap = 5000;
+    AudioFile<float> ir_file;
+    ir_file.setNumChannels(2);
+    ir_file.setNumSamplesPerChannel(tail_tap + 1);
+    ir_file.setSampleRate(SAMPLE_RATE);
+    for (auto &channel : ir_file.samples) {
+        std::fill(channel.begin(), channel.end(), 0.f);
+        channel[0] = 0.5f;
+        channel[tail_tap] = 0.5f;
+    }
+    const std::string filename = "/tmp/nina_reverb_ir_test.wav";
+    ir_file.save(filename);
+
+    ReverbModel model(ReverbModes::ir);
+    if (!model.loadImpulse(filename)) {
+        printf("\ncould not load the IR");
+        return false;
+    }
+    std::array<float, paramCount> params;
+    params.fill(0.f);
+    params[paramInHighCut] = 20000;
+    params[paramInLowCut] = 20;
+    params[paramLate] = 100;
+    params[paramWidth] = 100;
+    model.update(params, 0.5, 0.5, true);
+    model.setSyncTail(true);
+
+    // run an impulse through, the head tap should come out in the same buffer
+    std::array<float, BUFFER_SIZE> input_l, input_r, shimmer;
+    float *input_fp[2] = {input_l.data(), input_r.data()};
+    shimmer.fill(0.f);
+    std::vector<float> output;
+    for (uint b = 0; b < (tail_tap / BUFFER_SIZE) + 8; b++) {
+        input_l.fill(0.f);
+        input_r.fill(0.f);
+        if (b == 0) {
+            input_l[0] = 1.f;
+            input_r[0] = 1.f;
+        }
+        model.process(input_fp, 1.f, shimmer.data(), shimmer.data(), 0.f);
+        output.insert(output.end(), model.late_out_buffer[0], model.late_out_buffer[0] + BUFFER_SIZE);
+    }
+    std::remove(filename.c_str());
+
+    // check the taps are in the right place, the input filters spread the impulse so the taps are only compared
+    // with each other
+    float head_peak = 0.f, tail_peak = 0.f, other_energy = 0.f, total_energy = 0.f;
+    for (uint i = 0; i < output.size(); i++) {
+        const float value = output[i];
+        total_energy += value * value;
+        if (i < BUFFER_SIZE) {
+            head_peak = std::max(head_peak, std::abs(value));
+        } else if ((i >= tail_tap) && (i < tail_tap + BUFFER_SIZE)) {
+            tail_peak = std::max(tail_peak, std::abs(value));
+        } else {
+            other_energy += value * value;
+        }
+    }
+    printf("\nhead tap %f, tail tap %f, energy outside the taps %fdB", head_peak, tail_peak, 10.f * std::log10(other_energy / total_energy));
+    return (head_peak > 0.1f) && (std::abs(tail_peak - head_peak) < (0.01f * head_peak)) && (other_energy < (total_energy / 100.f));
+}
+
+bool reverb_conv_test() {
+    using namespace Steinberg::Vst::Nina;
+
+    // random IR covering the head partition and several tail partitions, compared with a direct convolution
+    constexpr uint tail_size = REVERB_IR_HEAD_SIZE * REVERB_IR_TAIL_FACTOR;
+    constexpr uint ir_length = 3 * tail_size + 100;
+    constexpr uint num_buffers = (2 * ir_length) / BUFFER_SIZE;
+    std::srand(3);
+    auto random = []() { return (float)std::rand() / (float)RAND_MAX - 0.5f; };
+    std::vector<float> ir_l(ir_length), ir_r(ir_length);
+    for (uint i = 0; i < ir_length; i++) {
+        ir_l[i] = random();
+        ir_r[i] = random();
+    }
+    fv3::irmodel3p_f conv;
+    conv.setFragmentSize(REVERB_IR_HEAD_SIZE, REVERB_IR_TAIL_FACTOR);
+    conv.setprocessoptions(FV3_IR_MUTE_DRY | FV3_IR_SKIP_FILTER);
+    conv.setwet(0);
+    conv.setwidth(1.0);
+    conv.loadImpulse(ir_l.data(), ir_r.data(), ir_length);
+    conv.setSyncTail(true);
+
+    std::vector<float> input_l(num_buffers * BUFFER_SIZE), input_r(num_buffers * BUFFER_SIZE);
+    std::vector<float> output_l(num_buffers * BUFFER_SIZE), output_r(num_buffers * BUFFER_SIZE);
+    for (uint i = 0; i < input_l.size(); i++) {
+        input_l[i] = random();
+        input_r[i] = random();
+    }
+    for (uint b = 0; b < num_buffers; b++) {
+        const uint offset = b * BUFFER_SIZE;
+        conv.processreplace(&input_l[offset], &input_r[offset], &output_l[offset], &output_r[offset], BUFFER_SIZE);
+    }
+
+    float max_error = 0.f, max_output = 0.f;
+    for (uint i = 0; i < output_l.size(); i++) {
+        double expected_l = 0.0, expected_r = 0.0;
+        for (uint j = 0; (j < ir_length) && (j <= i); j++) {
+            expected_l += (double)ir_l[j] * input_l[i - j];
+            expected_r += (double)ir_r[j] * input_r[i - j];
+        }
+        max_error = std::max({max_error, std::abs(output_l[i] - (float)expected_l), std::abs(output_r[i] - (float)expected_r)});
+        max_output = std::max({max_output, std::abs((float)expected_l), std::abs((float)expected_r)});
+    }
+    printf("\nconvolution error %fdB", 20.f * std::log10(max_error / max_output));
+    return max_error < (1e-4f * max_output);
+}
+
 bool wt_alloc_test() {
 
     using namespace Steinberg::Vst::Nina;
@@ -1034,16 +2362,17 @@ bool run_single_wavetable_save_output() {
     }
 
     AudioFile<float> audio_data;
-    auto &samples_2 = wave_loader_array.at(0).getCurrentWavetable()->_samples;
+    auto *wavetable = wave_loader_array.at(0).getCurrentWavetable();
+    const int16_t *samples_2 = wavetable->getSamples();
     audio_data.setNumChannels(1);
-    auto val = samples_2.size();
+    auto val = wavetable->getNumSamples();
     printf("\n val %d\n\n\n", (int)val);
-    audio_data.setNumSamplesPerChannel(samples_2.size());
+    audio_data.setNumSamplesPerChannel(wavetable->getNumSamples());
     int cont = 0;
-    int size = samples_2.size();
+    int size = wavetable->getNumSamples();
     printf("\n wt size %d\n", size);
     for (uint i = 0; i < size; i++) {
-        audio_data.samples[0][cont++] = (float)samples_2.at(i) / (float)INT16_MAX;
+        audio_data.samples[0][cont++] = (float)samples_2[i] / (float)INT16_MAX;
     }
 
     audio_data.setSampleRate(96000);
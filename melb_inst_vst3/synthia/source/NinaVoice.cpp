@@ -229,10 +229,15 @@ void LayerVoice::run() {
     _drive_compensator.reCalculate();
     _max_mix_out_level = 0;
     *_analog_input.filter_2_pole_in = _filter_2_pole_mode;
+    const bool automated = _layer_params.num_automated_state_params > 0;
     for (int i = 0; i < CV_BUFFER_SIZE; ++i) {
         _cv_a_val = (*_layer_params._cv_a)[i];
         _cv_b_val = (*_layer_params._cv_b)[i];
 
+        if (automated) {
+            _updateAutomatedParams(i);
+        }
+
         _matrix.run_fast_slots();
         _drive_compensator.run();
         _lfo_1.run();
@@ -260,6 +260,15 @@ class LayerVoice {
     float _midi_expression = 0;
     float _voice_morph_value = 0;
 
+    // morph position and layer run the local params were last updated for, -1 forces a full update
+    float _local_mod_pos = -1;
+    uint _local_run_count = 0;
+    bool _local_lfo_1_tempo_sync = false;
+    bool _local_lfo_2_tempo_sync = false;
+
+    // set while the matrix is compiled with every route for automation
+    bool _local_matrix_dense = false;
+
     MidiNote _midi_note;
 
     std::array<float *, NinaParams::NumDsts * NinaParams::NumSrcs> _setupLayerParams(NinaParams::LayerParams &layer_params, NinaParams::LayerStateParams &sp);
@@ -268,6 +277,66 @@ class LayerVoice {
         return _gains;
     }
 
+    inline float _morphLocalParam(uint i, float a, float b) {
+        return _transformLocalParam(i, a * (_state_a[i]) + b * (_state_b[i]));
+    }
+
+    inline float _transformLocalParam(uint i, float tmp) {
+        switch (i) {
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Lfo1, NinaParams::Osc1Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Lfo2, NinaParams::Osc1Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::AmpEnvelope, NinaParams::Osc1Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Wavetable, NinaParams::Osc1Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Time, NinaParams::Osc1Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::Aftertouch, NinaParams::Osc1Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::KeyVelocity, NinaParams::Osc1Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::PanPosition, NinaParams::Osc1Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::FilterEnvelope, NinaParams::Osc1Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Lfo1, NinaParams::Osc2Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Lfo2, NinaParams::Osc2Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::AmpEnvelope, NinaParams::Osc2Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Wavetable, NinaParams::Osc2Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Time, NinaParams::Osc2Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::Aftertouch, NinaParams::Osc2Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::KeyVelocity, NinaParams::Osc2Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::PanPosition, NinaParams::Osc2Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::FilterEnvelope, NinaParams::Osc2Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Lfo1, NinaParams::Osc3Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Lfo2, NinaParams::Osc3Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::AmpEnvelope, NinaParams::Osc3Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Wavetable, NinaParams::Osc3Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Time, NinaParams::Osc3Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::Aftertouch, NinaParams::Osc3Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::KeyVelocity, NinaParams::Osc3Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::PanPosition, NinaParams::Osc3Pitch)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::FilterEnvelope, NinaParams::Osc3Pitch)):
+
+            tmp = _xAbsXTransform(tmp);
+            break;
+
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::Osc1Level)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::Osc2Level)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::Osc3Level)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::XorLevel)):
+
+            tmp = _xSquaredTransform(tmp);
+            break;
+
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::Osc1Width)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::Lfo2Gain)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::Lfo1Gain)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::Osc2Width)):
+        case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::FilterResonance)):
+
+            tmp = _logPotTransform(tmp);
+            break;
+        default:
+            break;
+        }
+
+        return tmp;
+    }
+
     inline void _updateLocalParams() {
 
         // voice morph position is layer morph pos + voice mod morph value (which is scaled to match the 0->1 range of morph)
@@ -277,67 +346,56 @@ class LayerVoice {
         _morph_value = mod_pos;
         const float a = (1 - mod_pos);
         const float b = mod_pos;
-        const auto &a_p = _state_a;
-        const auto &b_p = _state_b;
-        for (int i = 0; i < NinaParams::NUM_LAYER_STATE_PARAMS; i++) {
-
-            float tmp = a * (a_p[i]) + b * (b_p[i]);
-
-            switch (i) {
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Lfo1, NinaParams::Osc1Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Lfo2, NinaParams::Osc1Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::AmpEnvelope, NinaParams::Osc1Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Wavetable, NinaParams::Osc1Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Time, NinaParams::Osc1Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::Aftertouch, NinaParams::Osc1Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::KeyVelocity, NinaParams::Osc1Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::PanPosition, NinaParams::Osc1Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::FilterEnvelope, NinaParams::Osc1Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Lfo1, NinaParams::Osc2Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Lfo2, NinaParams::Osc2Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::AmpEnvelope, NinaParams::Osc2Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Wavetable, NinaParams::Osc2Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Time, NinaParams::Osc2Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::Aftertouch, NinaParams::Osc2Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::KeyVelocity, NinaParams::Osc2Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::PanPosition, NinaParams::Osc2Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::FilterEnvelope, NinaParams::Osc2Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Lfo1, NinaParams::Osc3Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Lfo2, NinaParams::Osc3Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::AmpEnvelope, NinaParams::Osc3Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Wavetable, NinaParams::Osc3Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Time, NinaParams::Osc3Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::Aftertouch, NinaParams::Osc3Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::KeyVelocity, NinaParams::Osc3Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::PanPosition, NinaParams::Osc3Pitch)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::ModMatrixSrc::FilterEnvelope, NinaParams::Osc3Pitch)):
-
-                tmp = _xAbsXTransform(tmp);
-                break;
-
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::Osc1Level)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::Osc2Level)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::Osc3Level)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::XorLevel)):
-
-                tmp = _xSquaredTransform(tmp);
-                break;
-
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::Osc1Width)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::Lfo2Gain)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::Lfo1Gain)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::Osc2Width)):
-            case LAYER_STATE_PARAMID_TO_INDEX(MAKE_MOD_MATRIX_PARAMID(NinaParams::Constant, NinaParams::FilterResonance)):
-
-                tmp = _logPotTransform(tmp);
-                break;
-            default:
-                break;
+
+        // If the morph position hasn't moved since the last buffer then only the params the layer changed need to be
+        // morphed again, otherwise (or if this voice missed a buffer) morph them all
+        const bool lfo_sync_changed = (_layer_params.lfo_1_tempo_sync != _local_lfo_1_tempo_sync) || (_layer_params.lfo_2_tempo_sync != _local_lfo_2_tempo_sync);
+        bool params_changed = true;
+        if ((mod_pos == _local_mod_pos) && (_layer_params.state_params_run_count == _local_run_count + 1) && !lfo_sync_changed) {
+            for (uint n = 0; n < _layer_params.num_changed_state_params; n++) {
+                const uint i = _layer_params.changed_state_params[n];
+                _local_morphed_state_params[i] = _morphLocalParam(i, a, b);
             }
+            params_changed = (_layer_params.num_changed_state_params > 0) || _layer_params.common_params_changed;
+        } else {
+            for (uint i = 0; i < NinaParams::NUM_LAYER_STATE_PARAMS; i++) {
+                _local_morphed_state_params[i] = _morphLocalParam(i, a, b);
+            }
+        }
+        _local_mod_pos = mod_pos;
+        _local_run_count = _layer_params.state_params_run_count;
+        _local_lfo_1_tempo_sync = _layer_params.lfo_1_tempo_sync;
+        _local_lfo_2_tempo_sync = _layer_params.lfo_2_tempo_sync;
+        _updateLocalCompositeParams();
+
+        // the matrix gains point into the local params and the layer common params, so rebuild the active matrix
+        // routes if any of them may have changed to or from zero. While params are automated within the buffer
+        // their gains can cross zero between CV samples, so keep every route until the automation stops
+        const bool automated = _layer_params.num_automated_state_params > 0;
+        if (params_changed || automated || _local_matrix_dense) {
+            _matrix.compile(automated);
+            _local_matrix_dense = automated;
+        }
+    }
 
-            _local_morphed_state_params[i] = tmp;
+    /**
+     * @brief Set the automated params to their value for a CV sample, and re-run the slow matrix slots so the
+     * fast dsts follow them
+     *
+     * @param cv_sample
+     */
+    inline void _updateAutomatedParams(uint cv_sample) {
+        const float a = (1 - _morph_value);
+        const float b = _morph_value;
+        for (uint n = 0; n < _layer_params.num_automated_state_params; n++) {
+            const auto &automated = _layer_params.automated_state_params[n];
+            _local_morphed_state_params[automated.index] = _transformLocalParam(automated.index, a * automated.a_values[cv_sample] + b * automated.b_values[cv_sample]);
         }
+        _updateLocalCompositeParams();
+        _matrix.run_slow_slots();
+    }
 
+    inline void _updateLocalCompositeParams() {
         // update the tune values of each oscillator
         constexpr float gain = 5.f;
         constexpr float offset = 0;
@@ -0,0 +1,212 @@
+/**
+ * @file WavetableKernel.h
+ * @brief Wavetable fetch and interpolate kernel, with NEON, SSE and scalar implementations.
+ *
+ * @copyright Copyright (c) 2023 Melbourne Instruments, Australia
+ */
+#pragma once
+#include "common.h"
+#include <cmath>
+#include <cstdint>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+namespace Steinberg {
+namespace Vst {
+namespace Nina {
+
+// number of samples processed per vector
+constexpr uint WT_KERNEL_WIDTH = 4;
+constexpr float WT_INT16_TO_FLOAT = 1.f / 32767.f;
+
+/**
+ * @brief Params for one run of the kernel. The low and high pointers are the start of the two neighbouring
+ * waves for each wavetable at the current mipmap level, the samples are interpolated between these waves
+ * by the morph frac and between the two samples either side of the phase.
+ */
+struct WtKernelParams {
+    const int16_t *a_low;
+    const int16_t *a_high;
+    const int16_t *b_low;
+    const int16_t *b_high;
+    float phase_mult;
+    uint phase_mask;
+    float morph_frac_a;
+    float morph_frac_b;
+    float gain_a;
+    float gain_b;
+    float vol;
+};
+
+// a + b * c, fused on targets with fma so that the scalar and vector kernels round the same way
+inline float wtMulAdd(float a, float b, float c) {
+#if defined(__aarch64__) || defined(__FMA__)
+    return std::fmaf(b, c, a);
+#else
+    return a + b * c;
+#endif
+}
+
+/**
+ * @brief Scalar reference kernel, the vector kernels must match this bit for bit
+ *
+ * @param p kernel params
+ * @param phases phase of each output sample, 0 to 1
+ * @param output output samples
+ * @param num_samples number of samples to process
+ * @return float the last sample before the volume is applied
+ */
+inline float wtInterpolateScalar(const WtKernelParams &p, const float *phases, float *output, uint num_samples) {
+    float cv_out = 0.f;
+    for (uint i = 0; i < num_samples; i++) {
+        // get the two samples either side of the phase
+        const float pos = phases[i] * p.phase_mult;
+        const uint sample_pos_1 = ((uint)pos) & p.phase_mask;
+        const uint sample_pos_2 = (sample_pos_1 + 1) & p.phase_mask;
+        const float frac = pos - (float)sample_pos_1;
+
+        const float a_low_1 = (float)p.a_low[sample_pos_1] * WT_INT16_TO_FLOAT;
+        const float a_high_1 = (float)p.a_high[sample_pos_1] * WT_INT16_TO_FLOAT;
+        const float a_low_2 = (float)p.a_low[sample_pos_2] * WT_INT16_TO_FLOAT;
+        const float a_high_2 = (float)p.a_high[sample_pos_2] * WT_INT16_TO_FLOAT;
+        const float b_low_1 = (float)p.b_low[sample_pos_1] * WT_INT16_TO_FLOAT;
+        const float b_high_1 = (float)p.b_high[sample_pos_1] * WT_INT16_TO_FLOAT;
+        const float b_low_2 = (float)p.b_low[sample_pos_2] * WT_INT16_TO_FLOAT;
+        const float b_high_2 = (float)p.b_high[sample_pos_2] * WT_INT16_TO_FLOAT;
+
+        // interpolate between the waves, then between the samples
+        const float a_1 = wtMulAdd(a_low_1, a_high_1 - a_low_1, p.morph_frac_a);
+        const float a_2 = wtMulAdd(a_low_2, a_high_2 - a_low_2, p.morph_frac_a);
+        const float b_1 = wtMulAdd(b_low_1, b_high_1 - b_low_1, p.morph_frac_b);
+        const float b_2 = wtMulAdd(b_low_2, b_high_2 - b_low_2, p.morph_frac_b);
+        const float out_a = wtMulAdd(a_1, a_2 - a_1, frac);
+        const float out_b = wtMulAdd(b_1, b_2 - b_1, frac);
+
+        // mix the A and B wavetable outputs
+        cv_out = wtMulAdd(p.gain_a * out_a, p.gain_b, out_b) * 2.f;
+        output[i] = cv_out * p.vol;
+    }
+    return cv_out;
+}
+
+#if defined(__aarch64__)
+
+// load 4 int16 samples from a table and convert them to float
+static inline float32x4_t _wtGatherNeon(const int16_t *table, const uint32_t *idx) {
+    int16x4_t samples = vdup_n_s16(0);
+    samples = vld1_lane_s16(table + idx[0], samples, 0);
+    samples = vld1_lane_s16(table + idx[1], samples, 1);
+    samples = vld1_lane_s16(table + idx[2], samples, 2);
+    samples = vld1_lane_s16(table + idx[3], samples, 3);
+    return vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(samples)), WT_INT16_TO_FLOAT);
+}
+
+static inline float32x4_t _wtLerpNeon(float32x4_t a, float32x4_t b, float32x4_t frac) {
+    return vfmaq_f32(a, vsubq_f32(b, a), frac);
+}
+
+/**
+ * @brief NEON kernel, num_samples must be a multiple of WT_KERNEL_WIDTH
+ */
+inline float wtInterpolateNeon(const WtKernelParams &p, const float *phases, float *output, uint num_samples) {
+    const uint32x4_t mask = vdupq_n_u32(p.phase_mask);
+    const uint32x4_t one = vdupq_n_u32(1);
+    const float32x4_t morph_frac_a = vdupq_n_f32(p.morph_frac_a);
+    const float32x4_t morph_frac_b = vdupq_n_f32(p.morph_frac_b);
+    float32x4_t cv_out = vdupq_n_f32(0.f);
+    uint32_t idx_1[WT_KERNEL_WIDTH];
+    uint32_t idx_2[WT_KERNEL_WIDTH];
+    for (uint i = 0; i < num_samples; i += WT_KERNEL_WIDTH) {
+        const float32x4_t pos = vmulq_n_f32(vld1q_f32(phases + i), p.phase_mult);
+        const uint32x4_t sample_pos_1 = vandq_u32(vcvtq_u32_f32(pos), mask);
+        const uint32x4_t sample_pos_2 = vandq_u32(vaddq_u32(sample_pos_1, one), mask);
+        const float32x4_t frac = vsubq_f32(pos, vcvtq_f32_u32(sample_pos_1));
+        vst1q_u32(idx_1, sample_pos_1);
+        vst1q_u32(idx_2, sample_pos_2);
+
+        const float32x4_t a_1 = _wtLerpNeon(_wtGatherNeon(p.a_low, idx_1), _wtGatherNeon(p.a_high, idx_1), morph_frac_a);
+        const float32x4_t a_2 = _wtLerpNeon(_wtGatherNeon(p.a_low, idx_2), _wtGatherNeon(p.a_high, idx_2), morph_frac_a);
+        const float32x4_t b_1 = _wtLerpNeon(_wtGatherNeon(p.b_low, idx_1), _wtGatherNeon(p.b_high, idx_1), morph_frac_b);
+        const float32x4_t b_2 = _wtLerpNeon(_wtGatherNeon(p.b_low, idx_2), _wtGatherNeon(p.b_high, idx_2), morph_frac_b);
+        const float32x4_t out_a = _wtLerpNeon(a_1, a_2, frac);
+        const float32x4_t out_b = _wtLerpNeon(b_1, b_2, frac);
+
+        cv_out = vmulq_n_f32(vfmaq_n_f32(vmulq_n_f32(out_a, p.gain_a), out_b, p.gain_b), 2.f);
+        vst1q_f32(output + i, vmulq_n_f32(cv_out, p.vol));
+    }
+    return vgetq_lane_f32(cv_out, 3);
+}
+
+#elif defined(__SSE2__)
+
+// load 4 int16 samples from a table and convert them to float
+static inline __m128 _wtGatherSse(const int16_t *table, const uint32_t *idx) {
+    const __m128i samples = _mm_setr_epi32(table[idx[0]], table[idx[1]], table[idx[2]], table[idx[3]]);
+    return _mm_mul_ps(_mm_cvtepi32_ps(samples), _mm_set1_ps(WT_INT16_TO_FLOAT));
+}
+
+static inline __m128 _wtMulAddSse(__m128 a, __m128 b, __m128 c) {
+#ifdef __FMA__
+    return _mm_fmadd_ps(b, c, a);
+#else
+    return _mm_add_ps(a, _mm_mul_ps(b, c));
+#endif
+}
+
+static inline __m128 _wtLerpSse(__m128 a, __m128 b, __m128 frac) {
+    return _wtMulAddSse(a, _mm_sub_ps(b, a), frac);
+}
+
+/**
+ * @brief SSE kernel, num_samples must be a multiple of WT_KERNEL_WIDTH
+ */
+inline float wtInterpolateSse(const WtKernelParams &p, const float *phases, float *output, uint num_samples) {
+    const __m128i mask = _mm_set1_epi32(p.phase_mask);
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128 phase_mult = _mm_set1_ps(p.phase_mult);
+    const __m128 morph_frac_a = _mm_set1_ps(p.morph_frac_a);
+    const __m128 morph_frac_b = _mm_set1_ps(p.morph_frac_b);
+    __m128 cv_out = _mm_setzero_ps();
+    alignas(16) uint32_t idx_1[WT_KERNEL_WIDTH];
+    alignas(16) uint32_t idx_2[WT_KERNEL_WIDTH];
+    for (uint i = 0; i < num_samples; i += WT_KERNEL_WIDTH) {
+        // the positions are always positive and well under 2^31, so a signed truncate is the same as the scalar cast
+        const __m128 pos = _mm_mul_ps(_mm_loadu_ps(phases + i), phase_mult);
+        const __m128i sample_pos_1 = _mm_and_si128(_mm_cvttps_epi32(pos), mask);
+        const __m128i sample_pos_2 = _mm_and_si128(_mm_add_epi32(sample_pos_1, one), mask);
+        const __m128 frac = _mm_sub_ps(pos, _mm_cvtepi32_ps(sample_pos_1));
+        _mm_store_si128(reinterpret_cast<__m128i *>(idx_1), sample_pos_1);
+        _mm_store_si128(reinterpret_cast<__m128i *>(idx_2), sample_pos_2);
+
+        const __m128 a_1 = _wtLerpSse(_wtGatherSse(p.a_low, idx_1), _wtGatherSse(p.a_high, idx_1), morph_frac_a);
+        const __m128 a_2 = _wtLerpSse(_wtGatherSse(p.a_low, idx_2), _wtGatherSse(p.a_high, idx_2), morph_frac_a);
+        const __m128 b_1 = _wtLerpSse(_wtGatherSse(p.b_low, idx_1), _wtGatherSse(p.b_high, idx_1), morph_frac_b);
+        const __m128 b_2 = _wtLerpSse(_wtGatherSse(p.b_low, idx_2), _wtGatherSse(p.b_high, idx_2), morph_frac_b);
+        const __m128 out_a = _wtLerpSse(a_1, a_2, frac);
+        const __m128 out_b = _wtLerpSse(b_1, b_2, frac);
+
+        cv_out = _mm_mul_ps(_wtMulAddSse(_mm_mul_ps(out_a, _mm_set1_ps(p.gain_a)), _mm_set1_ps(p.gain_b), out_b), _mm_set1_ps(2.f));
+        _mm_storeu_ps(output + i, _mm_mul_ps(cv_out, _mm_set1_ps(p.vol)));
+    }
+    return _mm_cvtss_f32(_mm_shuffle_ps(cv_out, cv_out, _MM_SHUFFLE(3, 3, 3, 3)));
+}
+
+#endif
+
+/**
+ * @brief Run the fastest kernel available on this target, num_samples must be a multiple of WT_KERNEL_WIDTH
+ */
+inline float wtInterpolate(const WtKernelParams &p, const float *phases, float *output, uint num_samples) {
+#if defined(__aarch64__)
+    return wtInterpolateNeon(p, phases, output, num_samples);
+#elif defined(__SSE2__)
+    return wtInterpolateSse(p, phases, output, num_samples);
+#else
+    return wtInterpolateScalar(p, phases, output, num_samples);
+#endif
+}
+
+} // namespace Nina
+} // namespace Vst
+} // namespace Steinberg
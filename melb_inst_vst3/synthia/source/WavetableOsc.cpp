@@ -5,12 +5,15 @@
  * @copyright Copyright (c) 2022-2023 Melbourne Instruments, Australia
  */
 #include "WavetableOsc.h"
+#include "AnalogModelEval.h"
 #include <cmath>
 #include <dirent.h>
 #include <filesystem>
 #include <fstream>
 #include <sstream>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 
 namespace Steinberg {
@@ -21,6 +24,54 @@ namespace Nina {
 constexpr uint MIN_FREQ_HZ = 10;
 constexpr uint MAX_FREQ_HZ = 20000;
 
+// Wavetable cache file format, bump the version if the wave processing changes so old caches are rebuilt
+constexpr uint32_t WT_CACHE_MAGIC = 0x4354574e; // "NWTC"
+constexpr uint32_t WT_CACHE_VERSION = 1;
+
+struct WavetableCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;
+    int64_t source_mtime;
+    uint64_t source_size;
+    uint32_t num_waves;
+    uint32_t num_samples;
+};
+
+// the samples are followed by enough padding that reading the wave after the last one at the
+// highest mipmap stays within the file
+constexpr uint WT_CACHE_PAD_SAMPLES = WAVE_LENGTH >> 4;
+
+static uint64_t _fnv1aHash(uint64_t hash, const void *data, size_t size) {
+    auto bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+/**
+ * @brief Get the cache key of a wavetable file from its name, size and modification time, along with the
+ * cache version and sample rate as these change the processed samples
+ */
+static bool _getCacheKey(const std::string &filename, WavetableCacheKey &key) {
+    struct stat st;
+    if (::stat(NINA_WAVETABLE_FILE_PATH(filename).c_str(), &st) != 0) {
+        return false;
+    }
+    key.source_mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    key.source_size = st.st_size;
+    const uint32_t sample_rate = SAMPLE_RATE;
+    uint64_t hash = 0xcbf29ce484222325;
+    hash = _fnv1aHash(hash, filename.data(), filename.size());
+    hash = _fnv1aHash(hash, &key.source_mtime, sizeof(key.source_mtime));
+    hash = _fnv1aHash(hash, &key.source_size, sizeof(key.source_size));
+    hash = _fnv1aHash(hash, &WT_CACHE_VERSION, sizeof(WT_CACHE_VERSION));
+    hash = _fnv1aHash(hash, &sample_rate, sizeof(sample_rate));
+    key.hash = hash;
+    return true;
+}
+
 /**
  *-----------------------------------------------------------------------------
  * WavetableOsc class
@@ -44,9 +95,9 @@ void WavetableOsc::reCalculate() {
     // If a wavetable has been loaded
     _current_wavetable_a = _wavetable_loader_a.getCurrentWavetable();
     _current_wavetable_b = _wavetable_loader_b.getCurrentWavetable();
-    const auto &wavetable_a = _current_wavetable_a->_samples;
-    const auto &wavetable_b = _current_wavetable_b->_samples;
     if (_current_wavetable_a && _current_wavetable_b) {
+        const int16_t *wavetable_a = _current_wavetable_a->getSamples();
+        const int16_t *wavetable_b = _current_wavetable_b->getSamples();
         const bool interpolate = _interpolate;
         _wt_loaded = true;
         _num_waves_a = _current_wavetable_a->getNumWaves();
@@ -61,7 +112,7 @@ void WavetableOsc::reCalculate() {
             const float pitch = _pitch_cv_buffer.at(cv_i);
             float position = _shape_cv_buffer.at(cv_i);
             float scaled_pitch = pitch * noteGain + ((float)((int)_slow_mode) * SLOW_WAVE_SUB);
-            _phase_advance = (std::exp2f(scaled_pitch)) / (float)SAMPLE_RATE;
+            _phase_advance = analogExp2(scaled_pitch) / (float)SAMPLE_RATE;
 
             // clip the phase advance to 1.0 to avoid out of bounds array access
             _phase_advance = std::min((float)1.0, _phase_advance);
@@ -104,47 +155,30 @@ void WavetableOsc::reCalculate() {
                 const float morph_frac_a = _position_filter_state * ((float)_num_waves_a - 1) - (float)pos_a;
                 const float morph_frac_b = _position_filter_state * ((float)_num_waves_b - 1) - (float)pos_b;
 
-                for (int i = 0; i < WT_BUFFER_SIZE; ++i) {
-                    // increment and wrap the current phase.
+                // increment and wrap the phase for each sample, the phase advance is never more than 1 so a single subtract is the same as fmod
+                std::array<float, WT_BUFFER_SIZE> phases;
+                for (uint i = 0; i < WT_BUFFER_SIZE; ++i) {
                     _current_phase += _phase_advance;
-                    _current_phase = std::fmod(_current_phase, 1.f);
-
-                    // calculate the position of sample 1
-                    float pos = _current_phase * (float)phase_mult;
-                    const uint sample_pos_1 = ((uint)std::floor(pos)) & phase_mask;
-
-                    // wrap sample 2 position
-                    const uint sample_pos_2 = (sample_pos_1 + 1) & phase_mask;
-                    float frac_part = pos - (float)sample_pos_1;
-                    float sample_a_1, sample_a_2, sample_b_1, sample_b_2;
-
-                    // wt position interpolate method
-                    const float sample_1_a = _int16SampleToFloat(wavetable_a[(mipmap_offset_a + pos_a_low + sample_pos_1)]);
-                    const float sample_2_a = _int16SampleToFloat(wavetable_a[(mipmap_offset_a + pos_a_high + sample_pos_1)]);
-                    const float sample_1_a_2 = _int16SampleToFloat(wavetable_a[(mipmap_offset_a + pos_a_low + sample_pos_2)]);
-                    const float sample_2_a_2 = _int16SampleToFloat(wavetable_a[(mipmap_offset_a + pos_a_high + sample_pos_2)]);
-
-                    const float sample_1_b = _int16SampleToFloat(wavetable_b[(mipmap_offset_b + pos_b_low + sample_pos_1)]);
-                    const float sample_2_b = _int16SampleToFloat(wavetable_b[(mipmap_offset_b + pos_b_high + sample_pos_1)]);
-                    const float sample_1_b_2 = _int16SampleToFloat(wavetable_b[(mipmap_offset_b + pos_b_low + sample_pos_2)]);
-                    const float sample_2_b_2 = _int16SampleToFloat(wavetable_b[(mipmap_offset_b + pos_b_high + sample_pos_2)]);
-
-                    // We interpolate the samples based on the wavetable position
-                    sample_a_1 = sample_1_a + ((-sample_1_a + sample_2_a)) * morph_frac_a;
-                    sample_a_2 = sample_1_a_2 + ((-sample_1_a_2 + sample_2_a_2)) * morph_frac_a;
-                    sample_b_1 = sample_1_b + ((-sample_1_b + sample_2_b)) * morph_frac_b;
-                    sample_b_2 = sample_1_b_2 + ((-sample_1_b_2 + sample_2_b_2)) * morph_frac_b;
-
-                    _wt_out_a = sample_a_1 + ((-sample_a_1 + sample_a_2) * frac_part);
-                    _wt_out_b = sample_b_1 + ((-sample_b_1 + sample_b_2) * frac_part);
-
-                    // mix the A and B wavetable outputs
-                    float morphed_sum = gain_a * _wt_out_a + gain_b * _wt_out_b;
-
-                    _wt_cv_out = morphed_sum * 2.f;
-
-                    _audio_buffer[cv_i * WT_BUFFER_SIZE + i] = _wt_cv_out * wt_out_vol;
+                    if (_current_phase >= 1.f) {
+                        _current_phase -= 1.f;
+                    }
+                    phases[i] = _current_phase;
                 }
+
+                // fetch the samples and interpolate over the wave position and phase
+                WtKernelParams params;
+                params.a_low = wavetable_a + mipmap_offset_a + pos_a_low;
+                params.a_high = wavetable_a + mipmap_offset_a + pos_a_high;
+                params.b_low = wavetable_b + mipmap_offset_b + pos_b_low;
+                params.b_high = wavetable_b + mipmap_offset_b + pos_b_high;
+                params.phase_mult = (float)phase_mult;
+                params.phase_mask = phase_mask;
+                params.morph_frac_a = morph_frac_a;
+                params.morph_frac_b = morph_frac_b;
+                params.gain_a = gain_a;
+                params.gain_b = gain_b;
+                params.vol = wt_out_vol;
+                _wt_cv_out = wtInterpolate(params, phases.data(), &_audio_buffer[cv_i * WT_BUFFER_SIZE], WT_BUFFER_SIZE);
             } else {
                 uint mipmap_index = std::min(7u, std::max(0u, _mipmap_index));
                 uint mipmap_offset = getMipmapOffset(mipmap_index);
@@ -196,11 +230,11 @@ void WavetableOsc::reCalculate() {
                     const float sample_b_2 = _int16SampleToFloat(wavetable_b[(mipmap_offset_b + wave_pos_offset_b + sample_pos_2)]);
 
                     // interpolate between the samples
-                    _wt_out_a = sample_a_1 + ((-sample_a_1 + sample_a_2) * frac_part);
-                    _wt_out_b = sample_b_1 + ((-sample_b_1 + sample_b_2) * frac_part);
+                    const float wt_out_a = sample_a_1 + ((-sample_a_1 + sample_a_2) * frac_part);
+                    const float wt_out_b = sample_b_1 + ((-sample_b_1 + sample_b_2) * frac_part);
 
                     // mix the A and B wavetable outputs
-                    float morphed_sum = gain_a * _wt_out_a + gain_b * _wt_out_b;
+                    float morphed_sum = gain_a * wt_out_a + gain_b * wt_out_b;
                     _wt_cv_out = morphed_sum * 2.f;
 
                     // write the output to the array
@@ -319,19 +353,6 @@ void WavetableLoader::_monitorWavetable() {
                     // Load the wavetable
                     auto current_wt_select_num = _wt_select_num;
                     auto filename = filenames.at((uint)std::round(((float)(filenames.size()) * _wt_select_num)));
-                    if (!file.load(NINA_WAVETABLE_FILE_PATH(filename)))
-                        throw std::invalid_argument("Wavetable does not exist");
-
-                    // Check the number of samples is valid
-                    if (file.getNumChannels() == 0 ||
-                        (file.samples[0].size() % WAVE_LENGTH))
-                        throw std::runtime_error(
-                            "Wavetable number of channels/samples is invalid");
-
-                    // Get the number of waves and check it is valid
-                    auto num_waves = file.samples[0].size() / WAVE_LENGTH;
-                    if (num_waves > MAX_NUM_WAVES)
-                        throw std::runtime_error("Wavetable number of waves is invalid");
 
                     // Get a pointer to the free wavetable slot
                     Wavetable *wavetable = &_wavetable_slot1;
@@ -341,9 +362,33 @@ void WavetableLoader::_monitorWavetable() {
                     // Reset the wavetable
                     wavetable->reset();
 
-                    // Process the wavetable samples
-                    const float *samples = file.samples[0].data();
-                    wavetable->processWaves(num_waves, samples);
+                    // Map the preprocessed wavetable if it has been cached, otherwise load and
+                    // process the wavetable samples and cache them for the next load
+                    WavetableCacheKey key;
+                    bool cached = _getCacheKey(filename, key);
+                    const auto cache_path = NINA_WAVETABLE_CACHE_FILE_PATH(filename);
+                    if (!cached || !wavetable->mapCache(cache_path, key)) {
+                        if (!file.load(NINA_WAVETABLE_FILE_PATH(filename)))
+                            throw std::invalid_argument("Wavetable does not exist");
+
+                        // Check the number of samples is valid
+                        if (file.getNumChannels() == 0 ||
+                            (file.samples[0].size() % WAVE_LENGTH))
+                            throw std::runtime_error(
+                                "Wavetable number of channels/samples is invalid");
+
+                        // Get the number of waves and check it is valid
+                        auto num_waves = file.samples[0].size() / WAVE_LENGTH;
+                        if (num_waves > MAX_NUM_WAVES)
+                            throw std::runtime_error("Wavetable number of waves is invalid");
+
+                        // Process the wavetable samples
+                        const float *samples = file.samples[0].data();
+                        wavetable->processWaves(num_waves, samples);
+                        if (cached) {
+                            wavetable->saveCache(cache_path, key);
+                        }
+                    }
 
                     // Has the selected wavetable changed during the load?
                     // If so, loop again to load the new wavetable
@@ -383,6 +428,7 @@ void WavetableLoader::_monitorWavetable() {
 void Wavetable::reset() {
     // Reset the filters
     _num_waves = 0;
+    _unmapCache();
 }
 
 uint Wavetable::getNumWaves() const {
@@ -442,6 +488,91 @@ void Wavetable::processWaves(uint num_waves, const float *samples) {
     }
 }
 
+bool Wavetable::mapCache(const std::string &cache_path, const WavetableCacheKey &key) {
+    int fd = ::open(cache_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if ((::fstat(fd, &st) != 0) || ((size_t)st.st_size < sizeof(WavetableCacheHeader))) {
+        ::close(fd);
+        return false;
+    }
+
+    // Populate the mapping now, the samples are locked in memory below once the cache has been checked
+    size_t size = st.st_size;
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    // Check the cache is for this source file and the size matches the header
+    auto header = static_cast<const WavetableCacheHeader *>(map);
+    if ((header->magic != WT_CACHE_MAGIC) || (header->version != WT_CACHE_VERSION) ||
+        (header->hash != key.hash) || (header->source_mtime != key.source_mtime) ||
+        (header->source_size != key.source_size) || (header->num_waves == 0) ||
+        (header->num_waves > MAX_NUM_WAVES) || (header->num_samples != header->num_waves * WAVE_MIPMAP_SAMPLES) ||
+        (size != sizeof(WavetableCacheHeader) + (header->num_samples + WT_CACHE_PAD_SAMPLES) * sizeof(int16_t))) {
+        ::munmap(map, size);
+        return false;
+    }
+
+    // Keep the samples resident so the audio thread never takes a page fault reading them, the lock is released
+    // when the cache is unmapped
+    if (::mlock(map, size) != 0) {
+        printf("\nwavetable cache: could not lock %s in memory", cache_path.c_str());
+    }
+    _unmapCache();
+    _cache_map = map;
+    _cache_map_size = size;
+    _sample_data = reinterpret_cast<const int16_t *>(static_cast<const uint8_t *>(map) + sizeof(WavetableCacheHeader));
+    _num_waves = header->num_waves;
+    return true;
+}
+
+bool Wavetable::saveCache(const std::string &cache_path, const WavetableCacheKey &key) const {
+    if (_num_waves == 0) {
+        return false;
+    }
+    WavetableCacheHeader header;
+    header.magic = WT_CACHE_MAGIC;
+    header.version = WT_CACHE_VERSION;
+    header.hash = key.hash;
+    header.source_mtime = key.source_mtime;
+    header.source_size = key.source_size;
+    header.num_waves = _num_waves;
+    header.num_samples = _num_waves * WAVE_MIPMAP_SAMPLES;
+    const std::array<int16_t, WT_CACHE_PAD_SAMPLES> pad = {0};
+
+    // Write to a temporary file and rename it, so a partly written cache is never mapped
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(cache_path).parent_path(), ec);
+    const auto tmp_path = cache_path + ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(_sample_data), header.num_samples * sizeof(int16_t));
+    file.write(reinterpret_cast<const char *>(pad.data()), pad.size() * sizeof(int16_t));
+    file.close();
+    if (file.fail() || (::rename(tmp_path.c_str(), cache_path.c_str()) != 0)) {
+        ::unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void Wavetable::_unmapCache() {
+    if (_cache_map) {
+        ::munmap(_cache_map, _cache_map_size);
+        _cache_map = nullptr;
+        _cache_map_size = 0;
+    }
+    _sample_data = _samples.data();
+}
+
 /**
  *-----------------------------------------------------------------------------
  * WavetableWave class
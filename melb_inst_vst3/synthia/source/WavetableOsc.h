@@ -7,6 +7,7 @@
 #pragma once
 #include "AudioFile.h"
 #include "SynthMath.h"
+#include "WavetableKernel.h"
 #include "common.h"
 #include <algorithm>
 #include <atomic>
@@ -19,6 +20,7 @@ namespace Nina {
 
 // Constants
 constexpr uint WT_BUFFER_SIZE = SAMPLE_RATE / CV_SAMPLE_RATE;
+static_assert(WT_BUFFER_SIZE % WT_KERNEL_WIDTH == 0, "WT_BUFFER_SIZE must be a multiple of the kernel width");
 constexpr uint MAX_NUM_WAVES = 256;
 constexpr uint WAVE_LENGTH = (1024 * 2);
 constexpr uint NUM_MIPMAPS = 8;
@@ -150,27 +152,72 @@ class WavetableWave {
     std::array<int16_t, (WAVE_LENGTH * NUM_MIPMAPS)> _wavetable_wave;
 };
 
+/**
+ * @brief Identifies the source file a cached wavetable was processed from, the cache is only used if all of these match
+ */
+struct WavetableCacheKey {
+    uint64_t hash;
+    int64_t source_mtime;
+    uint64_t source_size;
+};
+
 class Wavetable {
   public:
     Wavetable() {
         // reserve the memory needed for a full length wavetable
-        _samples.reserve((int)MAX_NUM_WAVES * (getMipmapOffset(7) + 128));
-        for (int i = 0; i < (int)MAX_NUM_WAVES * (getMipmapOffset(7) + 128); i++) {
+        _samples.reserve(MAX_NUM_WAVES * WAVE_MIPMAP_SAMPLES);
+        for (uint i = 0; i < MAX_NUM_WAVES * WAVE_MIPMAP_SAMPLES; i++) {
             _samples.push_back(0);
             _num_waves = 0;
         }
+        _sample_data = _samples.data();
     }
 
     ~Wavetable() {
+        _unmapCache();
     }
 
     void reset();
     uint getNumWaves() const;
     void processWaves(uint num_waves, const float *samples);
-    std::vector<int16_t> _samples;
+
+    /**
+     * @brief Map a preprocessed wavetable cache file in place of the processed samples
+     *
+     * @param cache_path path of the cache file
+     * @param key key of the source wavetable file
+     * @return true if the cache was valid for the source file and has been mapped
+     */
+    bool mapCache(const std::string &cache_path, const WavetableCacheKey &key);
+
+    /**
+     * @brief Save the processed samples to a cache file, so the next load of the source file can be mapped
+     *
+     * @param cache_path path of the cache file
+     * @param key key of the source wavetable file
+     * @return true if the cache file was written
+     */
+    bool saveCache(const std::string &cache_path, const WavetableCacheKey &key) const;
+
+    const int16_t *getSamples() const {
+        return _sample_data;
+    }
+
+    uint getNumSamples() const {
+        return _sample_data == _samples.data() ? _samples.size() : (_num_waves * WAVE_MIPMAP_SAMPLES);
+    }
+
+    // number of samples in each wave over all the mipmap levels
+    static constexpr uint WAVE_MIPMAP_SAMPLES = getMipmapOffset(NUM_MIPMAPS - 1) + (WAVE_LENGTH >> 4);
 
   private:
+    std::vector<int16_t> _samples;
+    const int16_t *_sample_data;
     uint _num_waves;
+    void *_cache_map = nullptr;
+    size_t _cache_map_size = 0;
+
+    void _unmapCache();
 };
 
 class WavetableOsc;
@@ -245,8 +292,6 @@ class WavetableOsc {
     uint _wave_position_b = 0;
     uint _num_waves_a = 0;
     uint _num_waves_b = 0;
-    float _wt_out_a = 0;
-    float _wt_out_b = 0;
     uint _wave_pos_a = 0;
     uint _wave_pos_b = 0;
 
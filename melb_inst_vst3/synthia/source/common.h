@@ -35,8 +35,12 @@ namespace Nina {
 // Constants
 #ifdef __x86_64__
 constexpr char NINA_WAVETABLES_DIR[] = "./";
+constexpr char NINA_WAVETABLE_CACHE_DIR[] = "./wavetable_cache/";
+constexpr char NINA_REVERB_IRS_DIR[] = "./reverb_irs/";
 #else
 constexpr char NINA_WAVETABLES_DIR[] = "/udata/nina/wavetables/";
+constexpr char NINA_WAVETABLE_CACHE_DIR[] = "/udata/nina/wavetable_cache/";
+constexpr char NINA_REVERB_IRS_DIR[] = "/udata/nina/reverb_irs/";
 #endif
 constexpr int NUM_LAYERS = 4;
 constexpr int NUM_VOICES = 12;
@@ -70,9 +74,17 @@ constexpr float MORPH_ONE_THRESH = 1.0 - MORPH_THRESH;
 
 constexpr float AFTERTOUCH_MAG = 2.0;
 
+// max number of sample accurate automation points processed per buffer, and state params a layer can follow per buffer
+constexpr uint MAX_PARAM_CHANGE_POINTS = 1024;
+constexpr uint MAX_AUTOMATED_STATE_PARAMS = 16;
+
 // MACRO to get the full path of a Nina VST file
 #define NINA_WAVETABLE_FILE_PATH(filename) \
     (NINA_WAVETABLES_DIR + std::string(filename))
+#define NINA_WAVETABLE_CACHE_FILE_PATH(filename) \
+    (NINA_WAVETABLE_CACHE_DIR + std::string(filename) + ".wtc")
+#define NINA_REVERB_IR_FILE_PATH(filename) \
+    (NINA_REVERB_IRS_DIR + std::string(filename))
 
 #ifdef GPIO_TIMING_PIN_EN
 constexpr char MEM_DEV_NAME[] = "/dev/mem";
@@ -218,6 +230,19 @@ struct ParamChange {
     }
 };
 
+// Param change point struct, a single point of a host automation queue
+struct ParamChangePoint {
+    ParamID param_id;
+    float value;
+    uint offset;
+
+    ParamChangePoint() :
+        param_id(0), value(0.0f), offset(0) {}
+
+    ParamChangePoint(ParamID p, float v, uint o) :
+        param_id(p), value(v), offset(o) {}
+};
+
 inline static uint mask_param_id(const uint param_id) {
     return (param_id & 0x87FFFFFF);
 }
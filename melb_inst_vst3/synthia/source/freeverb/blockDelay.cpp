@@ -73,6 +73,12 @@ fv3_float_t *FV3_(blockDelay)::get(long prev) {
     return f + blockSize * ((N + cur - prev) % N);
 }
 
+fv3_float_t *FV3_(blockDelay)::getIndex(unsigned long index) {
+    if (blockSize == 0)
+        return NULL;
+    return f + blockSize * (long)(index % (unsigned long)N);
+}
+
 void FV3_(blockDelay)::push(fv3_float_t *i) {
     cur = (cur + 1) % N;
     std::memcpy(f + blockSize * cur, i, sizeof(fv3_float_t) * blockSize);
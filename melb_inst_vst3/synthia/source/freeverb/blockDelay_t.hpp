@@ -26,6 +26,7 @@ class _FV3_(blockDelay) {
     void setBlock(long size, long n) noexcept(false);
     _fv3_float_t *at(_fv3_float_t *i, long prev);
     _fv3_float_t *get(long prev);
+    _fv3_float_t *getIndex(unsigned long index);
     void push(_fv3_float_t *i);
     void mute();
 
@@ -34,6 +34,20 @@ FV3_(fragfft)::FV3_(~fragfft)() {
     freeFFT();
 }
 
+void FV3_(fragfft)::setSIMD(uint32_t flag1, uint32_t flag2) {
+    simdFlag1 = flag1;
+    simdFlag2 = flag2;
+    simdSize = 1;
+}
+
+uint32_t FV3_(fragfft)::getSIMD(uint32_t select) {
+    if (select == 0)
+        return simdFlag1;
+    if (select == 1)
+        return simdFlag2;
+    return 0;
+}
+
 long FV3_(fragfft)::getSIMDSize() {
     return simdSize;
 }
@@ -58,9 +72,6 @@ void FV3_(fragfft)::allocFFT(long size, unsigned fftflags) noexcept(false) {
     fftOrig.alloc(2 * size, 1);
     planRevrL = FFTW_(plan_r2r_1d)(2 * size, fftOrig.L, fftOrig.L, FFTW_HC2R, fftflags);
     planOrigL = FFTW_(plan_r2r_1d)(2 * size, fftOrig.L, fftOrig.L, FFTW_R2HC, fftflags);
-    planOrigR = FFTW_(plan_r2r_1d)(2 * size, fftOrig.R, fftOrig.R, FFTW_R2HC, fftflags);
-    planRevL = FFTW_(plan_r2r_1d)(2 * size, fftOrig.L, fftOrig.L, FFTW_HC2R, fftflags);
-    planRevR = FFTW_(plan_r2r_1d)(2 * size, fftOrig.R, fftOrig.R, FFTW_HC2R, fftflags);
     fragmentSize = size;
 }
 
@@ -71,8 +82,6 @@ void FV3_(fragfft)::freeFFT() {
     (planRevrL);
     FFTW_(destroy_plan)
     (planOrigL);
-    FFTW_(destroy_plan)
-    (planOrigR);
     fftOrig.free();
     fragmentSize = 0;
 }
@@ -104,32 +113,14 @@ void FV3_(fragfft)::R2SA(const fv3_float_t *in, fv3_float_t *out, long n) {
     }
 }
 
-void FV3_(fragfft)::R2HC(const fv3_float_t *iL, const fv3_float_t *iR,
-    fv3_float_t *oL, fv3_float_t *oR) {
+void FV3_(fragfft)::R2HC(const fv3_float_t *iL, fv3_float_t *oL) {
     if (fragmentSize == 0)
         return;
-#pragma omp parallel
-#pragma omp sections
-    {
-#pragma omp section
-        {
-            FV3_(utils)::mute(fftOrig.L + fragmentSize, fragmentSize);
-            std::memcpy(fftOrig.L, iL, sizeof(fv3_float_t) * fragmentSize);
-            FFTW_(execute)
-            (planOrigL);
-            R2SA(fftOrig.L, oL, fragmentSize * 2);
-        }
-#pragma omp section
-        {
-            FV3_(utils)::mute(fftOrig.R + fragmentSize, fragmentSize);
-            std::memcpy(fftOrig.R, iR, sizeof(fv3_float_t) * fragmentSize);
-            FFTW_(execute)
-            (planOrigR);
-            R2SA(fftOrig.R, oR, fragmentSize * 2);
-        }
-    }
-#pragma omp barrier
-    return;
+    FV3_(utils)::mute(fftOrig.L + fragmentSize, fragmentSize);
+    std::memcpy(fftOrig.L, iL, sizeof(fv3_float_t) * fragmentSize);
+    FFTW_(execute)
+    (planOrigL);
+    R2SA(fftOrig.L, oL, fragmentSize * 2);
 }
 
 void FV3_(fragfft)::SA2R(const fv3_float_t *in, fv3_float_t *out, long n, long simd) {
@@ -159,31 +150,14 @@ void FV3_(fragfft)::SA2R(const fv3_float_t *in, fv3_float_t *out, long n) {
     }
 }
 
-void FV3_(fragfft)::HC2R(const fv3_float_t *iL, const fv3_float_t *iR,
-    fv3_float_t *oL, fv3_float_t *oR) {
+void FV3_(fragfft)::HC2R(const fv3_float_t *iL, fv3_float_t *oL) {
     if (fragmentSize == 0)
         return;
-#pragma omp parallel
-#pragma omp sections
-    {
-#pragma omp section
-        {
-            SA2R(iL, fftOrig.L, fragmentSize * 2);
-            FFTW_(execute)
-            (planRevL);
-            for (long i = 0; i < fragmentSize * 2; i++)
-                oL[i] += fftOrig.L[i];
-        }
-#pragma omp section
-        {
-            SA2R(iR, fftOrig.R, fragmentSize * 2);
-            FFTW_(execute)
-            (planRevR);
-            for (long i = 0; i < fragmentSize * 2; i++)
-                oR[i] += fftOrig.R[i];
-        }
-    }
-    return;
+    SA2R(iL, fftOrig.L, fragmentSize * 2);
+    FFTW_(execute)
+    (planRevrL);
+    for (long i = 0; i < fragmentSize * 2; i++)
+        oL[i] += fftOrig.L[i];
 }
 
 // class frag
@@ -191,19 +165,18 @@ void FV3_(fragfft)::HC2R(const fv3_float_t *iL, const fv3_float_t *iR,
 FV3_(frag)::FV3_(frag)() {
     fragmentSize = 0;
     fftImpulse.L = fftImpulse.R = NULL;
-    setSIMD(0);
+    setSIMD(0, 0);
 }
 
 FV3_(frag)::FV3_(~frag)() {
     unloadImpulse();
 }
 
-void FV3_(frag)::loadImpulse(const fv3_float_t *L, const fv3_float_t *R, long size, long limit, unsigned fftflags) noexcept(false) {
-    this->loadImpulse(L, R, size, limit, fftflags, NULL, NULL);
+void FV3_(frag)::loadImpulse(const fv3_float_t *L, long size, long limit, unsigned fftflags) noexcept(false) {
+    this->loadImpulse(L, size, limit, fftflags, NULL);
 }
 
-void FV3_(frag)::loadImpulse(const fv3_float_t *L, const fv3_float_t *R, long size, long limit, unsigned fftflags,
-    fv3_float_t *preAllocatedL, fv3_float_t *preAllocatedR) noexcept(false) {
+void FV3_(frag)::loadImpulse(const fv3_float_t *L, long size, long limit, unsigned fftflags, fv3_float_t *preAllocatedL) noexcept(false) {
 #ifdef DEBUG
     std::fprintf(stderr, "frag::loadImpulse(f=%ld,l=%ld)\n", size, limit);
 #endif
@@ -225,37 +198,35 @@ void FV3_(frag)::loadImpulse(const fv3_float_t *L, const fv3_float_t *R, long si
     // impulse = [_Re_ impulse...< limit 0...0 (size)][_Im_ 0...0 (size*2)]
     FV3_(slot)
     impulse;
-    impulse.alloc(size, 2);
+    impulse.alloc(size, 1);
 
     for (long i = 0; i < limit; i++) {
         impulse.L[i] = L[i] / (fv3_float_t)(size * 2);
-        impulse.R[i] = R[i] / (fv3_float_t)(size * 2);
     }
 
     try {
-        if (preAllocatedL == NULL || preAllocatedR == NULL)
+        if (preAllocatedL == NULL)
             allocImpulse(size);
         else
-            registerPreallocatedBlock(preAllocatedL, preAllocatedR, size);
+            registerPreallocatedBlock(preAllocatedL, size);
         fragFFT.allocFFT(size, fftflags);
-    } catch (std::bad_alloc) {
+    } catch (const std::bad_alloc &) {
         unloadImpulse();
         throw;
     }
-    fragFFT.R2HC(impulse.L, impulse.R, fftImpulse.L, fftImpulse.R);
+    fragFFT.R2HC(impulse.L, fftImpulse.L);
 }
 
-void FV3_(frag)::registerPreallocatedBlock(fv3_float_t *_L, fv3_float_t *_R, long size) {
+void FV3_(frag)::registerPreallocatedBlock(fv3_float_t *_L, long size) {
     freeImpulse();
     fragmentSize = size;
     fftImpulse.L = _L;
-    fftImpulse.R = _R;
 }
 
 void FV3_(frag)::allocImpulse(long size) noexcept(false) {
     freeImpulse();
     fragmentSize = size;
-    fftImpulse.alloc(2 * size, 2);
+    fftImpulse.alloc(2 * size, 1);
 }
 
 void FV3_(frag)::freeImpulse() {
@@ -943,86 +914,84 @@ static void MULT_M_FPU(const fv3_float_t *iL, const fv3_float_t *fL, fv3_float_t
     oL[1] = tL1;
 }
 
-void FV3_(frag)::setSIMD(uint32_t simdFlag) {
-    if (simdFlag == 0)
-        simdFlag = FV3_(utils)::getSIMDFlag();
+void FV3_(frag)::setSIMD(uint32_t flag1, uint32_t flag2) {
+    simdFlag1 = flag1;
+    simdFlag2 = flag2;
     MULT_M = MULT_M_FPU;
 
 #ifdef LIBFV3_FLOAT
 #if defined(ENABLE_3DNOW)
-    if ((simdFlag & FV3_FLAG_3DNOW))
+    if ((flag1 & FV3_X86SIMD_FLAG_3DNOWP))
         MULT_M = MULT_M_F_3DNOW;
 #endif
 #if defined(ENABLE_SSE)
-    if ((simdFlag & FV3_FLAG_SSE))
+    if ((flag1 & FV3_X86SIMD_FLAG_SSE_V1))
         MULT_M = MULT_M_F_SSE;
 #endif
 #if defined(ENABLE_SSE_V2) || defined(ENABLE_SSE2)
-    if ((simdFlag & FV3_FLAG_SSE))
+    if ((flag1 & FV3_X86SIMD_FLAG_SSE))
         MULT_M = MULT_M_F_SSE_V2;
 #endif
 #if defined(ENABLE_SSE3) || defined(ENABLE_SSE4)
-    if ((simdFlag & FV3_FLAG_SSE3))
+    if ((flag1 & FV3_X86SIMD_FLAG_SSE3))
         MULT_M = MULT_M_F_SSE3;
 #endif
 #if defined(ENABLE_AVX)
-    if ((simdFlag & FV3_FLAG_AVX))
+    if ((flag1 & FV3_X86SIMD_FLAG_AVX))
         MULT_M = MULT_M_F_AVX;
 #endif
 #if defined(ENABLE_FMA3)
-    if ((simdFlag & FV3_FLAG_FMA3))
+    if ((flag1 & FV3_X86SIMD_FLAG_FMA3))
         MULT_M = MULT_M_F_FMA3;
 #endif
 #if defined(ENABLE_FMA4)
-    if ((simdFlag & FV3_FLAG_FMA4))
+    if ((flag1 & FV3_X86SIMD_FLAG_FMA4))
         MULT_M = MULT_M_F_FMA4;
 #endif
 #endif
 
 #ifdef LIBFV3_DOUBLE
 #if defined(ENABLE_SSE2) || defined(ENABLE_SSE3)
-    if ((simdFlag & FV3_FLAG_SSE2))
+    if ((flag1 & FV3_X86SIMD_FLAG_SSE2))
         MULT_M = MULT_M_D_SSE2;
 #endif
 #if defined(ENABLE_SSE4)
-    if ((simdFlag & FV3_FLAG_SSE4_1))
+    if ((flag1 & FV3_X86SIMD_FLAG_SSE4_1))
         MULT_M = MULT_M_D_SSE4;
 #endif
 #if defined(ENABLE_AVX)
-    if ((simdFlag & FV3_FLAG_AVX))
+    if ((flag1 & FV3_X86SIMD_FLAG_AVX))
         MULT_M = MULT_M_D_AVX;
 #endif
 #if defined(ENABLE_FMA3)
-    if ((simdFlag & FV3_FLAG_FMA3))
+    if ((flag1 & FV3_X86SIMD_FLAG_FMA3))
         MULT_M = MULT_M_D_FMA3;
 #endif
 #if defined(ENABLE_FMA4)
-    if ((simdFlag & FV3_FLAG_FMA4))
+    if ((flag1 & FV3_X86SIMD_FLAG_FMA4))
         MULT_M = MULT_M_D_FMA4;
 #endif
 #endif
 }
 
-void FV3_(frag)::MULT(const fv3_float_t *iL, const fv3_float_t *iR,
-    fv3_float_t *oL, fv3_float_t *oR) {
+uint32_t FV3_(frag)::getSIMD(uint32_t select) {
+    if (select == 0)
+        return simdFlag1;
+    if (select == 1)
+        return simdFlag2;
+    return 0;
+}
+
+void FV3_(frag)::MULT(const fv3_float_t *iL, fv3_float_t *oL) {
     if (fragmentSize == 0)
         return;
-#pragma omp parallel
-#pragma omp sections
-    {
-#pragma omp section
-        MULT_M(iL, fftImpulse.L, oL, fragmentSize);
-#pragma omp section
-        MULT_M(iR, fftImpulse.R, oR, fragmentSize);
-    }
-    return;
+    MULT_M(iL, fftImpulse.L, oL, fragmentSize);
 }
 
-void FV3_(frag)::getFFT(fv3_float_t *oL, fv3_float_t *oR) {
+void FV3_(frag)::getFFT(fv3_float_t *oL) {
     if (fragmentSize == 0)
         return;
     std::memcpy(oL, fftImpulse.L, sizeof(fv3_float_t) * fragmentSize * 2);
-    std::memcpy(oR, fftImpulse.R, sizeof(fv3_float_t) * fragmentSize * 2);
 }
 
 long FV3_(frag)::getFragmentSize() {
@@ -23,29 +23,28 @@
 #include "fv3_ns_start.h"
 #include "fv3_type_float.h"
 
+static void irmodel3p_runtail(FV3_(lfThreadInfoW) *info, unsigned long blocks) {
+    // the tail of the next large fragment, each fragment after the first times the block it is delayed by. Block 0
+    // is before the first input block so the fragments that would use it are skipped
+    FV3_(utils)::mute(*info->lSwapL, *info->lFragmentSize * 2);
+    for (long i = 0; (i < (long)info->lFragments->size() - 1) && ((unsigned long)i < blocks); i++) {
+        info->lFragments->at(i + 1)->MULT(info->lBlockDelayL->getIndex(blocks - i), *info->lSwapL);
+    }
+}
+
 static void *irmodel3p_lfthread(void *vdParam) {
     FV3_(lfThreadInfoW) *info = (FV3_(lfThreadInfoW) *)vdParam;
+    unsigned long request = info->tailDone->load();
     while (1) {
-        sleep(0);
-        info->event_StartThread->wait();
-        info->event_StartThread->reset();
-        if (*info->flags & FV3_IR3P_THREAD_FLAG_RUN) {
-            info->threadSection->lock();
-            if (info->lFragments->size() > 0) {
-                for (long i = 0; i < (long)info->lFragments->size() - 1; i++) {
-                    if ((long)info->lFragments->size() > i + 1) {
-                        info->lFragments->at(i + 1)->MULT(info->lBlockDelayL->get(i), *info->lSwapL);
-                    }
-                }
-            }
-            *info->flags = *info->flags ^ FV3_IR3P_THREAD_FLAG_RUN;
-            info->event_ThreadEnded->trigger();
-            info->threadSection->unlock();
-        }
-        if (*info->flags & FV3_IR3P_THREAD_FLAG_EXIT) {
-            *info->flags = *info->flags ^ FV3_IR3P_THREAD_FLAG_EXIT;
+        // wait for the next large fragment, the audio thread only checks tailDone and never waits for this thread.
+        // Only the latest request is run, so a late thread catches up on its next run
+        info->tailRequest->wait(request);
+        if (info->exitThread->load()) {
             break;
         }
+        request = info->tailRequest->load(std::memory_order_acquire);
+        irmodel3p_runtail(info, request);
+        info->tailDone->store(request, std::memory_order_release);
     }
     pthread_exit(NULL);
     return 0;
@@ -55,14 +54,17 @@ static void *irmodel3p_lfthread(void *vdParam) {
 
 FV3_(irmodel3pm)::FV3_(irmodel3pm)() {
     validThread = false;
+    lBlocks = tailMuteBlocks = 0;
+    tailMuted = false;
+    syncTail = false;
+    latePartitions = 0;
     hostThreadData.lFragmentSize = &lFragmentSize;
     hostThreadData.lFragments = &lFragments;
     hostThreadData.lBlockDelayL = &lBlockDelayL;
     hostThreadData.lSwapL = &lSwapSlot.L;
-    hostThreadData.flags = &threadFlags;
-    hostThreadData.threadSection = &threadSection;
-    hostThreadData.event_StartThread = &event_StartThread;
-    hostThreadData.event_ThreadEnded = &event_ThreadEnded;
+    hostThreadData.tailRequest = &tailRequest;
+    hostThreadData.tailDone = &tailDone;
+    hostThreadData.exitThread = &exitThread;
     resume();
 }
 
@@ -73,11 +75,12 @@ FV3_(irmodel3pm)::FV3_(~irmodel3pm)() {
 void FV3_(irmodel3pm)::resume() {
     mainSection.lock();
     if (validThread == false) {
-        threadFlags = FV3_IR3P_THREAD_FLAG_0; // init exit flag
+        tailRequest = 0;
+        tailDone = 0;
+        lBlocks = 0;
+        tailMuted = false;
+        exitThread = false;
         pthread_create(&lFragmentThreadHandle, NULL, irmodel3p_lfthread, &hostThreadData);
-        event_StartThread.reset();
-        event_ThreadEnded.reset();
-        event_ThreadEnded.set();
         validThread = true;
     }
     mainSection.unlock();
@@ -86,8 +89,10 @@ void FV3_(irmodel3pm)::resume() {
 void FV3_(irmodel3pm)::suspend() {
     mainSection.lock();
     if (validThread == true) {
-        threadFlags = threadFlags | FV3_IR3P_THREAD_FLAG_EXIT;
-        event_StartThread.trigger();
+        // the thread finishes the large fragment it is running before it exits
+        exitThread = true;
+        tailRequest.fetch_add(1);
+        tailRequest.notify_all();
         pthread_join(lFragmentThreadHandle, NULL);
         validThread = false;
     }
@@ -97,15 +102,14 @@ void FV3_(irmodel3pm)::suspend() {
 void FV3_(irmodel3pm)::loadImpulse(const fv3_float_t *inputL, long size) noexcept(false) {
     suspend();
     mainSection.lock();
-    threadSection.lock();
     try {
         FV3_(irmodel3m)::loadImpulse(inputL, size);
-    } catch (std::bad_alloc) {
-        threadSection.unlock();
+        lHeadSlot.alloc(2 * lFragmentSize, 1);
+    } catch (const std::bad_alloc &) {
         mainSection.unlock();
         throw;
     }
-    threadSection.unlock();
+    tailMuted = false;
     mainSection.unlock();
     resume();
 }
@@ -113,32 +117,62 @@ void FV3_(irmodel3pm)::loadImpulse(const fv3_float_t *inputL, long size) noexcep
 void FV3_(irmodel3pm)::unloadImpulse() {
     suspend();
     mainSection.lock();
-    threadSection.lock();
     FV3_(irmodel3m)::unloadImpulse();
-    threadSection.unlock();
+    lHeadSlot.free();
     mainSection.unlock();
     resume();
 }
 
 void FV3_(irmodel3pm)::setFragmentSize(long size, long factor) {
+    suspend();
     mainSection.lock();
-    threadSection.lock();
     FV3_(irmodel3m)::setFragmentSize(size, factor);
-    threadSection.unlock();
     mainSection.unlock();
+    resume();
 }
 
 void FV3_(irmodel3pm)::mute() {
     mainSection.lock();
-    threadSection.lock();
-    FV3_(irmodel3m)::mute();
-    threadSection.unlock();
+    if (tailDone.load(std::memory_order_acquire) == lBlocks) {
+        FV3_(irmodel3m)::mute();
+        tailMuted = false;
+    } else if (impulseSize > 0) {
+        // the thread is still using the large fragment delay and swap slots, the blocks from before the mute are
+        // cleared when it has finished
+        Scursor = Lcursor = Lstep = 0;
+        sBlockDelayL.mute();
+        sReverseSlot.mute();
+        lReverseSlot.mute();
+        sIFFTSlot.mute();
+        lIFFTSlot.mute();
+        sSwapSlot.mute();
+        restSlot.mute();
+        fifoSlot.mute();
+        lFrameSlot.mute();
+        sOnlySlot.mute();
+        tailMuteBlocks = lBlocks;
+        tailMuted = true;
+    }
+    lHeadSlot.mute();
     mainSection.unlock();
 }
 
-void FV3_(irmodel3pm)::processZL(fv3_float_t *inputL, long numsamples) {
-    // SOL2 calls suspend() multiple times while the thread mutex is still not clear.
+void FV3_(irmodel3pm)::setSyncTail(bool sync) {
     mainSection.lock();
+    syncTail = sync;
+    mainSection.unlock();
+}
+
+unsigned long FV3_(irmodel3pm)::getLatePartitions() {
+    return latePartitions;
+}
+
+void FV3_(irmodel3pm)::processZL(fv3_float_t *inputL, long numsamples) {
+    // the main section is only held by the other threads while the impulse or thread is changed
+    if (!mainSection.trylock()) {
+        FV3_(utils)::mute(inputL, numsamples);
+        return;
+    }
     if (validThread != true) {
         mainSection.unlock();
         return;
@@ -147,16 +181,37 @@ void FV3_(irmodel3pm)::processZL(fv3_float_t *inputL, long numsamples) {
     if (Lcursor == 0 && lFragments.size() > 0) {
         lFrameSlot.mute(lFragmentSize);
         lReverseSlot.mute(lFragmentSize - 1, lFragmentSize + 1);
-        event_ThreadEnded.wait();
-        event_ThreadEnded.reset();
-        threadSection.lock();
-        lBlockDelayL.push(lIFFTSlot.L);
-        lFragments[0]->MULT(lBlockDelayL.get(0), lSwapSlot.L);
-        lFragmentsFFT.HC2R(lSwapSlot.L, lReverseSlot.L);
-        lSwapSlot.mute(lFragmentSize * 2);
-        threadSection.unlock();
-        threadFlags = threadFlags | FV3_IR3P_THREAD_FLAG_RUN;
-        event_StartThread.trigger();
+        fv3_float_t *head = lSwapSlot.L;
+        if (tailDone.load(std::memory_order_acquire) != lBlocks) {
+            // the thread is late, only the first large fragment is output this time. The thread still has the swap
+            // slot, and it runs the tail for the latest block when it catches up
+            latePartitions++;
+            head = lHeadSlot.L;
+            lHeadSlot.mute(lFragmentSize * 2);
+        } else if (tailMuted) {
+            // the thread was running when the model was muted, so its tail is dropped and the blocks from before
+            // the mute are cleared
+            for (unsigned long i = 0; i < lFragments.size(); i++) {
+                if (lBlocks - i <= tailMuteBlocks) {
+                    FV3_(utils)::mute(lBlockDelayL.getIndex(lBlocks - i), lFragmentSize * 2);
+                }
+            }
+            lSwapSlot.mute(lFragmentSize * 2);
+            tailMuted = false;
+        }
+
+        // the input block is always added, the slot it replaces is older than any block the thread can be using
+        lBlocks++;
+        memcpy(lBlockDelayL.getIndex(lBlocks), lIFFTSlot.L, sizeof(fv3_float_t) * lFragmentSize * 2);
+        lFragments[0]->MULT(lBlockDelayL.getIndex(lBlocks), head);
+        lFragmentsFFT.HC2R(head, lReverseSlot.L);
+        if (syncTail) {
+            irmodel3p_runtail(&hostThreadData, lBlocks);
+            tailDone.store(lBlocks, std::memory_order_release);
+        } else {
+            tailRequest.store(lBlocks, std::memory_order_release);
+            tailRequest.notify_one();
+        }
     }
 
     if (Scursor == 0) {
@@ -222,7 +277,7 @@ FV3_(irmodel3p)::FV3_(irmodel3p)() {
         ir3mR = new FV3_(irmodel3pm);
         irmL = ir3mL;
         irmR = ir3mR;
-    } catch (std::bad_alloc) {
+    } catch (const std::bad_alloc &) {
         delete irmL;
         delete irmR;
         throw;
@@ -241,7 +296,7 @@ void FV3_(irmodel3p)::loadImpulse(const fv3_float_t *inputL, const fv3_float_t *
     mainSection.lock();
     try {
         FV3_(irmodel3)::loadImpulse(inputL, inputR, size);
-    } catch (std::bad_alloc) {
+    } catch (const std::bad_alloc &) {
         mainSection.unlock();
         throw;
     }
@@ -287,4 +342,13 @@ void FV3_(irmodel3p)::setInitialDelay(long numsamples) noexcept(false) {
     mainSection.unlock();
 }
 
+void FV3_(irmodel3p)::setSyncTail(bool sync) {
+    static_cast<FV3_(irmodel3pm) *>(ir3mL)->setSyncTail(sync);
+    static_cast<FV3_(irmodel3pm) *>(ir3mR)->setSyncTail(sync);
+}
+
+unsigned long FV3_(irmodel3p)::getLatePartitions() {
+    return static_cast<FV3_(irmodel3pm) *>(ir3mL)->getLatePartitions() + static_cast<FV3_(irmodel3pm) *>(ir3mR)->getLatePartitions();
+}
+
 #include "fv3_ns_end.h"
@@ -22,6 +22,7 @@
 #ifndef _FV3_IRMODEL3P_HPP
 #define _FV3_IRMODEL3P_HPP
 
+#include <atomic>
 #include <fftw3.h>
 #include <math.h>
 #include <new>
@@ -43,10 +44,6 @@
 #include <pthread.h>
 #include <unistd.h>
 
-#define FV3_IR3P_THREAD_FLAG_0 (0U)
-#define FV3_IR3P_THREAD_FLAG_EXIT (1U << 1)
-#define FV3_IR3P_THREAD_FLAG_RUN (1U << 2)
-
 namespace fv3 {
 
 #define _fv3_float_t float
@@ -23,9 +23,8 @@ typedef struct {
     std::vector<_FV3_(frag) *> *lFragments;
     _FV3_(blockDelay) * lBlockDelayL;
     _fv3_float_t **lSwapL;
-    volatile int *flags;
-    PthreadEvent *event_StartThread, *event_ThreadEnded;
-    PthreadLocker *threadSection;
+    std::atomic<unsigned long> *tailRequest, *tailDone;
+    std::atomic<bool> *exitThread;
 } _FV3_(lfThreadInfoW);
 
 class _FV3_(irmodel3pm) :
@@ -40,6 +39,8 @@ class _FV3_(irmodel3pm) :
     virtual void suspend();
     virtual void mute();
     virtual void setFragmentSize(long size, long factor);
+    void setSyncTail(bool sync);
+    unsigned long getLatePartitions();
 
   protected:
     virtual void processZL(_fv3_float_t *inputL, long numsamples);
@@ -47,11 +48,21 @@ class _FV3_(irmodel3pm) :
     bool validThread;
     _FV3_(lfThreadInfoW)
     hostThreadData;
-    volatile int threadFlags;
-    PthreadLocker threadSection, mainSection;
-    PthreadEvent event_StartThread, event_ThreadEnded;
+    PthreadLocker mainSection;
     pthread_t lFragmentThreadHandle;
 
+    // the large fragment thread is started once per large fragment and the audio thread never waits for it. The
+    // input blocks are numbered and always added to the block delay, the thread runs the tail for the latest
+    // block it was given, so if it has not finished by the next large fragment only the tail of that fragment is
+    // lost and the thread catches up
+    std::atomic<unsigned long> tailRequest, tailDone;
+    std::atomic<bool> exitThread;
+    unsigned long lBlocks, tailMuteBlocks;
+    bool tailMuted, syncTail;
+    unsigned long latePartitions;
+    _FV3_(slot)
+    lHeadSlot;
+
   private:
     _FV3_(irmodel3pm)
     (const _FV3_(irmodel3pm) & x);
@@ -71,6 +82,8 @@ class _FV3_(irmodel3p) :
     virtual void mute();
     virtual void setFragmentSize(long size, long factor);
     virtual void setInitialDelay(long numsamples) noexcept(false);
+    void setSyncTail(bool sync);
+    unsigned long getLatePartitions();
 
   protected:
     PthreadLocker mainSection;